@@ -1,7 +1,7 @@
 #!/bin/bash
 
 opts="-Wall -Wno-unused-function -O3"
-link_ops="-lm"
+link_ops="-lm -pthread -ldl"
 includes="lib"
 out_dir="build"
 
@@ -12,6 +12,9 @@ mkdir -p "$out_dir"
 echo "Build count lines"
 gcc $opts -I"$includes" misc/count_lines.c -o "$out_dir"/count_lines $link_ops
 
+echo "Build benchmarks"
+gcc $opts -I"$includes" misc/benchmarks.c -o "$out_dir"/benchmarks $link_ops
+
 echo "Build tests"
 gcc $opts -I"$includes" tests/tests.c -o "$out_dir"/tests $link_ops
 
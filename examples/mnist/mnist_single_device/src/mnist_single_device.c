@@ -1,4 +1,5 @@
 #include "../../../../lib/nfnn.h"
+#include "../../../../lib/nfnn_export.h"
 #include "../../../../lib/nfnn_mnist.h"
 
 int main()
@@ -36,6 +37,7 @@ int main()
 
     nfnn_optimizer *Optimizer = NfNN_Optimizer_SGD(&Mem_P, 0.01f, 1, 0.9, 0, 0, false);
     // nfnn_optimizer *Optimizer = NfNN_Optimizer_Adam(&Mem_P, 0, 1, 0, 0);
+    // NfNN_Optimizer_QuantizeState(Optimizer); // 8-bit optimizer state
 
     NfNN_Optimizer_AddParam(&Mem_P, Optimizer, W1);
     NfNN_Optimizer_AddParam(&Mem_P, Optimizer, B1);
@@ -50,6 +52,7 @@ int main()
     {
         u32 Correct = 0;
         u32 Total = 0;
+        NfNN_MemoryArena_NoGradBegin(&Mem_T, true);
         for (nfnn_dataloader_batch_mnist *It = NfNN_DataLoader_Mnist_NextBatch(ValidationLoader); It != 0;
              It = NfNN_DataLoader_Mnist_NextBatch(ValidationLoader))
         {
@@ -71,6 +74,7 @@ int main()
 
             NfNN_MemoryArena_TempClear(&Mem_T);
         }
+        NfNN_MemoryArena_NoGradEnd(&Mem_T);
 
         f32 ValidationAccuracy = 100.0 * (f32)Correct / (f32)Total;
         // u32 NumberOfBatches = NfNN_DataLoader_Mnist_NumberOfBatches(TrainLoader);
@@ -87,7 +91,6 @@ int main()
              It = NfNN_DataLoader_Mnist_NextBatch(TrainLoader))
         {
             NfNN_MemoryArena_TempInit(&Mem_T);
-            NfNN_Optimizer_ZeroGrad(Optimizer);
 
             nfnn_tensor *L1 = NfNN_MatMul(&Mem_T, It->Images, W1);
             nfnn_tensor *L1b = NfNN_Add(&Mem_T, L1, B1);
@@ -118,6 +121,7 @@ int main()
 
         u32 Correct = 0;
         u32 Total = 0;
+        NfNN_MemoryArena_NoGradBegin(&Mem_T, true);
         for (nfnn_dataloader_batch_mnist *It = NfNN_DataLoader_Mnist_NextBatch(ValidationLoader); It != 0;
              It = NfNN_DataLoader_Mnist_NextBatch(ValidationLoader))
         {
@@ -138,6 +142,7 @@ int main()
 
             NfNN_MemoryArena_TempClear(&Mem_T);
         }
+        NfNN_MemoryArena_NoGradEnd(&Mem_T);
 
         NfNN_MemoryArena_TempInit(&Mem_T);
         f32 ValidationAccuracy = 100.0 * (f32)Correct / (f32)Total;
@@ -146,4 +151,24 @@ int main()
                ValidationAccuracy);
     }
     printf("Training Complete!\n");
+
+    // NOTE(luatil): Standalone predictor for one image at a time, see nfnn_export.h
+    {
+        NfNN_MemoryArena_TempInit(&Mem_T);
+        nfnn_dataloader_mnist *ExportLoader = NfNN_Dataloader_Mnist_Create(&Mem_T, ValidationDataset, 1, 0);
+        nfnn_tensor *Image = NfNN_DataLoader_Mnist_NextBatch(ExportLoader)->Images;
+
+        nfnn_graph *Graph = NfNN_Graph_BeginCapture(&Mem_T);
+        nfnn_tensor *L1 = NfNN_MatMul(&Mem_T, Image, W1);
+        nfnn_tensor *R1 = NfNN_ReLU(&Mem_T, NfNN_Add(&Mem_T, L1, B1));
+        nfnn_tensor *L2 = NfNN_Add(&Mem_T, NfNN_MatMul(&Mem_T, R1, W2), B2);
+        NfNN_Graph_EndCapture(Graph, NfNN_LogSoftmax(&Mem_T, L2, 1), 0);
+
+        nfnn_export_stats Export = NfNN_Export_C(Graph, Image, "mnist", "mnist_model.c");
+        printf("Exported mnist_model.c: %u nodes, %u weights\n", Export.NodeCount, Export.WeightCount);
+#if !defined(_WIN32)
+        printf("Exported predictor max error: %f\n", NfNN_Export_Validate(Graph, Image, "mnist", "mnist_model.c"));
+#endif
+        NfNN_MemoryArena_TempClear(&Mem_T);
+    }
 }
@@ -15,9 +15,13 @@ struct configuration
 {
     u32 Seed;
     f32 LearningRate;
+    nfnn_optimizer_type Optimizer;
+    u32 WarmupSteps;
     u32 NumberOfWorkers;
+    u32 MicroBatches; // Per gradient a worker sends
     u32 NumberOfEpochs;
     u32 NumberOfUpdates;
+    nfnn_transport Transport;
     u32 Port;
     char IpAddress[NI_MAXHOST];
     char TrainingImagesFilePath[2048];
@@ -34,14 +38,21 @@ struct accuracy_and_loss
     f32 Loss;
 };
 
+static char *TransportNames[] = {"tcp", "shm", "inproc"};
+static char *OptimizerNames[] = {"sgd", "adam", "lars", "lamb"};
+
 static void PrintConfiguration(configuration Config)
 {
     printf("Configuration:\n");
     printf("  Seed: %u\n", Config.Seed);
     printf("  Learning Rate: %.4f\n", Config.LearningRate);
+    printf("  Optimizer: %s\n", OptimizerNames[Config.Optimizer]);
+    printf("  Warmup Steps: %u\n", Config.WarmupSteps);
     printf("  Number of Workers: %u\n", Config.NumberOfWorkers);
+    printf("  Micro-batches: %u\n", Config.MicroBatches);
     printf("  Number of Epochs: %u\n", Config.NumberOfEpochs);
     printf("  Number of Updates: %u\n", Config.NumberOfUpdates);
+    printf("  Transport: %s\n", TransportNames[Config.Transport]);
     printf("  Port: %u\n", Config.Port);
     printf("  IP Address: %s\n", Config.IpAddress);
     printf("  Training Images File Path: %s\n", Config.TrainingImagesFilePath);
@@ -59,11 +70,15 @@ static void PrintHelp(char *Exe)
     printf("  --worker, -w                Run as a worker\n");
     printf("  --seed <number>             Set the random seed (default: 3245)\n");
     printf("  --learning-rate <number>    Set the learning rate (default: 0.01)\n");
+    printf("  --optimizer <name>          Set the optimizer, sgd, adam, lars or lamb (default: sgd)\n");
+    printf("  --warmup <number>           Grow the learning rate over the first updates (default: 0)\n");
     printf("  --workers <number>          Set the number of workers (default: 1)\n");
+    printf("  --accumulate <number>       Set the micro-batches per gradient sent (default: 1)\n");
     printf("  --validation <number>       Set the validation batch size (default: 128)\n");
     printf("  --training <number>         Set the training batch size (default: 32)\n");
     printf("  --epochs <number>           Set the number of epochs (default: 5)\n");
     printf("  --updates <number>          Set the number of updates (default: 100000)\n");
+    printf("  --transport <name>          Set the transport, tcp, shm or inproc (default: tcp)\n");
     printf("  --port <number>             Set the port (default: 21756)\n");
     printf("  --ip <address>              Set the IP address (default: localhost)\n");
     printf("  --training-images <path>    Set the training images file path\n");
@@ -72,10 +87,31 @@ static void PrintHelp(char *Exe)
     printf("  --help, -h                  Show this help message and exit\n");
 }
 
-static nfnn_optimizer *CreateOptimizer(nfnn_memory_arena *Mem, model Model, f32 LearningRate, u32 NumberOfWorkers)
+// NOTE(luatil): The server adds up the gradients of all workers, so every worker makes the batch
+// bigger. LARS and LAMB scale each step to the size of the weights and keep working as workers are added.
+static nfnn_optimizer *CreateOptimizer(nfnn_memory_arena *Mem, model Model, configuration Config)
 {
-    nfnn_optimizer *Result = NfNN_Optimizer_SGD(Mem, LearningRate, NumberOfWorkers, 0, 0, 0, false);
-    // nfnn_optimizer *Result = NfNN_Optimizer_Adam(Mem, LearningRate, NumberOfWorkers, 0, 0);
+    nfnn_optimizer *Result = 0;
+    switch (Config.Optimizer)
+    {
+    case NFNN_OPTIMIZER_SGD: {
+        Result = NfNN_Optimizer_SGD(Mem, Config.LearningRate, Config.NumberOfWorkers, 0, 0, 0, false);
+    }
+    break;
+    case NFNN_OPTIMIZER_ADAM: {
+        Result = NfNN_Optimizer_Adam(Mem, Config.LearningRate, Config.NumberOfWorkers, 0, 0);
+    }
+    break;
+    case NFNN_OPTIMIZER_LARS: {
+        Result = NfNN_Optimizer_LARS(Mem, Config.LearningRate, Config.NumberOfWorkers, 0.9f, 0.0005f, 0);
+    }
+    break;
+    case NFNN_OPTIMIZER_LAMB: {
+        Result = NfNN_Optimizer_LAMB(Mem, Config.LearningRate, Config.NumberOfWorkers, 0, 0, 0.01f);
+    }
+    break;
+    }
+    NfNN_Optimizer_SetWarmup(Result, Config.WarmupSteps);
 
     NfNN_Optimizer_AddParam(Mem, Result, Model.W1);
     NfNN_Optimizer_AddParam(Mem, Result, Model.B1);
@@ -117,6 +153,7 @@ static accuracy_and_loss CalculateAccuracyAndLoss(nfnn_memory_arena *Mem, model
     u32 Correct = 0;
     u32 Total = 0;
     f32 AverageLoss = 0.0f;
+    NfNN_MemoryArena_NoGradBegin(Mem, true);
     for (nfnn_dataloader_batch_mnist *It = NfNN_DataLoader_Mnist_NextBatch(DataLoader); It != 0;
          It = NfNN_DataLoader_Mnist_NextBatch(DataLoader))
     {
@@ -133,6 +170,7 @@ static accuracy_and_loss CalculateAccuracyAndLoss(nfnn_memory_arena *Mem, model
 
         NfNN_MemoryArena_TempClear(Mem);
     }
+    NfNN_MemoryArena_NoGradEnd(Mem);
 
     f32 Accuracy = 100.0 * (f32)Correct / (f32)Total;
     AverageLoss /= Total;
@@ -143,6 +181,43 @@ static accuracy_and_loss CalculateAccuracyAndLoss(nfnn_memory_arena *Mem, model
     return Result;
 }
 
+static void RunAsWorker(configuration Config);
+
+static NFNN_THREAD_RESULT RunAsWorkerThread(void *Parameter)
+{
+    RunAsWorker(*(configuration *)Parameter);
+    return 0;
+}
+
+// NOTE(luatil): With the in-process transport the workers are threads of the server,
+// returns 0 for the other transports where they are started as their own processes
+static nfnn_thread *SpawnWorkers(nfnn_memory_arena *Mem, configuration Config, u32 Port)
+{
+    if (Config.Transport != NFNN_TRANSPORT_IN_PROCESS)
+    {
+        return 0;
+    }
+
+    configuration *Configs = NfNN_PushArray(Mem, configuration, Config.NumberOfWorkers);
+    nfnn_thread *Result = NfNN_PushArray(Mem, nfnn_thread, Config.NumberOfWorkers);
+    for (u32 Worker = 0; Worker < Config.NumberOfWorkers; Worker++)
+    {
+        Configs[Worker] = Config;
+        Configs[Worker].Seed = Config.Seed + Worker + 1;
+        Configs[Worker].Port = Port;
+        Result[Worker] = NfNN_Thread_Create(RunAsWorkerThread, Configs + Worker);
+    }
+    return Result;
+}
+
+static void JoinWorkers(nfnn_thread *Workers, configuration Config)
+{
+    for (u32 Worker = 0; Workers && Worker < Config.NumberOfWorkers; Worker++)
+    {
+        NfNN_Thread_Join(Workers[Worker]);
+    }
+}
+
 static void RunAsServer(configuration Config)
 
 {
@@ -180,7 +255,7 @@ static void RunAsServer(configuration Config)
 
     model Model = CreateModel(&Mem_P, &Random);
 
-    nfnn_optimizer *Optimizer = CreateOptimizer(&Mem_P, Model, Config.LearningRate, Config.NumberOfWorkers);
+    nfnn_optimizer *Optimizer = CreateOptimizer(&Mem_P, Model, Config);
 
     nfnn_datasets_mnist *FullTrainDataset =
         NfNN_Datasets_MNIST_Load(&Mem_P, Config.TrainingImagesFilePath, Config.TrainLabelsFilePath, 60000);
@@ -193,31 +268,36 @@ static void RunAsServer(configuration Config)
     nfnn_dataloader_mnist *ValidationLoader =
         NfNN_Dataloader_Mnist_Create(&Mem_P, ValidationDataset, Config.ValidationBatchSize, 0);
 
-    nfnn_parameter_server *Server = NfNN_ParameterServer_Create(&Mem_P, Config.IpAddress, Config.Port);
+    nfnn_parameter_server *Server =
+        NfNN_ParameterServer_Create(&Mem_P, Config.Transport, Config.IpAddress, Config.Port);
+    nfnn_thread *Workers = SpawnWorkers(&Mem_P, Config, Server->Port);
 
-    for (u32 G = 0; G < Config.NumberOfWorkers; G++)
-    {
-        NfNN_ParameterServer_AddWorker(&Mem_P, Server);
-    }
+    NfNN_ParameterServer_AcceptWorkers(Server, Config.NumberOfWorkers);
 
+    nfnn_tensor *Parameters[] = {Model.W1, Model.B1, Model.W2, Model.B2};
     for (u32 T = 0; T < Config.NumberOfUpdates; T++)
     {
         NfNN_MemoryArena_TempInit(&Mem_T);
         NfNN_Optimizer_ZeroGrad(Optimizer);
 
-        NfNN_ParameterServer_BroadcastWeights(&Mem_T, Server, Model.W1);
-        NfNN_ParameterServer_BroadcastWeights(&Mem_T, Server, Model.B1);
-        NfNN_ParameterServer_BroadcastWeights(&Mem_T, Server, Model.W2);
-        NfNN_ParameterServer_BroadcastWeights(&Mem_T, Server, Model.B2);
-
-        NfNN_ParameterServer_WaitWorkers(&Mem_T, Server, Config.NumberOfWorkers);
-
-        NfNN_ParameterServer_AwaitGradient(&Mem_T, Server, Model.W1);
-        NfNN_ParameterServer_AwaitGradient(&Mem_T, Server, Model.B1);
-        NfNN_ParameterServer_AwaitGradient(&Mem_T, Server, Model.W2);
-        NfNN_ParameterServer_AwaitGradient(&Mem_T, Server, Model.B2);
+        NfNN_ParameterServer_BroadcastWeights(&Mem_T, Server, Parameters, NFNN_ARRAY_COUNT(Parameters));
+        u32 Complete =
+            NfNN_ParameterServer_AwaitGradients(&Mem_T, Server, Parameters, NFNN_ARRAY_COUNT(Parameters));
+        if (Complete == 0)
+        {
+            NfNN_MemoryArena_TempClear(&Mem_T);
+            break;
+        }
 
-        NfNN_Optimizer_Step(Optimizer);
+        // NOTE(luatil): A worker that left midway has part of its gradient in the sum, the step is dropped
+        if (Server->PartialCount > 0)
+        {
+            printf("Iteration %d: Dropped, %u workers left midway\n", T, Server->PartialCount);
+        }
+        else
+        {
+            NfNN_Optimizer_Step(Optimizer);
+        }
 
         if (T % 1000 == 0)
         {
@@ -230,7 +310,7 @@ static void RunAsServer(configuration Config)
 
     // Acts as a syncronization barrier
     nfnn_tensor *Sync = NfNN_CreateTensor(&Mem_T, NfNN_Dim2(1, 1), false);
-    NfNN_ParameterServer_BroadcastWeights(&Mem_T, Server, Sync);
+    NfNN_ParameterServer_BroadcastWeights(&Mem_T, Server, &Sync, 1);
 
     nfnn_time End = NfNN_Time_CurrentTime();
     nfnn_time_diff Diff = NfNN_Time_Diff(Start, End);
@@ -242,7 +322,10 @@ static void RunAsServer(configuration Config)
     printf("\tTime(s): %ld\n", Diff.Seconds);
     printf("\tSent Bytes: %ld\n", GlobalWrite);
     printf("\tRecv Bytes: %ld\n", GlobalRead);
+    printf("\tSocket Calls: %ld\n", GlobalCalls);
 
+    JoinWorkers(Workers, Config);
+    NfNN_ParameterServer_Destroy(Server);
     NfNN_Network_DestroyInterface(Interface);
 }
 
@@ -271,9 +354,7 @@ static void RunAsWorker(configuration Config)
     nfnn_network_interface *Interface = NfNN_Network_CreateInterface(&Mem_P);
     model Model = CreateModel(&Mem_P, &Random);
 
-    nfnn_optimizer *Optimizer = CreateOptimizer(&Mem_P, Model, Config.LearningRate, Config.NumberOfWorkers);
-
-    nfnn_socket *Socket = NfNN_Network_TCPConnect(&Mem_P, Config.IpAddress, Config.Port);
+    nfnn_channel *Channel = NfNN_Network_Connect(&Mem_P, Config.Transport, Config.IpAddress, Config.Port);
 
     nfnn_datasets_mnist *FullTrainDataset =
         NfNN_Datasets_MNIST_Load(&Mem_P, Config.TrainingImagesFilePath, Config.TrainLabelsFilePath, 60000);
@@ -282,47 +363,50 @@ static void RunAsWorker(configuration Config)
     nfnn_datasets_mnist *TrainDataset = NfNN_Datasets_Mnist_Split(&Mem_P, FullTrainDataset, 0, TrainingNumber);
     nfnn_dataloader_mnist *TrainLoader = NfNN_Dataloader_Mnist_Create(&Mem_P, TrainDataset, 32, &Random);
 
-    for (u32 IterationCount = 0; IterationCount < Config.NumberOfUpdates;)
+    nfnn_tensor *Parameters[] = {Model.W1, Model.B1, Model.W2, Model.B2};
+
+    // NOTE(luatil): The gradients of Config.MicroBatches batches are added up before they are sent,
+    // the server gets one message per MicroBatches batches
+    for (u32 IterationCount = 0; IterationCount < Config.NumberOfUpdates; IterationCount++)
     {
-        for (nfnn_dataloader_batch_mnist *It = NfNN_DataLoader_Mnist_NextBatch(TrainLoader);
-             It != 0 && IterationCount < Config.NumberOfUpdates; It = NfNN_DataLoader_Mnist_NextBatch(TrainLoader))
+        u32 Step = NfNN_Network_RecvWeights(&Mem_T, Channel, Parameters, NFNN_ARRAY_COUNT(Parameters));
+
+        f32 Loss = 0.0f;
+        NfNN_AutoGrad_AccumulateBegin(&Mem_T, Config.MicroBatches);
+        for (u32 MicroBatch = 0; MicroBatch < Config.MicroBatches; MicroBatch++)
         {
+            nfnn_dataloader_batch_mnist *It = NfNN_DataLoader_Mnist_NextBatch(TrainLoader);
+            if (!It)
+            {
+                // NOTE(luatil): End of the dataset, the loader starts over
+                It = NfNN_DataLoader_Mnist_NextBatch(TrainLoader);
+            }
 
             NfNN_MemoryArena_TempInit(&Mem_T);
 
-            NfNN_Optimizer_ZeroGrad(Optimizer);
-
-            NfNN_Network_RecvTensor(&Mem_T, Socket->Handle, Model.W1);
-            NfNN_Network_RecvTensor(&Mem_T, Socket->Handle, Model.B1);
-            NfNN_Network_RecvTensor(&Mem_T, Socket->Handle, Model.W2);
-            NfNN_Network_RecvTensor(&Mem_T, Socket->Handle, Model.B2);
-
             nfnn_tensor *Outputs = Forward(&Mem_T, Model, It->Images);
+            nfnn_tensor *MicroLoss = NfNN_NLLLoss(&Mem_T, Outputs, It->Labels);
 
-            nfnn_tensor *Loss = NfNN_NLLLoss(&Mem_T, Outputs, It->Labels);
-
-            NfNN_AutoGrad_Backward(&Mem_T, Loss);
-
-            if (IterationCount % 100 == 0)
-            {
-                printf("Iteration %d: Loss: %f\n", IterationCount, NfNN_Item(Loss));
-            }
-
-            NfNN_Network_SendGradient(&Mem_T, Socket->Handle, Model.W1);
-            NfNN_Network_SendGradient(&Mem_T, Socket->Handle, Model.B1);
-            NfNN_Network_SendGradient(&Mem_T, Socket->Handle, Model.W2);
-            NfNN_Network_SendGradient(&Mem_T, Socket->Handle, Model.B2);
+            NfNN_AutoGrad_Backward(&Mem_T, MicroLoss);
+            Loss += NfNN_Item(MicroLoss) / (f32)Config.MicroBatches;
 
             NfNN_MemoryArena_TempClear(&Mem_T);
+        }
+        NfNN_AutoGrad_AccumulateEnd(&Mem_T);
 
-            IterationCount++;
+        if (IterationCount % 100 == 0)
+        {
+            printf("Iteration %d: Loss: %f\n", IterationCount, Loss);
         }
+
+        NfNN_Network_SendGradients(&Mem_T, Channel, Step, Parameters, NFNN_ARRAY_COUNT(Parameters));
     }
 
     // Acts as a syncronization barrier
     nfnn_tensor *Sync = NfNN_CreateTensor(&Mem_T, NfNN_Dim2(1, 1), false);
-    NfNN_Network_RecvTensor(&Mem_P, Socket->Handle, Sync);
+    NfNN_Network_RecvWeights(&Mem_P, Channel, &Sync, 1);
 
+    NfNN_Network_Disconnect(Channel);
     NfNN_Network_DestroyInterface(Interface);
 }
 
@@ -335,6 +419,7 @@ int main(int ArgumentCount, char **Arguments)
     Config.Seed = 3245;
     Config.LearningRate = 0.01f;
     Config.NumberOfWorkers = 1;
+    Config.MicroBatches = 1;
     Config.NumberOfEpochs = 5;
     Config.NumberOfUpdates = 5000;
     Config.Port = 21756;
@@ -374,6 +459,31 @@ int main(int ArgumentCount, char **Arguments)
             Config.NumberOfWorkers = NFNN_ATOI(Arguments[I + 1]);
             I += 2;
         }
+        else if (NFNN_STREQUAL(Arguments[I], "--optimizer"))
+        {
+            NFNN_ASSERT((I + 1) < ArgumentCount, "Optimizer must be specified");
+            u32 Type = 0;
+            while (Type < NFNN_ARRAY_COUNT(OptimizerNames) && !NFNN_STREQUAL(Arguments[I + 1], OptimizerNames[Type]))
+            {
+                Type++;
+            }
+            NFNN_ASSERT(Type < NFNN_ARRAY_COUNT(OptimizerNames), "Optimizer must be sgd, adam, lars or lamb");
+            Config.Optimizer = (nfnn_optimizer_type)Type;
+            I += 2;
+        }
+        else if (NFNN_STREQUAL(Arguments[I], "--warmup"))
+        {
+            NFNN_ASSERT((I + 1) < ArgumentCount, "Number of warmup steps must be specified");
+            Config.WarmupSteps = NFNN_ATOI(Arguments[I + 1]);
+            I += 2;
+        }
+        else if (NFNN_STREQUAL(Arguments[I], "--accumulate"))
+        {
+            NFNN_ASSERT((I + 1) < ArgumentCount, "Number of micro-batches must be specified");
+            Config.MicroBatches = NFNN_ATOI(Arguments[I + 1]);
+            NFNN_ASSERT(Config.MicroBatches > 0, "Number of micro-batches must be at least 1");
+            I += 2;
+        }
         else if (NFNN_STREQUAL(Arguments[I], "--validation"))
         {
             NFNN_ASSERT((I + 1) < ArgumentCount, "Validation batch size must be specified");
@@ -404,6 +514,19 @@ int main(int ArgumentCount, char **Arguments)
             Config.NumberOfUpdates = NFNN_ATOI(Arguments[I + 1]);
             I += 2;
         }
+        else if (NFNN_STREQUAL(Arguments[I], "--transport"))
+        {
+            NFNN_ASSERT((I + 1) < ArgumentCount, "Transport must be specified");
+            u32 Transport = 0;
+            while (Transport < NFNN_ARRAY_COUNT(TransportNames) &&
+                   !NFNN_STREQUAL(Arguments[I + 1], TransportNames[Transport]))
+            {
+                Transport++;
+            }
+            NFNN_ASSERT(Transport < NFNN_ARRAY_COUNT(TransportNames), "Transport must be tcp, shm or inproc");
+            Config.Transport = (nfnn_transport)Transport;
+            I += 2;
+        }
         else if (NFNN_STREQUAL(Arguments[I], "--port"))
         {
             NFNN_ASSERT((I + 1) < ArgumentCount, "Port must be specified");
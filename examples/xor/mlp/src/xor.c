@@ -35,8 +35,13 @@ int main()
     nfnn_memory_arena Mem_T = {0};
     NfNN_MemoryArena_Init(&Mem_T, MB(1));
 
+    // NOTE(luatil): Constants built by NfNN_SumAll live next to the parameters
+    NfNN_Constants_Attach(&Mem_T, &Mem_P);
+
     f32 LossF;
-    for (u32 I = 0; I < Epochs; I++)
+
+    // NOTE(luatil): The first epoch runs eagerly and is captured, the rest replay it
+    nfnn_graph *Graph = NfNN_Graph_BeginCapture(&Mem_T);
     {
         nfnn_tensor *L1 = NfNN_MatMul(&Mem_T, X, W1);
 
@@ -52,15 +57,30 @@ int main()
 
         LossF = NfNN_Item(Loss);
 
-        printf("%d:%f\n", I, LossF);
+        printf("%d:%f\n", 0, LossF);
 
         NfNN_AutoGrad_Backward(&Mem_T, Loss);
 
         NfNN_Optimizer_Step(Optim);
-        NfNN_Optimizer_ZeroGrad(Optim);
 
-        NfNN_MemoryArena_Clear(&Mem_T);
+        NfNN_Graph_EndCapture(Graph, Loss, Optim);
+    }
+
+    nfnn_graph_fusion_stats Fusion = NfNN_Graph_Fuse(Graph);
+    printf("Fused %u groups (%u ops), %llu bytes saved per step\n", Fusion.GroupCount, Fusion.FusedOpCount,
+           (unsigned long long)Fusion.BytesSaved);
+
+    for (u32 I = 1; I < Epochs; I++)
+    {
+        NfNN_Graph_Replay(Graph);
+
+        LossF = NfNN_Item(Graph->Loss);
+
+        printf("%d:%f\n", I, LossF);
     }
+
+    NfNN_MemoryArena_Clear(&Mem_T);
+
     {
         nfnn_tensor *L1 = NfNN_MatMul(&Mem_T, X, W1);
 
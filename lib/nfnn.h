@@ -2,10 +2,13 @@
 #define NFNN_H
 
 #include "nfnn_autograd.h"
+#include "nfnn_autotune.h"
+#include "nfnn_graph.h"
 #include "nfnn_math.h"
 #include "nfnn_network.h"
 #include "nfnn_ops.h"
 #include "nfnn_optimizer.h"
+#include "nfnn_parallel.h"
 #include "nfnn_random.h"
 #include "nfnn_tensor.h"
 #include "nfnn_time.h"
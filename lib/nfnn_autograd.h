@@ -3,238 +3,608 @@
 
 #include "nfnn_macro.h"
 #include "nfnn_math.h"
+#include "nfnn_ops.h"
 #include "nfnn_tensor.h"
+#include "nfnn_thread.h"
 #include "nfnn_types.h"
 
-static void NfNN_AutoGrad_PushTensor(nfnn_memory_arena *Mem, nfnn_tensor_list *List, nfnn_tensor *T)
+typedef void nfnn_grad_ready_function(void *Context, nfnn_tensor *Leaf);
+
+// NOTE(luatil): Backward on Mem calls Function once per leaf that requires a gradient, right
+// after the last kernel that writes its gradient or reads its data. The rest of backward does
+// not touch the leaf again, so Function may change both. 0 turns it off.
+static void NfNN_AutoGrad_SetGradReady(nfnn_memory_arena *Mem, nfnn_grad_ready_function *Function, void *Context)
+{
+    Mem->GradReady = Function;
+    Mem->GradReadyContext = Context;
+}
+
+// NOTE(luatil): Epoch of the most recent backward, leaves carry the epoch that last overwrote them
+static u32 NfNN_AutoGrad_Epoch;
+
+// NOTE(luatil): Gradient accumulation. Until NfNN_AutoGrad_AccumulateEnd every backward on Mem adds to
+// the gradients of the leaves that an earlier backward since Begin wrote, the first write still
+// overwrites them. The loss gradient starts at 1 / MicroBatches, so the leaves end up with the mean
+// over all micro-batches. Mem may be rewound between micro-batches. Grad ready hooks are held back
+// while accumulating, the parameters must not change before the last micro-batch.
+//
+// Usage:
+//   NfNN_AutoGrad_AccumulateBegin(&Mem_T, K);
+//   for (...K...) { TempInit; forward; NfNN_AutoGrad_Backward; TempClear; }
+//   NfNN_AutoGrad_AccumulateEnd(&Mem_T);
+//   NfNN_Optimizer_Step(Optimizer);
+static void NfNN_AutoGrad_AccumulateBegin(nfnn_memory_arena *Mem, u32 MicroBatches)
+{
+    NFNN_ASSERT(MicroBatches > 0, "NfNN_AutoGrad_AccumulateBegin: At least one micro-batch");
+    Mem->AccumulateEpoch = NFNN_ATOMIC_ADD_U32(&NfNN_AutoGrad_Epoch, 1);
+    Mem->AccumulateBackwards = 0;
+    Mem->AccumulateScale = 1.0f / (f32)MicroBatches;
+}
+
+static void NfNN_AutoGrad_AccumulateEnd(nfnn_memory_arena *Mem)
+{
+    Mem->AccumulateEpoch = 0;
+    Mem->AccumulateBackwards = 0;
+    Mem->AccumulateScale = 1.0f;
+}
+
+// NOTE(luatil): Gradient of the loss itself, where every backward starts
+static f32 NfNN_AutoGrad_Seed(nfnn_memory_arena *Mem)
+{
+    return Mem->AccumulateEpoch ? Mem->AccumulateScale : 1.0f;
+}
+
+// NOTE(luatil): Set when the backward of T is the first to write the gradient of input slot Input,
+// the kernel then overwrites it instead of adding to it
+static bool NfNN_AutoGrad_FirstWrite(nfnn_tensor *T, u32 Input)
+{
+    return (T->Op.FirstWrite >> Input) & 1;
+}
+
+// NOTE(luatil): For kernels that can only accumulate, a first write clears the gradient right before
+static f32 *NfNN_AutoGrad_Accumulator(nfnn_tensor *T, u32 Input)
+{
+    nfnn_tensor *In = T->Op.Inputs[Input];
+    if (NfNN_AutoGrad_FirstWrite(T, Input))
+    {
+        memset(In->Gradient, 0, NfNN_Size(In));
+    }
+    return In->Gradient;
+}
+
+// NOTE(luatil): Out = Const * Grad on a first write, Out += Const * Grad otherwise
+static void NfNN_AutoGrad_WriteScaled(nfnn_tensor *T, u32 Input, f32 *Grad, f32 Const)
 {
-    if (List->First == 0)
+    nfnn_tensor *In = T->Op.Inputs[Input];
+    if (NfNN_AutoGrad_FirstWrite(T, Input))
     {
-        List->First = T;
-        List->Last = T;
-        T->Prev = 0;
-        T->Next = 0;
+        NfNN_Math_MultiplyByConstant_f32(Grad, NfNN_Length(T), Const, In->Gradient);
     }
     else
     {
-        T->Prev = List->Last;
-        T->Next = 0;
-
-        List->Last->Next = T;
-        List->Last = T;
+        NfNN_Math_FmaddConst_f32(Grad, Const, NfNN_Length(T), In->Gradient);
     }
 }
 
-static void NfNN_AutoGrad_BuildTensorListRec(nfnn_memory_arena *Mem, nfnn_tensor *T, nfnn_tensor_list *List)
+static void NfNN_AutoGrad_ZeroGrad(nfnn_memory_arena *Mem, nfnn_tensor *T)
 {
+    if (!T->RequiresGrad)
+    {
+        return;
+    }
 
-    if (T->Visited)
+    if (!NfNN_Tape_Contains(Mem, T))
     {
+        memset(T->Gradient, 0, NfNN_Size(T));
         return;
     }
 
-    T->Visited = true;
+    u8 *Live = NfNN_Tape_MarkLive(Mem, T, true);
+    for (u32 Index = 0; Index <= T->TapeIndex; Index++)
+    {
+        if (Live[Index])
+        {
+            nfnn_tensor *It = NfNN_Tape_Get(Mem, Index);
+            memset(It->Gradient, 0, NfNN_Size(It));
+            for (u32 Input = 0; Input < NfNN_Op_InputCount(It->Op.Type); Input++)
+            {
+                nfnn_tensor *In = It->Op.Inputs[Input];
+                if (!NfNN_Tape_Contains(Mem, In) && In->RequiresGrad)
+                {
+                    memset(In->Gradient, 0, NfNN_Size(In));
+                }
+            }
+        }
+    }
+}
+
+static void NfNN_AutoGrad_Backward_NLLLoss(nfnn_tensor *T)
+{
+    nfnn_tensor *Left = T->Op.Binary.Left;
+    NfNN_Math_NLLLossD_Mean_f32(T->Gradient, Left->Data, T->Op.Binary.Right->Data, Left->Dimensions.Dimensions[0],
+                                Left->Dimensions.Dimensions[1], NfNN_AutoGrad_Accumulator(T, 0));
+}
+
+static void NfNN_AutoGrad_Backward_LogSoftmax(nfnn_tensor *T)
+{
+    NfNN_Math_LogSoftmaxOutD_f32(T->Gradient, T->Data, T->Dimensions.Dimensions[0], T->Dimensions.Dimensions[1],
+                                 T->Op.Dimensional.Dim, NfNN_AutoGrad_Accumulator(T, 0));
+}
+
+static void NfNN_AutoGrad_Backward_Square(nfnn_tensor *T)
+{
+    nfnn_tensor *Input = T->Op.Unary.Input;
+    NfNN_Math_SquareD_f32(T->Gradient, Input->Data, NfNN_Length(Input), NfNN_AutoGrad_Accumulator(T, 0));
+}
+
+static void NfNN_AutoGrad_Backward_ReLU(nfnn_tensor *T)
+{
+    NfNN_Math_ReLUMaskD_f32(T->Gradient, T->Op.Saved.Mask, NfNN_Length(T), NfNN_AutoGrad_Accumulator(T, 0));
+}
+
+static void NfNN_AutoGrad_Backward_Sigmoid(nfnn_tensor *T)
+{
+    NfNN_Math_SigmoidOutD_f32(T->Gradient, T->Data, NfNN_Length(T), NfNN_AutoGrad_Accumulator(T, 0));
+}
+
+static void NfNN_AutoGrad_Backward_Tanh(nfnn_tensor *T)
+{
+    NfNN_Math_TanhOutD_f32(T->Gradient, T->Data, NfNN_Length(T), NfNN_AutoGrad_Accumulator(T, 0));
+}
+
+// NOTE(luatil): Copy and Reshape keep the number of elements
+static void NfNN_AutoGrad_Backward_Copy(nfnn_tensor *T)
+{
+    NfNN_AutoGrad_WriteScaled(T, 0, T->Gradient, 1.0f);
+}
+
+static void NfNN_AutoGrad_Backward_MultiplyByConstant(nfnn_tensor *T)
+{
+    NfNN_AutoGrad_WriteScaled(T, 0, T->Gradient, T->Op.Constant.ConstantInputf32);
+}
+
+// NOTE(luatil): Binary ops only require a gradient for one of their operands
+static void NfNN_AutoGrad_Backward_Add(nfnn_tensor *T)
+{
+    if (T->Op.Binary.Left->RequiresGrad)
+    {
+        NfNN_AutoGrad_WriteScaled(T, 0, T->Gradient, 1.0f);
+    }
+    if (T->Op.Binary.Right->RequiresGrad)
+    {
+        NfNN_AutoGrad_WriteScaled(T, 1, T->Gradient, 1.0f);
+    }
+}
+
+static void NfNN_AutoGrad_Backward_BroadcastAddLeft(nfnn_tensor *T)
+{
+    if (T->Op.Binary.Left->RequiresGrad)
+    {
+        NfNN_AutoGrad_WriteScaled(T, 0, T->Gradient, 1.0f);
+    }
+}
+
+static void NfNN_AutoGrad_Backward_BroadcastAddScalarRight(nfnn_tensor *T)
+{
+    NfNN_Math_SumAllAdd_f32(T->Gradient, NfNN_Length(T), NfNN_AutoGrad_Accumulator(T, 1));
+}
+
+static void NfNN_AutoGrad_Backward_BroadcastAddRowRight(nfnn_tensor *T)
+{
+    nfnn_tensor *Right = T->Op.Binary.Right;
+    NfNN_Math_SumXAdd_f32(T->Gradient, T->Dimensions.Dimensions[0], T->Dimensions.Dimensions[1],
+                          Right->Dimensions.Dimensions[0], Right->Dimensions.Dimensions[1],
+                          NfNN_AutoGrad_Accumulator(T, 1));
+}
+
+static void NfNN_AutoGrad_Backward_BroadcastAddColumnRight(nfnn_tensor *T)
+{
+    nfnn_tensor *Right = T->Op.Binary.Right;
+    NfNN_Math_SumYAdd_f32(T->Gradient, T->Dimensions.Dimensions[0], T->Dimensions.Dimensions[1],
+                          Right->Dimensions.Dimensions[0], Right->Dimensions.Dimensions[1],
+                          NfNN_AutoGrad_Accumulator(T, 1));
+}
+
+static void NfNN_AutoGrad_Backward_BroadcastAddScalar(nfnn_tensor *T)
+{
+    NfNN_AutoGrad_Backward_BroadcastAddLeft(T);
+    NfNN_AutoGrad_Backward_BroadcastAddScalarRight(T);
+}
 
+static void NfNN_AutoGrad_Backward_BroadcastAddRow(nfnn_tensor *T)
+{
+    NfNN_AutoGrad_Backward_BroadcastAddLeft(T);
+    NfNN_AutoGrad_Backward_BroadcastAddRowRight(T);
+}
+
+static void NfNN_AutoGrad_Backward_BroadcastAddColumn(nfnn_tensor *T)
+{
+    NfNN_AutoGrad_Backward_BroadcastAddLeft(T);
+    NfNN_AutoGrad_Backward_BroadcastAddColumnRight(T);
+}
+
+static void NfNN_AutoGrad_Backward_Sub(nfnn_tensor *T)
+{
+    if (T->Op.Binary.Left->RequiresGrad)
+    {
+        NfNN_AutoGrad_WriteScaled(T, 0, T->Gradient, 1.0f);
+    }
+    if (T->Op.Binary.Right->RequiresGrad)
+    {
+        NfNN_AutoGrad_WriteScaled(T, 1, T->Gradient, -1.0f);
+    }
+}
+
+static void NfNN_AutoGrad_Backward_Mul(nfnn_tensor *T)
+{
+    nfnn_tensor *Left = T->Op.Binary.Left;
+    nfnn_tensor *Right = T->Op.Binary.Right;
+    if (Left->RequiresGrad && NfNN_AutoGrad_FirstWrite(T, 0))
+    {
+        NfNN_Math_Hadamard_f32(T->Gradient, Right->Data, NfNN_Length(T), Left->Gradient);
+    }
+    else if (Left->RequiresGrad)
+    {
+        NfNN_Math_Fmadd_f32(T->Gradient, Right->Data, NfNN_Length(T), Left->Gradient);
+    }
+    if (Right->RequiresGrad && NfNN_AutoGrad_FirstWrite(T, 1))
+    {
+        NfNN_Math_Hadamard_f32(T->Gradient, Left->Data, NfNN_Length(T), Right->Gradient);
+    }
+    else if (Right->RequiresGrad)
+    {
+        NfNN_Math_Fmadd_f32(T->Gradient, Left->Data, NfNN_Length(T), Right->Gradient);
+    }
+}
+
+// Example:
+// A in (3, 10) | B in (10, 4)
+// C = A @ B in (3, 4)
+// dL/dC in (3, 4)
+// dL/dA = dL/dC @ B^T in (3, 10)
+// dL/dC = A^T @ dL/dC in (10, 4)
+
+// Given total derivative rule we also need to add this to the gradient. Therefore:
+// dL/dA += dL/dC @ B^T in (3, 10)
+// dL/dB += A^T @ dL/dC in (10, 4)
+
+// NOTE(luatil): Only the operands kept in Op.Saved are read here, a missing
+// one means the other side does not need its gradient
+static void NfNN_AutoGrad_Backward_MatMulLeft(nfnn_tensor *T)
+{
+    nfnn_tensor *Right = T->Op.Binary.Right;
+    NfNN_Math_MatmulAddTransposeRight_f32(T->Gradient, T->Op.Saved.Right, T->Dimensions.Dimensions[0],
+                                          Right->Dimensions.Dimensions[1], Right->Dimensions.Dimensions[0],
+                                          NfNN_AutoGrad_Accumulator(T, 0));
+}
+
+static void NfNN_AutoGrad_Backward_MatMulRight(nfnn_tensor *T)
+{
+    nfnn_tensor *Left = T->Op.Binary.Left;
+    nfnn_tensor *Right = T->Op.Binary.Right;
+    NfNN_Math_MatmulAddTransposeLeft_f32(T->Op.Saved.Left, T->Gradient, Left->Dimensions.Dimensions[0],
+                                         Left->Dimensions.Dimensions[1], Right->Dimensions.Dimensions[1],
+                                         NfNN_AutoGrad_Accumulator(T, 1));
+}
+
+static void NfNN_AutoGrad_Backward_MatMul(nfnn_tensor *T)
+{
+    NfNN_AutoGrad_Backward_MatMulLeft(T);
+    NfNN_AutoGrad_Backward_MatMulRight(T);
+}
+
+// NOTE(luatil): Picks the backward kernel for T once, so callers replaying the
+// same graph many times do not have to look at shapes or saved state again
+static nfnn_op_kernel *NfNN_AutoGrad_BackwardKernel(nfnn_tensor *T)
+{
+    nfnn_op_kernel *Result = 0;
+    if (!T->RequiresGrad)
+    {
+        return Result;
+    }
     switch (T->Op.Type)
     {
-    case NFNN_OP_TYPE_ADD:
-    case NFNN_OP_TYPE_MUL:
-    case NFNN_OP_TYPE_MATMUL:
-    case NFNN_OP_TYPE_SUB:
-    case NFNN_OP_TYPE_BROADCAST_ADD:
     case NFNN_OP_TYPE_NLL_LOSS: {
-        NfNN_AutoGrad_BuildTensorListRec(Mem, T->Op.Binary.Left, List);
-        NfNN_AutoGrad_BuildTensorListRec(Mem, T->Op.Binary.Right, List);
+        Result = NfNN_AutoGrad_Backward_NLLLoss;
+    }
+    break;
+    case NFNN_OP_TYPE_LOG_SOFTMAX: {
+        Result = NfNN_AutoGrad_Backward_LogSoftmax;
     }
     break;
-    case NFNN_OP_TYPE_RELU:
-    case NFNN_OP_TYPE_SIGMOID:
-    case NFNN_OP_TYPE_TANH:
     case NFNN_OP_TYPE_SQUARE: {
-        NfNN_AutoGrad_BuildTensorListRec(Mem, T->Op.Unary.Input, List);
+        Result = NfNN_AutoGrad_Backward_Square;
     }
     break;
-    case NFNN_OP_TYPE_LOG_SOFTMAX: {
-        NfNN_AutoGrad_BuildTensorListRec(Mem, T->Op.Dimensional.Input, List);
+    case NFNN_OP_TYPE_RELU: {
+        Result = NfNN_AutoGrad_Backward_ReLU;
     }
     break;
-    case NFNN_OP_TYPE_LEAF: {
-        NFNN_NOT_USED();
+    case NFNN_OP_TYPE_SIGMOID: {
+        Result = NfNN_AutoGrad_Backward_Sigmoid;
+    }
+    break;
+    case NFNN_OP_TYPE_TANH: {
+        Result = NfNN_AutoGrad_Backward_Tanh;
     }
     break;
     case NFNN_OP_TYPE_COPY:
-    case NFNN_OP_TYPE_MUL_CONST:
-    case NFNN_OP_TYPE_RESHAPE:
+    case NFNN_OP_TYPE_RESHAPE: {
+        Result = NfNN_AutoGrad_Backward_Copy;
+    }
+    break;
+    case NFNN_OP_TYPE_MUL_CONST: {
+        Result = NfNN_AutoGrad_Backward_MultiplyByConstant;
+    }
+    break;
+    case NFNN_OP_TYPE_ADD: {
+        Result = NfNN_AutoGrad_Backward_Add;
+    }
+    break;
+    case NFNN_OP_TYPE_BROADCAST_ADD: {
+        nfnn_dim Right = T->Op.Binary.Right->Dimensions;
+        if (!T->Op.Binary.Right->RequiresGrad)
+        {
+            Result = NfNN_AutoGrad_Backward_BroadcastAddLeft;
+        }
+        else if (Right.Dimensions[0] == 1 && Right.Dimensions[1] == 1)
+        {
+            Result = NfNN_AutoGrad_Backward_BroadcastAddScalar;
+        }
+        else if (Right.Dimensions[0] == 1)
+        {
+            Result = NfNN_AutoGrad_Backward_BroadcastAddRow;
+        }
+        else if (Right.Dimensions[1] == 1)
+        {
+            Result = NfNN_AutoGrad_Backward_BroadcastAddColumn;
+        }
+        else
+        {
+            NFNN_ERROR();
+        }
+    }
+    break;
+    case NFNN_OP_TYPE_SUB: {
+        Result = NfNN_AutoGrad_Backward_Sub;
+    }
+    break;
+    case NFNN_OP_TYPE_MUL: {
+        Result = NfNN_AutoGrad_Backward_Mul;
+    }
+    break;
+    case NFNN_OP_TYPE_MATMUL: {
+        if (T->Op.Saved.Left && T->Op.Saved.Right)
+        {
+            Result = NfNN_AutoGrad_Backward_MatMul;
+        }
+        else if (T->Op.Saved.Right)
+        {
+            Result = NfNN_AutoGrad_Backward_MatMulLeft;
+        }
+        else if (T->Op.Saved.Left)
+        {
+            Result = NfNN_AutoGrad_Backward_MatMulRight;
+        }
+    }
+    break;
+    case NFNN_OP_TYPE_LEAF:
+    case NFNN_OP_TYPE_ARGMAX:
+    case NFNN_OP_TYPE_EQUAL: {
+        NFNN_NOT_USED();
+    }
+    break;
+    case NFNN_OP_TYPE_COUNT:
     default: {
-        NFNN_NOT_IMPLEMENTED();
+        NFNN_ERROR();
     }
     break;
     }
-
-    NfNN_AutoGrad_PushTensor(Mem, List, T);
+    return Result;
 }
 
-static void NfNN_AutoGrad_ReverseList(nfnn_tensor_list *List)
+// NOTE(luatil): Splits the backward of T into kernels that write disjoint inputs, so a
+// scheduler can run them at the same time. Writes[Part] has one bit per input slot.
+static u32 NfNN_AutoGrad_BackwardParts(nfnn_tensor *T, nfnn_op_kernel **Kernels, u32 *Writes)
 {
-    nfnn_tensor *T = List->Last;
-    while (T != 0)
+    u32 Result = 0;
+    nfnn_op_kernel *Kernel = NfNN_AutoGrad_BackwardKernel(T);
+    if (!Kernel)
+    {
+        return Result;
+    }
+
+    if (Kernel == NfNN_AutoGrad_Backward_MatMul)
+    {
+        Kernels[0] = NfNN_AutoGrad_Backward_MatMulLeft;
+        Writes[0] = 1 << 0;
+        Kernels[1] = NfNN_AutoGrad_Backward_MatMulRight;
+        Writes[1] = 1 << 1;
+        Result = 2;
+    }
+    else if (Kernel == NfNN_AutoGrad_Backward_BroadcastAddScalar || Kernel == NfNN_AutoGrad_Backward_BroadcastAddRow ||
+             Kernel == NfNN_AutoGrad_Backward_BroadcastAddColumn)
+    {
+        if (T->Op.Binary.Left->RequiresGrad)
+        {
+            Kernels[Result] = NfNN_AutoGrad_Backward_BroadcastAddLeft;
+            Writes[Result++] = 1 << 0;
+        }
+        if (Kernel == NfNN_AutoGrad_Backward_BroadcastAddScalar)
+        {
+            Kernels[Result] = NfNN_AutoGrad_Backward_BroadcastAddScalarRight;
+        }
+        else if (Kernel == NfNN_AutoGrad_Backward_BroadcastAddRow)
+        {
+            Kernels[Result] = NfNN_AutoGrad_Backward_BroadcastAddRowRight;
+        }
+        else
+        {
+            Kernels[Result] = NfNN_AutoGrad_Backward_BroadcastAddColumnRight;
+        }
+        Writes[Result++] = 1 << 1;
+    }
+    else
     {
-        nfnn_tensor *Prev = T->Prev;
-        T->Prev = T->Next;
-        T->Next = Prev;
-        T = Prev;
+        Kernels[0] = Kernel;
+        Writes[0] = 0;
+        for (u32 Input = 0; Input < NfNN_Op_InputCount(T->Op.Type); Input++)
+        {
+            if (T->Op.Inputs[Input]->RequiresGrad)
+            {
+                Writes[0] |= 1 << Input;
+            }
+        }
+        Result = 1;
     }
-    nfnn_tensor *Temp = List->Last;
-    List->Last = List->First;
-    List->First = Temp;
+
+    return Result;
 }
 
-// NOTE(luatil): Builds a linked list of tensors in reverse topological order
-// according to operation dependencies
-static nfnn_tensor_list *NfNN_AutoGrad_BuildList(nfnn_memory_arena *Mem, nfnn_tensor *T)
+typedef struct nfnn_tensor_set nfnn_tensor_set;
+struct nfnn_tensor_set
 {
-    nfnn_tensor_list *Result = NfNN_PushStruct(Mem, nfnn_tensor_list);
-    NfNN_AutoGrad_BuildTensorListRec(Mem, T, Result);
+    nfnn_tensor **Slots;
+    u32 Mask;
+};
+
+static nfnn_tensor_set NfNN_TensorSet(nfnn_memory_arena *Mem, u32 Capacity)
+{
+    nfnn_tensor_set Result = {0};
+    u32 TableSize = 1;
+    while (TableSize < 2 * Capacity + 1)
+    {
+        TableSize *= 2;
+    }
+    Result.Slots = NfNN_PushArray(Mem, nfnn_tensor *, TableSize);
+    Result.Mask = TableSize - 1;
+    memset(Result.Slots, 0, TableSize * sizeof(nfnn_tensor *));
     return Result;
 }
 
-static void NfNN_AutoGrad_ZeroGrad(nfnn_memory_arena *Mem, nfnn_tensor *T)
+// NOTE(luatil): Returns true the first time T is added
+static bool NfNN_TensorSet_Add(nfnn_tensor_set *Set, nfnn_tensor *T)
 {
-    nfnn_tensor_list *List = NfNN_AutoGrad_BuildList(Mem, T);
-    for (nfnn_tensor *It = List->First; It != 0; It = It->Next)
+    u32 Slot = (u32)(((uintptr_t)T >> 4) * 2654435761u) & Set->Mask;
+    while (Set->Slots[Slot] && Set->Slots[Slot] != T)
     {
-        // TODO(luatil): This breaks abstraction barrier
-        It->Visited = false;
-        memset(It->Gradient, 0, NfNN_Size(It));
+        Slot = (Slot + 1) & Set->Mask;
     }
+    bool Result = !Set->Slots[Slot];
+    Set->Slots[Slot] = T;
+    return Result;
 }
 
-static void NfNN_AutoGrad_Backward(nfnn_memory_arena *Mem, nfnn_tensor *T)
+// NOTE(luatil): One bit per input slot of the entry that is the first reader of a leaf that
+// requires a gradient. The tape is replayed in reverse, so its backward is the last to use the leaf.
+static u8 *NfNN_AutoGrad_LeafReady(nfnn_memory_arena *Mem, u8 *Live, u32 EntryCount)
 {
-    nfnn_tensor_list *List = NfNN_AutoGrad_BuildList(Mem, T);
+    u8 *Result = NfNN_PushArray(Mem, u8, EntryCount);
+    memset(Result, 0, EntryCount);
+    nfnn_tensor_set Seen = NfNN_TensorSet(Mem, 2 * EntryCount);
 
-    T->Gradient[0] = 1.0f;
-
-    // NOTE(luatil): Traverse in topological order
-    for (nfnn_tensor *It = List->Last; It != 0; It = It->Prev)
+    for (u32 Index = 0; Index < EntryCount; Index++)
     {
-        It->Visited = false;
-        nfnn_op Op = It->Op;
-        switch (Op.Type)
+        if (!Live[Index])
         {
-        case NFNN_OP_TYPE_NLL_LOSS: {
-            NfNN_Math_NLLLossD_Mean_f32(It->Gradient, Op.Binary.Left->Data, Op.Binary.Right->Data,
-                                        Op.Binary.Left->Dimensions.Dimensions[0],
-                                        Op.Binary.Left->Dimensions.Dimensions[1], Op.Binary.Left->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_LOG_SOFTMAX: {
-            NfNN_Math_LogSoftmaxD_f32(Mem, It->Gradient, Op.Dimensional.Input->Data, It->Dimensions.Dimensions[0],
-                                      It->Dimensions.Dimensions[1], Op.Dimensional.Dim, Op.Dimensional.Input->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_SQUARE: {
-            NfNN_Math_SquareD_f32(It->Gradient, Op.Unary.Input->Data, NfNN_Length(Op.Unary.Input),
-                                  Op.Unary.Input->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_RELU: {
-            NfNN_Math_ReLUD_f32(It->Gradient, Op.Unary.Input->Data, NfNN_Length(Op.Unary.Input),
-                                Op.Unary.Input->Gradient);
+            continue;
         }
-        break;
-        case NFNN_OP_TYPE_SIGMOID: {
-            NfNN_Math_SigmoidD_f32(It->Gradient, Op.Unary.Input->Data, NfNN_Length(Op.Unary.Input),
-                                   Op.Unary.Input->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_TANH: {
-            NfNN_Math_TanhD_f32(It->Gradient, Op.Unary.Input->Data, NfNN_Length(Op.Unary.Input),
-                                Op.Unary.Input->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_ADD: {
-            NfNN_Math_FmaddConst_f32(It->Gradient, 1.0f, NfNN_Length(Op.Binary.Left), Op.Binary.Left->Gradient);
-            NfNN_Math_FmaddConst_f32(It->Gradient, 1.0f, NfNN_Length(Op.Binary.Right), Op.Binary.Right->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_BROADCAST_ADD: {
-            NfNN_Math_FmaddConst_f32(It->Gradient, 1.0f, NfNN_Length(Op.Binary.Left), Op.Binary.Left->Gradient);
-
-            if (Op.Binary.Right->Dimensions.Dimensions[0] == 1 && Op.Binary.Right->Dimensions.Dimensions[1] == 1)
+        nfnn_tape_block *Block = NfNN_MemoryArena_TapeBlock(Mem, Index);
+        nfnn_tensor *It = 0;
+        for (u32 Input = 0; Input < NFNN_TAPE_MAX_INPUTS; Input++)
+        {
+            if (Block->Inputs[Input][Index % NFNN_TAPE_BLOCK] != NFNN_TAPE_NONE)
             {
-                NfNN_Math_SumAllAdd_f32(It->Gradient, NfNN_Length(It), Op.Binary.Right->Gradient);
+                continue;
             }
-            else if (Op.Binary.Right->Dimensions.Dimensions[0] == 1)
+            It = It ? It : NfNN_Tape_Get(Mem, Index);
+            nfnn_tensor *In = Input < NfNN_Op_InputCount(It->Op.Type) ? It->Op.Inputs[Input] : 0;
+            if (In && In->RequiresGrad && NfNN_TensorSet_Add(&Seen, In))
             {
+                Result[Index] |= 1 << Input;
+            }
+        }
+    }
+
+    return Result;
+}
 
-                NfNN_Math_SumXAdd_f32(It->Gradient, It->Dimensions.Dimensions[0], It->Dimensions.Dimensions[1],
-                                      Op.Binary.Right->Dimensions.Dimensions[0],
-                                      Op.Binary.Right->Dimensions.Dimensions[1], Op.Binary.Right->Gradient);
+// NOTE(luatil): Marks in Op.FirstWrite the backward that writes each gradient first, which is
+// the last reader on the tape. That kernel overwrites the gradient, so nothing has to be zeroed
+// before backward. Every gradient written gets the epoch of this backward, see NfNN_Optimizer_Step.
+// While accumulating leaves get the epoch of the accumulation instead, and once they have it
+// nothing overwrites them.
+static void NfNN_AutoGrad_FirstWrites(nfnn_memory_arena *Mem, u8 *Live, u32 EntryCount)
+{
+    u32 Epoch = NFNN_ATOMIC_ADD_U32(&NfNN_AutoGrad_Epoch, 1);
+    Mem->AccumulateBackwards += Mem->AccumulateEpoch != 0;
+    nfnn_tensor_set Written = NfNN_TensorSet(Mem, 2 * EntryCount);
+
+    for (u32 Index = EntryCount; Index-- > 0;)
+    {
+        if (!Live[Index])
+        {
+            continue;
+        }
+        nfnn_tensor *It = NfNN_Tape_Get(Mem, Index);
+        It->Op.FirstWrite = 0;
+        for (u32 Input = 0; It->RequiresGrad && Input < NfNN_Op_InputCount(It->Op.Type); Input++)
+        {
+            nfnn_tensor *In = It->Op.Inputs[Input];
+            if (In->RequiresGrad && NfNN_TensorSet_Add(&Written, In))
+            {
+                bool Leaf = In->Op.Type == NFNN_OP_TYPE_LEAF && Mem->AccumulateEpoch;
+                if (!Leaf || In->GradEpoch != Mem->AccumulateEpoch)
+                {
+                    It->Op.FirstWrite |= 1 << Input;
+                }
+                In->GradEpoch = Leaf ? Mem->AccumulateEpoch : Epoch;
             }
-            else if (Op.Binary.Right->Dimensions.Dimensions[1] == 1)
+        }
+    }
+}
+
+static void NfNN_AutoGrad_Backward(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    if (!T->RequiresGrad)
+    {
+        return;
+    }
+
+    NfNN_Realize(T);
+
+    T->Gradient[0] = NfNN_AutoGrad_Seed(Mem);
+
+    if (!NfNN_Tape_Contains(Mem, T))
+    {
+        return;
+    }
+
+    u8 *Live = NfNN_Tape_MarkLive(Mem, T, true);
+    bool Hooks = Mem->GradReady && !Mem->AccumulateEpoch;
+    u8 *Ready = Hooks ? NfNN_AutoGrad_LeafReady(Mem, Live, T->TapeIndex + 1) : 0;
+    NfNN_AutoGrad_FirstWrites(Mem, Live, T->TapeIndex + 1);
+
+    // NOTE(luatil): Replay the tape in reverse, skipping what T does not depend on
+    // and everything that cannot reach a leaf that requires a gradient
+    for (u32 Index = T->TapeIndex + 1; Index-- > 0;)
+    {
+        if (Live[Index])
+        {
+            nfnn_tensor *It = NfNN_Tape_Get(Mem, Index);
+            nfnn_op_kernel *Kernel = NfNN_AutoGrad_BackwardKernel(It);
+            if (Kernel)
             {
-                NfNN_Math_SumYAdd_f32(It->Gradient, It->Dimensions.Dimensions[0], It->Dimensions.Dimensions[1],
-                                      Op.Binary.Right->Dimensions.Dimensions[0],
-                                      Op.Binary.Right->Dimensions.Dimensions[1], Op.Binary.Right->Gradient);
+                Kernel(It);
             }
-            else
+            for (u32 Input = 0; Ready && Ready[Index] && Input < NFNN_TAPE_MAX_INPUTS; Input++)
             {
-                NFNN_ERROR();
+                if (Ready[Index] & (1 << Input))
+                {
+                    Mem->GradReady(Mem->GradReadyContext, It->Op.Inputs[Input]);
+                }
             }
         }
-        break;
-        case NFNN_OP_TYPE_SUB: {
-            NfNN_Math_FmaddConst_f32(It->Gradient, 1.0f, NfNN_Length(Op.Binary.Left), Op.Binary.Left->Gradient);
-            NfNN_Math_FmaddConst_f32(It->Gradient, -1.0f, NfNN_Length(Op.Binary.Right), Op.Binary.Right->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_MUL: {
-            NfNN_Math_Fmadd_f32(It->Gradient, Op.Binary.Right->Data, NfNN_Length(T), Op.Binary.Left->Gradient);
-            NfNN_Math_Fmadd_f32(It->Gradient, Op.Binary.Left->Data, NfNN_Length(T), Op.Binary.Right->Gradient);
-        }
-        break;
-        case NFNN_OP_TYPE_MATMUL: {
-            // Example:
-            // A in (3, 10) | B in (10, 4)
-            // C = A @ B in (3, 4)
-            // dL/dC in (3, 4)
-            // dL/dA = dL/dC @ B^T in (3, 10)
-            // dL/dC = A^T @ dL/dC in (10, 4)
-
-            // Given total derivative rule we also need to add this to the gradient. Therefore:
-            // dL/dA += dL/dC @ B^T in (3, 10)
-            // dL/dB += A^T @ dL/dC in (10, 4)
-            f32 *A = Op.Binary.Left->Data;
-            f32 *dLdA = Op.Binary.Left->Gradient;
-
-            u32 A_DimX = Op.Binary.Left->Dimensions.Dimensions[0];
-            u32 A_DimY = Op.Binary.Left->Dimensions.Dimensions[1];
-
-            f32 *B = Op.Binary.Right->Data;
-            f32 *dLdB = Op.Binary.Right->Gradient;
-
-            u32 B_DimX = Op.Binary.Right->Dimensions.Dimensions[0];
-            u32 B_DimY = Op.Binary.Right->Dimensions.Dimensions[1];
-
-            f32 *dLdC = It->Gradient;
-            u32 dLdC_DimX = A_DimX;
-            u32 dLdC_DimY = B_DimY;
-
-            NfNN_Math_MatmulAddTransposeRight_f32(dLdC, B, dLdC_DimX, B_DimY, B_DimX, dLdA);
-            NfNN_Math_MatmulAddTransposeLeft_f32(A, dLdC, A_DimX, A_DimY, dLdC_DimY, dLdB);
-        }
-        break;
-        case NFNN_OP_TYPE_LEAF: {
-            NFNN_NOT_USED();
-        }
-        break;
-        case NFNN_OP_TYPE_COUNT:
-        default: {
-            NFNN_ERROR();
-        }
-        break;
-        }
     }
 }
 
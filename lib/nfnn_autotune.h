@@ -0,0 +1,339 @@
+#ifndef NFNN_AUTOTUNE_H
+#define NFNN_AUTOTUNE_H
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#endif
+
+#include "nfnn_gemm.h"
+#include "nfnn_math.h"
+#include "nfnn_time.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): Benchmarks candidate configurations for every GEMM shape the program runs
+// and keeps the fastest one in a small text file, one line per shape and machine. Lines of
+// other machines sharing the file are kept, so a fleet can share one cache.
+//
+// Usage:
+//   NfNN_Gemm_SetThreadPool(Pool);                   // Optional, adds thread splits
+//   NfNN_Autotune_Begin("nfnn_gemm_tuning.txt");     // Loads this machine's choices
+//   ... one training step, its shapes get recorded
+//   NfNN_Autotune_End("nfnn_gemm_tuning.txt");       // Tunes new shapes and saves them
+//
+// Shapes found in the file are not measured again, so later runs start tuned. Record with the
+// sequential backward, shapes seen from the jobs of a parallel backward are recorded too but
+// the tuner then competes with them for the pool.
+
+#ifndef NFNN_AUTOTUNE_MICROSECONDS
+#define NFNN_AUTOTUNE_MICROSECONDS 1000 // Minimum measured time per candidate and repeat
+#endif
+
+typedef struct nfnn_autotune_stats nfnn_autotune_stats;
+struct nfnn_autotune_stats
+{
+    u32 Loaded;     // Shapes read from the cache for this machine
+    u32 Tuned;      // Shapes measured by this run
+    u32 Candidates; // Configurations measured by this run
+};
+
+static nfnn_autotune_stats NfNN_Autotune_Stats;
+
+// NOTE(luatil): CPU model and logical core count, the key of a line in the cache
+static void NfNN_Autotune_MachineKey(char *Buffer, u32 Size)
+{
+    char Model[256] = "unknown";
+    u32 Cores = 1;
+#if defined(_WIN32)
+    char *Identifier = getenv("PROCESSOR_IDENTIFIER");
+    if (Identifier)
+    {
+        snprintf(Model, sizeof(Model), "%s", Identifier);
+    }
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    Cores = SystemInfo.dwNumberOfProcessors;
+#else
+#if defined(__APPLE__)
+    size_t ModelSize = sizeof(Model);
+    sysctlbyname("machdep.cpu.brand_string", Model, &ModelSize, 0, 0);
+#else
+    FILE *File = fopen("/proc/cpuinfo", "rb");
+    if (File)
+    {
+        char Line[512];
+        while (fgets(Line, sizeof(Line), File))
+        {
+            char *Colon = strchr(Line, ':');
+            if (Colon && strncmp(Line, "model name", 10) == 0)
+            {
+                snprintf(Model, sizeof(Model), "%s", Colon + 2);
+                break;
+            }
+        }
+        fclose(File);
+    }
+#endif
+    Cores = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    for (char *It = Model; *It; It++)
+    {
+        if (*It == '\n' || *It == '\r' || *It == '\t')
+        {
+            *It = ' ';
+        }
+    }
+    snprintf(Buffer, Size, "%s| %u cores", Model, Cores);
+}
+
+// NOTE(luatil): Line format: kernel d0 d1 d2 kind block_rows block_inner block_columns threads key
+static bool NfNN_Autotune_ParseLine(char *Line, nfnn_gemm_entry *Entry, char *Key, u32 KeySize)
+{
+    u32 Values[9];
+    int Consumed = 0;
+    int Read = sscanf(Line, "%u %u %u %u %u %u %u %u %u %n", Values, Values + 1, Values + 2, Values + 3, Values + 4,
+                      Values + 5, Values + 6, Values + 7, Values + 8, &Consumed);
+    if (Read != 9 || Values[0] >= NFNN_GEMM_KERNEL_COUNT || Values[4] >= NFNN_GEMM_KIND_COUNT)
+    {
+        return false;
+    }
+
+    memset(Entry, 0, sizeof(nfnn_gemm_entry));
+    Entry->Kernel = (nfnn_gemm_kernel)Values[0];
+    Entry->Dimensions[0] = Values[1];
+    Entry->Dimensions[1] = Values[2];
+    Entry->Dimensions[2] = Values[3];
+    Entry->Config.Kind = (nfnn_gemm_kind)Values[4];
+    Entry->Config.BlockRows = NFNN_MAX(1, Values[5]);
+    Entry->Config.BlockInner = NFNN_MAX(1, Values[6]);
+    Entry->Config.BlockColumns = NFNN_MAX(1, Values[7]);
+    Entry->Config.Threads = NFNN_MAX(1, Values[8]);
+    Entry->Tuned = true;
+
+    snprintf(Key, KeySize, "%s", Line + Consumed);
+    Key[strcspn(Key, "\r\n")] = 0;
+    return true;
+}
+
+static u32 NfNN_Autotune_Load(char *Path)
+{
+    u32 Result = 0;
+    char Machine[512];
+    NfNN_Autotune_MachineKey(Machine, sizeof(Machine));
+
+    FILE *File = fopen(Path, "rb");
+    if (!File)
+    {
+        return Result;
+    }
+
+    char Line[1024];
+    char Key[512];
+    nfnn_gemm_entry Parsed;
+    while (fgets(Line, sizeof(Line), File))
+    {
+        if (NfNN_Autotune_ParseLine(Line, &Parsed, Key, sizeof(Key)) && strcmp(Key, Machine) == 0)
+        {
+            nfnn_gemm_entry *Entry =
+                NfNN_Gemm_Add(Parsed.Kernel, Parsed.Dimensions[0], Parsed.Dimensions[1], Parsed.Dimensions[2]);
+            if (Entry)
+            {
+                *Entry = Parsed;
+                Result++;
+            }
+        }
+    }
+    fclose(File);
+    return Result;
+}
+
+// NOTE(luatil): Rewrites the file with the lines of other machines and every tuned shape of this one.
+// Written to a private name and renamed, processes saving together never mix their output.
+static bool NfNN_Autotune_Save(char *Path)
+{
+    char Machine[512];
+    NfNN_Autotune_MachineKey(Machine, sizeof(Machine));
+
+#if defined(_WIN32)
+    int Process = (int)GetCurrentProcessId();
+#else
+    int Process = (int)getpid();
+#endif
+    char TempPath[1024 + 16];
+    snprintf(TempPath, sizeof(TempPath), "%s.%d", Path, Process);
+    FILE *Out = fopen(TempPath, "wb");
+    if (!Out)
+    {
+        return false;
+    }
+
+    FILE *In = fopen(Path, "rb");
+    if (In)
+    {
+        char Line[1024];
+        char Key[512];
+        nfnn_gemm_entry Parsed;
+        while (fgets(Line, sizeof(Line), In))
+        {
+            if (NfNN_Autotune_ParseLine(Line, &Parsed, Key, sizeof(Key)) && strcmp(Key, Machine) != 0)
+            {
+                fputs(Line, Out);
+            }
+        }
+        fclose(In);
+    }
+
+    for (u32 Index = 0; Index < NfNN_Gemm.EntryCount; Index++)
+    {
+        nfnn_gemm_entry *Entry = NfNN_Gemm.Entries + Index;
+        if (Entry->Tuned)
+        {
+            fprintf(Out, "%u %u %u %u %u %u %u %u %u %s\n", Entry->Kernel, Entry->Dimensions[0],
+                    Entry->Dimensions[1], Entry->Dimensions[2], Entry->Config.Kind, Entry->Config.BlockRows,
+                    Entry->Config.BlockInner, Entry->Config.BlockColumns, Entry->Config.Threads, Machine);
+        }
+    }
+    bool Written = !ferror(Out);
+    Written = fclose(Out) == 0 && Written;
+    if (!Written)
+    {
+        remove(TempPath);
+        return false;
+    }
+
+#if defined(_WIN32)
+    remove(Path);
+#endif
+    bool Result = rename(TempPath, Path) == 0;
+    if (!Result)
+    {
+        remove(TempPath);
+    }
+    return Result;
+}
+
+// NOTE(luatil): Best time of three, each one repeats the kernel for at least NFNN_AUTOTUNE_MICROSECONDS
+static f64 NfNN_Autotune_Measure(nfnn_gemm_entry *Entry, nfnn_gemm_config Config, f32 *A, f32 *B, f32 *Out)
+{
+    u32 *D = Entry->Dimensions;
+    f64 Result = 1e30;
+    NfNN_Math_GemmWithConfig_f32(Entry->Kernel, A, B, D[0], D[1], D[2], Out, Config);
+    for (u32 Repeat = 0; Repeat < 3; Repeat++)
+    {
+        u32 Calls = 0;
+        f64 Elapsed = 0.0;
+        nfnn_time Start = NfNN_Time_CurrentTime();
+        while (Elapsed < NFNN_AUTOTUNE_MICROSECONDS)
+        {
+            NfNN_Math_GemmWithConfig_f32(Entry->Kernel, A, B, D[0], D[1], D[2], Out, Config);
+            Calls++;
+            nfnn_time_diff Diff = NfNN_Time_Diff(Start, NfNN_Time_CurrentTime());
+            Elapsed = (f64)Diff.Seconds * 1000000.0 + (f64)Diff.Microseconds;
+        }
+        Result = NFNN_MIN(Result, Elapsed / Calls);
+    }
+    NfNN_Autotune_Stats.Candidates++;
+    return Result;
+}
+
+static void NfNN_Autotune_Entry(nfnn_gemm_entry *Entry)
+{
+    u32 *D = Entry->Dimensions;
+    // NOTE(luatil): A is (D0, D1) for every kernel, B is (D1, D2), (D2, D1) and (D0, D2)
+    u32 SizeA = D[0] * D[1];
+    u32 SizeB = Entry->Kernel == NFNN_GEMM_ADD_TRANSPOSE_LEFT ? D[0] * D[2] : D[1] * D[2];
+    u32 SizeOut = Entry->Kernel == NFNN_GEMM_ADD_TRANSPOSE_LEFT ? D[1] * D[2] : D[0] * D[2];
+
+    f32 *A = (f32 *)malloc(SizeA * sizeof(f32));
+    f32 *B = (f32 *)malloc(SizeB * sizeof(f32));
+    f32 *Out = (f32 *)calloc(SizeOut, sizeof(f32));
+    NFNN_ASSERT(A && B && Out, "NfNN_Autotune_Entry: Out of memory");
+    for (u32 Index = 0; Index < SizeA; Index++)
+    {
+        A[Index] = (f32)(Index % 17) * 0.01f;
+    }
+    for (u32 Index = 0; Index < SizeB; Index++)
+    {
+        B[Index] = (f32)(Index % 13) * 0.01f;
+    }
+
+    u32 MaxThreads = NfNN_Gemm.Pool ? NfNN_Gemm.Pool->ThreadCount : 1;
+    nfnn_gemm_config Best = {NFNN_GEMM_KIND_GENERIC, 1, 1, 1, 1};
+    f64 BestTime = NfNN_Autotune_Measure(Entry, Best, A, B, Out);
+
+    nfnn_gemm_config Specialized = {NFNN_GEMM_KIND_SPECIALIZED, 1, 1, 1, 1};
+    if (NfNN_Math_GemmSpecialized_f32(Entry->Kernel, A, B, D[0], D[1], D[2], Out))
+    {
+        f64 Time = NfNN_Autotune_Measure(Entry, Specialized, A, B, Out);
+        if (Time < BestTime)
+        {
+            Best = Specialized;
+            BestTime = Time;
+        }
+    }
+
+    u32 BlockRows[] = {4, 16, 64};
+    u32 BlockInner[] = {64, 256, 1 << 30};
+    u32 BlockColumns[] = {64, 256, 1 << 30};
+    u32 Threads[2] = {1, MaxThreads};
+    for (u32 T = 0; T < (MaxThreads > 1 ? 2u : 1u); T++)
+    {
+        for (u32 R = 0; R < 3; R++)
+        {
+            for (u32 I = 0; I < 3; I++)
+            {
+                for (u32 C = 0; C < 3; C++)
+                {
+                    nfnn_gemm_config Config = {NFNN_GEMM_KIND_BLOCKED, BlockRows[R], BlockInner[I], BlockColumns[C],
+                                               Threads[T]};
+                    f64 Time = NfNN_Autotune_Measure(Entry, Config, A, B, Out);
+                    if (Time < BestTime)
+                    {
+                        Best = Config;
+                        BestTime = Time;
+                    }
+                }
+            }
+        }
+    }
+
+    free(A);
+    free(B);
+    free(Out);
+
+    Entry->Config = Best;
+    Entry->Tuned = true;
+}
+
+static u32 NfNN_Autotune_Begin(char *Path)
+{
+    memset(&NfNN_Autotune_Stats, 0, sizeof(NfNN_Autotune_Stats));
+    NfNN_Autotune_Stats.Loaded = NfNN_Autotune_Load(Path);
+    NfNN_Gemm.Recording = true;
+    return NfNN_Autotune_Stats.Loaded;
+}
+
+static nfnn_autotune_stats NfNN_Autotune_End(char *Path)
+{
+    NfNN_Gemm.Recording = false;
+    for (u32 Index = 0; Index < NfNN_Gemm.EntryCount; Index++)
+    {
+        nfnn_gemm_entry *Entry = NfNN_Gemm.Entries + Index;
+        if (!Entry->Tuned)
+        {
+            NfNN_Autotune_Entry(Entry);
+            NfNN_Autotune_Stats.Tuned++;
+        }
+    }
+    if (NfNN_Autotune_Stats.Tuned > 0 && !NfNN_Autotune_Save(Path))
+    {
+        fprintf(stderr, "NfNN_Autotune_End: Could not write %s\n", Path);
+    }
+    return NfNN_Autotune_Stats;
+}
+
+#endif // NFNN_AUTOTUNE_H
@@ -0,0 +1,426 @@
+#ifndef NFNN_EXPORT_H
+#define NFNN_EXPORT_H
+
+#include "nfnn_graph.h"
+#include "nfnn_jit.h"
+#include "nfnn_macro.h"
+#include "nfnn_tensor.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): Writes the forward pass of a captured graph as one C file that only needs
+// <math.h>. Leaves other than the input are embedded as aligned static arrays, every node
+// becomes a call with constant shapes into a small kernel in the same file.
+//
+// Usage, with the model run once on an input of the deployed batch size:
+//   nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+//   nfnn_tensor *Output = Model(Mem, Input);
+//   NfNN_Graph_EndCapture(Graph, Output, 0);
+//   NfNN_Export_C(Graph, Input, "mnist", "mnist_model.c");
+//
+// The generated file declares
+//   void mnist_Predict(const float *Input, float *Output);
+// Intermediates live in static buffers, so one predictor must not be called from two
+// threads at once.
+
+// NOTE(luatil): Kernels of the generated file, each one is only ever called with
+// literal shapes so the compiler specializes it at the call site
+static char *NfNN_Export_Kernels =
+    "#include <math.h>\n"
+    "\n"
+    "#if defined(_MSC_VER)\n"
+    "#define NFNN_PREDICT_ALIGN __declspec(align(64))\n"
+    "#define NFNN_PREDICT_RESTRICT __restrict\n"
+    "#else\n"
+    "#define NFNN_PREDICT_ALIGN __attribute__((aligned(64)))\n"
+    "#define NFNN_PREDICT_RESTRICT restrict\n"
+    "#endif\n"
+    "\n"
+    "typedef float *NFNN_PREDICT_RESTRICT nfnn_predict_out;\n"
+    "typedef const float *NFNN_PREDICT_RESTRICT nfnn_predict_in;\n"
+    "\n"
+    "static inline void NfNN_Predict_MatMul(nfnn_predict_in X, nfnn_predict_in Y, unsigned M, unsigned K, unsigned N,\n"
+    "                                       nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < M; I++)\n"
+    "    {\n"
+    "        for (unsigned J = 0; J < N; J++)\n"
+    "            Out[I * N + J] = 0.0f;\n"
+    "        for (unsigned P = 0; P < K; P++)\n"
+    "        {\n"
+    "            float A = X[I * K + P];\n"
+    "            for (unsigned J = 0; J < N; J++)\n"
+    "                Out[I * N + J] += A * Y[P * N + J];\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_BroadcastAdd(nfnn_predict_in X, unsigned Rows, unsigned Cols, nfnn_predict_in B,\n"
+    "                                             unsigned BRows, unsigned BCols, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < Rows; I++)\n"
+    "        for (unsigned J = 0; J < Cols; J++)\n"
+    "            Out[I * Cols + J] = X[I * Cols + J] + B[(BRows != 1 ? I * BCols : 0) + (BCols != 1 ? J : 0)];\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Add(nfnn_predict_in X, nfnn_predict_in Y, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = X[I] + Y[I];\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Sub(nfnn_predict_in X, nfnn_predict_in Y, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = X[I] - Y[I];\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Mul(nfnn_predict_in X, nfnn_predict_in Y, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = X[I] * Y[I];\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_MulConst(nfnn_predict_in X, float C, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = X[I] * C;\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Copy(nfnn_predict_in X, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = X[I];\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_ReLU(nfnn_predict_in X, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = X[I] > 0.0f ? X[I] : 0.0f;\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Sigmoid(nfnn_predict_in X, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = 1.0f / (1.0f + expf(-X[I]));\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Tanh(nfnn_predict_in X, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = tanhf(X[I]);\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Square(nfnn_predict_in X, unsigned N, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < N; I++)\n"
+    "        Out[I] = X[I] * X[I];\n"
+    "}\n"
+    "\n"
+    "// Same rounding as the library: log of the softmax plus a small epsilon\n"
+    "static inline void NfNN_Predict_LogSoftmax(nfnn_predict_in X, unsigned Rows, unsigned Cols,\n"
+    "                                           nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < Rows; I++)\n"
+    "    {\n"
+    "        float Max = 0.0f;\n"
+    "        for (unsigned J = 0; J < Cols; J++)\n"
+    "            Max = X[I * Cols + J] > Max ? X[I * Cols + J] : Max;\n"
+    "        float Sum = 0.0f;\n"
+    "        for (unsigned J = 0; J < Cols; J++)\n"
+    "            Sum += expf(X[I * Cols + J] - Max);\n"
+    "        for (unsigned J = 0; J < Cols; J++)\n"
+    "            Out[I * Cols + J] = logf(expf(X[I * Cols + J] - Max) / Sum + 1.0e-10f);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void NfNN_Predict_Argmax(nfnn_predict_in X, unsigned Rows, unsigned Cols, nfnn_predict_out Out)\n"
+    "{\n"
+    "    for (unsigned I = 0; I < Rows; I++)\n"
+    "    {\n"
+    "        unsigned Index = 0;\n"
+    "        for (unsigned J = 1; J < Cols; J++)\n"
+    "            Index = X[I * Cols + J] > X[I * Cols + Index] ? J : Index;\n"
+    "        Out[I] = (float)Index;\n"
+    "    }\n"
+    "}\n"
+    "\n";
+
+typedef struct nfnn_export_stats nfnn_export_stats;
+struct nfnn_export_stats
+{
+    bool Written;
+    u32 NodeCount;
+    u32 WeightCount; // Floats embedded in the file
+};
+
+typedef struct nfnn_export_context nfnn_export_context;
+struct nfnn_export_context
+{
+    FILE *File;
+    char *Name;
+    nfnn_tensor *Input;
+    nfnn_graph *Graph;
+};
+
+// NOTE(luatil): Weights are named after the first node input that reads them
+static bool NfNN_Export_FirstUse(nfnn_graph *Graph, nfnn_tensor *T, u32 *Node, u32 *Slot)
+{
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        nfnn_tensor *It = Graph->Nodes[Index].Tensor;
+        for (u32 Input = 0; Input < NfNN_Op_InputCount(It->Op.Type); Input++)
+        {
+            if (It->Op.Inputs[Input] == T)
+            {
+                *Node = Index;
+                *Slot = Input;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// NOTE(luatil): The C name of the buffer holding T in the generated file
+static void NfNN_Export_BufferName(nfnn_export_context *Context, nfnn_tensor *T, char *Buffer, u32 Size)
+{
+    u32 Node = 0;
+    u32 Slot = 0;
+    if (T == Context->Input)
+    {
+        snprintf(Buffer, Size, "Input");
+    }
+    else if (T == Context->Graph->Loss)
+    {
+        snprintf(Buffer, Size, "Output");
+    }
+    else if (T->Op.Type != NFNN_OP_TYPE_LEAF)
+    {
+        for (u32 Index = 0; Index < Context->Graph->NodeCount; Index++)
+        {
+            if (Context->Graph->Nodes[Index].Tensor == T)
+            {
+                snprintf(Buffer, Size, "%s_T%u", Context->Name, Index);
+            }
+        }
+    }
+    else if (NfNN_Export_FirstUse(Context->Graph, T, &Node, &Slot))
+    {
+        snprintf(Buffer, Size, "%s_W%u_%u", Context->Name, Node, Slot);
+    }
+    else
+    {
+        NFNN_ERROR();
+    }
+}
+
+static void NfNN_Export_Weights(nfnn_export_context *Context, nfnn_tensor *T, nfnn_export_stats *Stats)
+{
+    char Buffer[128];
+    NfNN_Export_BufferName(Context, T, Buffer, sizeof(Buffer));
+
+    u32 Length = NfNN_Length(T);
+    fprintf(Context->File, "// (%u, %u)\nstatic const float %s[%u] NFNN_PREDICT_ALIGN = {", T->Dimensions.Dimensions[0],
+            T->Dimensions.Dimensions[1], Buffer, Length);
+    for (u32 Index = 0; Index < Length; Index++)
+    {
+        // NOTE(luatil): Hex floats round trip exactly
+        fprintf(Context->File, "%s%af,", Index % 8 == 0 ? "\n    " : " ", T->Data[Index]);
+    }
+    fprintf(Context->File, "\n};\n\n");
+    Stats->WeightCount += Length;
+}
+
+static bool NfNN_Export_Node(nfnn_export_context *Context, nfnn_tensor *T)
+{
+    char Out[128], A[128], B[128];
+    NfNN_Export_BufferName(Context, T, Out, sizeof(Out));
+    NfNN_Export_BufferName(Context, T->Op.Inputs[0], A, sizeof(A));
+    if (NfNN_Op_InputCount(T->Op.Type) == 2)
+    {
+        NfNN_Export_BufferName(Context, T->Op.Inputs[1], B, sizeof(B));
+    }
+
+    bool Result = true;
+    FILE *File = Context->File;
+    u32 Length = NfNN_Length(T);
+    nfnn_dim Left = T->Op.Inputs[0]->Dimensions;
+    nfnn_dim Right = NfNN_Op_InputCount(T->Op.Type) == 2 ? T->Op.Inputs[1]->Dimensions : Left;
+    switch (T->Op.Type)
+    {
+    case NFNN_OP_TYPE_MATMUL: {
+        fprintf(File, "    NfNN_Predict_MatMul(%s, %s, %u, %u, %u, %s);\n", A, B, Left.Dimensions[0],
+                Left.Dimensions[1], Right.Dimensions[1], Out);
+    }
+    break;
+    case NFNN_OP_TYPE_BROADCAST_ADD: {
+        fprintf(File, "    NfNN_Predict_BroadcastAdd(%s, %u, %u, %s, %u, %u, %s);\n", A, Left.Dimensions[0],
+                Left.Dimensions[1], B, Right.Dimensions[0], Right.Dimensions[1], Out);
+    }
+    break;
+    case NFNN_OP_TYPE_ADD:
+    case NFNN_OP_TYPE_SUB:
+    case NFNN_OP_TYPE_MUL: {
+        char *Kernel = T->Op.Type == NFNN_OP_TYPE_ADD ? "Add" : T->Op.Type == NFNN_OP_TYPE_SUB ? "Sub" : "Mul";
+        fprintf(File, "    NfNN_Predict_%s(%s, %s, %u, %s);\n", Kernel, A, B, Length, Out);
+    }
+    break;
+    case NFNN_OP_TYPE_MUL_CONST: {
+        fprintf(File, "    NfNN_Predict_MulConst(%s, %af, %u, %s);\n", A, T->Op.Constant.ConstantInputf32, Length, Out);
+    }
+    break;
+    case NFNN_OP_TYPE_COPY:
+    case NFNN_OP_TYPE_RESHAPE:
+    case NFNN_OP_TYPE_RELU:
+    case NFNN_OP_TYPE_SIGMOID:
+    case NFNN_OP_TYPE_TANH:
+    case NFNN_OP_TYPE_SQUARE: {
+        char *Kernel = "Copy";
+        switch (T->Op.Type)
+        {
+        case NFNN_OP_TYPE_RELU: {
+            Kernel = "ReLU";
+        }
+        break;
+        case NFNN_OP_TYPE_SIGMOID: {
+            Kernel = "Sigmoid";
+        }
+        break;
+        case NFNN_OP_TYPE_TANH: {
+            Kernel = "Tanh";
+        }
+        break;
+        case NFNN_OP_TYPE_SQUARE: {
+            Kernel = "Square";
+        }
+        break;
+        default: {
+        }
+        break;
+        }
+        fprintf(File, "    NfNN_Predict_%s(%s, %u, %s);\n", Kernel, A, Length, Out);
+    }
+    break;
+    case NFNN_OP_TYPE_LOG_SOFTMAX:
+    case NFNN_OP_TYPE_ARGMAX: {
+        Result = T->Op.Dimensional.Dim == 1;
+        fprintf(File, "    NfNN_Predict_%s(%s, %u, %u, %s);\n",
+                T->Op.Type == NFNN_OP_TYPE_ARGMAX ? "Argmax" : "LogSoftmax", A, Left.Dimensions[0], Left.Dimensions[1],
+                Out);
+    }
+    break;
+    default: {
+        Result = false;
+    }
+    break;
+    }
+    return Result;
+}
+
+// NOTE(luatil): Graph must not have been fused, Input is the leaf fed at prediction time
+// and Graph->Loss is the output
+static nfnn_export_stats NfNN_Export_C(nfnn_graph *Graph, nfnn_tensor *Input, char *Name, char *Path)
+{
+    nfnn_export_stats Result = {0};
+
+    FILE *File = fopen(Path, "wb");
+    if (!File)
+    {
+        fprintf(stderr, "NfNN_Export_C: Could not open %s\n", Path);
+        return Result;
+    }
+
+    nfnn_export_context Context = {File, Name, Input, Graph};
+    nfnn_tensor *Output = Graph->Loss;
+
+    fprintf(File, "// Generated by nfnn_export.h, forward pass of %s\n", Name);
+    fprintf(File, "// Input (%u, %u), Output (%u, %u)\n\n", Input->Dimensions.Dimensions[0],
+            Input->Dimensions.Dimensions[1], Output->Dimensions.Dimensions[0], Output->Dimensions.Dimensions[1]);
+    fputs(NfNN_Export_Kernels, File);
+
+    // NOTE(luatil): Weights first, then the intermediates, then one call per node
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        nfnn_tensor *T = Graph->Nodes[Index].Tensor;
+        NFNN_ASSERT(!Graph->Nodes[Index].Fusion, "NfNN_Export_C: Export the graph before NfNN_Graph_Fuse");
+        for (u32 Slot = 0; Slot < NfNN_Op_InputCount(T->Op.Type); Slot++)
+        {
+            nfnn_tensor *In = T->Op.Inputs[Slot];
+            u32 FirstNode = 0;
+            u32 FirstSlot = 0;
+            if (In->Op.Type == NFNN_OP_TYPE_LEAF && In != Input &&
+                NfNN_Export_FirstUse(Graph, In, &FirstNode, &FirstSlot) && FirstNode == Index && FirstSlot == Slot)
+            {
+                NfNN_Export_Weights(&Context, In, &Result);
+            }
+        }
+    }
+
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        nfnn_tensor *T = Graph->Nodes[Index].Tensor;
+        if (T != Output)
+        {
+            fprintf(File, "static float %s_T%u[%u] NFNN_PREDICT_ALIGN;\n", Name, Index, NfNN_Length(T));
+        }
+    }
+
+    fprintf(File, "\nvoid %s_Predict(const float *Input, float *Output)\n{\n", Name);
+    bool Supported = true;
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        nfnn_tensor *T = Graph->Nodes[Index].Tensor;
+        if (!NfNN_Export_Node(&Context, T))
+        {
+            fprintf(stderr, "NfNN_Export_C: Operation %d of node %u has no exported kernel\n", T->Op.Type, Index);
+            Supported = false;
+        }
+    }
+    fprintf(File, "}\n");
+    fclose(File);
+
+    Result.Written = Supported;
+    Result.NodeCount = Graph->NodeCount;
+    return Result;
+}
+
+#if !defined(_WIN32)
+typedef void nfnn_export_predict(const f32 *Input, f32 *Output);
+
+// NOTE(luatil): Builds the exported file as a shared object, runs it on the current data of
+// Input and returns the largest absolute difference from the library forward, or -1 if it
+// could not be built
+static f32 NfNN_Export_Validate(nfnn_graph *Graph, nfnn_tensor *Input, char *Name, char *Path)
+{
+    char ObjectPath[1024];
+    char Symbol[256];
+    // NOTE(luatil): dlopen only looks in the current directory for paths with a slash
+    snprintf(ObjectPath, sizeof(ObjectPath), "%s%s.so", strchr(Path, '/') ? "" : "./", Path);
+    snprintf(Symbol, sizeof(Symbol), "%s_Predict", Name);
+
+    void *Library = NfNN_Jit_Build(Path, ObjectPath) ? dlopen(ObjectPath, RTLD_NOW | RTLD_LOCAL) : 0;
+    nfnn_export_predict *Predict = Library ? (nfnn_export_predict *)dlsym(Library, Symbol) : 0;
+    if (!Predict)
+    {
+        fprintf(stderr, "NfNN_Export_Validate: Could not build %s\n", Path);
+        return -1.0f;
+    }
+
+    nfnn_tensor *Output = Graph->Loss;
+    f32 *Predicted = (f32 *)malloc(NfNN_Size(Output));
+    Predict(Input->Data, Predicted);
+    NfNN_Graph_Forward(Graph);
+
+    f32 Result = 0.0f;
+    for (u32 Index = 0; Index < NfNN_Length(Output); Index++)
+    {
+        Result = NFNN_MAX(Result, NfNN_Math_Single_Abs_f32(Predicted[Index] - Output->Data[Index]));
+    }
+
+    free(Predicted);
+    dlclose(Library);
+    return Result;
+}
+#endif
+
+#endif // NFNN_EXPORT_H
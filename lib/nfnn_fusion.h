@@ -0,0 +1,413 @@
+#ifndef NFNN_FUSION_H
+#define NFNN_FUSION_H
+
+#include "nfnn_macro.h"
+#include "nfnn_math.h"
+#include "nfnn_tensor.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): A chain of elementwise ops run as one loop. Elements are processed
+// in tiles small enough to stay in L1, intermediates only ever live in those tiles,
+// so memory sees one read of each input and one write of the output per element.
+// Backward recomputes the intermediates from the chain input instead of saving them.
+
+#define NFNN_FUSION_MAX_OPS 8
+#define NFNN_FUSION_TILE 256
+
+typedef enum nfnn_micro_type nfnn_micro_type;
+enum nfnn_micro_type
+{
+    NFNN_MICRO_COPY,
+    NFNN_MICRO_ADD,
+    NFNN_MICRO_SUB,
+    NFNN_MICRO_RSUB, // Side - X
+    NFNN_MICRO_MUL,
+    NFNN_MICRO_MUL_CONST,
+    NFNN_MICRO_SIGMOID,
+    NFNN_MICRO_RELU,
+    NFNN_MICRO_TANH,
+    NFNN_MICRO_SQUARE,
+    NFNN_MICRO_COUNT
+};
+
+// NOTE(luatil): Y = f(X, Side). Backward writes G * dY/dX into DX (may alias G)
+// and G * dY/dSide into DSide when it is not 0.
+typedef void nfnn_micro_forward(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y);
+typedef void nfnn_micro_backward(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide);
+
+static void NfNN_Micro_Copy(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = X[I];
+    }
+}
+
+static void NfNN_Micro_CopyD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        DX[I] = G[I];
+    }
+}
+
+static void NfNN_Micro_Add(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = X[I] + Side[I];
+    }
+}
+
+static void NfNN_Micro_AddD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    if (DSide)
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DSide[I] = Grad;
+            DX[I] = Grad;
+        }
+    }
+    else
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DX[I] = Grad;
+        }
+    }
+}
+
+static void NfNN_Micro_Sub(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = X[I] - Side[I];
+    }
+}
+
+static void NfNN_Micro_SubD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    if (DSide)
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DSide[I] = -Grad;
+            DX[I] = Grad;
+        }
+    }
+    else
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DX[I] = Grad;
+        }
+    }
+}
+
+static void NfNN_Micro_RSub(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = Side[I] - X[I];
+    }
+}
+
+static void NfNN_Micro_RSubD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    if (DSide)
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DSide[I] = Grad;
+            DX[I] = -Grad;
+        }
+    }
+    else
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DX[I] = -Grad;
+        }
+    }
+}
+
+static void NfNN_Micro_Mul(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = X[I] * Side[I];
+    }
+}
+
+static void NfNN_Micro_MulD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    if (DSide)
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DSide[I] = Grad * X[I];
+            DX[I] = Grad * Side[I];
+        }
+    }
+    else
+    {
+        for (u32 I = 0; I < N; I++)
+        {
+            f32 Grad = G[I];
+            DX[I] = Grad * Side[I];
+        }
+    }
+}
+
+static void NfNN_Micro_MulConst(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = X[I] * Constant;
+    }
+}
+
+static void NfNN_Micro_MulConstD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        DX[I] = G[I] * Constant;
+    }
+}
+
+static void NfNN_Micro_Sigmoid(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    NfNN_Math_Sigmoid_f32(X, N, Y);
+}
+
+static void NfNN_Micro_SigmoidD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        DX[I] = G[I] * Y[I] * (1.0f - Y[I]);
+    }
+}
+
+static void NfNN_Micro_ReLU(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = X[I] > 0.0f ? X[I] : 0.0f;
+    }
+}
+
+static void NfNN_Micro_ReLUD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        // NOTE(luatil): Load G unconditionally so this is a select and not a branch
+        f32 Grad = G[I];
+        DX[I] = X[I] > 0.0f ? Grad : 0.0f;
+    }
+}
+
+static void NfNN_Micro_Tanh(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    NfNN_Math_Tanh_f32(X, N, Y);
+}
+
+static void NfNN_Micro_TanhD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        DX[I] = G[I] * (1.0f - Y[I] * Y[I]);
+    }
+}
+
+static void NfNN_Micro_Square(f32 *X, f32 *Side, f32 Constant, u32 N, f32 *Y)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Y[I] = X[I] * X[I];
+    }
+}
+
+static void NfNN_Micro_SquareD(f32 *G, f32 *X, f32 *Y, f32 *Side, f32 Constant, u32 N, f32 *DX, f32 *DSide)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        DX[I] = 2.0f * G[I] * X[I];
+    }
+}
+
+typedef struct nfnn_micro_kernel nfnn_micro_kernel;
+struct nfnn_micro_kernel
+{
+    nfnn_micro_forward *Forward;
+    nfnn_micro_backward *Backward;
+    bool Expensive; // Not worth recomputing in backward, chains end here
+};
+
+static nfnn_micro_kernel NfNN_Micro_Kernels[NFNN_MICRO_COUNT] = {
+    [NFNN_MICRO_COPY] = {NfNN_Micro_Copy, NfNN_Micro_CopyD},
+    [NFNN_MICRO_ADD] = {NfNN_Micro_Add, NfNN_Micro_AddD},
+    [NFNN_MICRO_SUB] = {NfNN_Micro_Sub, NfNN_Micro_SubD},
+    [NFNN_MICRO_RSUB] = {NfNN_Micro_RSub, NfNN_Micro_RSubD},
+    [NFNN_MICRO_MUL] = {NfNN_Micro_Mul, NfNN_Micro_MulD},
+    [NFNN_MICRO_MUL_CONST] = {NfNN_Micro_MulConst, NfNN_Micro_MulConstD},
+    [NFNN_MICRO_SIGMOID] = {NfNN_Micro_Sigmoid, NfNN_Micro_SigmoidD, true},
+    [NFNN_MICRO_RELU] = {NfNN_Micro_ReLU, NfNN_Micro_ReLUD},
+    [NFNN_MICRO_TANH] = {NfNN_Micro_Tanh, NfNN_Micro_TanhD, true},
+    [NFNN_MICRO_SQUARE] = {NfNN_Micro_Square, NfNN_Micro_SquareD},
+};
+
+typedef struct nfnn_fusion_op nfnn_fusion_op;
+struct nfnn_fusion_op
+{
+    nfnn_micro_type Type;
+    nfnn_tensor *Side;   // Second operand, 0 for unary ops
+    bool Broadcast;      // Side is broadcast over Dimensions (BroadcastAdd)
+    nfnn_dim Dimensions; // Shape of the op result
+    f32 Constant;
+};
+
+typedef struct nfnn_fusion nfnn_fusion;
+struct nfnn_fusion
+{
+    nfnn_tensor *Input;  // Chain operand of the first op
+    nfnn_tensor *Output; // Result of the last op, the only tensor written
+    u32 OpCount;
+    nfnn_fusion_op Ops[NFNN_FUSION_MAX_OPS];
+};
+
+// NOTE(luatil): Walks the elements [Start, Start + N) of Op->Dimensions and calls
+// _Body with the matching Index into the broadcast side operand
+#define NFNN_FUSION_BROADCAST_LOOP(_Op, _Start, _N, _Body)                                                             \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        u32 _Cols = (_Op)->Dimensions.Dimensions[1];                                                                   \
+        u32 _SideCols = (_Op)->Side->Dimensions.Dimensions[1];                                                         \
+        bool _SideRows = (_Op)->Side->Dimensions.Dimensions[0] != 1;                                                   \
+        u32 _Row = (_Start) / _Cols;                                                                                   \
+        u32 _Col = (_Start) % _Cols;                                                                                   \
+        for (u32 I = 0; I < (_N); I++)                                                                                 \
+        {                                                                                                              \
+            u32 Index = (_SideRows ? _Row * _SideCols : 0) + (_SideCols == 1 ? 0 : _Col);                              \
+            _Body;                                                                                                     \
+            if (++_Col == _Cols)                                                                                       \
+            {                                                                                                          \
+                _Col = 0;                                                                                              \
+                _Row++;                                                                                                \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+// NOTE(luatil): Points into the side operand directly unless it is broadcast,
+// then it is gathered into Tile
+static f32 *NfNN_Fusion_Side(nfnn_fusion_op *Op, u32 Start, u32 N, f32 *Tile)
+{
+    f32 *Result = 0;
+    if (Op->Side && Op->Broadcast)
+    {
+        f32 *Data = Op->Side->Data;
+        NFNN_FUSION_BROADCAST_LOOP(Op, Start, N, Tile[I] = Data[Index]);
+        Result = Tile;
+    }
+    else if (Op->Side)
+    {
+        Result = Op->Side->Data + Start;
+    }
+    return Result;
+}
+
+static void NfNN_Fusion_SideGradient(nfnn_fusion_op *Op, u32 Start, u32 N, f32 *DSide)
+{
+    if (Op->Broadcast)
+    {
+        f32 *Gradient = Op->Side->Gradient;
+        NFNN_FUSION_BROADCAST_LOOP(Op, Start, N, Gradient[Index] += DSide[I]);
+    }
+    else
+    {
+        NfNN_Math_FmaddConst_f32(DSide, 1.0f, N, Op->Side->Gradient + Start);
+    }
+}
+
+static void NfNN_Fusion_Forward(nfnn_fusion *Fusion)
+{
+    f32 Tiles[2][NFNN_FUSION_TILE];
+    f32 SideTile[NFNN_FUSION_TILE];
+
+    u32 Length = NfNN_Length(Fusion->Output);
+    for (u32 Start = 0; Start < Length; Start += NFNN_FUSION_TILE)
+    {
+        u32 N = NFNN_MIN(NFNN_FUSION_TILE, Length - Start);
+        f32 *X = Fusion->Input->Data + Start;
+        for (u32 OpIndex = 0; OpIndex < Fusion->OpCount; OpIndex++)
+        {
+            nfnn_fusion_op *Op = Fusion->Ops + OpIndex;
+            f32 *Y = OpIndex + 1 == Fusion->OpCount ? Fusion->Output->Data + Start : Tiles[OpIndex & 1];
+            f32 *Side = NfNN_Fusion_Side(Op, Start, N, SideTile);
+            NfNN_Micro_Kernels[Op->Type].Forward(X, Side, Op->Constant, N, Y);
+            X = Y;
+        }
+    }
+}
+
+static void NfNN_Fusion_Backward(nfnn_fusion *Fusion)
+{
+    if (!Fusion->Output->RequiresGrad)
+    {
+        return;
+    }
+
+    f32 Values[NFNN_FUSION_MAX_OPS - 1][NFNN_FUSION_TILE];
+    f32 SideTile[NFNN_FUSION_TILE];
+    f32 DSide[NFNN_FUSION_TILE];
+    f32 G[NFNN_FUSION_TILE];
+    f32 *V[NFNN_FUSION_MAX_OPS + 1];
+
+    bool InputNeedsGrad = Fusion->Input->RequiresGrad;
+
+    u32 Length = NfNN_Length(Fusion->Output);
+    for (u32 Start = 0; Start < Length; Start += NFNN_FUSION_TILE)
+    {
+        u32 N = NFNN_MIN(NFNN_FUSION_TILE, Length - Start);
+
+        // NOTE(luatil): Recompute the intermediates of this tile
+        V[0] = Fusion->Input->Data + Start;
+        V[Fusion->OpCount] = Fusion->Output->Data + Start;
+        for (u32 OpIndex = 0; OpIndex + 1 < Fusion->OpCount; OpIndex++)
+        {
+            nfnn_fusion_op *Op = Fusion->Ops + OpIndex;
+            V[OpIndex + 1] = Values[OpIndex];
+            f32 *Side = NfNN_Fusion_Side(Op, Start, N, SideTile);
+            NfNN_Micro_Kernels[Op->Type].Forward(V[OpIndex], Side, Op->Constant, N, V[OpIndex + 1]);
+        }
+
+        NfNN_MemoryCopy(G, Fusion->Output->Gradient + Start, N * sizeof(f32));
+
+        for (u32 OpIndex = Fusion->OpCount; OpIndex-- > 0;)
+        {
+            nfnn_fusion_op *Op = Fusion->Ops + OpIndex;
+            f32 *Side = NfNN_Fusion_Side(Op, Start, N, SideTile);
+            bool SideNeedsGrad = Op->Side && Op->Side->RequiresGrad;
+            NfNN_Micro_Kernels[Op->Type].Backward(G, V[OpIndex], V[OpIndex + 1], Side, Op->Constant, N, G,
+                                                  SideNeedsGrad ? DSide : 0);
+            if (SideNeedsGrad)
+            {
+                NfNN_Fusion_SideGradient(Op, Start, N, DSide);
+            }
+        }
+
+        if (InputNeedsGrad)
+        {
+            NfNN_Math_FmaddConst_f32(G, 1.0f, N, Fusion->Input->Gradient + Start);
+        }
+    }
+}
+
+#endif // NFNN_FUSION_H
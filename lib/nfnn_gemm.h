@@ -0,0 +1,282 @@
+#ifndef NFNN_GEMM_H
+#define NFNN_GEMM_H
+
+#include "nfnn_macro.h"
+#include "nfnn_thread.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): How each GEMM shape is run. The MatMul dispatchers in nfnn_math.h look the
+// shape up here and fall back to the specialized or generic kernels when it was never tuned,
+// see nfnn_autotune.h for filling the table.
+
+typedef enum nfnn_gemm_kernel
+{
+    NFNN_GEMM_MATMUL,                // Out = A @ B with (RowsA, ColumnsA, ColumnsB)
+    NFNN_GEMM_ADD_TRANSPOSE_RIGHT,   // C += A @ B^T with (L, M, R)
+    NFNN_GEMM_ADD_TRANSPOSE_LEFT,    // C += A^T @ B with (L, M, R)
+    NFNN_GEMM_KERNEL_COUNT
+} nfnn_gemm_kernel;
+
+typedef enum nfnn_gemm_kind
+{
+    NFNN_GEMM_KIND_SPECIALIZED, // Instance from NFNN_MATMUL_SHAPES if there is one, otherwise generic
+    NFNN_GEMM_KIND_GENERIC,
+    NFNN_GEMM_KIND_BLOCKED,
+    NFNN_GEMM_KIND_COUNT
+} nfnn_gemm_kind;
+
+typedef struct nfnn_gemm_config nfnn_gemm_config;
+struct nfnn_gemm_config
+{
+    nfnn_gemm_kind Kind;
+    u32 BlockRows; // Rows of the output per block
+    u32 BlockInner;
+    u32 BlockColumns;
+    u32 Threads; // Output rows are split evenly, 1 runs on the calling thread
+};
+
+typedef struct nfnn_gemm_entry nfnn_gemm_entry;
+struct nfnn_gemm_entry
+{
+    nfnn_gemm_kernel Kernel;
+    u32 Dimensions[3];
+    nfnn_gemm_config Config;
+    bool Tuned;
+};
+
+#define NFNN_GEMM_MAX_ENTRIES 64
+
+typedef struct nfnn_gemm_state nfnn_gemm_state;
+struct nfnn_gemm_state
+{
+    u32 EntryCount;
+    nfnn_gemm_entry Entries[NFNN_GEMM_MAX_ENTRIES];
+    bool Recording; // Add every shape that is run to the table
+    u32 Lock;
+    nfnn_thread_pool *Pool;
+};
+
+static nfnn_gemm_state NfNN_Gemm;
+
+// NOTE(luatil): The pool is only used while it is idle, a GEMM that runs inside one of its
+// jobs stays on the calling thread
+static void NfNN_Gemm_SetThreadPool(nfnn_thread_pool *Pool)
+{
+    NfNN_Gemm.Pool = Pool;
+}
+
+// NOTE(luatil): Entries are written before the count that publishes them, a reader never sees a
+// half-filled one
+static nfnn_gemm_entry *NfNN_Gemm_Find(nfnn_gemm_kernel Kernel, u32 D0, u32 D1, u32 D2)
+{
+    u32 Count = NFNN_ATOMIC_LOAD_U32(&NfNN_Gemm.EntryCount);
+    for (u32 Index = 0; Index < Count; Index++)
+    {
+        nfnn_gemm_entry *Entry = NfNN_Gemm.Entries + Index;
+        if (Entry->Kernel == Kernel && Entry->Dimensions[0] == D0 && Entry->Dimensions[1] == D1 &&
+            Entry->Dimensions[2] == D2)
+        {
+            return Entry;
+        }
+    }
+    return 0;
+}
+
+static nfnn_gemm_entry *NfNN_Gemm_Add(nfnn_gemm_kernel Kernel, u32 D0, u32 D1, u32 D2)
+{
+    nfnn_gemm_entry *Result = NfNN_Gemm_Find(Kernel, D0, D1, D2);
+    if (!Result && NfNN_Gemm.EntryCount < NFNN_GEMM_MAX_ENTRIES)
+    {
+        Result = NfNN_Gemm.Entries + NfNN_Gemm.EntryCount;
+        memset(Result, 0, sizeof(nfnn_gemm_entry));
+        Result->Kernel = Kernel;
+        Result->Dimensions[0] = D0;
+        Result->Dimensions[1] = D1;
+        Result->Dimensions[2] = D2;
+        Result->Config.Threads = 1;
+        NFNN_ATOMIC_STORE_U32(&NfNN_Gemm.EntryCount, NfNN_Gemm.EntryCount + 1);
+    }
+    return Result;
+}
+
+// NOTE(luatil): While recording, GEMMs running on other threads (a parallel backward) may add
+// shapes, the lookup and the add happen under the lock so two threads never add the same one
+static nfnn_gemm_config NfNN_Gemm_Choose(nfnn_gemm_kernel Kernel, u32 D0, u32 D1, u32 D2)
+{
+    nfnn_gemm_config Result = {NFNN_GEMM_KIND_SPECIALIZED, 0, 0, 0, 1};
+
+    nfnn_gemm_entry *Entry = 0;
+    if (NfNN_Gemm.Recording)
+    {
+        while (!NFNN_ATOMIC_TRY_LOCK(&NfNN_Gemm.Lock))
+        {
+        }
+        Entry = NfNN_Gemm_Add(Kernel, D0, D1, D2);
+        NFNN_ATOMIC_UNLOCK(&NfNN_Gemm.Lock);
+    }
+    else
+    {
+        Entry = NfNN_Gemm_Find(Kernel, D0, D1, D2);
+    }
+
+    if (Entry && Entry->Tuned)
+    {
+        Result = Entry->Config;
+    }
+    return Result;
+}
+
+typedef struct nfnn_gemm_work nfnn_gemm_work;
+struct nfnn_gemm_work
+{
+    nfnn_gemm_kernel Kernel;
+    f32 *A;
+    f32 *B;
+    u32 Dimensions[3];
+    f32 *Out;
+    nfnn_gemm_config Config;
+    u32 Rows; // Of the output
+};
+
+static void NfNN_Gemm_BlockedRows(nfnn_gemm_work *Work, u32 RowStart, u32 RowEnd)
+{
+    f32 *A = Work->A;
+    f32 *B = Work->B;
+    f32 *Out = Work->Out;
+    u32 BR = Work->Config.BlockRows;
+    u32 BK = Work->Config.BlockInner;
+    u32 BN = Work->Config.BlockColumns;
+
+    switch (Work->Kernel)
+    {
+    case NFNN_GEMM_MATMUL: {
+        u32 K = Work->Dimensions[1];
+        u32 N = Work->Dimensions[2];
+        memset(Out + RowStart * N, 0, (RowEnd - RowStart) * N * sizeof(f32));
+        for (u32 I0 = RowStart; I0 < RowEnd; I0 += BR)
+        {
+            u32 I1 = NFNN_MIN(I0 + BR, RowEnd);
+            for (u32 K0 = 0; K0 < K; K0 += BK)
+            {
+                u32 K1 = NFNN_MIN(K0 + BK, K);
+                for (u32 J0 = 0; J0 < N; J0 += BN)
+                {
+                    u32 J1 = NFNN_MIN(J0 + BN, N);
+                    for (u32 I = I0; I < I1; I++)
+                    {
+                        for (u32 P = K0; P < K1; P++)
+                        {
+                            f32 Value = A[I * K + P];
+                            for (u32 J = J0; J < J1; J++)
+                            {
+                                Out[I * N + J] += Value * B[P * N + J];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    break;
+    case NFNN_GEMM_ADD_TRANSPOSE_RIGHT: {
+        // NOTE(luatil): C(L, R) += A(L, M) @ B(R, M)^T
+        u32 M = Work->Dimensions[1];
+        u32 R = Work->Dimensions[2];
+        for (u32 I0 = RowStart; I0 < RowEnd; I0 += BR)
+        {
+            u32 I1 = NFNN_MIN(I0 + BR, RowEnd);
+            for (u32 J0 = 0; J0 < R; J0 += BN)
+            {
+                u32 J1 = NFNN_MIN(J0 + BN, R);
+                for (u32 K0 = 0; K0 < M; K0 += BK)
+                {
+                    u32 K1 = NFNN_MIN(K0 + BK, M);
+                    for (u32 I = I0; I < I1; I++)
+                    {
+                        for (u32 J = J0; J < J1; J++)
+                        {
+                            f32 Sum = 0.0f;
+                            for (u32 P = K0; P < K1; P++)
+                            {
+                                Sum += A[I * M + P] * B[J * M + P];
+                            }
+                            Out[I * R + J] += Sum;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    break;
+    case NFNN_GEMM_ADD_TRANSPOSE_LEFT: {
+        // NOTE(luatil): C(M, R) += A(L, M)^T @ B(L, R)
+        u32 L = Work->Dimensions[0];
+        u32 M = Work->Dimensions[1];
+        u32 R = Work->Dimensions[2];
+        for (u32 I0 = RowStart; I0 < RowEnd; I0 += BR)
+        {
+            u32 I1 = NFNN_MIN(I0 + BR, RowEnd);
+            for (u32 K0 = 0; K0 < L; K0 += BK)
+            {
+                u32 K1 = NFNN_MIN(K0 + BK, L);
+                for (u32 J0 = 0; J0 < R; J0 += BN)
+                {
+                    u32 J1 = NFNN_MIN(J0 + BN, R);
+                    for (u32 I = I0; I < I1; I++)
+                    {
+                        for (u32 P = K0; P < K1; P++)
+                        {
+                            f32 Value = A[P * M + I];
+                            for (u32 J = J0; J < J1; J++)
+                            {
+                                Out[I * R + J] += Value * B[P * R + J];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    break;
+    case NFNN_GEMM_KERNEL_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+}
+
+static void NfNN_Gemm_BlockedJob(nfnn_thread_pool *Pool, u32 Worker, void *Context, u32 Item)
+{
+    nfnn_gemm_work *Work = (nfnn_gemm_work *)Context;
+    u32 Threads = Work->Config.Threads;
+    NfNN_Gemm_BlockedRows(Work, Item * Work->Rows / Threads, (Item + 1) * Work->Rows / Threads);
+}
+
+// NOTE(luatil): Each thread owns a contiguous range of output rows, so the result does not
+// depend on the thread count
+static void NfNN_Gemm_Blocked(nfnn_gemm_kernel Kernel, f32 *A, f32 *B, u32 D0, u32 D1, u32 D2, f32 *Out,
+                              nfnn_gemm_config Config)
+{
+    nfnn_gemm_work Work = {Kernel, A, B, {D0, D1, D2}, Out, Config, Kernel == NFNN_GEMM_ADD_TRANSPOSE_LEFT ? D1 : D0};
+    nfnn_thread_pool *Pool = NfNN_Gemm.Pool;
+
+    Work.Config.Threads = NFNN_MAX(1, NFNN_MIN(Config.Threads, Work.Rows));
+    bool Ran = false;
+    if (Pool && Work.Config.Threads > 1)
+    {
+        u32 Items[64];
+        Work.Config.Threads = NFNN_MIN(Work.Config.Threads, NFNN_MIN(Pool->ThreadCount, 64));
+        for (u32 Index = 0; Index < Work.Config.Threads; Index++)
+        {
+            Items[Index] = Index;
+        }
+        Ran = NfNN_ThreadPool_TryRun(Pool, NfNN_Gemm_BlockedJob, &Work, Items, Work.Config.Threads);
+    }
+    if (!Ran)
+    {
+        NfNN_Gemm_BlockedRows(&Work, 0, Work.Rows);
+    }
+}
+
+#endif // NFNN_GEMM_H
@@ -0,0 +1,446 @@
+#ifndef NFNN_GRAPH_H
+#define NFNN_GRAPH_H
+
+#include "nfnn_autograd.h"
+#include "nfnn_fusion.h"
+#include "nfnn_intern.h"
+#include "nfnn_macro.h"
+#include "nfnn_memory_arena.h"
+#include "nfnn_ops.h"
+#include "nfnn_optimizer.h"
+#include "nfnn_tensor.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): A captured training step. The first step runs eagerly while the
+// tape records it, after that the same kernels are replayed on the same buffers
+// without building tensors, walking the tape or looking at shapes again.
+//
+// Usage:
+//   nfnn_graph *Graph = NfNN_Graph_BeginCapture(&Mem_T);
+//   ... forward, NfNN_AutoGrad_Backward, NfNN_Optimizer_Step as usual ...
+//   NfNN_Graph_EndCapture(Graph, Loss, Optimizer);
+//   for (...) { copy the next batch into the input leaves; NfNN_Graph_Replay(Graph); }
+//
+// Mem_T must not be cleared while the graph is in use, shapes are fixed at capture time.
+// Ops repeated during the capture become one node, see nfnn_intern.h.
+
+// NOTE(luatil): Kernels generated for one node with its shapes baked in, they read
+// the buffers of the node from Buffers (see nfnn_jit.h)
+typedef void nfnn_graph_kernel(f32 **Buffers);
+
+typedef struct nfnn_graph_node nfnn_graph_node;
+struct nfnn_graph_node
+{
+    nfnn_tensor *Tensor;
+    nfnn_op_kernel *Forward;
+    nfnn_op_kernel *Backward; // 0 if nothing upstream needs a gradient
+    nfnn_fusion *Fusion;      // Replaces Forward/Backward after NfNN_Graph_Fuse
+    nfnn_graph_kernel *SpecializedForward;  // Replaces all of the above when set
+    nfnn_graph_kernel *SpecializedBackward;
+    f32 **Buffers;
+};
+
+typedef struct nfnn_graph nfnn_graph;
+struct nfnn_graph
+{
+    nfnn_memory_arena *Mem;
+    u32 TapeStart;
+
+    nfnn_graph_node *Nodes; // Topological order
+    u32 NodeCount;
+
+    f32 **Gradients; // Every gradient backward accumulates into, those of leaves first
+    u32 *GradientSizes;
+    u32 GradientCount;
+    u32 LeafGradientCount;
+    u32 GradientCapacity;
+
+    nfnn_tensor *Loss;
+    nfnn_optimizer *Optimizer;
+
+    nfnn_intern *Intern; // Repeated ops folded while capturing
+};
+
+static nfnn_graph *NfNN_Graph_BeginCapture(nfnn_memory_arena *Mem)
+{
+    nfnn_graph *Result = NfNN_PushStruct(Mem, nfnn_graph);
+    Result->Mem = Mem;
+    Result->TapeStart = Mem->TapeCount;
+    NfNN_Intern_Begin(Mem);
+    Result->Intern = Mem->Intern;
+    return Result;
+}
+
+static void NfNN_Graph_AddGradient(nfnn_graph *Graph, nfnn_tensor *T)
+{
+    NFNN_ASSERT(Graph->GradientCount < Graph->GradientCapacity, "NfNN_Graph_AddGradient: Out of space");
+    Graph->Gradients[Graph->GradientCount] = T->Gradient;
+    Graph->GradientSizes[Graph->GradientCount] = NfNN_Size(T);
+    Graph->GradientCount++;
+}
+
+static u32 NfNN_Graph_NodeInputs(nfnn_graph_node *Node, nfnn_tensor **Inputs)
+{
+    u32 Result = 0;
+    if (Node->Fusion)
+    {
+        Inputs[Result++] = Node->Fusion->Input;
+        for (u32 OpIndex = 0; OpIndex < Node->Fusion->OpCount; OpIndex++)
+        {
+            if (Node->Fusion->Ops[OpIndex].Side)
+            {
+                Inputs[Result++] = Node->Fusion->Ops[OpIndex].Side;
+            }
+        }
+    }
+    else
+    {
+        for (u32 Input = 0; Input < NfNN_Op_InputCount(Node->Tensor->Op.Type); Input++)
+        {
+            Inputs[Result++] = Node->Tensor->Op.Inputs[Input];
+        }
+    }
+    return Result;
+}
+
+// NOTE(luatil): Gradients of the nodes plus those of the leaves they read, each once
+static void NfNN_Graph_CollectGradients(nfnn_graph *Graph)
+{
+    nfnn_tensor *Inputs[NFNN_FUSION_MAX_OPS + 1];
+
+    Graph->GradientCount = 0;
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        u32 InputCount = NfNN_Graph_NodeInputs(Graph->Nodes + Index, Inputs);
+        for (u32 Input = 0; Input < InputCount; Input++)
+        {
+            nfnn_tensor *In = Inputs[Input];
+            if (NfNN_Tape_Contains(Graph->Mem, In) || !In->RequiresGrad)
+            {
+                continue;
+            }
+
+            bool Found = false;
+            for (u32 Leaf = 0; Leaf < Graph->GradientCount; Leaf++)
+            {
+                if (Graph->Gradients[Leaf] == In->Gradient)
+                {
+                    Found = true;
+                    break;
+                }
+            }
+            if (!Found)
+            {
+                NfNN_Graph_AddGradient(Graph, In);
+            }
+        }
+    }
+
+    Graph->LeafGradientCount = Graph->GradientCount;
+
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        if (Graph->Nodes[Index].Tensor->RequiresGrad)
+        {
+            NfNN_Graph_AddGradient(Graph, Graph->Nodes[Index].Tensor);
+        }
+    }
+}
+
+static void NfNN_Graph_EndCapture(nfnn_graph *Graph, nfnn_tensor *Loss, nfnn_optimizer *Optimizer)
+{
+    nfnn_memory_arena *Mem = Graph->Mem;
+
+    NFNN_ASSERT(NfNN_Tape_Contains(Mem, Loss) && Loss->TapeIndex >= Graph->TapeStart,
+                "NfNN_Graph_EndCapture: Loss was not computed during the capture");
+
+    Graph->Loss = Loss;
+    Graph->Optimizer = Optimizer;
+    NfNN_Intern_End(Mem);
+
+    // NOTE(luatil): A lazy capture still leaves every node computed once
+    NfNN_Realize(Loss);
+
+    // NOTE(luatil): Forward needs every node the loss depends on, not only the ones with a gradient
+    u8 *Live = NfNN_Tape_MarkLive(Mem, Loss, false);
+
+    u32 MaxNodes = Loss->TapeIndex + 1 - Graph->TapeStart;
+    Graph->Nodes = NfNN_PushArray(Mem, nfnn_graph_node, MaxNodes);
+    Graph->GradientCapacity = MaxNodes * (NFNN_MAX_INPUTS + 1);
+    Graph->Gradients = NfNN_PushArray(Mem, f32 *, Graph->GradientCapacity);
+    Graph->GradientSizes = NfNN_PushArray(Mem, u32, Graph->GradientCapacity);
+
+    for (u32 Index = 0; Index <= Loss->TapeIndex; Index++)
+    {
+        if (!Live[Index])
+        {
+            continue;
+        }
+
+        NFNN_ASSERT(Index >= Graph->TapeStart, "NfNN_Graph_EndCapture: Loss depends on an operation before capture");
+
+        nfnn_tensor *It = NfNN_Tape_Get(Mem, Index);
+
+        nfnn_graph_node *Node = Graph->Nodes + Graph->NodeCount++;
+        Node->Tensor = It;
+        Node->Forward = NfNN_Op_ForwardKernel(It);
+        Node->Backward = NfNN_AutoGrad_BackwardKernel(It);
+        Node->Fusion = 0;
+        Node->SpecializedForward = 0;
+        Node->SpecializedBackward = 0;
+        Node->Buffers = 0;
+    }
+
+    NfNN_Graph_CollectGradients(Graph);
+}
+
+// NOTE(luatil): Recomputes every node from the current data of its leaves
+static void NfNN_Graph_Forward(nfnn_graph *Graph)
+{
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        nfnn_graph_node *Node = Graph->Nodes + Index;
+        if (Node->SpecializedForward)
+        {
+            Node->SpecializedForward(Node->Buffers);
+        }
+        else if (Node->Fusion)
+        {
+            NfNN_Fusion_Forward(Node->Fusion);
+        }
+        else
+        {
+            Node->Forward(Node->Tensor);
+        }
+    }
+}
+
+// NOTE(luatil): While accumulating only the first backward since NfNN_AutoGrad_AccumulateBegin
+// clears the gradients of the leaves, every micro-batch has to reach the same leaves
+static void NfNN_Graph_Backward(nfnn_graph *Graph)
+{
+    nfnn_memory_arena *Mem = Graph->Mem;
+    u32 First = Mem->AccumulateEpoch && Mem->AccumulateBackwards > 0 ? Graph->LeafGradientCount : 0;
+    Mem->AccumulateBackwards += Mem->AccumulateEpoch != 0;
+    for (u32 Index = First; Index < Graph->GradientCount; Index++)
+    {
+        memset(Graph->Gradients[Index], 0, Graph->GradientSizes[Index]);
+    }
+
+    if (!Graph->Loss->RequiresGrad)
+    {
+        return;
+    }
+
+    Graph->Loss->Gradient[0] = NfNN_AutoGrad_Seed(Mem);
+
+    for (u32 Index = Graph->NodeCount; Index-- > 0;)
+    {
+        nfnn_graph_node *Node = Graph->Nodes + Index;
+        if (Node->SpecializedBackward)
+        {
+            Node->SpecializedBackward(Node->Buffers);
+        }
+        else if (Node->Fusion)
+        {
+            NfNN_Fusion_Backward(Node->Fusion);
+        }
+        else if (Node->Backward)
+        {
+            // NOTE(luatil): Gradients were zeroed above and fused nodes only accumulate, so the
+            // first writes an eager backward marked on the tape do not apply here
+            Node->Tensor->Op.FirstWrite = 0;
+            Node->Backward(Node->Tensor);
+        }
+    }
+}
+
+// NOTE(luatil): One full training step: forward, backward and the optimizer if one was captured
+static void NfNN_Graph_Replay(nfnn_graph *Graph)
+{
+    NfNN_Graph_Forward(Graph);
+    NfNN_Graph_Backward(Graph);
+    if (Graph->Optimizer)
+    {
+        NfNN_Optimizer_Step(Graph->Optimizer);
+    }
+}
+
+typedef struct nfnn_graph_fusion_stats nfnn_graph_fusion_stats;
+struct nfnn_graph_fusion_stats
+{
+    u32 GroupCount;   // Fused loops created
+    u32 FusedOpCount; // Ops that now run inside a fused loop
+    u64 BytesSaved;   // Memory traffic removed per replayed step
+};
+
+// NOTE(luatil): Describes T as a step of a chain that flows through Chain,
+// returns false if T is not elementwise in Chain
+static bool NfNN_Graph_FusionOp(nfnn_tensor *T, nfnn_tensor *Chain, nfnn_fusion_op *Op)
+{
+    bool Result = true;
+    nfnn_fusion_op Zero = {0};
+    *Op = Zero;
+    Op->Dimensions = T->Dimensions;
+
+    nfnn_tensor *Left = T->Op.Binary.Left;
+    nfnn_tensor *Right = T->Op.Binary.Right;
+    bool Binary = NfNN_Op_InputCount(T->Op.Type) == 2;
+
+    if (Binary && ((Left == Chain) == (Right == Chain)))
+    {
+        return false;
+    }
+    if (!Binary && T->Op.Unary.Input != Chain)
+    {
+        return false;
+    }
+
+    switch (T->Op.Type)
+    {
+    case NFNN_OP_TYPE_COPY:
+    case NFNN_OP_TYPE_RESHAPE: {
+        Op->Type = NFNN_MICRO_COPY;
+    }
+    break;
+    case NFNN_OP_TYPE_SIGMOID: {
+        Op->Type = NFNN_MICRO_SIGMOID;
+    }
+    break;
+    case NFNN_OP_TYPE_RELU: {
+        Op->Type = NFNN_MICRO_RELU;
+    }
+    break;
+    case NFNN_OP_TYPE_TANH: {
+        Op->Type = NFNN_MICRO_TANH;
+    }
+    break;
+    case NFNN_OP_TYPE_SQUARE: {
+        Op->Type = NFNN_MICRO_SQUARE;
+    }
+    break;
+    case NFNN_OP_TYPE_MUL_CONST: {
+        Op->Type = NFNN_MICRO_MUL_CONST;
+        Op->Constant = T->Op.Constant.ConstantInputf32;
+    }
+    break;
+    case NFNN_OP_TYPE_ADD:
+    case NFNN_OP_TYPE_MUL: {
+        Op->Type = T->Op.Type == NFNN_OP_TYPE_ADD ? NFNN_MICRO_ADD : NFNN_MICRO_MUL;
+        Op->Side = Left == Chain ? Right : Left;
+    }
+    break;
+    case NFNN_OP_TYPE_SUB: {
+        Op->Type = Left == Chain ? NFNN_MICRO_SUB : NFNN_MICRO_RSUB;
+        Op->Side = Left == Chain ? Right : Left;
+    }
+    break;
+    case NFNN_OP_TYPE_BROADCAST_ADD: {
+        Op->Type = NFNN_MICRO_ADD;
+        Op->Side = Right;
+        Op->Broadcast = true;
+        Result = Left == Chain;
+    }
+    break;
+    default: {
+        Result = false;
+    }
+    break;
+    }
+    return Result;
+}
+
+// NOTE(luatil): Finds maximal runs of consecutive elementwise nodes where each
+// result is only read by the next one and replaces every run with one fused loop.
+// A run may end at, but not go through, an op that is expensive to recompute.
+// Intermediates of a run are no longer written, only the last result of a run
+// is valid after a replay.
+static nfnn_graph_fusion_stats NfNN_Graph_Fuse(nfnn_graph *Graph)
+{
+    nfnn_graph_fusion_stats Result = {0};
+
+    nfnn_memory_arena *Mem = Graph->Mem;
+    nfnn_tensor *Inputs[NFNN_FUSION_MAX_OPS + 1];
+
+    // NOTE(luatil): How many times each node is read by the graph, the loss counts as read
+    u32 *Uses = NfNN_PushArray(Mem, u32, Graph->NodeCount);
+    u32 *NodeOf = NfNN_PushArray(Mem, u32, Graph->Loss->TapeIndex + 1 - Graph->TapeStart);
+    memset(Uses, 0, Graph->NodeCount * sizeof(u32));
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        NodeOf[Graph->Nodes[Index].Tensor->TapeIndex - Graph->TapeStart] = Index;
+    }
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        u32 InputCount = NfNN_Graph_NodeInputs(Graph->Nodes + Index, Inputs);
+        for (u32 Input = 0; Input < InputCount; Input++)
+        {
+            if (NfNN_Tape_Contains(Mem, Inputs[Input]))
+            {
+                Uses[NodeOf[Inputs[Input]->TapeIndex - Graph->TapeStart]]++;
+            }
+        }
+    }
+    Uses[Graph->NodeCount - 1]++;
+
+    u32 NodeCount = 0;
+    for (u32 Index = 0; Index < Graph->NodeCount;)
+    {
+        nfnn_tensor *Head = Graph->Nodes[Index].Tensor;
+        nfnn_fusion Fusion = {0};
+        Fusion.Input = NfNN_Op_InputCount(Head->Op.Type) ? Head->Op.Inputs[0] : 0;
+
+        u32 Last = Index;
+        if (Fusion.Input && NfNN_Graph_FusionOp(Head, Fusion.Input, Fusion.Ops))
+        {
+            Fusion.OpCount = 1;
+            while (Last + 1 < Graph->NodeCount && Fusion.OpCount < NFNN_FUSION_MAX_OPS && Uses[Last] == 1 &&
+                   !NfNN_Micro_Kernels[Fusion.Ops[Fusion.OpCount - 1].Type].Expensive)
+            {
+                nfnn_tensor *Current = Graph->Nodes[Last].Tensor;
+                nfnn_tensor *Next = Graph->Nodes[Last + 1].Tensor;
+                if (NfNN_Length(Next) != NfNN_Length(Current) ||
+                    !NfNN_Graph_FusionOp(Next, Current, Fusion.Ops + Fusion.OpCount))
+                {
+                    break;
+                }
+                Fusion.OpCount++;
+                Last++;
+            }
+        }
+
+        if (Fusion.OpCount > 1)
+        {
+            Fusion.Output = Graph->Nodes[Last].Tensor;
+
+            nfnn_graph_node *Node = Graph->Nodes + NodeCount++;
+            *Node = Graph->Nodes[Last];
+            Node->Fusion = NfNN_PushStruct(Mem, nfnn_fusion);
+            *Node->Fusion = Fusion;
+            Node->SpecializedForward = 0;
+            Node->SpecializedBackward = 0;
+
+            // NOTE(luatil): Each intermediate used to be written and read in forward, and its
+            // gradient cleared, accumulated into (read and write) and read in backward
+            for (u32 It = Index; It < Last; It++)
+            {
+                Result.BytesSaved += 6 * (u64)NfNN_Size(Graph->Nodes[It].Tensor);
+            }
+            Result.GroupCount++;
+            Result.FusedOpCount += Fusion.OpCount;
+        }
+        else
+        {
+            Graph->Nodes[NodeCount++] = Graph->Nodes[Index];
+        }
+
+        Index = Last + 1;
+    }
+    Graph->NodeCount = NodeCount;
+
+    NfNN_Graph_CollectGradients(Graph);
+
+    return Result;
+}
+
+#endif // NFNN_GRAPH_H
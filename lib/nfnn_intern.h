@@ -0,0 +1,263 @@
+#ifndef NFNN_INTERN_H
+#define NFNN_INTERN_H
+
+#include "nfnn_macro.h"
+#include "nfnn_math.h"
+#include "nfnn_memory_arena.h"
+#include "nfnn_tensor.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): Hash-consing for graph construction.
+//
+// Constants: once NfNN_Constants_Attach gave an arena a cache kept in a long-lived arena, NfNN_Const
+// on it returns one shared tensor per shape and value instead of a new one every call. Shared
+// constants are read only, NfNN_Sum and NfNN_MSELoss stop building a tensor per step. Every
+// thread attaches a cache to its own arena, caches are not shared between threads.
+//
+// Ops: inside an intern scope (every graph capture opens one) an op with the same type, inputs
+// and parameters as an op already on the tape returns that result, nothing is allocated or
+// computed. Leaves must not change inside the scope, a repeated op would see the old values.
+// Copies and reshapes always make a new tensor.
+
+#define NFNN_CONSTANT_CACHE_SLOTS 256 // Power of two
+#define NFNN_INTERN_SLOTS 4096        // Power of two, per scope
+
+typedef struct nfnn_constant_entry nfnn_constant_entry;
+struct nfnn_constant_entry
+{
+    nfnn_tensor *Tensor;
+    u32 Bits; // Of the value
+};
+
+typedef struct nfnn_constant_cache nfnn_constant_cache;
+struct nfnn_constant_cache
+{
+    nfnn_memory_arena *Mem; // Where the constants live
+    u32 Count;
+    u32 Hits;
+    nfnn_constant_entry Slots[NFNN_CONSTANT_CACHE_SLOTS];
+};
+
+typedef struct nfnn_intern nfnn_intern;
+struct nfnn_intern
+{
+    u32 Depth;
+    u32 Count;
+    u32 Hits;       // Ops that returned an earlier result
+    u64 BytesSaved; // Arena bytes given back by those ops
+    nfnn_tensor **Slots;
+};
+
+static u64 NfNN_Intern_Mix(u64 Hash, u64 Value)
+{
+    Hash ^= Value + 0x9e3779b97f4a7c15ull + (Hash << 6) + (Hash >> 2);
+    return Hash;
+}
+
+static u32 NfNN_Intern_Bits(f32 Value)
+{
+    u32 Result = 0;
+    memcpy(&Result, &Value, sizeof(Result));
+    return Result;
+}
+
+// NOTE(luatil): Gives Mem a new cache whose table and constants live in Store, 0 turns it off.
+// Store has to outlive the use of Mem, a cache inside memory its own arena releases is dropped.
+// Tensors handed out before stay valid as long as their arena.
+static void NfNN_Constants_Attach(nfnn_memory_arena *Mem, nfnn_memory_arena *Store)
+{
+    Mem->Constants = 0;
+    if (Store)
+    {
+        nfnn_constant_cache *Cache = NfNN_PushStruct(Store, nfnn_constant_cache);
+        memset(Cache, 0, sizeof(nfnn_constant_cache));
+        Cache->Mem = Store;
+        Mem->Constants = Cache;
+    }
+}
+
+static nfnn_constant_entry *NfNN_Constants_Slot(nfnn_constant_cache *Cache, nfnn_dim Dim, u32 Bits)
+{
+    u64 Hash = NfNN_Intern_Mix(NfNN_Intern_Mix(NfNN_Intern_Mix(0, Dim.Dimensions[0]), Dim.Dimensions[1]), Bits);
+    u32 Mask = NFNN_CONSTANT_CACHE_SLOTS - 1;
+    for (u32 Probe = 0; Probe < NFNN_CONSTANT_CACHE_SLOTS; Probe++)
+    {
+        nfnn_constant_entry *Entry = Cache->Slots + ((Hash + Probe) & Mask);
+        if (!Entry->Tensor || (Entry->Bits == Bits && NfNN_Dim_Equal(Entry->Tensor->Dimensions, Dim)))
+        {
+            return Entry;
+        }
+    }
+    return 0;
+}
+
+// NOTE(luatil): Returns 0 when Mem has no cache or it is full, the caller then builds its own tensor
+static nfnn_tensor *NfNN_Constants_Get(nfnn_memory_arena *Mem, nfnn_dim Dim, f32 Value)
+{
+    nfnn_tensor *Result = 0;
+    nfnn_constant_cache *Cache = Mem->Constants;
+    if (!Cache)
+    {
+        return Result;
+    }
+
+    u32 Bits = NfNN_Intern_Bits(Value);
+    nfnn_constant_entry *Entry = NfNN_Constants_Slot(Cache, Dim, Bits);
+    if (Entry && Entry->Tensor)
+    {
+        Result = Entry->Tensor;
+        Cache->Hits++;
+    }
+    else if (Entry && Cache->Count < NFNN_CONSTANT_CACHE_SLOTS * 3 / 4)
+    {
+        Result = NfNN_CreateTensor(Cache->Mem, Dim, false);
+        Result->Op.Type = NFNN_OP_TYPE_LEAF;
+        NfNN_Math_FillConstant_f32(Result->Data, NfNN_Length(Result), Value);
+        Entry->Tensor = Result;
+        Entry->Bits = Bits;
+        Cache->Count++;
+    }
+    return Result;
+}
+
+// NOTE(luatil): Scopes nest, the table lives in Mem until the outermost scope ends
+static void NfNN_Intern_Begin(nfnn_memory_arena *Mem)
+{
+    if (!Mem->Intern)
+    {
+        nfnn_intern *Intern = NfNN_PushStruct(Mem, nfnn_intern);
+        memset(Intern, 0, sizeof(nfnn_intern));
+        Intern->Slots = NfNN_PushArray(Mem, nfnn_tensor *, NFNN_INTERN_SLOTS);
+        memset(Intern->Slots, 0, NFNN_INTERN_SLOTS * sizeof(nfnn_tensor *));
+        Mem->Intern = Intern;
+    }
+    Mem->Intern->Depth++;
+}
+
+static void NfNN_Intern_End(nfnn_memory_arena *Mem)
+{
+    NFNN_ASSERT(Mem->Intern && Mem->Intern->Depth > 0, "NfNN_Intern_End: Not inside an intern scope");
+    if (--Mem->Intern->Depth == 0)
+    {
+        Mem->Intern = 0;
+    }
+}
+
+static bool NfNN_Intern_Enabled(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    return Mem->Intern && Mem->NoGradDepth == 0 && T->Op.Type != NFNN_OP_TYPE_COPY &&
+           T->Op.Type != NFNN_OP_TYPE_RESHAPE;
+}
+
+// NOTE(luatil): The parameter shares its bytes with the second input, see nfnn_op
+static u32 NfNN_Intern_Parameter(nfnn_tensor *T)
+{
+    u32 Result = 0;
+    switch (T->Op.Type)
+    {
+    case NFNN_OP_TYPE_LOG_SOFTMAX:
+    case NFNN_OP_TYPE_ARGMAX: {
+        Result = T->Op.Dimensional.Dim;
+    }
+    break;
+    case NFNN_OP_TYPE_MUL_CONST: {
+        Result = NfNN_Intern_Bits(T->Op.Constant.ConstantInputf32);
+    }
+    break;
+    default: {
+        Result = 0;
+    }
+    break;
+    }
+    return Result;
+}
+
+static u64 NfNN_Intern_Hash(nfnn_tensor *T)
+{
+    u64 Hash = NfNN_Intern_Mix(0, T->Op.Type);
+    for (u32 Input = 0; Input < NfNN_Op_InputCount(T->Op.Type); Input++)
+    {
+        Hash = NfNN_Intern_Mix(Hash, (u64)(uintptr_t)T->Op.Inputs[Input]);
+    }
+    Hash = NfNN_Intern_Mix(Hash, NfNN_Intern_Parameter(T));
+    Hash = NfNN_Intern_Mix(Hash, T->Dimensions.Dimensions[0]);
+    Hash = NfNN_Intern_Mix(Hash, T->Dimensions.Dimensions[1]);
+    return Hash;
+}
+
+static bool NfNN_Intern_Same(nfnn_tensor *A, nfnn_tensor *B)
+{
+    if (A->Op.Type != B->Op.Type || A->RequiresGrad != B->RequiresGrad ||
+        !NfNN_Dim_Equal(A->Dimensions, B->Dimensions))
+    {
+        return false;
+    }
+    for (u32 Input = 0; Input < NfNN_Op_InputCount(A->Op.Type); Input++)
+    {
+        if (A->Op.Inputs[Input] != B->Op.Inputs[Input])
+        {
+            return false;
+        }
+    }
+    return NfNN_Intern_Parameter(A) == NfNN_Intern_Parameter(B);
+}
+
+// NOTE(luatil): Returns the slot holding an op equal to T or the empty slot T would go in
+static nfnn_tensor **NfNN_Intern_Slot(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    u64 Hash = NfNN_Intern_Hash(T);
+    u32 Mask = NFNN_INTERN_SLOTS - 1;
+    for (u32 Probe = 0; Probe < NFNN_INTERN_SLOTS; Probe++)
+    {
+        nfnn_tensor **Slot = Mem->Intern->Slots + ((Hash + Probe) & Mask);
+        if (!*Slot || (NfNN_Tape_Contains(Mem, *Slot) && NfNN_Intern_Same(*Slot, T)))
+        {
+            return Slot;
+        }
+    }
+    return 0;
+}
+
+// NOTE(luatil): Called with the freshly built result of an op before it runs. On a hit the
+// result was the last thing allocated, so its tensor and buffers go back to the arena.
+static nfnn_tensor *NfNN_Intern_Find(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    nfnn_tensor *Result = 0;
+    if (!NfNN_Intern_Enabled(Mem, T))
+    {
+        return Result;
+    }
+
+    nfnn_tensor **Slot = NfNN_Intern_Slot(Mem, T);
+    if (Slot && *Slot)
+    {
+        Result = *Slot;
+        u8 *Start = (u8 *)T;
+        if (Start >= Mem->Base && Start < Mem->Base + Mem->Used)
+        {
+            u64 Size = (Mem->Base + Mem->Used) - Start;
+            memset(Start, 0, Size);
+            Mem->Used -= Size;
+            Mem->Intern->BytesSaved += Size;
+        }
+        Mem->Intern->Hits++;
+    }
+    return Result;
+}
+
+static void NfNN_Intern_Add(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    if (!NfNN_Intern_Enabled(Mem, T) || Mem->Intern->Count >= NFNN_INTERN_SLOTS * 3 / 4)
+    {
+        return;
+    }
+
+    nfnn_tensor **Slot = NfNN_Intern_Slot(Mem, T);
+    if (Slot && !*Slot)
+    {
+        *Slot = T;
+        Mem->Intern->Count++;
+    }
+}
+
+#endif // NFNN_INTERN_H
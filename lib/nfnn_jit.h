@@ -0,0 +1,574 @@
+#ifndef NFNN_JIT_H
+#define NFNN_JIT_H
+
+#include <stdarg.h>
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "nfnn_autotune.h"
+#include "nfnn_fusion.h"
+#include "nfnn_graph.h"
+#include "nfnn_macro.h"
+#include "nfnn_tensor.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): Generates C for the fused and MatMul nodes of a captured graph with every
+// shape baked in as a constant, compiles it with the system compiler into a shared object
+// and points the nodes at the loaded kernels. The object is cached on disk under the hash
+// of its source, which covers the graph structure, the shapes, the flags and the CPU it was
+// built for, so later runs with the same graph on the same machine only load it. Opt-in
+// header, link with -ldl.
+//
+// Usage, after NfNN_Graph_Fuse:
+//   nfnn_jit_stats Jit = NfNN_Jit_Compile(Graph, "nfnn_jit_cache");
+
+#ifndef NFNN_JIT_COMPILER
+#define NFNN_JIT_COMPILER "gcc -O3 -march=native -shared -fPIC"
+#endif
+
+typedef struct nfnn_jit_stats nfnn_jit_stats;
+struct nfnn_jit_stats
+{
+    u64 Hash;
+    u32 KernelCount; // Nodes now running generated code
+    bool Compiled;   // False when the object came from the cache
+    bool Loaded;
+};
+
+typedef struct nfnn_jit_source nfnn_jit_source;
+struct nfnn_jit_source
+{
+    char *Data;
+    u64 Used;
+    u64 Capacity;
+};
+
+static void NfNN_Jit_Emit(nfnn_jit_source *Source, char *Format, ...)
+{
+    for (;;)
+    {
+        va_list Arguments;
+        va_start(Arguments, Format);
+        int Length = vsnprintf(Source->Data + Source->Used, Source->Capacity - Source->Used, Format, Arguments);
+        va_end(Arguments);
+
+        NFNN_ASSERT(Length >= 0, "NfNN_Jit_Emit: Bad format");
+        if (Source->Used + Length < Source->Capacity)
+        {
+            Source->Used += Length;
+            break;
+        }
+        Source->Capacity = 2 * (Source->Capacity + Length);
+        Source->Data = (char *)realloc(Source->Data, Source->Capacity);
+        NFNN_ASSERT(Source->Data, "NfNN_Jit_Emit: Out of memory");
+    }
+}
+
+static u64 NfNN_Jit_Hash(char *Data, u64 Size)
+{
+    // NOTE(luatil): FNV-1a
+    u64 Result = 14695981039346656037ull;
+    for (u64 Index = 0; Index < Size; Index++)
+    {
+        Result = (Result ^ (u8)Data[Index]) * 1099511628211ull;
+    }
+    return Result;
+}
+
+// NOTE(luatil): Index into a broadcast side operand as a C expression of R, C and I
+static void NfNN_Jit_EmitSideIndex(nfnn_jit_source *Source, nfnn_fusion_op *Op, u32 Columns)
+{
+    if (!Op->Broadcast)
+    {
+        NfNN_Jit_Emit(Source, "I");
+        return;
+    }
+
+    u32 OpColumns = Op->Dimensions.Dimensions[1];
+    u32 SideRows = Op->Side->Dimensions.Dimensions[0];
+    u32 SideColumns = Op->Side->Dimensions.Dimensions[1];
+    char *Row = OpColumns == Columns ? "R" : "(I / %uu)";
+    char *Column = OpColumns == Columns ? "C" : "(I %% %uu)";
+
+    if (SideRows == 1 && SideColumns == 1)
+    {
+        NfNN_Jit_Emit(Source, "0");
+    }
+    else if (SideRows == 1)
+    {
+        NfNN_Jit_Emit(Source, Column, OpColumns);
+    }
+    else if (SideColumns == 1)
+    {
+        NfNN_Jit_Emit(Source, Row, OpColumns);
+    }
+    else
+    {
+        NfNN_Jit_Emit(Source, Row, OpColumns);
+        NfNN_Jit_Emit(Source, " * %uu + ", SideColumns);
+        NfNN_Jit_Emit(Source, Column, OpColumns);
+    }
+}
+
+static void NfNN_Jit_EmitSide(nfnn_jit_source *Source, nfnn_fusion_op *Op, u32 OpIndex, u32 Columns)
+{
+    NfNN_Jit_Emit(Source, "S%u[", OpIndex);
+    NfNN_Jit_EmitSideIndex(Source, Op, Columns);
+    NfNN_Jit_Emit(Source, "]");
+}
+
+static void NfNN_Jit_EmitFusionPointers(nfnn_jit_source *Source, nfnn_fusion *Fusion, bool Backward)
+{
+    NfNN_Jit_Emit(Source, "    const float *In = B[0];\n");
+    NfNN_Jit_Emit(Source, "    %sfloat *Out = B[2];\n", Backward ? "const " : "");
+    if (Backward)
+    {
+        NfNN_Jit_Emit(Source, "    float *InGrad = B[1];\n    const float *OutGrad = B[3];\n");
+    }
+    for (u32 OpIndex = 0, Side = 0; OpIndex < Fusion->OpCount; OpIndex++)
+    {
+        if (Fusion->Ops[OpIndex].Side)
+        {
+            NfNN_Jit_Emit(Source, "    const float *S%u = B[%u];\n", OpIndex, 4 + 2 * Side);
+            if (Backward)
+            {
+                NfNN_Jit_Emit(Source, "    float *SG%u = B[%u];\n", OpIndex, 5 + 2 * Side);
+            }
+            Side++;
+        }
+    }
+    NfNN_Jit_Emit(Source, "    (void)In;\n    (void)Out;\n");
+}
+
+// NOTE(luatil): Emits "V<OpIndex + 1> = f(V<OpIndex>, Side)" with the same math as the micro kernels
+static void NfNN_Jit_EmitMicroForward(nfnn_jit_source *Source, nfnn_fusion_op *Op, u32 OpIndex, u32 Columns)
+{
+    u32 X = OpIndex;
+    u32 Y = OpIndex + 1;
+    NfNN_Jit_Emit(Source, "            float V%u = ", Y);
+    switch (Op->Type)
+    {
+    case NFNN_MICRO_COPY: {
+        NfNN_Jit_Emit(Source, "V%u", X);
+    }
+    break;
+    case NFNN_MICRO_ADD: {
+        NfNN_Jit_Emit(Source, "V%u + ", X);
+        NfNN_Jit_EmitSide(Source, Op, OpIndex, Columns);
+    }
+    break;
+    case NFNN_MICRO_SUB: {
+        NfNN_Jit_Emit(Source, "V%u - ", X);
+        NfNN_Jit_EmitSide(Source, Op, OpIndex, Columns);
+    }
+    break;
+    case NFNN_MICRO_RSUB: {
+        NfNN_Jit_EmitSide(Source, Op, OpIndex, Columns);
+        NfNN_Jit_Emit(Source, " - V%u", X);
+    }
+    break;
+    case NFNN_MICRO_MUL: {
+        NfNN_Jit_Emit(Source, "V%u * ", X);
+        NfNN_Jit_EmitSide(Source, Op, OpIndex, Columns);
+    }
+    break;
+    case NFNN_MICRO_MUL_CONST: {
+        NfNN_Jit_Emit(Source, "V%u * %af", X, Op->Constant);
+    }
+    break;
+    case NFNN_MICRO_SIGMOID: {
+        NfNN_Jit_Emit(Source, "1.0f / (1.0f + expf(-V%u))", X);
+    }
+    break;
+    case NFNN_MICRO_RELU: {
+        NfNN_Jit_Emit(Source, "V%u > 0.0f ? V%u : 0.0f", X, X);
+    }
+    break;
+    case NFNN_MICRO_TANH: {
+        NfNN_Jit_Emit(Source, "tanhf(V%u)", X);
+    }
+    break;
+    case NFNN_MICRO_SQUARE: {
+        NfNN_Jit_Emit(Source, "V%u * V%u", X, X);
+    }
+    break;
+    case NFNN_MICRO_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+    NfNN_Jit_Emit(Source, ";\n");
+}
+
+// NOTE(luatil): Emits the side gradient (when SideGrad is set) and then G = G * dY/dX
+static void NfNN_Jit_EmitMicroBackward(nfnn_jit_source *Source, nfnn_fusion_op *Op, u32 OpIndex, u32 Columns,
+                                       bool SideGrad)
+{
+    u32 X = OpIndex;
+    u32 Y = OpIndex + 1;
+    char *DSide = 0;
+    char *DX = 0;
+    char Buffer[64];
+    switch (Op->Type)
+    {
+    case NFNN_MICRO_COPY:
+    case NFNN_MICRO_ADD: {
+        DSide = "G";
+        DX = "G";
+    }
+    break;
+    case NFNN_MICRO_SUB: {
+        DSide = "-G";
+        DX = "G";
+    }
+    break;
+    case NFNN_MICRO_RSUB: {
+        DSide = "G";
+        DX = "-G";
+    }
+    break;
+    case NFNN_MICRO_MUL: {
+        snprintf(Buffer, sizeof(Buffer), "G * V%u", X);
+        DSide = Buffer;
+        NfNN_Jit_Emit(Source, "            float DX%u = G * ", OpIndex);
+        NfNN_Jit_EmitSide(Source, Op, OpIndex, Columns);
+        NfNN_Jit_Emit(Source, ";\n");
+        DX = 0;
+    }
+    break;
+    case NFNN_MICRO_MUL_CONST: {
+        snprintf(Buffer, sizeof(Buffer), "G * %af", Op->Constant);
+        DX = Buffer;
+    }
+    break;
+    case NFNN_MICRO_SIGMOID: {
+        snprintf(Buffer, sizeof(Buffer), "G * V%u * (1.0f - V%u)", Y, Y);
+        DX = Buffer;
+    }
+    break;
+    case NFNN_MICRO_RELU: {
+        snprintf(Buffer, sizeof(Buffer), "V%u > 0.0f ? G : 0.0f", X);
+        DX = Buffer;
+    }
+    break;
+    case NFNN_MICRO_TANH: {
+        snprintf(Buffer, sizeof(Buffer), "G * (1.0f - V%u * V%u)", Y, Y);
+        DX = Buffer;
+    }
+    break;
+    case NFNN_MICRO_SQUARE: {
+        snprintf(Buffer, sizeof(Buffer), "2.0f * G * V%u", X);
+        DX = Buffer;
+    }
+    break;
+    case NFNN_MICRO_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+
+    if (SideGrad)
+    {
+        NfNN_Jit_Emit(Source, "            SG%u[", OpIndex);
+        NfNN_Jit_EmitSideIndex(Source, Op, Columns);
+        NfNN_Jit_Emit(Source, "] += %s;\n", DSide);
+    }
+    if (DX)
+    {
+        NfNN_Jit_Emit(Source, "            G = %s;\n", DX);
+    }
+    else
+    {
+        NfNN_Jit_Emit(Source, "            G = DX%u;\n", OpIndex);
+    }
+}
+
+static void NfNN_Jit_EmitLoopBegin(nfnn_jit_source *Source, u32 Rows, u32 Columns)
+{
+    NfNN_Jit_Emit(Source, "    for (unsigned R = 0; R < %uu; R++)\n    {\n", Rows);
+    NfNN_Jit_Emit(Source, "        for (unsigned C = 0; C < %uu; C++)\n        {\n", Columns);
+    NfNN_Jit_Emit(Source, "            unsigned I = R * %uu + C;\n            (void)I;\n", Columns);
+}
+
+static void NfNN_Jit_EmitLoopEnd(nfnn_jit_source *Source)
+{
+    NfNN_Jit_Emit(Source, "        }\n    }\n}\n\n");
+}
+
+static void NfNN_Jit_EmitFusion(nfnn_jit_source *Source, nfnn_fusion *Fusion, u32 Node)
+{
+    u32 Rows = Fusion->Output->Dimensions.Dimensions[0];
+    u32 Columns = Fusion->Output->Dimensions.Dimensions[1];
+
+    NfNN_Jit_Emit(Source, "void NfNN_Jit_Forward_%u(float **B)\n{\n", Node);
+    NfNN_Jit_EmitFusionPointers(Source, Fusion, false);
+    NfNN_Jit_EmitLoopBegin(Source, Rows, Columns);
+    NfNN_Jit_Emit(Source, "            float V0 = In[I];\n");
+    for (u32 OpIndex = 0; OpIndex < Fusion->OpCount; OpIndex++)
+    {
+        NfNN_Jit_EmitMicroForward(Source, Fusion->Ops + OpIndex, OpIndex, Columns);
+    }
+    NfNN_Jit_Emit(Source, "            Out[I] = V%u;\n", Fusion->OpCount);
+    NfNN_Jit_EmitLoopEnd(Source);
+
+    if (!Fusion->Output->RequiresGrad)
+    {
+        return;
+    }
+
+    NfNN_Jit_Emit(Source, "void NfNN_Jit_Backward_%u(float **B)\n{\n", Node);
+    NfNN_Jit_EmitFusionPointers(Source, Fusion, true);
+    NfNN_Jit_EmitLoopBegin(Source, Rows, Columns);
+    NfNN_Jit_Emit(Source, "            float V0 = In[I];\n");
+    for (u32 OpIndex = 0; OpIndex + 1 < Fusion->OpCount; OpIndex++)
+    {
+        NfNN_Jit_EmitMicroForward(Source, Fusion->Ops + OpIndex, OpIndex, Columns);
+    }
+    NfNN_Jit_Emit(Source, "            float V%u = Out[I];\n            (void)V%u;\n", Fusion->OpCount,
+                  Fusion->OpCount);
+    NfNN_Jit_Emit(Source, "            float G = OutGrad[I];\n");
+    for (u32 OpIndex = Fusion->OpCount; OpIndex-- > 0;)
+    {
+        nfnn_fusion_op *Op = Fusion->Ops + OpIndex;
+        NfNN_Jit_EmitMicroBackward(Source, Op, OpIndex, Columns, Op->Side && Op->Side->RequiresGrad);
+    }
+    if (Fusion->Input->RequiresGrad)
+    {
+        NfNN_Jit_Emit(Source, "            InGrad[I] += G;\n");
+    }
+    NfNN_Jit_EmitLoopEnd(Source);
+}
+
+// NOTE(luatil): Rows of the right operand and of the result are contiguous in the inner
+// loops, with the sizes known the compiler unrolls and vectorizes them
+static void NfNN_Jit_EmitMatMul(nfnn_jit_source *Source, nfnn_tensor *T, u32 Node)
+{
+    u32 M = T->Op.Binary.Left->Dimensions.Dimensions[0];
+    u32 K = T->Op.Binary.Left->Dimensions.Dimensions[1];
+    u32 N = T->Op.Binary.Right->Dimensions.Dimensions[1];
+
+    NfNN_Jit_Emit(Source, "void NfNN_Jit_Forward_%u(float **B)\n{\n", Node);
+    NfNN_Jit_Emit(Source, "    const float *X = B[0];\n    const float *Y = B[1];\n    float *Out = B[2];\n");
+    NfNN_Jit_Emit(Source, "    for (unsigned I = 0; I < %uu; I++)\n    {\n", M);
+    NfNN_Jit_Emit(Source, "        float Row[%uu] = {0};\n", N);
+    NfNN_Jit_Emit(Source, "        for (unsigned K = 0; K < %uu; K++)\n        {\n", K);
+    NfNN_Jit_Emit(Source, "            float A = X[I * %uu + K];\n", K);
+    NfNN_Jit_Emit(Source, "            for (unsigned J = 0; J < %uu; J++)\n", N);
+    NfNN_Jit_Emit(Source, "                Row[J] += A * Y[K * %uu + J];\n        }\n", N);
+    NfNN_Jit_Emit(Source, "        for (unsigned J = 0; J < %uu; J++)\n", N);
+    NfNN_Jit_Emit(Source, "            Out[I * %uu + J] = Row[J];\n    }\n}\n\n", N);
+
+    if (!T->RequiresGrad)
+    {
+        return;
+    }
+
+    NfNN_Jit_Emit(Source, "void NfNN_Jit_Backward_%u(float **B)\n{\n", Node);
+    NfNN_Jit_Emit(Source, "    const float *X = B[0];\n    const float *Y = B[1];\n    const float *G = B[3];\n");
+    NfNN_Jit_Emit(Source, "    float *XGrad = B[4];\n    float *YGrad = B[5];\n    (void)X;\n    (void)Y;\n");
+    if (T->Op.Saved.Right)
+    {
+        // NOTE(luatil): dX += G @ Y^T
+        NfNN_Jit_Emit(Source, "    for (unsigned I = 0; I < %uu; I++)\n", M);
+        NfNN_Jit_Emit(Source, "        for (unsigned K = 0; K < %uu; K++)\n        {\n", K);
+        NfNN_Jit_Emit(Source, "            float Sum = 0.0f;\n");
+        NfNN_Jit_Emit(Source, "            for (unsigned J = 0; J < %uu; J++)\n", N);
+        NfNN_Jit_Emit(Source, "                Sum += G[I * %uu + J] * Y[K * %uu + J];\n", N, N);
+        NfNN_Jit_Emit(Source, "            XGrad[I * %uu + K] += Sum;\n        }\n", K);
+    }
+    if (T->Op.Saved.Left)
+    {
+        // NOTE(luatil): dY += X^T @ G
+        NfNN_Jit_Emit(Source, "    for (unsigned I = 0; I < %uu; I++)\n", M);
+        NfNN_Jit_Emit(Source, "        for (unsigned K = 0; K < %uu; K++)\n        {\n", K);
+        NfNN_Jit_Emit(Source, "            float A = X[I * %uu + K];\n", K);
+        NfNN_Jit_Emit(Source, "            for (unsigned J = 0; J < %uu; J++)\n", N);
+        NfNN_Jit_Emit(Source, "                YGrad[K * %uu + J] += A * G[I * %uu + J];\n        }\n", N, N);
+    }
+    NfNN_Jit_Emit(Source, "}\n\n");
+}
+
+static f32 **NfNN_Jit_FusionBuffers(nfnn_memory_arena *Mem, nfnn_fusion *Fusion)
+{
+    f32 **Result = NfNN_PushArray(Mem, f32 *, 4 + 2 * NFNN_FUSION_MAX_OPS);
+    u32 Count = 0;
+    Result[Count++] = Fusion->Input->Data;
+    Result[Count++] = Fusion->Input->Gradient;
+    Result[Count++] = Fusion->Output->Data;
+    Result[Count++] = Fusion->Output->Gradient;
+    for (u32 OpIndex = 0; OpIndex < Fusion->OpCount; OpIndex++)
+    {
+        if (Fusion->Ops[OpIndex].Side)
+        {
+            Result[Count++] = Fusion->Ops[OpIndex].Side->Data;
+            Result[Count++] = Fusion->Ops[OpIndex].Side->Gradient;
+        }
+    }
+    return Result;
+}
+
+static f32 **NfNN_Jit_MatMulBuffers(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    f32 **Result = NfNN_PushArray(Mem, f32 *, 6);
+    Result[0] = T->Op.Binary.Left->Data;
+    Result[1] = T->Op.Binary.Right->Data;
+    Result[2] = T->Data;
+    Result[3] = T->Gradient;
+    Result[4] = T->Op.Binary.Left->Gradient;
+    Result[5] = T->Op.Binary.Right->Gradient;
+    return Result;
+}
+
+// NOTE(luatil): A single elementwise node is generated as a fusion of one op
+static bool NfNN_Jit_NodeFusion(nfnn_graph_node *Node, nfnn_fusion *Fusion)
+{
+    bool Result = false;
+    if (Node->Fusion)
+    {
+        *Fusion = *Node->Fusion;
+        Result = true;
+    }
+    else if (NfNN_Op_InputCount(Node->Tensor->Op.Type) > 0)
+    {
+        nfnn_fusion Zero = {0};
+        *Fusion = Zero;
+        Fusion->Input = Node->Tensor->Op.Inputs[0];
+        Fusion->Output = Node->Tensor;
+        Fusion->OpCount = 1;
+        // NOTE(luatil): A lone copy or reshape may share its buffers with its input
+        Result = NfNN_Graph_FusionOp(Node->Tensor, Fusion->Input, Fusion->Ops) &&
+                 Fusion->Ops[0].Type != NFNN_MICRO_COPY && NfNN_Length(Fusion->Input) == NfNN_Length(Node->Tensor);
+    }
+    return Result;
+}
+
+#if !defined(_WIN32)
+// NOTE(luatil): Writes to a private name and renames, so a process compiling the same source never
+// sees it truncated
+static bool NfNN_Jit_WriteSource(nfnn_jit_source *Source, char *SourcePath)
+{
+    char TempPath[1024 + 16];
+    snprintf(TempPath, sizeof(TempPath), "%s.%d", SourcePath, (int)getpid());
+    FILE *File = fopen(TempPath, "wb");
+    if (!File)
+    {
+        return false;
+    }
+    bool Result = fwrite(Source->Data, 1, Source->Used, File) == Source->Used;
+    Result = fclose(File) == 0 && Result && rename(TempPath, SourcePath) == 0;
+    if (!Result)
+    {
+        remove(TempPath);
+    }
+    return Result;
+}
+
+// NOTE(luatil): Compiles to a private name and renames, so concurrent processes never load a partial
+// object. Paths go to the shell in single quotes, a path holding one is not built.
+static bool NfNN_Jit_Build(char *SourcePath, char *ObjectPath)
+{
+    char TempPath[1024 + 16];
+    char Command[4096];
+    snprintf(TempPath, sizeof(TempPath), "%s.%d", ObjectPath, (int)getpid());
+    if (strchr(SourcePath, '\'') || strchr(TempPath, '\''))
+    {
+        return false;
+    }
+    snprintf(Command, sizeof(Command), "%s -x c -o '%s' '%s' -lm", NFNN_JIT_COMPILER, TempPath, SourcePath);
+    bool Result = system(Command) == 0 && rename(TempPath, ObjectPath) == 0;
+    if (!Result)
+    {
+        remove(TempPath);
+    }
+    return Result;
+}
+#endif
+
+static nfnn_jit_stats NfNN_Jit_Compile(nfnn_graph *Graph, char *CacheDirectory)
+{
+    nfnn_jit_stats Result = {0};
+
+#if defined(_WIN32)
+    // NOTE(luatil): No loader here yet, the graph keeps running the library kernels
+#else
+    nfnn_jit_source Source = {0};
+    Source.Capacity = KB(64);
+    Source.Data = (char *)malloc(Source.Capacity);
+    NFNN_ASSERT(Source.Data, "NfNN_Jit_Compile: Out of memory");
+
+    // NOTE(luatil): -march=native objects only run on the CPU they were built on, the machine key
+    // in the source keeps hosts sharing a cache directory apart
+    char Machine[512];
+    NfNN_Autotune_MachineKey(Machine, sizeof(Machine));
+    NfNN_Jit_Emit(&Source, "// Generated by nfnn_jit.h: %s\n// For: %s\n#include <math.h>\n\n", NFNN_JIT_COMPILER,
+                  Machine);
+
+    nfnn_fusion Fusion;
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        nfnn_graph_node *Node = Graph->Nodes + Index;
+        if (NfNN_Jit_NodeFusion(Node, &Fusion))
+        {
+            NfNN_Jit_EmitFusion(&Source, &Fusion, Index);
+        }
+        else if (Node->Tensor->Op.Type == NFNN_OP_TYPE_MATMUL)
+        {
+            NfNN_Jit_EmitMatMul(&Source, Node->Tensor, Index);
+        }
+    }
+
+    Result.Hash = NfNN_Jit_Hash(Source.Data, Source.Used);
+
+    char SourcePath[1024];
+    char ObjectPath[1024];
+    mkdir(CacheDirectory, 0755);
+    snprintf(SourcePath, sizeof(SourcePath), "%s/nfnn_jit_%016llx.c", CacheDirectory, (unsigned long long)Result.Hash);
+    snprintf(ObjectPath, sizeof(ObjectPath), "%s/nfnn_jit_%016llx.so", CacheDirectory, (unsigned long long)Result.Hash);
+
+    if (access(ObjectPath, F_OK) != 0)
+    {
+        Result.Compiled = NfNN_Jit_WriteSource(&Source, SourcePath) && NfNN_Jit_Build(SourcePath, ObjectPath);
+    }
+    free(Source.Data);
+
+    void *Library = dlopen(ObjectPath, RTLD_NOW | RTLD_LOCAL);
+    if (!Library)
+    {
+        fprintf(stderr, "NfNN_Jit_Compile: Falling back to library kernels, could not load %s\n", ObjectPath);
+        return Result;
+    }
+    Result.Loaded = true;
+
+    // NOTE(luatil): The library stays loaded for the lifetime of the process
+    for (u32 Index = 0; Index < Graph->NodeCount; Index++)
+    {
+        nfnn_graph_node *Node = Graph->Nodes + Index;
+        char Name[64];
+
+        snprintf(Name, sizeof(Name), "NfNN_Jit_Forward_%u", Index);
+        nfnn_graph_kernel *Forward = (nfnn_graph_kernel *)dlsym(Library, Name);
+        if (!Forward)
+        {
+            continue;
+        }
+        snprintf(Name, sizeof(Name), "NfNN_Jit_Backward_%u", Index);
+        nfnn_graph_kernel *Backward = (nfnn_graph_kernel *)dlsym(Library, Name);
+
+        Node->Buffers = NfNN_Jit_NodeFusion(Node, &Fusion) ? NfNN_Jit_FusionBuffers(Graph->Mem, &Fusion)
+                                                           : NfNN_Jit_MatMulBuffers(Graph->Mem, Node->Tensor);
+        Node->SpecializedForward = Forward;
+        Node->SpecializedBackward = Backward;
+        Result.KernelCount++;
+    }
+#endif
+
+    return Result;
+}
+
+#endif // NFNN_JIT_H
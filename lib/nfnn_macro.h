@@ -76,6 +76,11 @@
     } while (0)
 
 #define NFNN_ARRAY_COUNT(_array) (sizeof(_array) / sizeof(_array[0]))
+#define NFNN_MIN(_A, _B) ((_A) < (_B) ? (_A) : (_B))
+#define NFNN_MAX(_A, _B) ((_A) > (_B) ? (_A) : (_B))
+
+// NOTE(luatil): Number of u32 words needed to store one bit per element
+#define NFNN_MASK_WORDS(_N) (((_N) + 31) / 32)
 
 #define NFNN_ERROR() NFNN_ASSERT(false, "Error")
 #define NFNN_NOT_USED()
@@ -1,6 +1,7 @@
 #ifndef NFNN_MATH_H
 #define NFNN_MATH_H
 
+#include "nfnn_gemm.h"
 #include "nfnn_macro.h"
 #include "nfnn_memory_arena.h"
 #include "nfnn_types.h"
@@ -85,6 +86,15 @@ static void NfNN_Math_SigmoidD_f32(f32 *Grad, f32 *In, u32 N, f32 *Out)
     }
 }
 
+// NOTE(luatil): Derivative written in terms of the output Y = Sigmoid(X)
+static void NfNN_Math_SigmoidOutD_f32(f32 *Grad, f32 *Y, u32 N, f32 *Out)
+{
+    for (u32 Index = 0; Index < N; ++Index)
+    {
+        Out[Index] += Grad[Index] * Y[Index] * (1.0f - Y[Index]);
+    }
+}
+
 static void NfNN_Math_FillConstant_f32(f32 *Data, u32 NumberOfElements, f32 Constant)
 {
     for (u32 Index = 0; Index < NumberOfElements; ++Index)
@@ -202,7 +212,7 @@ static void NfNN_Math_FmaddConst_f32(f32 *Mul, f32 Const, u32 NumberOfElements,
     }
 }
 
-static void NfNN_Math_MatMul_f32(f32 *A, f32 *B, u32 RowsA, u32 ColumnsA, u32 ColumnsB, f32 *Out)
+static void NfNN_Math_MatMulGeneric_f32(f32 *A, f32 *B, u32 RowsA, u32 ColumnsA, u32 ColumnsB, f32 *Out)
 {
     for (u32 Row = 0; Row < RowsA; ++Row)
     {
@@ -260,7 +270,7 @@ static bool NfNN_Math_CompareMemory_f32(f32 *A, f32 *B, u32 NumberOfElements, f3
 }
 
 static void // Calculates C += A @ B^T
-NfNN_Math_MatmulAddTransposeRight_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *C)
+NfNN_Math_MatmulAddTransposeRightGeneric_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *C)
 {
     // Perform the matrix multiplication and addition C += A * B^T
     for (u32 I = 0; I < L; ++I)
@@ -281,7 +291,7 @@ NfNN_Math_MatmulAddTransposeRight_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *
 }
 
 static void // Calculates C += A^T @ B
-NfNN_Math_MatmulAddTransposeLeft_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *C)
+NfNN_Math_MatmulAddTransposeLeftGeneric_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *C)
 {
     // Perform the matrix multiplication and addition C += A^T * B
     for (u32 I = 0; I < M; ++I)
@@ -301,6 +311,204 @@ NfNN_Math_MatmulAddTransposeLeft_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *C
     }
 }
 
+// NOTE(luatil): MatMul shapes known at build time, as (Rows of A, Columns of A, Columns of B).
+// Each one gets a forward kernel and the two kernels of its backward with every dimension
+// a literal, so the compiler can fully unroll and vectorize them. Other shapes use the
+// generic kernels. Define NFNN_MATMUL_SHAPES before including nfnn.h to replace the list.
+#ifndef NFNN_MATMUL_SHAPES
+#define NFNN_MATMUL_SHAPES(_X)                                                                                         \
+    _X(32, 784, 32) _X(64, 784, 32) _X(128, 784, 32) _X(32, 32, 10) _X(64, 32, 10) _X(128, 32, 10)
+#endif
+
+// NOTE(luatil): Out = A @ B with the rows of B and Out contiguous in the inner loop
+#define NFNN_MATMUL_KERNEL(_A, _B, _RowsA, _ColumnsA, _ColumnsB, _Out)                                                 \
+    for (u32 Row = 0; Row < (_RowsA); ++Row)                                                                           \
+    {                                                                                                                  \
+        f32 *OutRow = (_Out) + Row * (_ColumnsB);                                                                      \
+        for (u32 Column = 0; Column < (_ColumnsB); ++Column)                                                           \
+        {                                                                                                              \
+            OutRow[Column] = 0.0f;                                                                                     \
+        }                                                                                                              \
+        for (u32 Inner = 0; Inner < (_ColumnsA); ++Inner)                                                              \
+        {                                                                                                              \
+            f32 Value = (_A)[Row * (_ColumnsA) + Inner];                                                               \
+            f32 *BRow = (_B) + Inner * (_ColumnsB);                                                                    \
+            for (u32 Column = 0; Column < (_ColumnsB); ++Column)                                                       \
+            {                                                                                                          \
+                OutRow[Column] += Value * BRow[Column];                                                                \
+            }                                                                                                          \
+        }                                                                                                              \
+    }
+
+// NOTE(luatil): C += A @ B^T, long dot products are split over 8 lanes so they vectorize
+#define NFNN_MATMUL_ADD_TRANSPOSE_RIGHT_KERNEL(_A, _B, _L, _M, _R, _C)                                                 \
+    for (u32 I = 0; I < (_L); ++I)                                                                                     \
+    {                                                                                                                  \
+        for (u32 J = 0; J < (_R); ++J)                                                                                 \
+        {                                                                                                              \
+            f32 Lanes[8] = {0};                                                                                        \
+            u32 K = 0;                                                                                                 \
+            for (; (_M) >= 32 && K + 8 <= (_M); K += 8)                                                                \
+            {                                                                                                          \
+                for (u32 Lane = 0; Lane < 8; ++Lane)                                                                   \
+                {                                                                                                      \
+                    Lanes[Lane] += (_A)[I * (_M) + K + Lane] * (_B)[J * (_M) + K + Lane];                              \
+                }                                                                                                      \
+            }                                                                                                          \
+            f32 Sum = 0.0f;                                                                                            \
+            for (; K < (_M); ++K)                                                                                      \
+            {                                                                                                          \
+                Sum += (_A)[I * (_M) + K] * (_B)[J * (_M) + K];                                                        \
+            }                                                                                                          \
+            for (u32 Lane = 0; Lane < 8; ++Lane)                                                                       \
+            {                                                                                                          \
+                Sum += Lanes[Lane];                                                                                    \
+            }                                                                                                          \
+            (_C)[I * (_R) + J] += Sum;                                                                                 \
+        }                                                                                                              \
+    }
+
+// NOTE(luatil): C += A^T @ B as a sum of outer products, rows of B and C are contiguous
+#define NFNN_MATMUL_ADD_TRANSPOSE_LEFT_KERNEL(_A, _B, _L, _M, _R, _C)                                                  \
+    for (u32 K = 0; K < (_L); ++K)                                                                                     \
+    {                                                                                                                  \
+        for (u32 I = 0; I < (_M); ++I)                                                                                 \
+        {                                                                                                              \
+            f32 Value = (_A)[K * (_M) + I];                                                                            \
+            for (u32 J = 0; J < (_R); ++J)                                                                             \
+            {                                                                                                          \
+                (_C)[I * (_R) + J] += Value * (_B)[K * (_R) + J];                                                      \
+            }                                                                                                          \
+        }                                                                                                              \
+    }
+
+// NOTE(luatil): For Out(M, N) = A(M, K) @ B(K, N) the backward computes
+// dA += dOut @ B^T as TransposeRight(L = M, M = N, R = K) and
+// dB += A^T @ dOut as TransposeLeft(L = M, M = K, R = N)
+#define NFNN_MATMUL_INSTANTIATE(_M, _K, _N)                                                                            \
+    static void NfNN_Math_MatMul_##_M##x##_K##x##_N##_f32(f32 *A, f32 *B, f32 *Out)                                    \
+    {                                                                                                                  \
+        NFNN_MATMUL_KERNEL(A, B, _M, _K, _N, Out);                                                                     \
+    }                                                                                                                  \
+    static void NfNN_Math_MatmulAddTransposeRight_##_M##x##_K##x##_N##_f32(f32 *A, f32 *B, f32 *C)                     \
+    {                                                                                                                  \
+        NFNN_MATMUL_ADD_TRANSPOSE_RIGHT_KERNEL(A, B, _M, _N, _K, C);                                                   \
+    }                                                                                                                  \
+    static void NfNN_Math_MatmulAddTransposeLeft_##_M##x##_K##x##_N##_f32(f32 *A, f32 *B, f32 *C)                      \
+    {                                                                                                                  \
+        NFNN_MATMUL_ADD_TRANSPOSE_LEFT_KERNEL(A, B, _M, _K, _N, C);                                                    \
+    }
+
+NFNN_MATMUL_SHAPES(NFNN_MATMUL_INSTANTIATE)
+
+#define NFNN_MATMUL_DISPATCH(_M, _K, _N)                                                                               \
+    if (D0 == _M && D1 == _K && D2 == _N)                                                                              \
+    {                                                                                                                  \
+        NfNN_Math_MatMul_##_M##x##_K##x##_N##_f32(A, B, Out);                                                          \
+        return true;                                                                                                   \
+    }
+
+#define NFNN_MATMUL_ADD_TRANSPOSE_RIGHT_DISPATCH(_M, _K, _N)                                                           \
+    if (D0 == _M && D1 == _N && D2 == _K)                                                                              \
+    {                                                                                                                  \
+        NfNN_Math_MatmulAddTransposeRight_##_M##x##_K##x##_N##_f32(A, B, Out);                                         \
+        return true;                                                                                                   \
+    }
+
+#define NFNN_MATMUL_ADD_TRANSPOSE_LEFT_DISPATCH(_M, _K, _N)                                                            \
+    if (D0 == _M && D1 == _K && D2 == _N)                                                                              \
+    {                                                                                                                  \
+        NfNN_Math_MatmulAddTransposeLeft_##_M##x##_K##x##_N##_f32(A, B, Out);                                          \
+        return true;                                                                                                   \
+    }
+
+// NOTE(luatil): Runs the instance from NFNN_MATMUL_SHAPES for this shape, false if there is none
+static bool NfNN_Math_GemmSpecialized_f32(nfnn_gemm_kernel Kernel, f32 *A, f32 *B, u32 D0, u32 D1, u32 D2, f32 *Out)
+{
+    switch (Kernel)
+    {
+    case NFNN_GEMM_MATMUL: {
+        NFNN_MATMUL_SHAPES(NFNN_MATMUL_DISPATCH)
+    }
+    break;
+    case NFNN_GEMM_ADD_TRANSPOSE_RIGHT: {
+        NFNN_MATMUL_SHAPES(NFNN_MATMUL_ADD_TRANSPOSE_RIGHT_DISPATCH)
+    }
+    break;
+    case NFNN_GEMM_ADD_TRANSPOSE_LEFT: {
+        NFNN_MATMUL_SHAPES(NFNN_MATMUL_ADD_TRANSPOSE_LEFT_DISPATCH)
+    }
+    break;
+    case NFNN_GEMM_KERNEL_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+    return false;
+}
+
+static void NfNN_Math_GemmGeneric_f32(nfnn_gemm_kernel Kernel, f32 *A, f32 *B, u32 D0, u32 D1, u32 D2, f32 *Out)
+{
+    switch (Kernel)
+    {
+    case NFNN_GEMM_MATMUL: {
+        NfNN_Math_MatMulGeneric_f32(A, B, D0, D1, D2, Out);
+    }
+    break;
+    case NFNN_GEMM_ADD_TRANSPOSE_RIGHT: {
+        NfNN_Math_MatmulAddTransposeRightGeneric_f32(A, B, D0, D1, D2, Out);
+    }
+    break;
+    case NFNN_GEMM_ADD_TRANSPOSE_LEFT: {
+        NfNN_Math_MatmulAddTransposeLeftGeneric_f32(A, B, D0, D1, D2, Out);
+    }
+    break;
+    case NFNN_GEMM_KERNEL_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+}
+
+static void NfNN_Math_GemmWithConfig_f32(nfnn_gemm_kernel Kernel, f32 *A, f32 *B, u32 D0, u32 D1, u32 D2, f32 *Out,
+                                         nfnn_gemm_config Config)
+{
+    if (Config.Kind == NFNN_GEMM_KIND_BLOCKED)
+    {
+        NfNN_Gemm_Blocked(Kernel, A, B, D0, D1, D2, Out, Config);
+    }
+    else if (Config.Kind == NFNN_GEMM_KIND_GENERIC || !NfNN_Math_GemmSpecialized_f32(Kernel, A, B, D0, D1, D2, Out))
+    {
+        NfNN_Math_GemmGeneric_f32(Kernel, A, B, D0, D1, D2, Out);
+    }
+}
+
+// NOTE(luatil): A tuned configuration wins, see nfnn_autotune.h, otherwise the specialized
+// instance and then the generic kernel
+static void NfNN_Math_Gemm_f32(nfnn_gemm_kernel Kernel, f32 *A, f32 *B, u32 D0, u32 D1, u32 D2, f32 *Out)
+{
+    NfNN_Math_GemmWithConfig_f32(Kernel, A, B, D0, D1, D2, Out, NfNN_Gemm_Choose(Kernel, D0, D1, D2));
+}
+
+static void NfNN_Math_MatMul_f32(f32 *A, f32 *B, u32 RowsA, u32 ColumnsA, u32 ColumnsB, f32 *Out)
+{
+    NfNN_Math_Gemm_f32(NFNN_GEMM_MATMUL, A, B, RowsA, ColumnsA, ColumnsB, Out);
+}
+
+static void // Calculates C += A @ B^T
+NfNN_Math_MatmulAddTransposeRight_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *C)
+{
+    NfNN_Math_Gemm_f32(NFNN_GEMM_ADD_TRANSPOSE_RIGHT, A, B, L, M, R, C);
+}
+
+static void // Calculates C += A^T @ B
+NfNN_Math_MatmulAddTransposeLeft_f32(f32 *A, f32 *B, u32 L, u32 M, u32 R, f32 *C)
+{
+    NfNN_Math_Gemm_f32(NFNN_GEMM_ADD_TRANSPOSE_LEFT, A, B, L, M, R, C);
+}
+
 static void NfNN_Math_Tanh_f32(f32 *A, u32 N, f32 *Out)
 {
     for (u32 Index = 0; Index < N; ++Index)
@@ -317,6 +525,15 @@ static void NfNN_Math_TanhD_f32(f32 *Grad, f32 *In, u32 N, f32 *Out)
     }
 }
 
+// NOTE(luatil): Derivative written in terms of the output Y = Tanh(X)
+static void NfNN_Math_TanhOutD_f32(f32 *Grad, f32 *Y, u32 N, f32 *Out)
+{
+    for (u32 Index = 0; Index < N; ++Index)
+    {
+        Out[Index] += Grad[Index] * (1.0f - Y[Index] * Y[Index]);
+    }
+}
+
 static void NfNN_Math_ReLU_f32(f32 *A, u32 N, f32 *Out)
 {
     for (u32 Index = 0; Index < N; ++Index)
@@ -333,6 +550,38 @@ static void NfNN_Math_ReLUD_f32(f32 *Grad, f32 *In, u32 N, f32 *Out)
     }
 }
 
+// NOTE(luatil): Computes ReLU and packs (A > 0) into Mask, one bit per element
+static void NfNN_Math_ReLUMask_f32(f32 *A, u32 N, f32 *Out, u32 *Mask)
+{
+    for (u32 Word = 0; Word < NFNN_MASK_WORDS(N); ++Word)
+    {
+        u32 Bits = 0;
+        u32 Start = Word * 32;
+        u32 End = (Start + 32 < N) ? Start + 32 : N;
+        for (u32 Index = Start; Index < End; ++Index)
+        {
+            u32 Positive = A[Index] > 0.0f;
+            Bits |= Positive << (Index - Start);
+            Out[Index] = Positive ? A[Index] : 0.0f;
+        }
+        Mask[Word] = Bits;
+    }
+}
+
+static void NfNN_Math_ReLUMaskD_f32(f32 *Grad, u32 *Mask, u32 N, f32 *Out)
+{
+    for (u32 Word = 0; Word < NFNN_MASK_WORDS(N); ++Word)
+    {
+        u32 Bits = Mask[Word];
+        u32 Start = Word * 32;
+        u32 End = (Start + 32 < N) ? Start + 32 : N;
+        for (u32 Index = Start; Index < End; ++Index)
+        {
+            Out[Index] += ((Bits >> (Index - Start)) & 1) ? Grad[Index] : 0.0f;
+        }
+    }
+}
+
 static void NfNN_Math_Square_f32(f32 *In, u32 N, f32 *Out)
 {
     for (u32 Index = 0; Index < N; ++Index)
@@ -522,16 +771,47 @@ static void NfNN_Math_LogSoftmaxD_f32(nfnn_memory_arena *Mem, f32 *Grad, f32 *X,
     }
 }
 
+// NOTE(luatil): Same as NfNN_Math_LogSoftmaxD_f32 but written in terms of the
+// output Y = LogSoftmax(X), so neither the input nor a softmax buffer is needed:
+// dL/dX_j = dL/dY_j - exp(Y_j) * sum_k dL/dY_k
+static void NfNN_Math_LogSoftmaxOutD_f32(f32 *Grad, f32 *Y, u32 X_Dim, u32 Y_Dim, u32 Dim, f32 *Out)
+{
+    if (Dim == 1)
+    {
+        for (u32 I = 0; I < X_Dim; I++)
+        {
+            f32 Sum = 0.0f;
+            for (u32 K = 0; K < Y_Dim; K++)
+            {
+                Sum += Grad[I * Y_Dim + K];
+            }
+            for (u32 J = 0; J < Y_Dim; J++)
+            {
+                Out[I * Y_Dim + J] += Grad[I * Y_Dim + J] - NfNN_Math_Single_Exp_f32(Y[I * Y_Dim + J]) * Sum;
+            }
+        }
+    }
+    else if (Dim == 0)
+    {
+        NFNN_NOT_IMPLEMENTED();
+    }
+    else
+    {
+        NFNN_ERROR();
+    }
+}
+
 static void NfNN_Math_NLLLoss_Mean_f32(f32 *A, f32 *Indexes, u32 X, u32 Y, f32 *Out)
 {
     // NOTE(luatil): Might also want to handle different types of reductions
     // see Pytorch's documentation on reduction=mean | sum | none
     // This is reduction=mean
+    f32 Sum = 0.0f;
     for (u32 I = 0; I < X; I++)
     {
-        Out[0] += -A[I * Y + (u32)Indexes[I]];
+        Sum += -A[I * Y + (u32)Indexes[I]];
     }
-    Out[0] /= (f32)X;
+    Out[0] = Sum / (f32)X;
 }
 
 static void NfNN_Math_NLLLossD_Mean_f32(f32 *Grad, f32 *X, f32 *Indexes, u32 X_Dim, u32 Y_Dim, f32 *Out)
@@ -600,4 +880,125 @@ static void NfNN_Math_Zero_f32(f32 *A, u32 N)
     }
 }
 
+#define NFNN_MATH_LANES 8
+
+// NOTE(luatil): Eight independent partial sums, with a single one the compiler may not reorder
+// the additions and the loop stays scalar
+static f32 NfNN_Math_SumSquares_f32(f32 *A, u32 N)
+{
+    f32 Lanes[NFNN_MATH_LANES] = {0};
+    u32 I = 0;
+    for (; I + NFNN_MATH_LANES <= N; I += NFNN_MATH_LANES)
+    {
+        for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
+        {
+            Lanes[Lane] += A[I + Lane] * A[I + Lane];
+        }
+    }
+    for (; I < N; I++)
+    {
+        Lanes[0] += A[I] * A[I];
+    }
+
+    f32 Result = 0.0f;
+    for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
+    {
+        Result += Lanes[Lane];
+    }
+    return Result;
+}
+
+// NOTE(luatil): Out += In. A block of lanes is read before any of it is written, so the adds
+// can use vector registers without proving that In and Out do not overlap
+static void NfNN_Math_Accumulate_f32(f32 *In, u32 N, f32 *Out)
+{
+    u32 I = 0;
+    for (; I + NFNN_MATH_LANES <= N; I += NFNN_MATH_LANES)
+    {
+        f32 Lanes[NFNN_MATH_LANES];
+        for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
+        {
+            Lanes[Lane] = Out[I + Lane] + In[I + Lane];
+        }
+        for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
+        {
+            Out[I + Lane] = Lanes[Lane];
+        }
+    }
+    for (; I < N; I++)
+    {
+        Out[I] += In[I];
+    }
+}
+
+static f32 NfNN_Math_AbsMax_f32(f32 *A, u32 N)
+{
+    f32 Lanes[NFNN_MATH_LANES] = {0};
+    u32 I = 0;
+    for (; I + NFNN_MATH_LANES <= N; I += NFNN_MATH_LANES)
+    {
+        for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
+        {
+            Lanes[Lane] = NfNN_Math_Single_Max_f32(Lanes[Lane], NfNN_Math_Single_Abs_f32(A[I + Lane]));
+        }
+    }
+    for (; I < N; I++)
+    {
+        Lanes[0] = NfNN_Math_Single_Max_f32(Lanes[0], NfNN_Math_Single_Abs_f32(A[I]));
+    }
+
+    f32 Result = 0.0f;
+    for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
+    {
+        Result = NfNN_Math_Single_Max_f32(Result, Lanes[Lane]);
+    }
+    return Result;
+}
+
+// NOTE(luatil): 8-bit block quantization, the returned scale is the largest magnitude of the block
+// over the largest code. Values round to the nearest code. Rounding goes through integer conversion,
+// floorf and ceilf are library calls without SSE4.1 and keep the loops scalar.
+static f32 NfNN_Math_Quantize_s8(f32 *In, u32 N, s8 *Out)
+{
+    f32 Max = NfNN_Math_AbsMax_f32(In, N);
+    f32 Inverse = Max > 0.0f ? 127.0f / Max : 0.0f;
+    for (u32 I = 0; I < N; I++)
+    {
+        f32 Value = In[I] * Inverse;
+        Out[I] = (s8)(s32)(Value + (Value < 0.0f ? -0.5f : 0.5f));
+    }
+    return Max / 127.0f;
+}
+
+static void NfNN_Math_Dequantize_s8(s8 *In, f32 Scale, u32 N, f32 *Out)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Out[I] = (f32)In[I] * Scale;
+    }
+}
+
+// NOTE(luatil): For values that are never negative. They round up, so only zero maps to zero.
+static f32 NfNN_Math_QuantizeUp_u8(f32 *In, u32 N, u8 *Out)
+{
+    f32 Max = NfNN_Math_AbsMax_f32(In, N);
+    f32 Inverse = Max > 0.0f ? 255.0f / Max : 0.0f;
+    for (u32 I = 0; I < N; I++)
+    {
+        f32 Value = In[I] * Inverse;
+        s32 Code = (s32)Value;
+        Code += (f32)Code < Value;
+        Out[I] = (u8)NFNN_MIN(Code, 255);
+    }
+    return Max / 255.0f;
+}
+
+static void NfNN_Math_Dequantize_u8(u8 *In, f32 Scale, u32 N, f32 *Out)
+{
+    for (u32 I = 0; I < N; I++)
+    {
+        Out[I] = (f32)In[I] * Scale;
+    }
+}
+
 #endif // NFNN_MATH_H
@@ -7,6 +7,8 @@
 #include "nfnn_macro.h"
 #include "nfnn_types.h"
 
+struct nfnn_tensor;
+
 typedef struct nfnn_memory_arena nfnn_memory_arena;
 struct nfnn_memory_arena
 {
@@ -14,6 +16,29 @@ struct nfnn_memory_arena
     u64 Size;
     u64 Used;
     u64 TempCount;
+    // NOTE(luatil): Operations executed on this arena are recorded on a tape at
+    // the top of the block, growing down, in execution order
+    u32 TapeCount;
+    u32 TempTapeCount;
+    // NOTE(luatil): Inside a no-grad scope operations record nothing and only allocate
+    // their outputs, with InPlace they may also reuse buffers produced inside the scope
+    u32 NoGradDepth;
+    bool NoGradInPlace;
+    u64 NoGradStart;
+    // NOTE(luatil): In lazy mode operations are only recorded, see NfNN_Realize
+    bool Lazy;
+    // NOTE(luatil): Table of the open intern scope, see nfnn_intern.h
+    struct nfnn_intern *Intern;
+    // NOTE(luatil): Shared constants of the operations on this arena, see NfNN_Constants_Attach
+    struct nfnn_constant_cache *Constants;
+    // NOTE(luatil): Called by backward once the gradient of a leaf is final, see NfNN_AutoGrad_SetGradReady
+    void (*GradReady)(void *Context, struct nfnn_tensor *Leaf);
+    void *GradReadyContext;
+    // NOTE(luatil): Gradient accumulation over micro-batches, see NfNN_AutoGrad_AccumulateBegin. Kept
+    // in the header so rewinding the arena between micro-batches does not end it.
+    u32 AccumulateEpoch; // 0 when not accumulating
+    u32 AccumulateBackwards;
+    f32 AccumulateScale;
 };
 
 static void NfNN_MemoryArena_Init(nfnn_memory_arena *Arena, u64 Size)
@@ -27,6 +52,18 @@ static void NfNN_MemoryArena_Init(nfnn_memory_arena *Arena, u64 Size)
 
     Arena->Size = Size;
     Arena->Used = 0;
+    Arena->TapeCount = 0;
+    Arena->NoGradDepth = 0;
+    Arena->NoGradInPlace = false;
+    Arena->NoGradStart = 0;
+    Arena->Lazy = false;
+    Arena->Intern = 0;
+    Arena->Constants = 0;
+    Arena->GradReady = 0;
+    Arena->GradReadyContext = 0;
+    Arena->AccumulateEpoch = 0;
+    Arena->AccumulateBackwards = 0;
+    Arena->AccumulateScale = 1.0f;
 }
 
 static u8 *NfNN_MemoryArena_Alloc(nfnn_memory_arena *Arena, u64 Size)
@@ -37,27 +74,145 @@ static u8 *NfNN_MemoryArena_Alloc(nfnn_memory_arena *Arena, u64 Size)
     return Result;
 }
 
+// NOTE(luatil): A constant cache that lived in the released memory is dropped with it
+static void NfNN_MemoryArena_Release(nfnn_memory_arena *Arena, u64 From)
+{
+    u8 *Constants = (u8 *)Arena->Constants;
+    if (Constants >= Arena->Base + From && Constants < Arena->Base + Arena->Used)
+    {
+        Arena->Constants = 0;
+    }
+}
+
 static void NfNN_MemoryArena_Clear(nfnn_memory_arena *Arena)
 {
+    NfNN_MemoryArena_Release(Arena, 0);
     memset(Arena->Base, 0, Arena->Size);
     Arena->Used = 0;
+    Arena->TapeCount = 0;
 }
 
 static void NfNN_MemoryArena_TempInit(nfnn_memory_arena *Arena)
 {
     // TODO(luatil): Allow this to be nested
     Arena->TempCount = Arena->Used;
+    Arena->TempTapeCount = Arena->TapeCount;
 }
 
+static void NfNN_MemoryArena_TapeRewind(nfnn_memory_arena *Arena, u32 Count);
+
 static void NfNN_MemoryArena_TempClear(nfnn_memory_arena *Arena)
 {
+    NfNN_MemoryArena_Release(Arena, Arena->TempCount);
     memset(Arena->Base + Arena->TempCount, 0, Arena->Used - Arena->TempCount);
     Arena->Used = Arena->TempCount;
+    NfNN_MemoryArena_TapeRewind(Arena, Arena->TempTapeCount);
+}
+
+// NOTE(luatil): Scopes nest, the outermost one decides whether buffers may be reused
+static void NfNN_MemoryArena_NoGradBegin(nfnn_memory_arena *Arena, bool InPlace)
+{
+    if (Arena->NoGradDepth++ == 0)
+    {
+        Arena->NoGradInPlace = InPlace;
+        Arena->NoGradStart = Arena->Used;
+    }
+}
+
+static void NfNN_MemoryArena_NoGradEnd(nfnn_memory_arena *Arena)
+{
+    NFNN_ASSERT(Arena->NoGradDepth > 0, "NfNN_MemoryArena_NoGradEnd: Not inside a no-grad scope");
+    if (--Arena->NoGradDepth == 0)
+    {
+        Arena->NoGradInPlace = false;
+    }
+}
+
+static void NfNN_MemoryArena_SetLazy(nfnn_memory_arena *Arena, bool Lazy)
+{
+    Arena->Lazy = Lazy;
+}
+
+// NOTE(luatil): Only memory allocated after the outermost scope began can be overwritten,
+// so leaves and parameters living below it are never touched
+static bool NfNN_MemoryArena_IsScratch(nfnn_memory_arena *Arena, void *Pointer)
+{
+    u8 *Start = Arena->Base + Arena->NoGradStart;
+    u8 *End = Arena->Base + Arena->Used;
+    return Arena->NoGradDepth > 0 && Arena->NoGradInPlace && (u8 *)Pointer >= Start && (u8 *)Pointer < End;
+}
+
+// NOTE(luatil): The tape is kept in blocks of dense arrays. Walks over the graph only read the
+// input indexes and flags, the payload pointer of an entry is looked at when it has to run.
+#define NFNN_TAPE_BLOCK 64
+#define NFNN_TAPE_MAX_INPUTS 2
+#define NFNN_TAPE_NONE 0xFFFFFFFF // Input that is not on the tape, or no input at all
+
+typedef struct nfnn_tape_block nfnn_tape_block;
+struct nfnn_tape_block
+{
+    u32 Inputs[NFNN_TAPE_MAX_INPUTS][NFNN_TAPE_BLOCK]; // Tape index of every input of an entry
+    u8 Types[NFNN_TAPE_BLOCK];
+    u8 Flags[NFNN_TAPE_BLOCK];
+    void *Entries[NFNN_TAPE_BLOCK];
+};
+
+static u64 NfNN_MemoryArena_TapeSize(nfnn_memory_arena *Arena)
+{
+    u64 Blocks = ((u64)Arena->TapeCount + NFNN_TAPE_BLOCK - 1) / NFNN_TAPE_BLOCK;
+    return Blocks * sizeof(nfnn_tape_block);
+}
+
+// NOTE(luatil): Blocks grow down from the top of the arena, entry 0 is the first one recorded
+static nfnn_tape_block *NfNN_MemoryArena_TapeBlock(nfnn_memory_arena *Arena, u32 Index)
+{
+    nfnn_tape_block *Top = (nfnn_tape_block *)(Arena->Base + Arena->Size);
+    return Top - 1 - Index / NFNN_TAPE_BLOCK;
+}
+
+static void **NfNN_MemoryArena_TapeEntry(nfnn_memory_arena *Arena, u32 Index)
+{
+    return NfNN_MemoryArena_TapeBlock(Arena, Index)->Entries + Index % NFNN_TAPE_BLOCK;
+}
+
+// NOTE(luatil): Blocks no longer used go back to zero, unused arena memory is always zero
+// and tensors allocated there later must not find old entries in it
+static void NfNN_MemoryArena_TapeRewind(nfnn_memory_arena *Arena, u32 Count)
+{
+    u64 Size = NfNN_MemoryArena_TapeSize(Arena);
+    Arena->TapeCount = Count;
+    u64 Kept = NfNN_MemoryArena_TapeSize(Arena);
+    memset(Arena->Base + Arena->Size - Size, 0, Size - Kept);
+}
+
+static u32 NfNN_MemoryArena_TapePush(nfnn_memory_arena *Arena, void *Entry)
+{
+    u64 Grow = Arena->TapeCount % NFNN_TAPE_BLOCK == 0 ? sizeof(nfnn_tape_block) : 0;
+    NFNN_ASSERT(Arena->Used + NfNN_MemoryArena_TapeSize(Arena) + Grow <= Arena->Size, "Memory arena tape overflow.");
+
+    u32 Result = Arena->TapeCount++;
+    nfnn_tape_block *Block = NfNN_MemoryArena_TapeBlock(Arena, Result);
+    if (Grow)
+    {
+        memset(Block, 0, sizeof(nfnn_tape_block));
+    }
+    u32 Lane = Result % NFNN_TAPE_BLOCK;
+    for (u32 Input = 0; Input < NFNN_TAPE_MAX_INPUTS; Input++)
+    {
+        Block->Inputs[Input][Lane] = NFNN_TAPE_NONE;
+    }
+    Block->Types[Lane] = 0;
+    Block->Flags[Lane] = 0;
+    Block->Entries[Lane] = Entry;
+    return Result;
 }
 
+// NOTE(luatil): Sizes are rounded up to 8 bytes, so byte arrays like the live marks of a
+// backward do not leave the pointers and futex words of later structs misaligned
 static void *NfNN__PushSize(nfnn_memory_arena *Arena, u32 Size)
 {
-    NFNN_ASSERT((Arena->Used + Size) <= Arena->Size, "Memory arena overflow.");
+    Size = (Size + 7) & ~7u;
+    NFNN_ASSERT((Arena->Used + Size + NfNN_MemoryArena_TapeSize(Arena)) <= Arena->Size, "Memory arena overflow.");
     void *Result = Arena->Base + Arena->Used;
     Arena->Used += Size;
     return Result;
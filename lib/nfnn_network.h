@@ -4,12 +4,13 @@
 #include "nfnn_macro.h"
 #include "nfnn_math.h"
 #include "nfnn_memory_arena.h"
+#include "nfnn_ops.h"
 #include "nfnn_platform.h"
 #include "nfnn_tensor.h"
+#include "nfnn_transport.h"
 #include "nfnn_types.h"
 
-static u64 GlobalRead = 0;
-static u64 GlobalWrite = 0;
+#define NFNN_NETWORK_STAGING KB(16) // Received gradients pass through this many bytes at a time
 
 typedef struct nfnn_socket nfnn_socket;
 struct nfnn_socket
@@ -17,17 +18,6 @@ struct nfnn_socket
     nfnn_platform_socket Handle;
 };
 
-typedef struct nfnn_parameter_server nfnn_parameter_server;
-struct nfnn_parameter_server
-{
-    char Host[NFNN_MAXHOST];
-    u32 Port;
-    nfnn_socket *Socket;
-    nfnn_fd_set *Master;
-    nfnn_fd_set *Working;
-    nfnn_platform_socket MaxSocket;
-};
-
 typedef struct nfnn_network_interface nfnn_network_interface;
 struct nfnn_network_interface
 {
@@ -101,7 +91,7 @@ static nfnn_socket *NfNN_Network_TCPListeningSocket(nfnn_memory_arena *Mem, char
         NFNN_ASSERT(0, "bind failed");
     }
 
-    if (listen(Result->Handle, 10) < 0)
+    if (listen(Result->Handle, SOMAXCONN) < 0)
     {
         NFNN_ASSERT(0, "listen failed");
     }
@@ -132,74 +122,31 @@ static void NfNN_Network_DestroyInterface(nfnn_network_interface *Interface)
 #endif
 }
 
-static nfnn_parameter_server *NfNN_ParameterServer_Create(nfnn_memory_arena *Mem, char *Host, u32 Port)
+// NOTE(luatil): Connects a worker to the server on Port, a blocking channel
+static nfnn_channel *NfNN_Network_Connect(nfnn_memory_arena *Mem, nfnn_transport Transport, char *Host, u32 Port)
 {
-    nfnn_parameter_server *Result = NfNN_PushStruct(Mem, nfnn_parameter_server);
-
-    u32 HostLength = NFNN_STRLEN(Host);
-    NfNN_MemoryCopy(Result->Host, Host, HostLength);
-
-    Result->Port = Port;
-    Result->Socket = NfNN_Network_TCPListeningSocket(Mem, Host, Port);
-
-    Result->Master = NfNN_PushStruct(Mem, nfnn_fd_set);
-    Result->Working = NfNN_PushStruct(Mem, nfnn_fd_set);
-
-    NFNN_FD_ZERO(Result->Master);
-    NFNN_FD_ZERO(Result->Working);
-    NFNN_FD_SET(Result->Socket->Handle, Result->Master);
-    Result->MaxSocket = Result->Socket->Handle;
-
+    nfnn_channel *Result = NfNN_PushStruct(Mem, nfnn_channel);
+    if (Transport == NFNN_TRANSPORT_TCP)
+    {
+        *Result = NfNN_Channel_Socket(NfNN_Network_TCPConnect(Mem, Host, Port)->Handle);
+    }
+    else
+    {
+        nfnn_ring_segment *Segment = NfNN_Segment_Open(Transport, Port);
+        u32 Pair = NFNN_ATOMIC_ADD_U32(&Segment->Attached, 1) - 1;
+        NFNN_ASSERT(Pair < NFNN_RING_CHANNELS, "NfNN_Network_Connect: Too many workers on one segment");
+        *Result = NfNN_Channel_Rings(Transport, Segment, Pair, true);
+        NfNN_Segment_Ring(Segment);
+    }
     return Result;
 }
 
-static void NfNN_ParameterServer_AddWorker(nfnn_memory_arena *Mem, nfnn_parameter_server *Server)
+static void NfNN_Network_Disconnect(nfnn_channel *Channel)
 {
-    NfNN_MemoryCopy(Server->Working, Server->Master, sizeof(nfnn_fd_set));
-
-    int SelectResult = select(Server->MaxSocket + 1, Server->Working, 0, 0, 0);
-
-    NFNN_ASSERT(SelectResult >= 0, "select failed");
-
-    for (nfnn_platform_socket SockIt = 1; SockIt <= Server->MaxSocket; SockIt++)
+    NfNN_Channel_Close(Channel);
+    if (Channel->Transport != NFNN_TRANSPORT_TCP)
     {
-        if (NFNN_FD_ISSET(SockIt, Server->Working))
-        {
-            if (SockIt == Server->Socket->Handle)
-            {
-                // New connection (accept
-                struct sockaddr PeerAddr = {0};
-                socklen_t PeerAddrlen = sizeof(struct sockaddr);
-
-                nfnn_platform_socket Peer = accept(Server->Socket->Handle, &PeerAddr, &PeerAddrlen);
-
-                if (Peer == 0)
-                {
-                    printf("accept failed with error: %d\n", NFNN_GETSOCKETERRNO());
-                    NFNN_CLOSESOCKET(Server->Socket->Handle);
-                    return;
-                }
-
-                char NodeBuffer[NI_MAXHOST] = {0};
-                char ServiceBuffer[NI_MAXSERV] = {0};
-
-                getnameinfo(&PeerAddr, PeerAddrlen, NodeBuffer, sizeof(NodeBuffer), ServiceBuffer,
-                            sizeof(ServiceBuffer), NI_NUMERICHOST | NI_NUMERICSERV);
-
-                printf("New connection from %s:%s\n", NodeBuffer, ServiceBuffer);
-
-                NFNN_FD_SET(Peer, Server->Master);
-                Server->MaxSocket = (Peer > Server->MaxSocket) ? Peer : Server->MaxSocket;
-            }
-            else
-            {
-                NFNN_ERROR();
-            }
-        }
-        else
-        {
-            NFNN_NOT_USED();
-        }
+        NfNN_Segment_Close(Channel->Transport, Channel->Segment, 0, false);
     }
 }
 
@@ -265,6 +212,7 @@ static void NfNN_Network_SendGradient(nfnn_memory_arena *Mem, nfnn_platform_sock
 
 static void NfNN_Network_SendTensor(nfnn_memory_arena *Mem, nfnn_platform_socket Sock, nfnn_tensor *T)
 {
+    NfNN_Realize(T);
     NfNN_Network_SendAll(Sock, NfNN_Size(T), (char *)T->Data);
 }
 
@@ -273,110 +221,935 @@ static void NfNN_Network_RecvTensor(nfnn_memory_arena *Mem, nfnn_platform_socket
     NfNN_Network_RecvSize(Sock, NfNN_Size(T), (char *)T->Data);
 }
 
-static void NfNN_ParameterServer_BroadcastWeights(nfnn_memory_arena *Mem, nfnn_parameter_server *Server, nfnn_tensor *T)
+// NOTE(luatil): Adds each piece while it is still in cache, nothing is allocated
+static void NfNN_Network_RecvAddGradient(nfnn_memory_arena *Mem, nfnn_platform_socket Sock, nfnn_tensor *T)
+{
+    f32 Staging[NFNN_NETWORK_STAGING / sizeof(f32)];
+    u32 Length = NfNN_Length(T);
+    for (u32 Offset = 0; Offset < Length; Offset += NFNN_ARRAY_COUNT(Staging))
+    {
+        u32 Piece = NFNN_MIN(Length - Offset, NFNN_ARRAY_COUNT(Staging));
+        NfNN_Network_RecvSize(Sock, Piece * sizeof(f32), (char *)Staging);
+        NfNN_Math_Accumulate_f32(Staging, Piece, T->Gradient + Offset);
+    }
+}
+
+// NOTE(luatil): Framed messages. A step moves all of its tensors in one message, a header that
+// names them and then their data. Tensors that fit in NFNN_NETWORK_BUCKET bytes are packed right
+// after the header, so the header and the small tensors are one piece and every larger tensor is
+// one more piece of the same vectored call. Both ends derive the layout from their own tensors
+// and check the header against it, a message that does not match is a protocol error.
+
+#define NFNN_NETWORK_MAGIC 0x4E4E464E // "NFNN" on the wire
+#define NFNN_NETWORK_MAX_TENSORS 16   // Per message
+#define NFNN_NETWORK_BUCKET KB(4)     // Bytes of small tensors sent together with the header
+
+typedef enum nfnn_message_type
+{
+    NFNN_MESSAGE_WEIGHTS = 1,   // Server to worker, the data of the tensors
+    NFNN_MESSAGE_GRADIENTS = 2, // Worker to server, the gradients of the tensors
+} nfnn_message_type;
+
+typedef struct nfnn_message_entry nfnn_message_entry;
+struct nfnn_message_entry
+{
+    u32 Id;     // Index in the tensor list both ends pass
+    u32 Length; // In floats
+};
+
+typedef struct nfnn_message_header nfnn_message_header;
+struct nfnn_message_header
+{
+    u32 Magic;
+    u32 Type;
+    u32 Step; // Of the weights, gradients carry the step of the weights they were computed on
+    u32 TensorCount;
+    u32 BucketSize;                                       // Bytes of the bucket, the start of the payload
+    u32 PayloadSize;                                      // Bytes after the header
+    nfnn_message_entry Entries[NFNN_NETWORK_MAX_TENSORS]; // In payload order, bucketed ones first
+};
+
+typedef struct nfnn_message_frame nfnn_message_frame;
+struct nfnn_message_frame
+{
+    nfnn_message_header Header;
+    u8 Bucket[NFNN_NETWORK_BUCKET];
+};
+
+static f32 *NfNN_Message_Data(nfnn_tensor *T, u32 Type)
+{
+    return Type == NFNN_MESSAGE_WEIGHTS ? T->Data : T->Gradient;
+}
+
+// NOTE(luatil): Small tensors go into the bucket in id order until it is full, the rest follow
+static void NfNN_Message_Layout(nfnn_message_header *Header, u32 Type, u32 Step, nfnn_tensor **Tensors, u32 Count)
 {
-    for (nfnn_platform_socket Sock = 1; Sock <= Server->MaxSocket; Sock++)
+    NFNN_ASSERT(Count <= NFNN_NETWORK_MAX_TENSORS, "NfNN_Message_Layout: Too many tensors for one message");
+    memset(Header, 0, sizeof(nfnn_message_header));
+    Header->Magic = NFNN_NETWORK_MAGIC;
+    Header->Type = Type;
+    Header->Step = Step;
+    Header->TensorCount = Count;
+
+    bool Bucketed[NFNN_NETWORK_MAX_TENSORS] = {0};
+    u32 EntryCount = 0;
+    for (u32 Id = 0; Id < Count; Id++)
     {
-        if (NFNN_FD_ISSET(Sock, Server->Master))
+        u32 Size = NfNN_Size(Tensors[Id]);
+        if (Header->BucketSize + Size <= NFNN_NETWORK_BUCKET)
         {
-            if (Sock != Server->Socket->Handle)
-            {
-                NfNN_Network_SendTensor(Mem, Sock, T);
-            }
-            else
-            {
-                NFNN_NOT_USED();
-            }
+            Bucketed[Id] = true;
+            Header->BucketSize += Size;
+            Header->Entries[EntryCount++] = (nfnn_message_entry){Id, NfNN_Length(Tensors[Id])};
         }
-        else
+    }
+    for (u32 Id = 0; Id < Count; Id++)
+    {
+        if (!Bucketed[Id])
         {
-            NFNN_NOT_USED();
+            Header->Entries[EntryCount++] = (nfnn_message_entry){Id, NfNN_Length(Tensors[Id])};
         }
     }
+    for (u32 Index = 0; Index < Count; Index++)
+    {
+        Header->PayloadSize += Header->Entries[Index].Length * sizeof(f32);
+    }
 }
 
-static void NfNN_Network_RecvAddGradient(nfnn_memory_arena *Mem, nfnn_platform_socket Sock, nfnn_tensor *T)
+// NOTE(luatil): Everything but the step has to match, Expected comes from NfNN_Message_Layout
+static bool NfNN_Message_Check(nfnn_message_header *Header, nfnn_message_header *Expected)
 {
-    nfnn_tensor *Temp = NfNN_TensorLike(Mem, T);
-    NfNN_Network_RecvGradient(Mem, Sock, Temp);
-    NfNN_Math_Add_f32(Temp->Gradient, T->Gradient, NfNN_Length(T), T->Gradient);
+    return Header->Magic == Expected->Magic && Header->Type == Expected->Type &&
+           Header->TensorCount == Expected->TensorCount && Header->BucketSize == Expected->BucketSize &&
+           Header->PayloadSize == Expected->PayloadSize &&
+           memcmp(Header->Entries, Expected->Entries, sizeof(Header->Entries)) == 0;
 }
 
-static void NfNN_ParameterServer_AwaitGradient(nfnn_memory_arena *Mem, nfnn_parameter_server *Server, nfnn_tensor *T)
+// NOTE(luatil): Copies the bucketed tensors between the bucket and the tensors
+static void NfNN_Message_Bucket(nfnn_message_frame *Frame, nfnn_tensor **Tensors, bool Pack)
 {
-    for (nfnn_platform_socket Sock = 1; Sock <= Server->MaxSocket; Sock++)
+    u32 Offset = 0;
+    for (u32 Index = 0; Index < Frame->Header.TensorCount && Offset < Frame->Header.BucketSize; Index++)
     {
-        if (NFNN_FD_ISSET(Sock, Server->Master))
+        nfnn_message_entry Entry = Frame->Header.Entries[Index];
+        f32 *Data = NfNN_Message_Data(Tensors[Entry.Id], Frame->Header.Type);
+        u32 Size = Entry.Length * sizeof(f32);
+        if (Pack)
         {
-            if (Sock != Server->Socket->Handle)
-            {
-                nfnn_tensor *Temp = NfNN_TensorLike(Mem, T);
-                NfNN_Network_RecvGradient(Mem, Sock, Temp);
-                NfNN_Math_Add_f32(Temp->Gradient, T->Gradient, NfNN_Length(T), T->Gradient);
-            }
-            else
-            {
-                NFNN_NOT_USED();
-            }
+            memcpy(Frame->Bucket + Offset, Data, Size);
         }
         else
         {
-            NFNN_NOT_USED();
+            memcpy(Data, Frame->Bucket + Offset, Size);
+        }
+        Offset += Size;
+    }
+}
+
+// NOTE(luatil): The frame up to the end of the bucket, then one vector per tensor that is not in
+// it. Returns the number of vectors, at most NFNN_NETWORK_MAX_TENSORS + 1.
+static u32 NfNN_Message_Vectors(nfnn_message_frame *Frame, nfnn_tensor **Tensors, nfnn_iovec *Vectors)
+{
+    u32 Result = 1;
+    NFNN_IOVEC_SET(Vectors[0], Frame, sizeof(nfnn_message_header) + Frame->Header.BucketSize);
+
+    u32 Offset = 0;
+    for (u32 Index = 0; Index < Frame->Header.TensorCount; Index++)
+    {
+        nfnn_message_entry Entry = Frame->Header.Entries[Index];
+        u32 Size = Entry.Length * sizeof(f32);
+        if (Offset >= Frame->Header.BucketSize)
+        {
+            NFNN_IOVEC_SET(Vectors[Result], NfNN_Message_Data(Tensors[Entry.Id], Frame->Header.Type), Size);
+            Result++;
+        }
+        Offset += Size;
+    }
+    return Result;
+}
+
+// NOTE(luatil): Moves past Bytes that were transferred, returns the first vector not done
+static u32 NfNN_Message_Advance(nfnn_iovec *Vectors, u32 First, u32 Count, u32 Bytes)
+{
+    while (First < Count && Bytes >= NFNN_IOVEC_LENGTH(Vectors[First]))
+    {
+        Bytes -= NFNN_IOVEC_LENGTH(Vectors[First]);
+        First++;
+    }
+    if (First < Count)
+    {
+        NFNN_IOVEC_SET(Vectors[First], NFNN_IOVEC_BASE(Vectors[First]) + Bytes,
+                       NFNN_IOVEC_LENGTH(Vectors[First]) - Bytes);
+    }
+    return First;
+}
+
+// NOTE(luatil): Blocks until every vector moved
+static void NfNN_Network_TransferVectors(nfnn_channel *Channel, nfnn_iovec *Vectors, u32 Count, bool Send)
+{
+    u32 First = 0;
+    while (First < Count)
+    {
+        int Bytes = NfNN_Channel_Transfer(Channel, Vectors + First, Count - First, Send);
+        if (Bytes == NFNN_CHANNEL_AGAIN)
+        {
+            NfNN_Channel_Wait(Channel, Send);
+            continue;
         }
+        NFNN_ASSERT(Bytes > 0, "NfNN_Network_TransferVectors: Connection failed");
+        First = NfNN_Message_Advance(Vectors, First, Count, Bytes);
     }
 }
 
-static nfnn_platform_socket NfNN_ParameterServer_AwaitForWorker(nfnn_memory_arena *Mem, nfnn_parameter_server *Server)
+// NOTE(luatil): Sends the gradients of the Count tensors as one message, usually in one call
+static void NfNN_Network_SendGradients(nfnn_memory_arena *Mem, nfnn_channel *Channel, u32 Step, nfnn_tensor **Tensors,
+                                       u32 Count)
+{
+    nfnn_message_frame Frame;
+    nfnn_iovec Vectors[NFNN_NETWORK_MAX_TENSORS + 1];
+    NfNN_Message_Layout(&Frame.Header, NFNN_MESSAGE_GRADIENTS, Step, Tensors, Count);
+    NfNN_Message_Bucket(&Frame, Tensors, true);
+    u32 VectorCount = NfNN_Message_Vectors(&Frame, Tensors, Vectors);
+    NfNN_Network_TransferVectors(Channel, Vectors, VectorCount, true);
+}
+
+// NOTE(luatil): Receives the data of the Count tensors, returns the step of the weights
+static u32 NfNN_Network_RecvWeights(nfnn_memory_arena *Mem, nfnn_channel *Channel, nfnn_tensor **Tensors, u32 Count)
+{
+    nfnn_message_frame Frame;
+    nfnn_message_header Expected;
+    nfnn_iovec Vectors[NFNN_NETWORK_MAX_TENSORS + 1];
+    NfNN_Message_Layout(&Expected, NFNN_MESSAGE_WEIGHTS, 0, Tensors, Count);
+    Frame.Header = Expected;
+    u32 VectorCount = NfNN_Message_Vectors(&Frame, Tensors, Vectors);
+    NfNN_Network_TransferVectors(Channel, Vectors, VectorCount, false);
+    NFNN_ASSERT(NfNN_Message_Check(&Frame.Header, &Expected), "NfNN_Network_RecvWeights: Protocol error");
+    NfNN_Message_Bucket(&Frame, Tensors, false);
+    return Frame.Header.Step;
+}
+
+// NOTE(luatil): Readiness of many sockets at once. Linux uses epoll, so a wait costs the number of
+// ready sockets, other platforms fall back to select over the registered sockets.
+
+#define NFNN_POLL_READ 1
+#define NFNN_POLL_WRITE 2
+#define NFNN_POLL_EVENTS 64 // Handled per wait
+
+typedef struct nfnn_poll_event nfnn_poll_event;
+struct nfnn_poll_event
+{
+    u32 Key;
+    bool Readable; // Also set on errors and hangups, the next recv reports them
+    bool Writable;
+};
+
+typedef struct nfnn_poller nfnn_poller;
+struct nfnn_poller
+{
+#if defined(NFNN_PLATFORM_EPOLL)
+    int Handle;
+#else
+    u32 Capacity;
+    nfnn_platform_socket *Sockets; // By key
+    u32 *Interest;                 // By key, 0 when not registered
+    nfnn_fd_set *Read;
+    nfnn_fd_set *Write;
+#endif
+};
+
+static void NfNN_Poller_Init(nfnn_memory_arena *Mem, nfnn_poller *Poller, u32 Capacity)
+{
+#if defined(NFNN_PLATFORM_EPOLL)
+    Poller->Handle = epoll_create1(0);
+    NFNN_ASSERT(Poller->Handle >= 0, "epoll_create1 failed");
+#else
+    Poller->Capacity = Capacity;
+    Poller->Sockets = NfNN_PushArray(Mem, nfnn_platform_socket, Capacity);
+    Poller->Interest = NfNN_PushArray(Mem, u32, Capacity);
+    memset(Poller->Interest, 0, Capacity * sizeof(u32));
+    Poller->Read = NfNN_PushStruct(Mem, nfnn_fd_set);
+    Poller->Write = NfNN_PushStruct(Mem, nfnn_fd_set);
+#endif
+}
+
+static void NfNN_Poller_Destroy(nfnn_poller *Poller)
+{
+#if defined(NFNN_PLATFORM_EPOLL)
+    close(Poller->Handle);
+#endif
+}
+
+// NOTE(luatil): Old is what the socket was registered with, 0 adds it and New 0 removes it
+static void NfNN_Poller_Set(nfnn_poller *Poller, nfnn_platform_socket Socket, u32 Key, u32 Old, u32 New)
 {
-    NfNN_MemoryCopy(Server->Working, Server->Master, sizeof(nfnn_fd_set));
+#if defined(NFNN_PLATFORM_EPOLL)
+    struct epoll_event Event = {0};
+    Event.events = ((New & NFNN_POLL_READ) ? EPOLLIN : 0) | ((New & NFNN_POLL_WRITE) ? EPOLLOUT : 0);
+    Event.data.u32 = Key;
+    int Op = !Old ? EPOLL_CTL_ADD : (!New ? EPOLL_CTL_DEL : EPOLL_CTL_MOD);
+    int Result = epoll_ctl(Poller->Handle, Op, Socket, &Event);
+    NFNN_ASSERT(Result == 0, "epoll_ctl failed");
+#else
+    NFNN_ASSERT(Key < Poller->Capacity, "NfNN_Poller_Set: Key out of range");
+    Poller->Sockets[Key] = Socket;
+    Poller->Interest[Key] = New;
+#endif
+}
 
-    int SelectResult = select(Server->MaxSocket + 1, Server->Working, 0, 0, 0);
+// NOTE(luatil): Blocks until at least one registered socket is ready
+static u32 NfNN_Poller_Wait(nfnn_poller *Poller, nfnn_poll_event *Events, u32 MaxEvents)
+{
+    u32 Result = 0;
+#if defined(NFNN_PLATFORM_EPOLL)
+    struct epoll_event Ready[NFNN_POLL_EVENTS];
+    int Count = epoll_wait(Poller->Handle, Ready, NFNN_MIN(MaxEvents, NFNN_POLL_EVENTS), -1);
+    NFNN_ASSERT(Count >= 0 || errno == EINTR, "epoll_wait failed");
+    for (int Index = 0; Index < Count; Index++)
+    {
+        nfnn_poll_event *Event = Events + Result++;
+        Event->Key = Ready[Index].data.u32;
+        Event->Readable = (Ready[Index].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+        Event->Writable = (Ready[Index].events & (EPOLLOUT | EPOLLERR)) != 0;
+    }
+#else
+    nfnn_platform_socket MaxSocket = 0;
+    NFNN_FD_ZERO(Poller->Read);
+    NFNN_FD_ZERO(Poller->Write);
+    for (u32 Key = 0; Key < Poller->Capacity; Key++)
+    {
+        if (Poller->Interest[Key] & NFNN_POLL_READ)
+        {
+            NFNN_FD_SET(Poller->Sockets[Key], Poller->Read);
+        }
+        if (Poller->Interest[Key] & NFNN_POLL_WRITE)
+        {
+            NFNN_FD_SET(Poller->Sockets[Key], Poller->Write);
+        }
+        if (Poller->Interest[Key])
+        {
+            MaxSocket = NFNN_MAX(MaxSocket, Poller->Sockets[Key]);
+        }
+    }
 
+    int SelectResult = select((int)MaxSocket + 1, Poller->Read, Poller->Write, 0, 0);
     NFNN_ASSERT(SelectResult >= 0, "select failed");
 
-    for (nfnn_platform_socket Sock = 1; Sock <= Server->MaxSocket; Sock++)
+    for (u32 Key = 0; Key < Poller->Capacity && Result < MaxEvents; Key++)
     {
-        if (NFNN_FD_ISSET(Sock, Server->Working))
+        bool Readable = Poller->Interest[Key] && NFNN_FD_ISSET(Poller->Sockets[Key], Poller->Read);
+        bool Writable = Poller->Interest[Key] && NFNN_FD_ISSET(Poller->Sockets[Key], Poller->Write);
+        if (Readable || Writable)
         {
-            if (Sock != Server->Socket->Handle)
-            {
-                return Sock;
-            }
-            else
+            nfnn_poll_event *Event = Events + Result++;
+            Event->Key = Key;
+            Event->Readable = Readable;
+            Event->Writable = Writable;
+        }
+    }
+#endif
+    return Result;
+}
+
+// NOTE(luatil): The parameter server runs a single event loop over non-blocking channels. Every
+// worker is a row in the worker table with its own receive and send progress, the barriers queue
+// work on the connections and poll until it is done, nothing sleeps. Weights go out and gradients
+// come in as framed messages, one vectored call moves a whole message when the channel takes it.
+// TCP channels are polled with the poller, ring channels are checked one by one and the server
+// sleeps on the doorbell of the segment when none is ready.
+
+#define NFNN_PARAMETER_SERVER_MAX_WORKERS 1024
+#define NFNN_PARAMETER_SERVER_LISTENER NFNN_PARAMETER_SERVER_MAX_WORKERS // Poll key of the listening socket
+#define NFNN_PARAMETER_SERVER_NO_WORKER 0xFFFFFFFF
+
+typedef enum nfnn_connection_state
+{
+    NFNN_CONNECTION_IDLE,      // Nothing expected from the worker
+    NFNN_CONNECTION_WAITING,   // Watched until the worker starts a message
+    NFNN_CONNECTION_QUEUED,    // A message started, the worker waits in the ready ring
+    NFNN_CONNECTION_RECEIVING, // The message is added to its targets as it arrives
+    NFNN_CONNECTION_CLOSED,
+} nfnn_connection_state;
+
+typedef struct nfnn_connection nfnn_connection;
+struct nfnn_connection
+{
+    nfnn_channel Channel;
+    nfnn_connection_state State;
+    u32 Interest; // What the poller watches for, NFNN_POLL_*
+
+    nfnn_message_header Header; // Of the message being received
+    f32 *Staging;               // NFNN_NETWORK_STAGING bytes, the payload arrives here one chunk at a time
+    u32 RecvSize;               // Of the payload
+    u32 Received;               // Header included
+    u32 Reduced;                // Bytes of the payload added so far
+    nfnn_tensor **Targets;      // By message id, the payload is added to their gradients
+    u32 Step;                   // Of the weights behind the last gradients taken from the worker
+
+    u32 SendSize; // Of the weights message of the server
+    u32 Sent;
+};
+
+typedef struct nfnn_parameter_server nfnn_parameter_server;
+struct nfnn_parameter_server
+{
+    char Host[NFNN_MAXHOST];
+    u32 Port; // The bound one when created with 0, ring transports pick one
+    nfnn_transport Transport;
+    nfnn_socket *Socket;         // TCP
+    nfnn_ring_segment *Segment; // Ring transports
+    nfnn_memory_arena *Mem; // Long-lived, staging buffers come from here
+    bool Quiet;             // No messages on connects and disconnects
+    nfnn_poller Poller;
+
+    nfnn_connection *Workers;
+    u32 WorkerCount;    // Accepted, closed ones keep their row
+    u32 LiveCount;      // Not closed
+    u32 ExpectedCount;  // Accepting until WorkerCount gets here
+    u32 ReceivingCount; // Connections in NFNN_CONNECTION_RECEIVING
+    u32 CompleteCount;  // Messages that arrived whole during the last await
+    u32 PartialCount;   // Messages cut off by a disconnect during the last await, their chunks were added
+    u32 SendingCount;   // Connections with unsent bytes
+
+    u32 *Ready; // Ring of workers in the order their message started
+    u32 ReadyStart;
+    u32 ReadyCount;
+
+    u32 Step;                     // Of the weights, one more every time gradients were taken
+    nfnn_message_header Expected; // Layout of the gradient messages being received
+    nfnn_message_frame *Frame;    // Weights message being sent, shared by every connection
+    nfnn_iovec Vectors[NFNN_NETWORK_MAX_TENSORS + 1];
+    u32 VectorCount;
+};
+
+static nfnn_parameter_server *NfNN_ParameterServer_Create(nfnn_memory_arena *Mem, nfnn_transport Transport,
+                                                          char *Host, u32 Port)
+{
+    nfnn_parameter_server *Result = NfNN_PushStruct(Mem, nfnn_parameter_server);
+    memset(Result, 0, sizeof(nfnn_parameter_server));
+
+    u32 HostLength = NFNN_STRLEN(Host);
+    NfNN_MemoryCopy(Result->Host, Host, HostLength);
+    Result->Transport = Transport;
+
+    if (Transport == NFNN_TRANSPORT_TCP)
+    {
+        Result->Socket = NfNN_Network_TCPListeningSocket(Mem, Host, Port);
+        NFNN_SET_NONBLOCKING(Result->Socket->Handle);
+
+        struct sockaddr_storage Address = {0};
+        socklen_t AddressLength = sizeof(Address);
+        getsockname(Result->Socket->Handle, (struct sockaddr *)&Address, &AddressLength);
+        Result->Port = Address.ss_family == AF_INET6 ? ntohs(((struct sockaddr_in6 *)&Address)->sin6_port)
+                                                     : ntohs(((struct sockaddr_in *)&Address)->sin_port);
+        NfNN_Poller_Init(Mem, &Result->Poller, NFNN_PARAMETER_SERVER_MAX_WORKERS + 1);
+    }
+    else
+    {
+        Result->Port = Port ? Port : NfNN_Segment_EphemeralPort();
+        Result->Segment = NfNN_Segment_Create(Transport, Result->Port);
+    }
+
+    Result->Mem = Mem;
+    Result->Workers = NfNN_PushArray(Mem, nfnn_connection, NFNN_PARAMETER_SERVER_MAX_WORKERS);
+    memset(Result->Workers, 0, NFNN_PARAMETER_SERVER_MAX_WORKERS * sizeof(nfnn_connection));
+    Result->Ready = NfNN_PushArray(Mem, u32, NFNN_PARAMETER_SERVER_MAX_WORKERS);
+    Result->Frame = NfNN_PushStruct(Mem, nfnn_message_frame);
+
+    return Result;
+}
+
+static void NfNN_ParameterServer_Watch(nfnn_parameter_server *Server, u32 Worker)
+{
+    nfnn_connection *Connection = Server->Workers + Worker;
+    u32 Interest = 0;
+    if (Connection->State != NFNN_CONNECTION_CLOSED)
+    {
+        bool Read = Connection->State == NFNN_CONNECTION_WAITING || Connection->State == NFNN_CONNECTION_RECEIVING;
+        Interest |= Read ? NFNN_POLL_READ : 0;
+        Interest |= Connection->Sent < Connection->SendSize ? NFNN_POLL_WRITE : 0;
+    }
+    if (Interest != Connection->Interest && Server->Transport == NFNN_TRANSPORT_TCP)
+    {
+        NfNN_Poller_Set(&Server->Poller, Connection->Channel.Handle, Worker, Connection->Interest, Interest);
+    }
+    Connection->Interest = Interest;
+}
+
+static void NfNN_ParameterServer_Close(nfnn_parameter_server *Server, u32 Worker)
+{
+    nfnn_connection *Connection = Server->Workers + Worker;
+    if (Connection->State == NFNN_CONNECTION_CLOSED)
+    {
+        return;
+    }
+
+    Server->ReceivingCount -= Connection->State == NFNN_CONNECTION_RECEIVING;
+    Server->PartialCount += Connection->State == NFNN_CONNECTION_RECEIVING && Connection->Reduced > 0;
+    Server->SendingCount -= Connection->Sent < Connection->SendSize;
+    Connection->State = NFNN_CONNECTION_CLOSED;
+    Connection->SendSize = Connection->Sent = 0;
+    NfNN_ParameterServer_Watch(Server, Worker);
+    NfNN_Channel_Close(&Connection->Channel);
+    Server->LiveCount--;
+
+    if (!Server->Quiet)
+    {
+        printf("Worker %u disconnected\n", Worker);
+    }
+}
+
+static nfnn_connection *NfNN_ParameterServer_AddConnection(nfnn_parameter_server *Server, nfnn_channel Channel)
+{
+    nfnn_connection *Result = Server->Workers + Server->WorkerCount++;
+    memset(Result, 0, sizeof(nfnn_connection));
+    Result->Channel = Channel;
+    Result->Staging = NfNN_PushArray(Server->Mem, f32, NFNN_NETWORK_STAGING / sizeof(f32));
+    Result->State = NFNN_CONNECTION_IDLE;
+    Server->LiveCount++;
+    return Result;
+}
+
+static void NfNN_ParameterServer_Accept(nfnn_parameter_server *Server)
+{
+    if (Server->Transport != NFNN_TRANSPORT_TCP)
+    {
+        u32 Attached = NFNN_MIN(NFNN_ATOMIC_LOAD_U32(&Server->Segment->Attached), NFNN_RING_CHANNELS);
+        while (Server->WorkerCount < Server->ExpectedCount && Server->WorkerCount < Attached)
+        {
+            nfnn_channel Channel = NfNN_Channel_Rings(Server->Transport, Server->Segment, Server->WorkerCount, false);
+            NfNN_ParameterServer_AddConnection(Server, Channel);
+        }
+        return;
+    }
+
+    while (Server->WorkerCount < Server->ExpectedCount)
+    {
+        struct sockaddr_storage PeerAddr = {0};
+        socklen_t PeerAddrlen = sizeof(PeerAddr);
+
+        nfnn_platform_socket Peer = accept(Server->Socket->Handle, (struct sockaddr *)&PeerAddr, &PeerAddrlen);
+
+        if (!NFNN_ISVALIDSOCKET(Peer))
+        {
+            NFNN_ASSERT(NFNN_WOULDBLOCK(), "accept failed");
+            break;
+        }
+
+        char NodeBuffer[NI_MAXHOST] = {0};
+        char ServiceBuffer[NI_MAXSERV] = {0};
+
+        getnameinfo((struct sockaddr *)&PeerAddr, PeerAddrlen, NodeBuffer, sizeof(NodeBuffer), ServiceBuffer,
+                    sizeof(ServiceBuffer), NI_NUMERICHOST | NI_NUMERICSERV);
+
+        if (!Server->Quiet)
+        {
+            printf("New connection from %s:%s\n", NodeBuffer, ServiceBuffer);
+        }
+
+        NFNN_SET_NONBLOCKING(Peer);
+        NfNN_ParameterServer_AddConnection(Server, NfNN_Channel_Socket(Peer));
+    }
+}
+
+
+// NOTE(luatil): Adds the staged chunk, bytes [Reduced, Reduced + Size) of the payload
+static void NfNN_ParameterServer_AddChunk(nfnn_parameter_server *Server, nfnn_connection *Connection, u32 Size)
+{
+    f32 *In = Connection->Staging;
+    u32 Offset = Connection->Reduced / sizeof(f32);
+    u32 Count = Size / sizeof(f32);
+    for (u32 Index = 0; Index < Server->Expected.TensorCount && Count > 0; Index++)
+    {
+        nfnn_message_entry Entry = Server->Expected.Entries[Index];
+        if (Offset >= Entry.Length)
+        {
+            Offset -= Entry.Length;
+            continue;
+        }
+
+        u32 Piece = NFNN_MIN(Count, Entry.Length - Offset);
+        NfNN_Math_Accumulate_f32(In, Piece, Connection->Targets[Entry.Id]->Gradient + Offset);
+        In += Piece;
+        Count -= Piece;
+        Offset = 0;
+    }
+}
+
+// NOTE(luatil): Reads up to one chunk into the staging buffer and adds it once it is complete,
+// the first read also takes the header. A worker sending a lot does not hold up the others, the
+// poller reports the connection again while more is waiting. A header that does not match the
+// expected layout, or is from a step that did not happen yet, closes the connection.
+static void NfNN_ParameterServer_Receive(nfnn_parameter_server *Server, u32 Worker)
+{
+    nfnn_connection *Connection = Server->Workers + Worker;
+    if (Connection->State == NFNN_CONNECTION_WAITING)
+    {
+        Connection->State = NFNN_CONNECTION_QUEUED;
+        Server->Ready[(Server->ReadyStart + Server->ReadyCount++) % NFNN_PARAMETER_SERVER_MAX_WORKERS] = Worker;
+        NfNN_ParameterServer_Watch(Server, Worker);
+        return;
+    }
+    if (Connection->State != NFNN_CONNECTION_RECEIVING)
+    {
+        return;
+    }
+
+    u32 HeaderSize = sizeof(nfnn_message_header);
+    u32 ChunkEnd = NFNN_MIN(Connection->RecvSize, Connection->Reduced + NFNN_NETWORK_STAGING);
+    while (Connection->Received < HeaderSize + ChunkEnd)
+    {
+        nfnn_iovec Vectors[2];
+        u32 VectorCount = 0;
+        u32 Payload = 0;
+        if (Connection->Received < HeaderSize)
+        {
+            NFNN_IOVEC_SET(Vectors[0], (u8 *)&Connection->Header + Connection->Received,
+                           HeaderSize - Connection->Received);
+            VectorCount++;
+        }
+        else
+        {
+            Payload = Connection->Received - HeaderSize;
+        }
+        NFNN_IOVEC_SET(Vectors[VectorCount], (u8 *)Connection->Staging + (Payload - Connection->Reduced),
+                       ChunkEnd - Payload);
+        VectorCount++;
+
+        int Recv = NfNN_Channel_Transfer(&Connection->Channel, Vectors, VectorCount, false);
+        if (Recv > 0)
+        {
+            bool HadHeader = Connection->Received >= HeaderSize;
+            Connection->Received += Recv;
+            if (!HadHeader && Connection->Received >= HeaderSize &&
+                (!NfNN_Message_Check(&Connection->Header, &Server->Expected) || Connection->Header.Step > Server->Step))
             {
-                NFNN_NOT_USED();
+                if (!Server->Quiet)
+                {
+                    printf("Worker %u: Protocol error\n", Worker);
+                }
+                NfNN_ParameterServer_Close(Server, Worker);
+                return;
             }
         }
+        else if (Recv == NFNN_CHANNEL_AGAIN)
+        {
+            return;
+        }
         else
         {
-            NFNN_NOT_USED();
+            NfNN_ParameterServer_Close(Server, Worker);
+            return;
         }
     }
-    return -1;
+
+    NfNN_ParameterServer_AddChunk(Server, Connection, ChunkEnd - Connection->Reduced);
+    Connection->Reduced = ChunkEnd;
+
+    if (Connection->Reduced == Connection->RecvSize)
+    {
+        Connection->State = NFNN_CONNECTION_IDLE;
+        Connection->Targets = 0;
+        Connection->Step = Connection->Header.Step;
+        Server->ReceivingCount--;
+        Server->CompleteCount++;
+        NfNN_ParameterServer_Watch(Server, Worker);
+    }
 }
 
-static void NfNN_ParameterServer_WaitWorkers(nfnn_memory_arena *Mem, nfnn_parameter_server *Server, u32 NumberOfWorkers)
+static void NfNN_ParameterServer_Flush(nfnn_parameter_server *Server, u32 Worker)
 {
-    u32 ReadyToRead = 0;
-    for (;;)
+    nfnn_connection *Connection = Server->Workers + Worker;
+    while (Connection->Sent < Connection->SendSize)
+    {
+        nfnn_iovec Vectors[NFNN_NETWORK_MAX_TENSORS + 1];
+        memcpy(Vectors, Server->Vectors, Server->VectorCount * sizeof(nfnn_iovec));
+        u32 First = NfNN_Message_Advance(Vectors, 0, Server->VectorCount, Connection->Sent);
+
+        int Sent = NfNN_Channel_Transfer(&Connection->Channel, Vectors + First, Server->VectorCount - First, true);
+        if (Sent > 0)
+        {
+            Connection->Sent += Sent;
+        }
+        else if (Sent == NFNN_CHANNEL_AGAIN)
+        {
+            NfNN_ParameterServer_Watch(Server, Worker);
+            return;
+        }
+        else
+        {
+            NfNN_ParameterServer_Close(Server, Worker);
+            return;
+        }
+    }
+
+    Connection->SendSize = Connection->Sent = 0;
+    Server->SendingCount--;
+    NfNN_ParameterServer_Watch(Server, Worker);
+}
+
+// NOTE(luatil): Ring channels that are ready for what they are watched for, the listener key
+// stands for workers that attached and were not accepted yet. Returns 0 without waiting.
+static u32 NfNN_ParameterServer_RingEvents(nfnn_parameter_server *Server, nfnn_poll_event *Events, u32 MaxEvents)
+{
+    u32 Result = 0;
+    if (Server->WorkerCount < Server->ExpectedCount &&
+        Server->WorkerCount < NFNN_ATOMIC_LOAD_U32(&Server->Segment->Attached))
+    {
+        nfnn_poll_event *Event = Events + Result++;
+        Event->Key = NFNN_PARAMETER_SERVER_LISTENER;
+        Event->Readable = true;
+        Event->Writable = false;
+    }
+    for (u32 Worker = 0; Worker < Server->WorkerCount && Result < MaxEvents; Worker++)
+    {
+        nfnn_connection *Connection = Server->Workers + Worker;
+        bool Readable = (Connection->Interest & NFNN_POLL_READ) && NfNN_Channel_Ready(&Connection->Channel, false);
+        bool Writable = (Connection->Interest & NFNN_POLL_WRITE) && NfNN_Channel_Ready(&Connection->Channel, true);
+        if (Readable || Writable)
+        {
+            nfnn_poll_event *Event = Events + Result++;
+            Event->Key = Worker;
+            Event->Readable = Readable;
+            Event->Writable = Writable;
+        }
+    }
+    return Result;
+}
+
+// NOTE(luatil): Waits once and handles everything that became ready
+static void NfNN_ParameterServer_Poll(nfnn_parameter_server *Server)
+{
+    nfnn_poll_event Events[NFNN_POLL_EVENTS];
+    u32 EventCount = 0;
+    if (Server->Transport == NFNN_TRANSPORT_TCP)
+    {
+        EventCount = NfNN_Poller_Wait(&Server->Poller, Events, NFNN_POLL_EVENTS);
+    }
+    else
     {
-        for (nfnn_platform_socket Sock = 1; Sock <= Server->MaxSocket; Sock++)
+        for (;;)
         {
-            if (NFNN_FD_ISSET(Sock, Server->Master) && Sock != Server->Socket->Handle)
+            u32 Seen = NFNN_ATOMIC_LOAD_U32(&Server->Segment->Doorbell);
+            EventCount = NfNN_ParameterServer_RingEvents(Server, Events, NFNN_POLL_EVENTS);
+            if (EventCount > 0)
             {
-                ReadyToRead++;
+                break;
             }
+            NfNN_Segment_Wait(Server->Segment, Seen);
         }
-        if (ReadyToRead == NumberOfWorkers)
+    }
+    for (u32 Index = 0; Index < EventCount; Index++)
+    {
+        nfnn_poll_event *Event = Events + Index;
+        if (Event->Key == NFNN_PARAMETER_SERVER_LISTENER)
         {
-            break;
+            NfNN_ParameterServer_Accept(Server);
+            continue;
         }
-        else
+        if (Event->Readable)
+        {
+            NfNN_ParameterServer_Receive(Server, Event->Key);
+        }
+        if (Event->Writable && Server->Workers[Event->Key].Sent < Server->Workers[Event->Key].SendSize)
+        {
+            NfNN_ParameterServer_Flush(Server, Event->Key);
+        }
+    }
+}
+
+// NOTE(luatil): Builds the weights message of the Count tensors at the current step. The large
+// tensors are sent straight from their data, they must not change until SendingCount drops back.
+static void NfNN_ParameterServer_Frame(nfnn_parameter_server *Server, nfnn_tensor **Tensors, u32 Count)
+{
+    NFNN_ASSERT(Server->SendingCount == 0, "NfNN_ParameterServer_Frame: Send in progress");
+    for (u32 Index = 0; Index < Count; Index++)
+    {
+        NfNN_Realize(Tensors[Index]);
+    }
+    NfNN_Message_Layout(&Server->Frame->Header, NFNN_MESSAGE_WEIGHTS, Server->Step, Tensors, Count);
+    NfNN_Message_Bucket(Server->Frame, Tensors, true);
+    Server->VectorCount = NfNN_Message_Vectors(Server->Frame, Tensors, Server->Vectors);
+}
+
+// NOTE(luatil): Sends the message built by NfNN_ParameterServer_Frame once the socket takes it
+static void NfNN_ParameterServer_QueueSend(nfnn_parameter_server *Server, u32 Worker)
+{
+    nfnn_connection *Connection = Server->Workers + Worker;
+    NFNN_ASSERT(Connection->Sent == Connection->SendSize, "NfNN_ParameterServer_QueueSend: Send in progress");
+    if (Connection->State == NFNN_CONNECTION_CLOSED)
+    {
+        return;
+    }
+
+    Connection->SendSize = sizeof(nfnn_message_header) + Server->Frame->Header.PayloadSize;
+    Connection->Sent = 0;
+    Server->SendingCount++;
+    NfNN_ParameterServer_Flush(Server, Worker);
+}
+
+// NOTE(luatil): The next message of the worker gets added to the gradients of the targets, which
+// are indexed by message id and have to stay valid until it arrived. Server->Expected has the
+// layout.
+static void NfNN_ParameterServer_Expect(nfnn_parameter_server *Server, u32 Worker, nfnn_tensor **Targets)
+{
+    nfnn_connection *Connection = Server->Workers + Worker;
+    if (Connection->State != NFNN_CONNECTION_IDLE && Connection->State != NFNN_CONNECTION_QUEUED)
+    {
+        return;
+    }
+
+    Connection->Targets = Targets;
+    Connection->RecvSize = Server->Expected.PayloadSize;
+    Connection->Received = 0;
+    Connection->Reduced = 0;
+    Connection->State = NFNN_CONNECTION_RECEIVING;
+    Server->ReceivingCount++;
+    NfNN_ParameterServer_Watch(Server, Worker);
+}
+
+static void NfNN_ParameterServer_AcceptWorkers(nfnn_parameter_server *Server, u32 NumberOfWorkers)
+{
+    NFNN_ASSERT(NumberOfWorkers <= NFNN_PARAMETER_SERVER_MAX_WORKERS, "Too many workers");
+    NFNN_ASSERT(Server->Transport == NFNN_TRANSPORT_TCP || NumberOfWorkers <= NFNN_RING_CHANNELS,
+                "Too many workers for a ring transport");
+    Server->ExpectedCount = NumberOfWorkers;
+
+    bool Listen = Server->Transport == NFNN_TRANSPORT_TCP;
+    if (Listen)
+    {
+        NfNN_Poller_Set(&Server->Poller, Server->Socket->Handle, NFNN_PARAMETER_SERVER_LISTENER, 0, NFNN_POLL_READ);
+    }
+    NfNN_ParameterServer_Accept(Server);
+    while (Server->WorkerCount < Server->ExpectedCount)
+    {
+        NfNN_ParameterServer_Poll(Server);
+    }
+    if (Listen)
+    {
+        NfNN_Poller_Set(&Server->Poller, Server->Socket->Handle, NFNN_PARAMETER_SERVER_LISTENER, NFNN_POLL_READ, 0);
+    }
+}
+
+// NOTE(luatil): Sends the data of the Count tensors to every worker as one message, all sends
+// make progress at the same time
+static void NfNN_ParameterServer_BroadcastWeights(nfnn_memory_arena *Mem, nfnn_parameter_server *Server,
+                                                  nfnn_tensor **Tensors, u32 Count)
+{
+    NfNN_ParameterServer_Frame(Server, Tensors, Count);
+    for (u32 Worker = 0; Worker < Server->WorkerCount; Worker++)
+    {
+        NfNN_ParameterServer_QueueSend(Server, Worker);
+    }
+    while (Server->SendingCount > 0)
+    {
+        NfNN_ParameterServer_Poll(Server);
+    }
+}
+
+static void NfNN_ParameterServer_SendWeights(nfnn_memory_arena *Mem, nfnn_parameter_server *Server, u32 Worker,
+                                             nfnn_tensor **Tensors, u32 Count)
+{
+    NfNN_ParameterServer_Frame(Server, Tensors, Count);
+    NfNN_ParameterServer_QueueSend(Server, Worker);
+    while (Server->Workers[Worker].Sent < Server->Workers[Worker].SendSize)
+    {
+        NfNN_ParameterServer_Poll(Server);
+    }
+}
+
+// NOTE(luatil): Barrier, adds the gradients of the Count tensors from every live worker to their
+// gradients and moves to the next step. Chunks are added as they arrive from whichever worker has
+// data, so the receives of slow workers overlap with the adds of fast ones. The order of the
+// adds, and with it the last bits of the sum, depends on the timing. Returns the number of workers
+// whose message arrived whole. A worker that leaves midway keeps the chunks it sent in the sum and
+// counts in Server->PartialCount, the caller should drop or redo such a step.
+static u32 NfNN_ParameterServer_AwaitGradients(nfnn_memory_arena *Mem, nfnn_parameter_server *Server,
+                                               nfnn_tensor **Tensors, u32 Count)
+{
+    Server->CompleteCount = 0;
+    Server->PartialCount = 0;
+    NfNN_Message_Layout(&Server->Expected, NFNN_MESSAGE_GRADIENTS, Server->Step, Tensors, Count);
+    for (u32 Worker = 0; Worker < Server->WorkerCount; Worker++)
+    {
+        NfNN_ParameterServer_Expect(Server, Worker, Tensors);
+    }
+    while (Server->ReceivingCount > 0)
+    {
+        NfNN_ParameterServer_Poll(Server);
+    }
+    Server->Step++;
+    return Server->CompleteCount;
+}
+
+// NOTE(luatil): Waits for the next worker that sends the gradients of all Count tensors, adds
+// them to the tensors and moves to the next step. Workers[Result].Step tells which weights they
+// were computed on. Workers are served in the order their message started and stay watched until
+// it does, so do not mix with NfNN_ParameterServer_AwaitGradients. The message of a waiting
+// worker stays in its socket until the worker is served. Returns NFNN_PARAMETER_SERVER_NO_WORKER
+// when every worker is gone. Server->PartialCount tells whether a worker left midway before the
+// returned one was served, its chunks are then in the tensors too.
+static u32 NfNN_ParameterServer_AwaitAnyGradient(nfnn_memory_arena *Mem, nfnn_parameter_server *Server,
+                                                 nfnn_tensor **Tensors, u32 Count)
+{
+    Server->CompleteCount = 0;
+    Server->PartialCount = 0;
+    NfNN_Message_Layout(&Server->Expected, NFNN_MESSAGE_GRADIENTS, Server->Step, Tensors, Count);
+    for (u32 Worker = 0; Worker < Server->WorkerCount; Worker++)
+    {
+        if (Server->Workers[Worker].State == NFNN_CONNECTION_IDLE)
+        {
+            Server->Workers[Worker].State = NFNN_CONNECTION_WAITING;
+            NfNN_ParameterServer_Watch(Server, Worker);
+        }
+    }
+
+    for (;;)
+    {
+        while (Server->ReadyCount == 0 && Server->LiveCount > 0)
+        {
+            NfNN_ParameterServer_Poll(Server);
+        }
+        if (Server->ReadyCount == 0)
+        {
+            return NFNN_PARAMETER_SERVER_NO_WORKER;
+        }
+
+        u32 Result = Server->Ready[Server->ReadyStart];
+        Server->ReadyStart = (Server->ReadyStart + 1) % NFNN_PARAMETER_SERVER_MAX_WORKERS;
+        Server->ReadyCount--;
+
+        // NOTE(luatil): A worker that leaves midway keeps the chunks it sent in the tensors, see PartialCount
+        NfNN_ParameterServer_Expect(Server, Result, Tensors);
+        while (Server->Workers[Result].State == NFNN_CONNECTION_RECEIVING)
+        {
+            NfNN_ParameterServer_Poll(Server);
+        }
+        if (Server->Workers[Result].State == NFNN_CONNECTION_IDLE)
         {
-            ReadyToRead = 0;
-            NFNN_PLATFORM_SLEEP(0.01);
+            Server->Step++;
+            return Result;
         }
     }
 }
 
+static void NfNN_ParameterServer_Destroy(nfnn_parameter_server *Server)
+{
+    for (u32 Worker = 0; Worker < Server->WorkerCount; Worker++)
+    {
+        if (Server->Workers[Worker].State != NFNN_CONNECTION_CLOSED)
+        {
+            NfNN_Channel_Close(&Server->Workers[Worker].Channel);
+        }
+    }
+    if (Server->Transport == NFNN_TRANSPORT_TCP)
+    {
+        NFNN_CLOSESOCKET(Server->Socket->Handle);
+        NfNN_Poller_Destroy(&Server->Poller);
+    }
+    else
+    {
+        NfNN_Segment_Close(Server->Transport, Server->Segment, Server->Port, true);
+    }
+}
+
 #endif // NFNN_NETWORK_H
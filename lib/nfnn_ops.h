@@ -1,6 +1,7 @@
 #ifndef NFNN_OPS_H
 #define NFNN_OPS_H
 
+#include "nfnn_intern.h"
 #include "nfnn_math.h"
 #include "nfnn_memory_arena.h"
 #include "nfnn_random.h"
@@ -33,8 +34,238 @@ static nfnn_op NfNN_Op_Unary(nfnn_op_type Type, nfnn_tensor *Input)
     return Result;
 }
 
+// NOTE(luatil): Forward kernels only read the op and its inputs, so a recorded
+// graph can be run again after new data is copied into its leaves
+static void NfNN_Op_Forward_Copy(nfnn_tensor *T)
+{
+    NfNN_MemoryCopy(T->Data, T->Op.Unary.Input->Data, NfNN_Size(T));
+}
+
+static void NfNN_Op_Forward_Sigmoid(nfnn_tensor *T)
+{
+    NfNN_Math_Sigmoid_f32(T->Op.Unary.Input->Data, NfNN_Length(T), T->Data);
+}
+
+static void NfNN_Op_Forward_MultiplyByConstant(nfnn_tensor *T)
+{
+    NfNN_Math_MultiplyByConstant_f32(T->Op.Constant.Input->Data, NfNN_Length(T), T->Op.Constant.ConstantInputf32,
+                                     T->Data);
+}
+
+static void NfNN_Op_Forward_Add(nfnn_tensor *T)
+{
+    NfNN_Math_Add_f32(T->Op.Binary.Left->Data, T->Op.Binary.Right->Data, NfNN_Length(T), T->Data);
+}
+
+static void NfNN_Op_Forward_BroadcastAdd(nfnn_tensor *T)
+{
+    nfnn_tensor *X = T->Op.Binary.Left;
+    nfnn_tensor *Y = T->Op.Binary.Right;
+    NfNN_Math_BroadcastAdd_f32(X->Data, X->Dimensions.Dimensions[0], X->Dimensions.Dimensions[1], Y->Data,
+                               Y->Dimensions.Dimensions[0], Y->Dimensions.Dimensions[1], T->Data);
+}
+
+static void NfNN_Op_Forward_Sub(nfnn_tensor *T)
+{
+    NfNN_Math_Sub_f32(T->Op.Binary.Left->Data, T->Op.Binary.Right->Data, NfNN_Length(T), T->Data);
+}
+
+static void NfNN_Op_Forward_Mul(nfnn_tensor *T)
+{
+    NfNN_Math_Hadamard_f32(T->Op.Binary.Left->Data, T->Op.Binary.Right->Data, NfNN_Length(T), T->Data);
+}
+
+static void NfNN_Op_Forward_MatMul(nfnn_tensor *T)
+{
+    nfnn_tensor *X = T->Op.Binary.Left;
+    nfnn_tensor *Y = T->Op.Binary.Right;
+    NfNN_Math_MatMul_f32(X->Data, Y->Data, X->Dimensions.Dimensions[0], X->Dimensions.Dimensions[1],
+                         Y->Dimensions.Dimensions[1], T->Data);
+}
+
+static void NfNN_Op_Forward_ReLU(nfnn_tensor *T)
+{
+    if (T->Op.Saved.Mask)
+    {
+        NfNN_Math_ReLUMask_f32(T->Op.Unary.Input->Data, NfNN_Length(T), T->Data, T->Op.Saved.Mask);
+    }
+    else
+    {
+        NfNN_Math_ReLU_f32(T->Op.Unary.Input->Data, NfNN_Length(T), T->Data);
+    }
+}
+
+static void NfNN_Op_Forward_Tanh(nfnn_tensor *T)
+{
+    NfNN_Math_Tanh_f32(T->Op.Unary.Input->Data, NfNN_Length(T), T->Data);
+}
+
+static void NfNN_Op_Forward_Square(nfnn_tensor *T)
+{
+    NfNN_Math_Square_f32(T->Op.Unary.Input->Data, NfNN_Length(T), T->Data);
+}
+
+static void NfNN_Op_Forward_LogSoftmax(nfnn_tensor *T)
+{
+    nfnn_tensor *X = T->Op.Dimensional.Input;
+    NfNN_Math_LogSoftmax_f32(X->Data, X->Dimensions.Dimensions[0], X->Dimensions.Dimensions[1], T->Op.Dimensional.Dim,
+                             T->Data);
+}
+
+static void NfNN_Op_Forward_NLLLoss(nfnn_tensor *T)
+{
+    nfnn_tensor *X = T->Op.Binary.Left;
+    NfNN_Math_NLLLoss_Mean_f32(X->Data, T->Op.Binary.Right->Data, X->Dimensions.Dimensions[0],
+                               X->Dimensions.Dimensions[1], T->Data);
+}
+
+static void NfNN_Op_Forward_Argmax(nfnn_tensor *T)
+{
+    nfnn_tensor *X = T->Op.Dimensional.Input;
+    NfNN_Math_Argmax(X->Data, X->Dimensions.Dimensions[0], X->Dimensions.Dimensions[1], T->Op.Dimensional.Dim,
+                     T->Data);
+}
+
+static void NfNN_Op_Forward_Equal(nfnn_tensor *T)
+{
+    NfNN_Math_Close_f32(T->Op.Binary.Left->Data, T->Op.Binary.Right->Data, NfNN_Length(T), T->Data,
+                        NFNN_EPS_FOR_EQUAL);
+}
+
+static nfnn_op_kernel *NfNN_Op_ForwardKernel(nfnn_tensor *T)
+{
+    nfnn_op_kernel *Result = 0;
+    switch (T->Op.Type)
+    {
+    case NFNN_OP_TYPE_COPY:
+    case NFNN_OP_TYPE_RESHAPE: {
+        Result = NfNN_Op_Forward_Copy;
+    }
+    break;
+    case NFNN_OP_TYPE_SIGMOID: {
+        Result = NfNN_Op_Forward_Sigmoid;
+    }
+    break;
+    case NFNN_OP_TYPE_MUL_CONST: {
+        Result = NfNN_Op_Forward_MultiplyByConstant;
+    }
+    break;
+    case NFNN_OP_TYPE_ADD: {
+        Result = NfNN_Op_Forward_Add;
+    }
+    break;
+    case NFNN_OP_TYPE_BROADCAST_ADD: {
+        Result = NfNN_Op_Forward_BroadcastAdd;
+    }
+    break;
+    case NFNN_OP_TYPE_SUB: {
+        Result = NfNN_Op_Forward_Sub;
+    }
+    break;
+    case NFNN_OP_TYPE_MUL: {
+        Result = NfNN_Op_Forward_Mul;
+    }
+    break;
+    case NFNN_OP_TYPE_MATMUL: {
+        Result = NfNN_Op_Forward_MatMul;
+    }
+    break;
+    case NFNN_OP_TYPE_RELU: {
+        Result = NfNN_Op_Forward_ReLU;
+    }
+    break;
+    case NFNN_OP_TYPE_TANH: {
+        Result = NfNN_Op_Forward_Tanh;
+    }
+    break;
+    case NFNN_OP_TYPE_SQUARE: {
+        Result = NfNN_Op_Forward_Square;
+    }
+    break;
+    case NFNN_OP_TYPE_LOG_SOFTMAX: {
+        Result = NfNN_Op_Forward_LogSoftmax;
+    }
+    break;
+    case NFNN_OP_TYPE_NLL_LOSS: {
+        Result = NfNN_Op_Forward_NLLLoss;
+    }
+    break;
+    case NFNN_OP_TYPE_ARGMAX: {
+        Result = NfNN_Op_Forward_Argmax;
+    }
+    break;
+    case NFNN_OP_TYPE_EQUAL: {
+        Result = NfNN_Op_Forward_Equal;
+    }
+    break;
+    case NFNN_OP_TYPE_LEAF: {
+        NFNN_NOT_USED();
+    }
+    break;
+    case NFNN_OP_TYPE_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+    return Result;
+}
+
+// NOTE(luatil): Runs the pending kernels T depends on in tape order. Lazy results nothing
+// demanded, like predictions when only the loss is read, are never computed.
+static void NfNN_Realize(nfnn_tensor *T)
+{
+    nfnn_memory_arena *Mem = T->Pending;
+    if (!Mem)
+    {
+        return;
+    }
+
+    u8 *Live = NfNN_Tape_MarkLive(Mem, T, false);
+    for (u32 Index = 0; Index <= T->TapeIndex; Index++)
+    {
+        u8 *Flags = NfNN_Tape_Flags(Mem, Index);
+        if (Live[Index] && (*Flags & NFNN_TAPE_PENDING))
+        {
+            nfnn_tensor *It = NfNN_Tape_Get(Mem, Index);
+            NfNN_Op_ForwardKernel(It)(It);
+            It->Pending = 0;
+            *Flags &= ~NFNN_TAPE_PENDING;
+        }
+    }
+}
+
+// NOTE(luatil): Eager by default. A lazy arena only records the operation, under no-grad
+// nothing is recorded so it always runs right away. Returns the tensor to use, inside an
+// intern scope that can be an earlier result of the same op.
+static nfnn_tensor *NfNN_Op_Execute(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    nfnn_tensor *Interned = NfNN_Intern_Find(Mem, T);
+    if (Interned)
+    {
+        return Interned;
+    }
+
+    if (Mem->Lazy && Mem->NoGradDepth == 0)
+    {
+        T->Pending = Mem;
+    }
+    else
+    {
+        for (u32 Input = 0; Input < NfNN_Op_InputCount(T->Op.Type); Input++)
+        {
+            NfNN_Realize(T->Op.Inputs[Input]);
+        }
+        NfNN_Op_ForwardKernel(T)(T);
+    }
+    NfNN_Tape_Record(Mem, T);
+    NfNN_Intern_Add(Mem, T);
+    return T;
+}
+
 static f32 NfNN_Item(nfnn_tensor *T)
 {
+    NfNN_Realize(T);
     NFNN_ASSERT(T->Dimensions.Dimensions[0] == 1 && T->Dimensions.Dimensions[1] == 1,
                 "NfNN_Item: Tensor is not a scalar");
     return T->Data[0];
@@ -57,6 +288,7 @@ static nfnn_tensor *NfNN_Select(nfnn_memory_arena *Mem, nfnn_tensor *X, u32 *Ind
     nfnn_tensor *Result = NfNN_CreateTensor(Mem, NfNN_Dim2(N, X->Dimensions.Dimensions[1]), false);
 
     Result->Op.Type = NFNN_OP_TYPE_LEAF;
+    NfNN_Realize(X);
 
     // NOTE(luatil): Don't know how to do this in a better way
 
@@ -78,7 +310,7 @@ static nfnn_tensor *NfNN_Matrix(nfnn_memory_arena *Mem, nfnn_random_state *Rando
     Result->Data = NfNN_PushArray(Mem, f32, InputSize * OutputSize);
     Result->Gradient = NfNN_PushArray(Mem, f32, InputSize * OutputSize);
     Result->RequiresGrad = true;
-    Result->Visited = false;
+    Result->TapeIndex = 0;
     Result->Op.Type = NFNN_OP_TYPE_LEAF;
 
     // TODO(luatil): Initialize weights
@@ -89,33 +321,37 @@ static nfnn_tensor *NfNN_Matrix(nfnn_memory_arena *Mem, nfnn_random_state *Rando
 
 static nfnn_tensor *NfNN_Copy(nfnn_memory_arena *Mem, nfnn_tensor *X)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, X);
+    nfnn_tensor *Result = NfNN_OpResult(Mem, X->Dimensions, X->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_COPY;
     Result->Op.Unary.Input = X;
 
-    // Operation
-    NfNN_MemoryCopy(Result->Data, X->Data, NfNN_Size(X));
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
 
 static nfnn_tensor *NfNN_Sigmoid(nfnn_memory_arena *Mem, nfnn_tensor *X)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, X);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, X, X->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_SIGMOID;
     Result->Op.Unary.Input = X;
 
-    // Operation
-    NfNN_Math_Sigmoid_f32(X->Data, NfNN_Length(X), Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
 
 static nfnn_tensor *NfNN_Const(nfnn_memory_arena *Mem, nfnn_dim Dim, f32 Const)
 {
-    nfnn_tensor *Result = NfNN_CreateTensor(Mem, Dim, false);
+    nfnn_tensor *Result = NfNN_Constants_Get(Mem, Dim, Const);
+    if (Result)
+    {
+        return Result;
+    }
+
+    Result = NfNN_CreateTensor(Mem, Dim, false);
 
     Result->Op.Type = NFNN_OP_TYPE_LEAF;
     Result->RequiresGrad = false;
@@ -140,12 +376,13 @@ static nfnn_tensor *NfNN_Ones(nfnn_memory_arena *Mem, nfnn_dim Dim)
 
 static nfnn_tensor *NfNN_MultiplyByConstant(nfnn_memory_arena *Mem, nfnn_tensor *X, f32 Constant)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, X);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, X, X->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_MUL_CONST;
+    Result->Op.Constant.Input = X;
     Result->Op.Constant.ConstantInputf32 = Constant;
 
-    NfNN_Math_MultiplyByConstant_f32(X->Data, NfNN_Length(Result), Constant, Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
@@ -158,56 +395,56 @@ static nfnn_tensor *NfNN_Add(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor
 
     NFNN_ASSERT((EqualDimensions || Broadcastable), "NfNN_Add: Dimensions must be equal or broadcastable");
 
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, X);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, X, X->RequiresGrad || Y->RequiresGrad);
 
     if (EqualDimensions)
     {
         Result->Op = NfNN_Op_Binary(NFNN_OP_TYPE_ADD, X, Y);
-        NfNN_Math_Add_f32(X->Data, Y->Data, NfNN_Length(X), Result->Data);
     }
     else if (Broadcastable)
     {
         Result->Op = NfNN_Op_Binary(NFNN_OP_TYPE_BROADCAST_ADD, X, Y);
-        NfNN_Math_BroadcastAdd_f32(X->Data, X->Dimensions.Dimensions[0], X->Dimensions.Dimensions[1], Y->Data,
-                                   Y->Dimensions.Dimensions[0], Y->Dimensions.Dimensions[1], Result->Data);
     }
     else
     {
         NFNN_ERROR();
     }
 
+    Result = NfNN_Op_Execute(Mem, Result);
+
     return Result;
 }
 
 static nfnn_tensor *NfNN_Sub(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *Y)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, X);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, X, X->RequiresGrad || Y->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_SUB;
     Result->Op.Binary.Left = X;
     Result->Op.Binary.Right = Y;
 
-    NfNN_Math_Sub_f32(X->Data, Y->Data, NfNN_Length(X), Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
 
 static nfnn_tensor *NfNN_Mul(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *Y)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, X);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, X, X->RequiresGrad || Y->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_MUL;
     Result->Op.Binary.Left = X;
     Result->Op.Binary.Right = Y;
 
-    NfNN_Math_Add_f32(X->Data, Y->Data, NfNN_Length(X), Result->Data);
-    NfNN_Math_Hadamard_f32(X->Data, Y->Data, NfNN_Length(X), Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
 
 static bool NfNN_AllClose(nfnn_tensor *X, nfnn_tensor *Y, f32 Episilon)
 {
+    NfNN_Realize(X);
+    NfNN_Realize(Y);
     u32 NumberOfElements = NfNN_Length(X);
     for (u32 I = 0; I < NumberOfElements; I++)
     {
@@ -222,15 +459,21 @@ static bool NfNN_AllClose(nfnn_tensor *X, nfnn_tensor *Y, f32 Episilon)
 
 static nfnn_tensor *NfNN_MatMul(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *Y)
 {
-    nfnn_tensor *Result =
-        NfNN_CreateTensor(Mem, NfNN_Dim2(X->Dimensions.Dimensions[0], Y->Dimensions.Dimensions[1]), true);
+    nfnn_tensor *Result = NfNN_OpResult(Mem, NfNN_Dim2(X->Dimensions.Dimensions[0], Y->Dimensions.Dimensions[1]),
+                                        X->RequiresGrad || Y->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_MATMUL;
     Result->Op.Binary.Left = X;
     Result->Op.Binary.Right = Y;
 
-    NfNN_Math_MatMul_f32(X->Data, Y->Data, X->Dimensions.Dimensions[0], X->Dimensions.Dimensions[1],
-                         Y->Dimensions.Dimensions[1], Result->Data);
+    // NOTE(luatil): dL/dX only reads Y and dL/dY only reads X
+    if (Result->RequiresGrad)
+    {
+        Result->Op.Saved.Left = Y->RequiresGrad ? X->Data : 0;
+        Result->Op.Saved.Right = X->RequiresGrad ? Y->Data : 0;
+    }
+
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
@@ -242,6 +485,10 @@ static nfnn_tensor *NfNN_Reshape(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_di
     Result->Dimensions = Dim;
     Result->Op.Type = NFNN_OP_TYPE_RESHAPE;
     Result->Op.Unary.Input = X;
+    if (NfNN_Tape_Contains(Mem, Result))
+    {
+        NfNN_Tape_Update(Mem, Result);
+    }
     return Result;
 }
 
@@ -277,54 +524,62 @@ static nfnn_tensor *NfNN_From_f32(nfnn_memory_arena *Mem, f32 *T, nfnn_dim Dim)
 
 static nfnn_tensor *NfNN_ReLU(nfnn_memory_arena *Mem, nfnn_tensor *T)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, T);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, T, T->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_RELU;
     Result->Op.Unary.Input = T;
 
-    NfNN_Math_ReLU_f32(T->Data, NfNN_Length(T), Result->Data);
+    // NOTE(luatil): Backward only needs the sign of the input, keep it as a bit mask
+    if (Result->RequiresGrad)
+    {
+        Result->Op.Saved.Mask = NfNN_PushArray(Mem, u32, NFNN_MASK_WORDS(NfNN_Length(T)));
+    }
+
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
 
 static nfnn_tensor *NfNN_Tanh(nfnn_memory_arena *Mem, nfnn_tensor *T)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, T);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, T, T->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_TANH;
     Result->Op.Unary.Input = T;
 
-    NfNN_Math_Tanh_f32(T->Data, NfNN_Length(T), Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
 
 static nfnn_tensor *NfNN_Square(nfnn_memory_arena *Mem, nfnn_tensor *T)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, T);
+    nfnn_tensor *Result = NfNN_OpResultInPlace(Mem, T, T->RequiresGrad);
 
     Result->Op.Type = NFNN_OP_TYPE_SQUARE;
     Result->Op.Unary.Input = T;
 
-    NfNN_Math_Square_f32(T->Data, NfNN_Length(T), Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
 
     return Result;
 }
 
 static nfnn_tensor *NfNN_LogSoftmax(nfnn_memory_arena *Mem, nfnn_tensor *T, u32 Dim)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, T);
+    // NOTE(luatil): Along columns a row of the output is written before the whole input is read
+    nfnn_tensor *Result =
+        Dim == 1 ? NfNN_OpResultInPlace(Mem, T, T->RequiresGrad) : NfNN_OpResult(Mem, T->Dimensions, T->RequiresGrad);
     Result->Op = NfNN_Op_Dimensional(NFNN_OP_TYPE_LOG_SOFTMAX, T, Dim);
-    NfNN_Math_LogSoftmax_f32(T->Data, T->Dimensions.Dimensions[0], T->Dimensions.Dimensions[1], Dim, Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
     return Result;
 }
 
 static nfnn_tensor *NfNN_NLLLoss(nfnn_memory_arena *Mem, nfnn_tensor *T, nfnn_tensor *Indexes)
 {
-    nfnn_tensor *Result = NfNN_CreateTensor(Mem, NfNN_Dim2(1, 1), true);
+    // NOTE(luatil): The indexes never get a gradient
+    nfnn_tensor *Result = NfNN_OpResult(Mem, NfNN_Dim2(1, 1), T->RequiresGrad);
     Result->Op = NfNN_Op_Binary(NFNN_OP_TYPE_NLL_LOSS, T, Indexes);
-    NfNN_Math_NLLLoss_Mean_f32(T->Data, Indexes->Data, T->Dimensions.Dimensions[0], T->Dimensions.Dimensions[1],
-                               Result->Data);
+    Result = NfNN_Op_Execute(Mem, Result);
     return Result;
 }
 
@@ -346,8 +601,9 @@ static nfnn_tensor *NfNN_Argmax(nfnn_memory_arena *Mem, nfnn_tensor *T, u32 Dim)
     nfnn_tensor *Result = 0;
     if (Dim == 1)
     {
-        Result = NfNN_CreateTensor(Mem, NfNN_Dim2(T->Dimensions.Dimensions[0], 1), false);
-        NfNN_Math_Argmax(T->Data, T->Dimensions.Dimensions[0], T->Dimensions.Dimensions[1], Dim, Result->Data);
+        Result = NfNN_OpResult(Mem, NfNN_Dim2(T->Dimensions.Dimensions[0], 1), false);
+        Result->Op = NfNN_Op_Dimensional(NFNN_OP_TYPE_ARGMAX, T, Dim);
+        Result = NfNN_Op_Execute(Mem, Result);
     }
     else if (Dim == 0)
     {
@@ -369,8 +625,9 @@ static nfnn_tensor *NfNN_Max(nfnn_memory_arena *Mem, nfnn_tensor *T, u32 Dim)
 
 static nfnn_tensor *NfNN_Equal(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *Y)
 {
-    nfnn_tensor *Result = NfNN_TensorLike(Mem, X);
-    NfNN_Math_Close_f32(X->Data, Y->Data, NfNN_Length(X), Result->Data, NFNN_EPS_FOR_EQUAL);
+    nfnn_tensor *Result = NfNN_OpResult(Mem, X->Dimensions, false);
+    Result->Op = NfNN_Op_Binary(NFNN_OP_TYPE_EQUAL, X, Y);
+    Result = NfNN_Op_Execute(Mem, Result);
     return Result;
 }
 
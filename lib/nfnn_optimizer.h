@@ -1,27 +1,18 @@
 #ifndef NFNN_OPTIMIZER_H
 #define NFNN_OPTIMIZER_H
 
+#include "nfnn_autograd.h"
 #include "nfnn_math.h"
 #include "nfnn_tensor.h"
+#include "nfnn_thread.h"
 
 typedef enum nfnn_optimizer_type nfnn_optimizer_type;
 enum nfnn_optimizer_type
 {
     NFNN_OPTIMIZER_SGD,
     NFNN_OPTIMIZER_ADAM,
-};
-
-typedef struct nfnn_optimizer_sgd_param nfnn_optimizer_sgd_param;
-struct nfnn_optimizer_sgd_param
-{
-    nfnn_tensor *B;
-};
-
-typedef struct nfnn_optimizer_adam_param nfnn_optimizer_adam_param;
-struct nfnn_optimizer_adam_param
-{
-    nfnn_tensor *M;
-    nfnn_tensor *V;
+    NFNN_OPTIMIZER_LARS,
+    NFNN_OPTIMIZER_LAMB,
 };
 
 typedef struct nfnn_optimizer_sgd nfnn_optimizer_sgd;
@@ -39,15 +30,53 @@ struct nfnn_optimizer_adam
     f32 Beta1, Beta2; // in [0, 1) Exponential decay rates for the moment estimates
 };
 
+// NOTE(luatil): Layer-wise adaptive rate scaling, every tensor steps with the learning rate times
+// a trust ratio of its own: TrustCoefficient * |W| / (|G| + WeightDecay * |W|)
+typedef struct nfnn_optimizer_lars nfnn_optimizer_lars;
+struct nfnn_optimizer_lars
+{
+    f32 WeightDecay;
+    f32 Momentum;
+    f32 TrustCoefficient;
+};
+
+// NOTE(luatil): Adam with bias correction and decoupled weight decay, the update of every tensor
+// is scaled to |W| / |Update|
+typedef struct nfnn_optimizer_lamb nfnn_optimizer_lamb;
+struct nfnn_optimizer_lamb
+{
+    f32 Beta1, Beta2;
+    f32 WeightDecay;
+};
+
+// NOTE(luatil): Parameters, gradients and optimizer state live in one flat buffer with a section
+// per kind. A parameter has the same offset in every section, offsets are aligned so every tensor
+// starts on a cache line. The padding stays zero and every update maps zero to zero.
+typedef enum nfnn_optimizer_section nfnn_optimizer_section;
+enum nfnn_optimizer_section
+{
+    NFNN_OPTIMIZER_SECTION_DATA,
+    NFNN_OPTIMIZER_SECTION_GRADIENT,
+    NFNN_OPTIMIZER_SECTION_STATE,  // SGD and LARS: momentum buffer, Adam and LAMB: first moment
+    NFNN_OPTIMIZER_SECTION_STATE2, // Adam and LAMB: second moment
+};
+
+#define NFNN_OPTIMIZER_ALIGN 16          // Floats, one cache line
+#define NFNN_OPTIMIZER_CHUNK (16 * 1024) // Floats per job when a thread pool is set
+#define NFNN_OPTIMIZER_BLOCK 64          // Floats per scale of quantized state, parameters start on a block
+#define NFNN_OPTIMIZER_PIECE 1024        // Floats of quantized state expanded at a time, a multiple of the block
+
+// NOTE(luatil): Sections are one cache line further apart than their capacity, with power of two
+// capacities the same offset in every section would otherwise map to the same cache set
+#define NFNN_OPTIMIZER_STRIDE(Capacity) ((u64)(Capacity) + NFNN_OPTIMIZER_ALIGN)
+
 typedef struct nfnn_optimizer_param nfnn_optimizer_param;
 struct nfnn_optimizer_param
 {
     nfnn_tensor *Tensor;
     nfnn_optimizer_param *Next;
-    union {
-        nfnn_optimizer_sgd_param SGD;
-        nfnn_optimizer_adam_param Adam;
-    };
+    u32 Offset; // Into every section
+    u32 Length; // Including the padding up to the next parameter
 };
 
 typedef struct nfnn_optimizer nfnn_optimizer;
@@ -56,24 +85,43 @@ struct nfnn_optimizer
     nfnn_optimizer_type Type;
     u32 Iteration;
     f32 LearningRate;
+    u32 WarmupSteps; // The learning rate grows linearly over the first steps, 0 starts at full rate
     u32 NumberOfWorkers;
     union {
         nfnn_optimizer_sgd SGD;
         nfnn_optimizer_adam Adam;
+        nfnn_optimizer_lars LARS;
+        nfnn_optimizer_lamb LAMB;
     };
     nfnn_optimizer_param *First;
     nfnn_optimizer_param *Last;
+
+    f32 *Flat;
+    u32 SectionCount;
+    u32 Count;    // Floats used in every section
+    u32 Capacity; // Floats in every section
+    nfnn_thread_pool *Pool;
+    u8 *Updated; // One per NFNN_OPTIMIZER_ALIGN floats, set at the start of every parameter updated this step
+
+    bool Quantized; // State sections are 8-bit codes instead of floats, see NfNN_Optimizer_QuantizeState
+    u8 *Codes;      // Capacity per state section
+    f32 *Scales;    // Capacity / NFNN_OPTIMIZER_BLOCK per state section
+
+    u32 StepEpoch; // NfNN_AutoGrad_Epoch at the last step, see NfNN_Optimizer_ClearStaleGradients
 };
 
 static nfnn_optimizer *NfNN_Optimizer_SGD(nfnn_memory_arena *Mem, f32 LearningRate, u32 NumberOfWorkers, f32 Momentum,
                                           f32 Dampening, f32 WeightDecay, bool Nesterov)
 {
     nfnn_optimizer *Result = NfNN_PushStruct(Mem, nfnn_optimizer);
+    memset(Result, 0, sizeof(nfnn_optimizer));
+    Result->StepEpoch = NFNN_ATOMIC_LOAD_U32(&NfNN_AutoGrad_Epoch);
     Result->Type = NFNN_OPTIMIZER_SGD;
     Result->LearningRate = LearningRate;
     Result->First = 0;
     Result->Last = 0;
     Result->NumberOfWorkers = NumberOfWorkers;
+    Result->SectionCount = 3;
 
     // NOTE(luatil): All should default to 0
     Result->SGD.Dampening = Dampening;
@@ -88,10 +136,13 @@ static nfnn_optimizer *NfNN_Optimizer_Adam(nfnn_memory_arena *Mem, f32 LearningR
                                            f32 Beta2)
 {
     nfnn_optimizer *Result = NfNN_PushStruct(Mem, nfnn_optimizer);
+    memset(Result, 0, sizeof(nfnn_optimizer));
+    Result->StepEpoch = NFNN_ATOMIC_LOAD_U32(&NfNN_AutoGrad_Epoch);
     Result->Type = NFNN_OPTIMIZER_ADAM;
     Result->First = 0;
     Result->Last = 0;
     Result->NumberOfWorkers = NumberOfWorkers;
+    Result->SectionCount = 4;
 
     // Adam part
     if (LearningRate != 0)
@@ -122,114 +173,597 @@ static nfnn_optimizer *NfNN_Optimizer_Adam(nfnn_memory_arena *Mem, f32 LearningR
     return Result;
 }
 
-static void NfNN_Optimizer_AddParam(nfnn_memory_arena *Mem, nfnn_optimizer *Optimizer, nfnn_tensor *T)
+static nfnn_optimizer *NfNN_Optimizer_LARS(nfnn_memory_arena *Mem, f32 LearningRate, u32 NumberOfWorkers, f32 Momentum,
+                                           f32 WeightDecay, f32 TrustCoefficient)
+{
+    nfnn_optimizer *Result = NfNN_PushStruct(Mem, nfnn_optimizer);
+    memset(Result, 0, sizeof(nfnn_optimizer));
+    Result->StepEpoch = NFNN_ATOMIC_LOAD_U32(&NfNN_AutoGrad_Epoch);
+    Result->Type = NFNN_OPTIMIZER_LARS;
+    Result->LearningRate = LearningRate;
+    Result->NumberOfWorkers = NumberOfWorkers;
+    Result->SectionCount = 3;
+
+    Result->LARS.Momentum = Momentum;
+    Result->LARS.WeightDecay = WeightDecay;
+    Result->LARS.TrustCoefficient = TrustCoefficient != 0 ? TrustCoefficient : 0.001f;
+
+    return Result;
+}
+
+static nfnn_optimizer *NfNN_Optimizer_LAMB(nfnn_memory_arena *Mem, f32 LearningRate, u32 NumberOfWorkers, f32 Beta1,
+                                           f32 Beta2, f32 WeightDecay)
+{
+    nfnn_optimizer *Result = NfNN_PushStruct(Mem, nfnn_optimizer);
+    memset(Result, 0, sizeof(nfnn_optimizer));
+    Result->StepEpoch = NFNN_ATOMIC_LOAD_U32(&NfNN_AutoGrad_Epoch);
+    Result->Type = NFNN_OPTIMIZER_LAMB;
+    Result->LearningRate = LearningRate != 0 ? LearningRate : 0.001f;
+    Result->NumberOfWorkers = NumberOfWorkers;
+    Result->SectionCount = 4;
+
+    Result->LAMB.Beta1 = Beta1 != 0 ? Beta1 : 0.9f;
+    Result->LAMB.Beta2 = Beta2 != 0 ? Beta2 : 0.999f;
+    Result->LAMB.WeightDecay = WeightDecay;
+
+    return Result;
+}
+
+// NOTE(luatil): Large batches, as with many workers, diverge when they start at full rate
+static void NfNN_Optimizer_SetWarmup(nfnn_optimizer *Optimizer, u32 WarmupSteps)
+{
+    Optimizer->WarmupSteps = WarmupSteps;
+}
+
+static f32 NfNN_Optimizer_LearningRate(nfnn_optimizer *Optimizer)
+{
+    f32 Result = Optimizer->LearningRate;
+    if (Optimizer->Iteration < Optimizer->WarmupSteps)
+    {
+        Result *= (f32)(Optimizer->Iteration + 1) / (f32)Optimizer->WarmupSteps;
+    }
+    return Result;
+}
+
+// NOTE(luatil): LARS and LAMB need the norms of a whole tensor, they update one parameter at a time
+static bool NfNN_Optimizer_LayerWise(nfnn_optimizer *Optimizer)
+{
+    return Optimizer->Type == NFNN_OPTIMIZER_LARS || Optimizer->Type == NFNN_OPTIMIZER_LAMB;
+}
+
+// NOTE(luatil): Keeps the optimizer state in 8 bits per value with one scale per NFNN_OPTIMIZER_BLOCK
+// floats, Adam state goes from 8 to about 2.1 bytes per parameter. Call before adding parameters.
+static void NfNN_Optimizer_QuantizeState(nfnn_optimizer *Optimizer)
+{
+    NFNN_ASSERT(Optimizer->Count == 0, "NfNN_Optimizer_QuantizeState: Parameters were already added");
+    Optimizer->Quantized = true;
+}
+
+static u32 NfNN_Optimizer_Alignment(nfnn_optimizer *Optimizer)
+{
+    return Optimizer->Quantized ? NFNN_OPTIMIZER_BLOCK : NFNN_OPTIMIZER_ALIGN;
+}
+
+// NOTE(luatil): With quantized state only the parameters and gradients are floats
+static u32 NfNN_Optimizer_FloatSections(nfnn_optimizer *Optimizer)
 {
-    switch (Optimizer->Type)
+    return Optimizer->Quantized ? NFNN_OPTIMIZER_SECTION_STATE : Optimizer->SectionCount;
+}
+
+static f32 *NfNN_Optimizer_Section(nfnn_optimizer *Optimizer, nfnn_optimizer_section Section)
+{
+    NFNN_ASSERT((u32)Section < NfNN_Optimizer_FloatSections(Optimizer),
+                "NfNN_Optimizer_Section: Not used by this optimizer");
+    return Optimizer->Flat + Section * NFNN_OPTIMIZER_STRIDE(Optimizer->Capacity);
+}
+
+// NOTE(luatil): Moves every section to a bigger buffer and points the parameters at it,
+// the old buffer stays behind in the arena
+static void NfNN_Optimizer_Grow(nfnn_memory_arena *Mem, nfnn_optimizer *Optimizer, u32 Capacity)
+{
+    u32 Sections = NfNN_Optimizer_FloatSections(Optimizer);
+    u64 Floats = Sections * NFNN_OPTIMIZER_STRIDE(Capacity) + NFNN_OPTIMIZER_ALIGN;
+    f32 *Base = NfNN_PushArray(Mem, f32, Floats);
+    memset(Base, 0, Floats * sizeof(f32));
+    uintptr_t Align = NFNN_OPTIMIZER_ALIGN * sizeof(f32);
+    f32 *Flat = (f32 *)(((uintptr_t)Base + Align - 1) & ~(Align - 1));
+
+    for (u32 Section = 0; Optimizer->Flat && Section < Sections; Section++)
     {
-    case NFNN_OPTIMIZER_SGD: {
-        nfnn_optimizer_param *Param = NfNN_PushStruct(Mem, nfnn_optimizer_param);
-        Param->Tensor = T;
-        Param->Next = 0;
+        f32 *Old = NfNN_Optimizer_Section(Optimizer, (nfnn_optimizer_section)Section);
+        NfNN_MemoryCopy(Flat + Section * NFNN_OPTIMIZER_STRIDE(Capacity), Old, Optimizer->Count * sizeof(f32));
+    }
+    u8 *Updated = NfNN_PushArray(Mem, u8, Capacity / NFNN_OPTIMIZER_ALIGN);
+    memset(Updated, 0, Capacity / NFNN_OPTIMIZER_ALIGN);
+    if (Optimizer->Updated)
+    {
+        NfNN_MemoryCopy(Updated, Optimizer->Updated, Optimizer->Count / NFNN_OPTIMIZER_ALIGN);
+    }
 
-        Param->SGD.B = NfNN_ZeroesLike(Mem, T);
+    u32 States = Optimizer->SectionCount - Sections;
+    if (States)
+    {
+        u8 *Codes = NfNN_PushArray(Mem, u8, States * Capacity);
+        f32 *Scales = NfNN_PushArray(Mem, f32, States * Capacity / NFNN_OPTIMIZER_BLOCK);
+        memset(Codes, 0, States * Capacity);
+        memset(Scales, 0, States * Capacity / NFNN_OPTIMIZER_BLOCK * sizeof(f32));
+        for (u32 State = 0; Optimizer->Codes && State < States; State++)
+        {
+            NfNN_MemoryCopy(Codes + State * Capacity, Optimizer->Codes + State * Optimizer->Capacity, Optimizer->Count);
+            NfNN_MemoryCopy(Scales + State * Capacity / NFNN_OPTIMIZER_BLOCK,
+                            Optimizer->Scales + State * Optimizer->Capacity / NFNN_OPTIMIZER_BLOCK,
+                            Optimizer->Count / NFNN_OPTIMIZER_BLOCK * sizeof(f32));
+        }
+        Optimizer->Codes = Codes;
+        Optimizer->Scales = Scales;
+    }
+
+    Optimizer->Flat = Flat;
+    Optimizer->Capacity = Capacity;
+    Optimizer->Updated = Updated;
 
-        NFNN_SLL_PushBack(Optimizer->First, Optimizer->Last, Param);
+    for (nfnn_optimizer_param *Param = Optimizer->First; Param != 0; Param = Param->Next)
+    {
+        Param->Tensor->Data = NfNN_Optimizer_Section(Optimizer, NFNN_OPTIMIZER_SECTION_DATA) + Param->Offset;
+        Param->Tensor->Gradient = NfNN_Optimizer_Section(Optimizer, NFNN_OPTIMIZER_SECTION_GRADIENT) + Param->Offset;
     }
-    break;
-    case NFNN_OPTIMIZER_ADAM: {
-        nfnn_optimizer_param *Param = NfNN_PushStruct(Mem, nfnn_optimizer_param);
-        Param->Tensor = T;
-        Param->Next = 0;
+}
 
-        Param->Adam.M = NfNN_ZeroesLike(Mem, T);
-        Param->Adam.V = NfNN_ZeroesLike(Mem, T);
+// NOTE(luatil): T moves into the flat buffer of the optimizer. Add parameters before any
+// operation uses them, results keep pointers to the buffers of their inputs.
+static void NfNN_Optimizer_AddParam(nfnn_memory_arena *Mem, nfnn_optimizer *Optimizer, nfnn_tensor *T)
+{
+    nfnn_optimizer_param *Param = NfNN_PushStruct(Mem, nfnn_optimizer_param);
+    Param->Tensor = T;
+    Param->Next = 0;
+    Param->Offset = Optimizer->Count;
+    u32 Alignment = NfNN_Optimizer_Alignment(Optimizer);
+    Param->Length = (NfNN_Length(T) + Alignment - 1) / Alignment * Alignment;
 
-        NFNN_SLL_PushBack(Optimizer->First, Optimizer->Last, Param);
+    if (Param->Offset + Param->Length > Optimizer->Capacity)
+    {
+        NfNN_Optimizer_Grow(Mem, Optimizer, NFNN_MAX(Param->Offset + Param->Length, 2 * Optimizer->Capacity));
     }
-    break;
+
+    f32 *Data = NfNN_Optimizer_Section(Optimizer, NFNN_OPTIMIZER_SECTION_DATA) + Param->Offset;
+    f32 *Gradient = NfNN_Optimizer_Section(Optimizer, NFNN_OPTIMIZER_SECTION_GRADIENT) + Param->Offset;
+    NfNN_MemoryCopy(Data, T->Data, NfNN_Size(T));
+    if (T->Gradient)
+    {
+        NfNN_MemoryCopy(Gradient, T->Gradient, NfNN_Size(T));
     }
+    T->Data = Data;
+    T->Gradient = Gradient;
+
+    Optimizer->Count += Param->Length;
+    NFNN_SLL_PushBack(Optimizer->First, Optimizer->Last, Param);
 }
 
-static void NfNN_Optimizer_SGDUpdate(nfnn_tensor *T, nfnn_optimizer_sgd_param Param, f32 Lr, f32 WeightDecay,
+// NOTE(luatil): Large steps are split over the pool while it is idle
+static void NfNN_Optimizer_SetThreadPool(nfnn_optimizer *Optimizer, nfnn_thread_pool *Pool)
+{
+    Optimizer->Pool = Pool;
+}
+
+// NOTE(luatil): Every option is folded into a coefficient before the loop. The first two
+// iterations start the momentum buffer from the gradient.
+static void NfNN_Optimizer_SGDUpdate(f32 *Data, f32 *Gradient, f32 *B, u32 Count, f32 Lr, f32 WeightDecay,
                                      f32 Momentum, f32 Dampening, bool Nesterov, u32 Timestamp)
 {
-    for (u32 I = 0; I < NfNN_Length(T); I++)
+    if (Momentum == 0)
+    {
+        for (u32 I = 0; I < Count; I++)
+        {
+            f32 G = Gradient[I] + WeightDecay * Data[I];
+            Gradient[I] = G;
+            Data[I] -= Lr * G;
+        }
+        return;
+    }
+
+    f32 KeepB = Timestamp > 1 ? Momentum : 0.0f;
+    f32 TakeG = Timestamp > 1 ? 1.0f - Dampening : 1.0f;
+    f32 StepG = Nesterov ? 1.0f : 0.0f;
+    f32 StepB = Nesterov ? Momentum : 1.0f;
+    for (u32 I = 0; I < Count; I++)
+    {
+        f32 G = Gradient[I] + WeightDecay * Data[I];
+        f32 Buffer = KeepB * B[I] + TakeG * G;
+        B[I] = Buffer;
+        G = StepG * G + StepB * Buffer;
+        Gradient[I] = G;
+        Data[I] -= Lr * G;
+    }
+}
+
+static void NfNN_Optimizer_AdamUpdate(f32 *Theta, f32 *G, f32 *M, f32 *V, u32 Count, f32 Alpha, f32 Beta1, f32 Beta2)
+{
+    for (u32 I = 0; I < Count; I++)
+    {
+        M[I] = Beta1 * M[I] + (1.0f - Beta1) * G[I];
+        V[I] = Beta2 * V[I] + (1.0f - Beta2) * (G[I] * G[I]);
+        Theta[I] = Theta[I] - Alpha * M[I] / (NfNN_Math_Single_Sqrt_f32(V[I]) + 1e-8f);
+    }
+}
+
+// NOTE(luatil): Ratio is 1 when either norm is zero, a fresh or all zero tensor steps like SGD
+static f32 NfNN_Optimizer_TrustRatio(f32 Numerator, f32 Denominator)
+{
+    return Numerator > 0.0f && Denominator > 0.0f ? Numerator / Denominator : 1.0f;
+}
+
+static f32 NfNN_Optimizer_LARSRatio(f32 *Data, f32 *Gradient, u32 Count, f32 WeightDecay, f32 TrustCoefficient)
+{
+    f32 DataNorm = NfNN_Math_Single_Sqrt_f32(NfNN_Math_SumSquares_f32(Data, Count));
+    f32 GradientNorm = NfNN_Math_Single_Sqrt_f32(NfNN_Math_SumSquares_f32(Gradient, Count));
+    f32 Result = 1.0f;
+    if (DataNorm > 0.0f && GradientNorm > 0.0f)
+    {
+        Result = TrustCoefficient * DataNorm / (GradientNorm + WeightDecay * DataNorm);
+    }
+    return Result;
+}
+
+// NOTE(luatil): Step is the learning rate times the trust ratio of the whole tensor
+static void NfNN_Optimizer_LARSUpdate(f32 *Data, f32 *Gradient, f32 *B, u32 Count, f32 Step, f32 WeightDecay,
+                                      f32 Momentum)
+{
+    for (u32 I = 0; I < Count; I++)
+    {
+        f32 G = Gradient[I] + WeightDecay * Data[I];
+        f32 Buffer = Momentum * B[I] + Step * G;
+        B[I] = Buffer;
+        Gradient[I] = G;
+        Data[I] -= Buffer;
+    }
+}
+
+// NOTE(luatil): Leaves the update in the gradient and adds the squares of both norms to Lanes,
+// the caller scales it by the trust ratio once the whole tensor is done. Timestamp starts at 1.
+static void NfNN_Optimizer_LAMBUpdate(f32 *Theta, f32 *G, f32 *M, f32 *V, u32 Count, f32 Beta1, f32 Beta2,
+                                      f32 WeightDecay, u32 Timestamp, f32 Lanes[2][NFNN_MATH_LANES])
+{
+    f32 Correction1 = 1.0f / (1.0f - NfNN_Math_Single_Exp_f32(Timestamp * NfNN_Math_Single_Log_f32(Beta1)));
+    f32 Correction2 = 1.0f / (1.0f - NfNN_Math_Single_Exp_f32(Timestamp * NfNN_Math_Single_Log_f32(Beta2)));
+
+    NFNN_ASSERT(Count % NFNN_MATH_LANES == 0, "NfNN_Optimizer_LAMBUpdate: Parameters are padded to whole lanes");
+    for (u32 I = 0; I < Count; I += NFNN_MATH_LANES)
     {
-        if (WeightDecay != 0)
+        for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
         {
-            T->Gradient[I] += WeightDecay * T->Data[I];
+            u32 J = I + Lane;
+            M[J] = Beta1 * M[J] + (1.0f - Beta1) * G[J];
+            V[J] = Beta2 * V[J] + (1.0f - Beta2) * (G[J] * G[J]);
+            f32 Update = (M[J] * Correction1) / (NfNN_Math_Single_Sqrt_f32(V[J] * Correction2) + 1e-6f) +
+                         WeightDecay * Theta[J];
+            G[J] = Update;
+            Lanes[0][Lane] += Theta[J] * Theta[J];
+            Lanes[1][Lane] += Update * Update;
         }
+    }
+}
 
-        if (Momentum != 0)
+// NOTE(luatil): Quantized state is kept as codes of NFNN_OPTIMIZER_BLOCK floats with one scale each.
+// The first state is signed. The second is a second moment and is kept as its square root, which
+// leaves small moments more of their precision.
+// NOTE(luatil): Count is a whole number of blocks
+static void NfNN_Optimizer_LoadState(nfnn_optimizer *Optimizer, u32 State, u32 Offset, u32 Count, f32 *Out)
+{
+    u64 Index = (u64)State * Optimizer->Capacity + Offset;
+    f32 *Scales = Optimizer->Scales + Index / NFNN_OPTIMIZER_BLOCK;
+    for (u32 Block = 0; Block < Count; Block += NFNN_OPTIMIZER_BLOCK)
+    {
+        f32 Scale = Scales[Block / NFNN_OPTIMIZER_BLOCK];
+        if (State == 0)
         {
-            if (Timestamp > 1)
-            {
-                Param.B->Data[I] = Momentum * Param.B->Data[I] + (1.0f - Dampening) * T->Gradient[I];
-            }
-            else
-            {
-                Param.B->Data[I] = T->Gradient[I];
-            }
-            if (Nesterov)
+            NfNN_Math_Dequantize_s8((s8 *)Optimizer->Codes + Index + Block, Scale, NFNN_OPTIMIZER_BLOCK, Out + Block);
+        }
+        else
+        {
+            NfNN_Math_Dequantize_u8(Optimizer->Codes + Index + Block, Scale, NFNN_OPTIMIZER_BLOCK, Out + Block);
+        }
+    }
+    if (State != 0)
+    {
+        NfNN_Math_Hadamard_f32(Out, Out, Count, Out);
+    }
+}
+
+// NOTE(luatil): Overwrites In
+static void NfNN_Optimizer_StoreState(nfnn_optimizer *Optimizer, u32 State, u32 Offset, u32 Count, f32 *In)
+{
+    u64 Index = (u64)State * Optimizer->Capacity + Offset;
+    f32 *Scales = Optimizer->Scales + Index / NFNN_OPTIMIZER_BLOCK;
+    for (u32 I = 0; State != 0 && I < Count; I++)
+    {
+        In[I] = NfNN_Math_Single_Sqrt_f32(In[I]);
+    }
+    for (u32 Block = 0; Block < Count; Block += NFNN_OPTIMIZER_BLOCK)
+    {
+        if (State == 0)
+        {
+            Scales[Block / NFNN_OPTIMIZER_BLOCK] =
+                NfNN_Math_Quantize_s8(In + Block, NFNN_OPTIMIZER_BLOCK, (s8 *)Optimizer->Codes + Index + Block);
+        }
+        else
+        {
+            Scales[Block / NFNN_OPTIMIZER_BLOCK] =
+                NfNN_Math_QuantizeUp_u8(In + Block, NFNN_OPTIMIZER_BLOCK, Optimizer->Codes + Index + Block);
+        }
+    }
+}
+
+// NOTE(luatil): Quantized state is expanded a piece at a time, updated with the parameters and
+// stored back while the piece is still in cache
+static void NfNN_Optimizer_Update(nfnn_optimizer *Optimizer, u32 Start, u32 End)
+{
+    f32 *Data = NfNN_Optimizer_Section(Optimizer, NFNN_OPTIMIZER_SECTION_DATA);
+    f32 *Gradient = NfNN_Optimizer_Section(Optimizer, NFNN_OPTIMIZER_SECTION_GRADIENT);
+    f32 Lr = NfNN_Optimizer_LearningRate(Optimizer);
+    u32 States = Optimizer->SectionCount - NFNN_OPTIMIZER_SECTION_STATE;
+    if (Optimizer->Type == NFNN_OPTIMIZER_SGD && Optimizer->SGD.Momentum == 0)
+    {
+        States = 0;
+    }
+
+    f32 Step = Lr;
+    if (Optimizer->Type == NFNN_OPTIMIZER_LARS)
+    {
+        Step *= NfNN_Optimizer_LARSRatio(Data + Start, Gradient + Start, End - Start, Optimizer->LARS.WeightDecay,
+                                         Optimizer->LARS.TrustCoefficient);
+    }
+    f32 Lanes[2][NFNN_MATH_LANES] = {0};
+
+    u32 Piece = Optimizer->Quantized && States ? NFNN_OPTIMIZER_PIECE : End - Start;
+    for (u32 Offset = Start; Offset < End; Offset += Piece)
+    {
+        u32 Count = NFNN_MIN(Piece, End - Offset);
+        f32 Block[2][NFNN_OPTIMIZER_PIECE];
+        f32 *State[2] = {0, 0};
+        for (u32 Index = 0; Index < States; Index++)
+        {
+            if (Optimizer->Quantized)
             {
-                T->Gradient[I] = T->Gradient[I] + Momentum * Param.B->Data[I];
+                State[Index] = Block[Index];
+                NfNN_Optimizer_LoadState(Optimizer, Index, Offset, Count, State[Index]);
             }
             else
             {
-                T->Gradient[I] = Param.B->Data[I];
+                State[Index] =
+                    NfNN_Optimizer_Section(Optimizer, (nfnn_optimizer_section)(NFNN_OPTIMIZER_SECTION_STATE + Index)) +
+                    Offset;
             }
         }
 
-        T->Data[I] -= Lr * T->Gradient[I];
+        switch (Optimizer->Type)
+        {
+        case NFNN_OPTIMIZER_SGD: {
+            NfNN_Optimizer_SGDUpdate(Data + Offset, Gradient + Offset, State[0], Count, Lr, Optimizer->SGD.WeightDecay,
+                                     Optimizer->SGD.Momentum, Optimizer->SGD.Dampening, Optimizer->SGD.Nesterov,
+                                     Optimizer->Iteration);
+        }
+        break;
+        case NFNN_OPTIMIZER_ADAM: {
+            NfNN_Optimizer_AdamUpdate(Data + Offset, Gradient + Offset, State[0], State[1], Count, Lr,
+                                      Optimizer->Adam.Beta1, Optimizer->Adam.Beta2);
+        }
+        break;
+        case NFNN_OPTIMIZER_LARS: {
+            NfNN_Optimizer_LARSUpdate(Data + Offset, Gradient + Offset, State[0], Count, Step,
+                                      Optimizer->LARS.WeightDecay, Optimizer->LARS.Momentum);
+        }
+        break;
+        case NFNN_OPTIMIZER_LAMB: {
+            NfNN_Optimizer_LAMBUpdate(Data + Offset, Gradient + Offset, State[0], State[1], Count,
+                                      Optimizer->LAMB.Beta1, Optimizer->LAMB.Beta2, Optimizer->LAMB.WeightDecay,
+                                      Optimizer->Iteration + 1, Lanes);
+        }
+        break;
+        }
+
+        for (u32 Index = 0; Optimizer->Quantized && Index < States; Index++)
+        {
+            NfNN_Optimizer_StoreState(Optimizer, Index, Offset, Count, State[Index]);
+        }
+    }
+
+    if (Optimizer->Type == NFNN_OPTIMIZER_LAMB)
+    {
+        f32 ThetaSquares = 0.0f;
+        f32 UpdateSquares = 0.0f;
+        for (u32 Lane = 0; Lane < NFNN_MATH_LANES; Lane++)
+        {
+            ThetaSquares += Lanes[0][Lane];
+            UpdateSquares += Lanes[1][Lane];
+        }
+        f32 Ratio = NfNN_Optimizer_TrustRatio(NfNN_Math_Single_Sqrt_f32(ThetaSquares),
+                                              NfNN_Math_Single_Sqrt_f32(UpdateSquares));
+        NfNN_Math_FmaddConst_f32(Gradient + Start, -Lr * Ratio, End - Start, Data + Start);
     }
 }
 
-static void NfNN_Optimizer_AdamUpdate(nfnn_tensor *T, nfnn_optimizer_adam_param Param, f32 Alpha, f32 Beta1, f32 Beta2)
+typedef struct nfnn_optimizer_work nfnn_optimizer_work;
+struct nfnn_optimizer_work
+{
+    nfnn_optimizer *Optimizer;
+    u32 Start;
+    u32 End;
+    u32 Chunk;
+};
+
+static void NfNN_Optimizer_UpdateJob(nfnn_thread_pool *Pool, u32 Worker, void *Context, u32 Item)
+{
+    nfnn_optimizer_work *Work = (nfnn_optimizer_work *)Context;
+    u32 Start = Work->Start + Item * Work->Chunk;
+    NfNN_Optimizer_Update(Work->Optimizer, Start, NFNN_MIN(Start + Work->Chunk, Work->End));
+}
+
+static void NfNN_Optimizer_UpdateRange(nfnn_optimizer *Optimizer, u32 Start, u32 End)
 {
-    f32 *Theta = T->Data;
-    f32 *G = T->Gradient;
-    f32 *M = Param.M->Data;
-    f32 *V = Param.V->Data;
-    for (u32 I = 0; I < NfNN_Length(T); I++)
+    nfnn_thread_pool *Pool = Optimizer->Pool;
+    bool Ran = false;
+    if (Pool && Pool->ThreadCount > 1 && End - Start > NFNN_OPTIMIZER_CHUNK &&
+        !NfNN_Optimizer_LayerWise(Optimizer))
     {
-        M[I] = Beta1 * M[I] + (1.0f - Beta1) * G[I];
-        V[I] = Beta2 * V[I] + (1.0f - Beta2) * (G[I] * G[I]);
-        Theta[I] = Theta[I] - Alpha * M[I] / (NfNN_Math_Single_Sqrt_f32(V[I]) + 1e-8f);
+        u32 Items[64];
+        nfnn_optimizer_work Work = {Optimizer, Start, End, NFNN_MAX(NFNN_OPTIMIZER_CHUNK, (End - Start + 63) / 64)};
+        u32 Alignment = NfNN_Optimizer_Alignment(Optimizer);
+        Work.Chunk = (Work.Chunk + Alignment - 1) / Alignment * Alignment;
+        u32 ItemCount = (End - Start + Work.Chunk - 1) / Work.Chunk;
+        for (u32 Index = 0; Index < ItemCount; Index++)
+        {
+            Items[Index] = Index;
+        }
+        Ran = NfNN_ThreadPool_TryRun(Pool, NfNN_Optimizer_UpdateJob, &Work, Items, ItemCount);
+    }
+    if (!Ran)
+    {
+        NfNN_Optimizer_Update(Optimizer, Start, End);
     }
 }
 
-static void NfNN_Optimizer_Update(nfnn_optimizer *Optimizer, nfnn_optimizer_param *Param)
+typedef struct nfnn_optimizer_layers nfnn_optimizer_layers;
+struct nfnn_optimizer_layers
 {
-    switch (Optimizer->Type)
+    nfnn_optimizer *Optimizer;
+    nfnn_optimizer_param *Params[64];
+    u32 Count;
+};
+
+static void NfNN_Optimizer_LayerJob(nfnn_thread_pool *Pool, u32 Worker, void *Context, u32 Item)
+{
+    nfnn_optimizer_layers *Layers = (nfnn_optimizer_layers *)Context;
+    nfnn_optimizer_param *Param = Layers->Params[Item];
+    NfNN_Optimizer_Update(Layers->Optimizer, Param->Offset, Param->Offset + Param->Length);
+}
+
+// NOTE(luatil): With a pool every parameter of the batch is a job of its own
+static void NfNN_Optimizer_UpdateLayers(nfnn_optimizer_layers *Layers)
+{
+    nfnn_thread_pool *Pool = Layers->Optimizer->Pool;
+    bool Ran = false;
+    if (Pool && Pool->ThreadCount > 1 && Layers->Count > 1)
     {
-    case NFNN_OPTIMIZER_SGD: {
-        NfNN_Optimizer_SGDUpdate(Param->Tensor, Param->SGD, Optimizer->LearningRate, Optimizer->SGD.WeightDecay,
-                                 Optimizer->SGD.Momentum, Optimizer->SGD.Dampening, Optimizer->SGD.Nesterov,
-                                 Optimizer->Iteration);
+        u32 Items[64];
+        for (u32 Index = 0; Index < Layers->Count; Index++)
+        {
+            Items[Index] = Index;
+        }
+        Ran = NfNN_ThreadPool_TryRun(Pool, NfNN_Optimizer_LayerJob, Layers, Items, Layers->Count);
     }
-    break;
-    case NFNN_OPTIMIZER_ADAM: {
-        NfNN_Optimizer_AdamUpdate(Param->Tensor, Param->Adam, Optimizer->LearningRate, Optimizer->Adam.Beta1,
-                                  Optimizer->Adam.Beta2);
+    for (u32 Index = 0; !Ran && Index < Layers->Count; Index++)
+    {
+        NfNN_Optimizer_LayerJob(Pool, 0, Layers, Index);
     }
-    break;
+    Layers->Count = 0;
+}
+
+// NOTE(luatil): Backward overwrites the gradients it reaches instead of adding to zeroed ones, see
+// NfNN_AutoGrad_FirstWrites. A parameter no backward reached since the last step still holds the
+// gradient of an older one, it is zeroed here so the step sees the same as after
+// NfNN_Optimizer_ZeroGrad. Gradients written by hand are kept when NfNN_Optimizer_ZeroGrad ran
+// before them or when no backward ran anywhere since the last step.
+static void NfNN_Optimizer_ClearStaleGradients(nfnn_optimizer *Optimizer)
+{
+    u32 Epoch = NFNN_ATOMIC_LOAD_U32(&NfNN_AutoGrad_Epoch);
+    for (nfnn_optimizer_param *Param = Optimizer->First; Param != 0 && Epoch != Optimizer->StepEpoch;
+         Param = Param->Next)
+    {
+        if (Param->Tensor->RequiresGrad && Param->Tensor->GradEpoch <= Optimizer->StepEpoch)
+        {
+            NfNN_Math_Zero_f32(Param->Tensor->Gradient, Param->Length);
+        }
     }
+    Optimizer->StepEpoch = Epoch;
 }
 
+// NOTE(luatil): Neighbouring trainable parameters are one range of the flat buffer, so with
+// nothing frozen a step is a single pass. Frozen parameters (RequiresGrad = false) are left untouched,
+// and so are the ones backward already updated, see NfNN_Optimizer_OverlapBackward. LARS and LAMB
+// go one parameter at a time.
 static void NfNN_Optimizer_Step(nfnn_optimizer *Optimizer)
 {
-    for (nfnn_optimizer_param *Param = Optimizer->First; Param != 0; Param = Param->Next)
+    NfNN_Optimizer_ClearStaleGradients(Optimizer);
+
+    nfnn_optimizer_layers Layers = {Optimizer};
+    for (nfnn_optimizer_param *Param = Optimizer->First; Param != 0 && NfNN_Optimizer_LayerWise(Optimizer);
+         Param = Param->Next)
+    {
+        if (Param->Tensor->RequiresGrad && !Optimizer->Updated[Param->Offset / NFNN_OPTIMIZER_ALIGN])
+        {
+            Layers.Params[Layers.Count++] = Param;
+        }
+        if (Layers.Count == NFNN_ARRAY_COUNT(Layers.Params) || (!Param->Next && Layers.Count))
+        {
+            NfNN_Optimizer_UpdateLayers(&Layers);
+        }
+    }
+
+    nfnn_optimizer_param *Param = NfNN_Optimizer_LayerWise(Optimizer) ? 0 : Optimizer->First;
+    while (Param)
+    {
+        if (!Param->Tensor->RequiresGrad || Optimizer->Updated[Param->Offset / NFNN_OPTIMIZER_ALIGN])
+        {
+            Param = Param->Next;
+            continue;
+        }
+        u32 Start = Param->Offset;
+        while (Param && Param->Tensor->RequiresGrad && !Optimizer->Updated[Param->Offset / NFNN_OPTIMIZER_ALIGN])
+        {
+            Param = Param->Next;
+        }
+        NfNN_Optimizer_UpdateRange(Optimizer, Start, Param ? Param->Offset : Optimizer->Count);
+    }
+    if (Optimizer->Count)
     {
-        NfNN_Optimizer_Update(Optimizer, Param);
+        memset(Optimizer->Updated, 0, Optimizer->Count / NFNN_OPTIMIZER_ALIGN);
     }
     Optimizer->Iteration++;
 }
 
+// NOTE(luatil): Grad ready hook, updates the parameter while its gradient is still in cache.
+// Runs on any thread of a parallel backward, parameters never share a cache line.
+static void NfNN_Optimizer_GradReady(void *Context, nfnn_tensor *Leaf)
+{
+    nfnn_optimizer *Optimizer = (nfnn_optimizer *)Context;
+    f32 *Data = Optimizer->Flat ? NfNN_Optimizer_Section(Optimizer, NFNN_OPTIMIZER_SECTION_DATA) : 0;
+    if (!Data || Leaf->Data < Data || Leaf->Data >= Data + Optimizer->Count)
+    {
+        return;
+    }
+
+    u32 Offset = (u32)(Leaf->Data - Data);
+    u32 Alignment = NfNN_Optimizer_Alignment(Optimizer);
+    u32 Length = (NfNN_Length(Leaf) + Alignment - 1) / Alignment * Alignment;
+    NFNN_ASSERT(Offset % Alignment == 0, "NfNN_Optimizer_GradReady: Leaf is a view into a parameter");
+    if (!Optimizer->Updated[Offset / NFNN_OPTIMIZER_ALIGN])
+    {
+        Optimizer->Updated[Offset / NFNN_OPTIMIZER_ALIGN] = 1;
+        NfNN_Optimizer_UpdateRange(Optimizer, Offset, Offset + Length);
+    }
+}
+
+// NOTE(luatil): From now on backward on Mem updates every parameter of Optimizer as soon as its
+// gradient is final, NfNN_Optimizer_Step then only does the ones backward did not reach and
+// finishes the iteration. Nothing may change the gradients between backward and the step.
+static void NfNN_Optimizer_OverlapBackward(nfnn_memory_arena *Mem, nfnn_optimizer *Optimizer)
+{
+    NfNN_AutoGrad_SetGradReady(Mem, NfNN_Optimizer_GradReady, Optimizer);
+}
+
+// NOTE(luatil): Only needed before gradients are added up by hand, backward overwrites them
+// NOTE(luatil): The zeroed gradients count as written, whatever is added to them before the next
+// step is kept, like the gradients a parameter server receives
 static void NfNN_Optimizer_ZeroGrad(nfnn_optimizer *Optimizer)
 {
+    u32 Epoch = NFNN_ATOMIC_ADD_U32(&NfNN_AutoGrad_Epoch, 1);
     for (nfnn_optimizer_param *Param = Optimizer->First; Param != 0; Param = Param->Next)
     {
-        NfNN_Math_Zero_f32(Param->Tensor->Gradient, NfNN_Length(Param->Tensor));
+        if (Param->Tensor->RequiresGrad)
+        {
+            NfNN_Math_Zero_f32(Param->Tensor->Gradient, Param->Length);
+            Param->Tensor->GradEpoch = Epoch;
+        }
     }
 }
 
@@ -0,0 +1,286 @@
+#ifndef NFNN_PARALLEL_H
+#define NFNN_PARALLEL_H
+
+#include <stdint.h>
+
+#include "nfnn_autograd.h"
+#include "nfnn_math.h"
+#include "nfnn_memory_arena.h"
+#include "nfnn_tensor.h"
+#include "nfnn_thread.h"
+#include "nfnn_types.h"
+
+// NOTE(luatil): One independently schedulable piece of the backward of a tape entry.
+// Tensor is either the entry itself or a copy whose inputs accumulate into partial buffers.
+typedef struct nfnn_backward_part nfnn_backward_part;
+struct nfnn_backward_part
+{
+    nfnn_tensor *Tensor;
+    nfnn_op_kernel *Kernel;
+    u32 Writes;
+    u32 TargetCount;
+    u32 Targets[2];
+    u32 LeafCount; // Leaves read or written by the part, only with a grad ready hook
+    u32 Leaves[2];
+};
+
+// NOTE(luatil): A gradient buffer written by one or more parts. It is complete once every
+// writer has finished, which is when the parts of its own backward become ready.
+typedef struct nfnn_backward_target nfnn_backward_target;
+struct nfnn_backward_target
+{
+    nfnn_tensor *Tensor;
+    u32 Pending;
+    u32 WriterCount;
+    f32 **Partials; // One per writer in tape order, only with more than one writer
+    u32 FirstPart;
+    u32 PartCount;
+    u32 Uses;       // Parts left that touch a leaf, the last one calls the grad ready hook
+    bool Overwrite; // One of the writers is the first write, see NfNN_AutoGrad_FirstWrites
+};
+
+typedef struct nfnn_backward_plan nfnn_backward_plan;
+struct nfnn_backward_plan
+{
+    nfnn_backward_part *Parts;
+    u32 PartCount;
+    nfnn_backward_target *Targets;
+    u32 TargetCount;
+    u32 *TargetTable; // Open addressing from tensor to target index + 1
+    u32 TargetTableMask;
+    nfnn_grad_ready_function *GradReady;
+    void *GradReadyContext;
+};
+
+static u32 NfNN_Parallel_Target(nfnn_backward_plan *Plan, nfnn_tensor *T)
+{
+    u32 Slot = (u32)(((uintptr_t)T >> 4) * 2654435761u) & Plan->TargetTableMask;
+    while (Plan->TargetTable[Slot] && Plan->Targets[Plan->TargetTable[Slot] - 1].Tensor != T)
+    {
+        Slot = (Slot + 1) & Plan->TargetTableMask;
+    }
+
+    if (!Plan->TargetTable[Slot])
+    {
+        nfnn_backward_target *Target = &Plan->Targets[Plan->TargetCount++];
+        memset(Target, 0, sizeof(nfnn_backward_target));
+        Target->Tensor = T;
+        Plan->TargetTable[Slot] = Plan->TargetCount;
+    }
+
+    return Plan->TargetTable[Slot] - 1;
+}
+
+static void NfNN_Parallel_BackwardJob(nfnn_thread_pool *Pool, u32 Worker, void *Context, u32 Item)
+{
+    nfnn_backward_plan *Plan = (nfnn_backward_plan *)Context;
+    nfnn_backward_part *Part = &Plan->Parts[Item];
+
+    Part->Kernel(Part->Tensor);
+
+    for (u32 Index = 0; Index < Part->TargetCount; Index++)
+    {
+        nfnn_backward_target *Target = &Plan->Targets[Part->Targets[Index]];
+        if (NFNN_ATOMIC_SUB_U32(&Target->Pending, 1) == 0)
+        {
+            // NOTE(luatil): The last writer sums the partials in tape order, so the result
+            // does not depend on which thread finished first. The first one overwrites the
+            // gradient unless it is accumulating, no writer touched it directly.
+            for (u32 Writer = 0; Target->Partials && Writer < Target->WriterCount; Writer++)
+            {
+                if (Writer == 0 && Target->Overwrite)
+                {
+                    NfNN_MemoryCopy(Target->Tensor->Gradient, Target->Partials[Writer], NfNN_Size(Target->Tensor));
+                }
+                else
+                {
+                    NfNN_Math_FmaddConst_f32(Target->Partials[Writer], 1.0f, NfNN_Length(Target->Tensor),
+                                             Target->Tensor->Gradient);
+                }
+            }
+            for (u32 Ready = 0; Ready < Target->PartCount; Ready++)
+            {
+                NfNN_ThreadPool_Push(Pool, Worker, Target->FirstPart + Ready);
+            }
+        }
+    }
+
+    // NOTE(luatil): A part that only reads a leaf (the left half of a MatMul) can still be running
+    // after its gradient is complete, so the hook waits for every part that touches the leaf
+    for (u32 Index = 0; Index < Part->LeafCount; Index++)
+    {
+        nfnn_backward_target *Target = &Plan->Targets[Part->Leaves[Index]];
+        if (NFNN_ATOMIC_SUB_U32(&Target->Uses, 1) == 0)
+        {
+            Plan->GradReady(Plan->GradReadyContext, Target->Tensor);
+        }
+    }
+}
+
+// NOTE(luatil): Same result as NfNN_AutoGrad_Backward, but every part of the reverse tape
+// whose output gradient is complete can run on any thread of the pool
+static void NfNN_AutoGrad_BackwardParallel(nfnn_memory_arena *Mem, nfnn_tensor *T, nfnn_thread_pool *Pool)
+{
+    if (!T->RequiresGrad)
+    {
+        return;
+    }
+
+    NfNN_Realize(T);
+
+    T->Gradient[0] = NfNN_AutoGrad_Seed(Mem);
+
+    if (!NfNN_Tape_Contains(Mem, T))
+    {
+        return;
+    }
+
+    u8 *Live = NfNN_Tape_MarkLive(Mem, T, true);
+    u32 EntryCount = T->TapeIndex + 1;
+    NfNN_AutoGrad_FirstWrites(Mem, Live, EntryCount);
+
+    nfnn_backward_plan *Plan = NfNN_PushStruct(Mem, nfnn_backward_plan);
+    memset(Plan, 0, sizeof(nfnn_backward_plan));
+    Plan->GradReady = Mem->AccumulateEpoch ? 0 : Mem->GradReady;
+    Plan->GradReadyContext = Mem->GradReadyContext;
+    Plan->Parts = NfNN_PushArray(Mem, nfnn_backward_part, 2 * EntryCount);
+    u32 *FirstPart = NfNN_PushArray(Mem, u32, EntryCount);
+    u32 *PartCount = NfNN_PushArray(Mem, u32, EntryCount);
+
+    // NOTE(luatil): Parts are listed in the order the sequential backward would run them
+    for (u32 Index = EntryCount; Index-- > 0;)
+    {
+        FirstPart[Index] = Plan->PartCount;
+        PartCount[Index] = 0;
+        if (Live[Index])
+        {
+            nfnn_tensor *It = NfNN_Tape_Get(Mem, Index);
+            nfnn_op_kernel *Kernels[2] = {0};
+            u32 Writes[2] = {0};
+            PartCount[Index] = NfNN_AutoGrad_BackwardParts(It, Kernels, Writes);
+            for (u32 Part = 0; Part < PartCount[Index]; Part++)
+            {
+                nfnn_backward_part *It_Part = &Plan->Parts[Plan->PartCount++];
+                memset(It_Part, 0, sizeof(nfnn_backward_part));
+                It_Part->Tensor = It;
+                It_Part->Kernel = Kernels[Part];
+                It_Part->Writes = Writes[Part];
+            }
+        }
+    }
+
+    u32 TableSize = 1;
+    while (TableSize < 4 * Plan->PartCount + 1)
+    {
+        TableSize *= 2;
+    }
+    Plan->Targets = NfNN_PushArray(Mem, nfnn_backward_target, 2 * Plan->PartCount);
+    Plan->TargetTable = NfNN_PushArray(Mem, u32, TableSize);
+    Plan->TargetTableMask = TableSize - 1;
+    memset(Plan->TargetTable, 0, TableSize * sizeof(u32));
+
+    for (u32 Index = 0; Index < Plan->PartCount; Index++)
+    {
+        nfnn_backward_part *Part = &Plan->Parts[Index];
+        for (u32 Input = 0; Input < 2; Input++)
+        {
+            if (Part->Writes & (1 << Input))
+            {
+                u32 Target = NfNN_Parallel_Target(Plan, Part->Tensor->Op.Inputs[Input]);
+                if (Part->TargetCount == 0 || Part->Targets[0] != Target)
+                {
+                    Part->Targets[Part->TargetCount++] = Target;
+                    Plan->Targets[Target].WriterCount++;
+                }
+                Plan->Targets[Target].Overwrite |= NfNN_AutoGrad_FirstWrite(Part->Tensor, Input);
+            }
+        }
+
+        for (u32 Input = 0; Plan->GradReady && Input < NfNN_Op_InputCount(Part->Tensor->Op.Type); Input++)
+        {
+            nfnn_tensor *In = Part->Tensor->Op.Inputs[Input];
+            if (In->RequiresGrad && !NfNN_Tape_Contains(Mem, In))
+            {
+                u32 Target = NfNN_Parallel_Target(Plan, In);
+                if (Part->LeafCount == 0 || Part->Leaves[0] != Target)
+                {
+                    Part->Leaves[Part->LeafCount++] = Target;
+                    Plan->Targets[Target].Uses++;
+                }
+            }
+        }
+    }
+
+    u32 *Filled = NfNN_PushArray(Mem, u32, Plan->TargetCount);
+    for (u32 Index = 0; Index < Plan->TargetCount; Index++)
+    {
+        nfnn_backward_target *Target = &Plan->Targets[Index];
+        Target->Pending = Target->WriterCount;
+        if (NfNN_Tape_Contains(Mem, Target->Tensor) && Target->Tensor->TapeIndex < EntryCount)
+        {
+            Target->FirstPart = FirstPart[Target->Tensor->TapeIndex];
+            Target->PartCount = PartCount[Target->Tensor->TapeIndex];
+        }
+        if (Target->WriterCount > 1)
+        {
+            Target->Partials = NfNN_PushArray(Mem, f32 *, Target->WriterCount);
+        }
+        Filled[Index] = 0;
+    }
+
+    // NOTE(luatil): Writers of a shared gradient get a private copy of their op whose input
+    // accumulates into a zeroed partial buffer instead of the shared one
+    for (u32 Index = 0; Index < Plan->PartCount; Index++)
+    {
+        nfnn_backward_part *Part = &Plan->Parts[Index];
+        nfnn_tensor *Shadow = 0;
+        for (u32 Input = 0; Input < NfNN_Op_InputCount(Part->Tensor->Op.Type); Input++)
+        {
+            nfnn_tensor *In = Part->Tensor->Op.Inputs[Input];
+            if (!(Part->Writes & (1 << Input)))
+            {
+                continue;
+            }
+
+            u32 TargetIndex = NfNN_Parallel_Target(Plan, In);
+            nfnn_backward_target *Target = &Plan->Targets[TargetIndex];
+            if (Target->WriterCount > 1)
+            {
+                if (!Shadow)
+                {
+                    Shadow = NfNN_PushStruct(Mem, nfnn_tensor);
+                    *Shadow = *Part->Tensor;
+                }
+
+                if (Input == 1 && Part->Tensor->Op.Inputs[0] == In && (Part->Writes & 1))
+                {
+                    Shadow->Op.Inputs[1] = Shadow->Op.Inputs[0];
+                }
+                else
+                {
+                    nfnn_tensor *ShadowIn = NfNN_PushStruct(Mem, nfnn_tensor);
+                    *ShadowIn = *In;
+                    ShadowIn->Gradient = NfNN_PushTensor(Mem, In->Dimensions);
+                    memset(ShadowIn->Gradient, 0, NfNN_Size(In));
+                    Target->Partials[Filled[TargetIndex]++] = ShadowIn->Gradient;
+                    Shadow->Op.Inputs[Input] = ShadowIn;
+                }
+            }
+        }
+        if (Shadow)
+        {
+            Part->Tensor = Shadow;
+        }
+    }
+
+    NFNN_ASSERT(Plan->PartCount <= Pool->Queues[0].Capacity, "NfNN_AutoGrad_BackwardParallel: Pool queues too small");
+
+    u32 *Roots = NfNN_PushArray(Mem, u32, PartCount[T->TapeIndex]);
+    for (u32 Index = 0; Index < PartCount[T->TapeIndex]; Index++)
+    {
+        Roots[Index] = FirstPart[T->TapeIndex] + Index;
+    }
+    NfNN_ThreadPool_Run(Pool, NfNN_Parallel_BackwardJob, Plan, Roots, PartCount[T->TapeIndex]);
+}
+
+#endif // NFNN_PARALLEL_H
@@ -12,12 +12,21 @@
 #else
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define NFNN_PLATFORM_EPOLL
+#else
+#include <sys/select.h>
+#endif
+
 #endif
 
 #if defined(_WIN32)
@@ -25,6 +34,14 @@
 #define NFNN_CLOSESOCKET(s) closesocket(s)
 #define NFNN_GETSOCKETERRNO() (WSAGetLastError())
 typedef SOCKET nfnn_platform_socket;
+#define NFNN_SET_NONBLOCKING(s)                                                                                        \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        u_long Mode = 1;                                                                                               \
+        ioctlsocket(s, FIONBIO, &Mode);                                                                                \
+    } while (0)
+#define NFNN_WOULDBLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define NFNN_MSG_NOSIGNAL 0
 #define NFNN_PLATFORM_SLEEP(_seconds) Sleep(_seconds * 1000)
 #define NFNN_PRINT_WORKING_DIR()                                                                                       \
     do                                                                                                                 \
@@ -38,6 +55,13 @@ typedef SOCKET nfnn_platform_socket;
 #define NFNN_CLOSESOCKET(s) close(s)
 typedef int nfnn_platform_socket;
 #define NFNN_GETSOCKETERRNO() (errno)
+#define NFNN_SET_NONBLOCKING(s) fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK)
+#define NFNN_WOULDBLOCK() (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+#if defined(MSG_NOSIGNAL)
+#define NFNN_MSG_NOSIGNAL MSG_NOSIGNAL
+#else
+#define NFNN_MSG_NOSIGNAL 0
+#endif
 #define NFNN_PLATFORM_SLEEP(_seconds) usleep((_seconds * 1000) * 1000)
 #define NFNN_PRINT_WORKING_DIR()                                                                                       \
     do                                                                                                                 \
@@ -69,4 +93,48 @@ typedef fd_set nfnn_fd_set;
 #define NFNN_FD_SET(socket, set) FD_SET(socket, set)
 #define NFNN_FD_ISSET(socket, set) FD_ISSET(socket, set)
 
+// NOTE(luatil): Scatter/gather socket IO, one call moves every buffer of the list. Returns the
+// bytes moved like send and recv, or -1.
+#if defined(_WIN32)
+typedef WSABUF nfnn_iovec;
+#define NFNN_IOVEC_SET(v, b, l) ((v).buf = (CHAR *)(b), (v).len = (ULONG)(l))
+#define NFNN_IOVEC_BASE(v) ((u8 *)(v).buf)
+#define NFNN_IOVEC_LENGTH(v) ((u32)(v).len)
+
+static int NfNN_Platform_WriteV(nfnn_platform_socket Socket, nfnn_iovec *Vectors, u32 Count)
+{
+    DWORD Sent = 0;
+    return WSASend(Socket, Vectors, Count, &Sent, 0, 0, 0) == 0 ? (int)Sent : -1;
+}
+
+static int NfNN_Platform_ReadV(nfnn_platform_socket Socket, nfnn_iovec *Vectors, u32 Count)
+{
+    DWORD Received = 0;
+    DWORD Flags = 0;
+    return WSARecv(Socket, Vectors, Count, &Received, &Flags, 0, 0) == 0 ? (int)Received : -1;
+}
+#else
+typedef struct iovec nfnn_iovec;
+#define NFNN_IOVEC_SET(v, b, l) ((v).iov_base = (void *)(b), (v).iov_len = (size_t)(l))
+#define NFNN_IOVEC_BASE(v) ((u8 *)(v).iov_base)
+#define NFNN_IOVEC_LENGTH(v) ((u32)(v).iov_len)
+
+// NOTE(luatil): sendmsg instead of writev, so a closed peer does not raise SIGPIPE
+static int NfNN_Platform_WriteV(nfnn_platform_socket Socket, nfnn_iovec *Vectors, u32 Count)
+{
+    struct msghdr Message = {0};
+    Message.msg_iov = Vectors;
+    Message.msg_iovlen = Count;
+    return (int)sendmsg(Socket, &Message, NFNN_MSG_NOSIGNAL);
+}
+
+static int NfNN_Platform_ReadV(nfnn_platform_socket Socket, nfnn_iovec *Vectors, u32 Count)
+{
+    struct msghdr Message = {0};
+    Message.msg_iov = Vectors;
+    Message.msg_iovlen = Count;
+    return (int)recvmsg(Socket, &Message, 0);
+}
+#endif
+
 #endif // NFNN_PLATFORM_H
@@ -124,12 +124,24 @@ enum nfnn_op_type
     NFNN_OP_TYPE_TANH,
     NFNN_OP_TYPE_MUL_CONST,
     NFNN_OP_TYPE_RESHAPE,
+    NFNN_OP_TYPE_ARGMAX,
+    NFNN_OP_TYPE_EQUAL,
     NFNN_OP_TYPE_COUNT
 };
 
 typedef struct nfnn_tensor nfnn_tensor;
 struct nfnn_tensor;
 
+// NOTE(luatil): What an operation keeps alive for its backward pass. Anything
+// not listed here is not read by backward and can be reused after forward.
+typedef struct nfnn_op_saved nfnn_op_saved;
+struct nfnn_op_saved
+{
+    u32 *Mask;  // 1 bit per element (ReLU: Input > 0)
+    f32 *Left;  // Left operand data, only if Right needs its gradient
+    f32 *Right; // Right operand data, only if Left needs its gradient
+};
+
 #define NFNN_MAX_INPUTS 2
 typedef struct nfnn_op nfnn_op;
 struct nfnn_op
@@ -153,37 +165,27 @@ struct nfnn_op
         } Unary;
         struct
         {
+            nfnn_tensor *Input;
             f32 ConstantInputf32;
         } Constant;
     };
-    nfnn_op *Next;
-    nfnn_op *Prev;
+    nfnn_op_saved Saved;
+    u32 FirstWrite; // Bit per input, set when this backward overwrites its gradient, see NfNN_AutoGrad_FirstWrites
 };
 
-typedef struct nfnn_op_list nfnn_op_list;
-struct nfnn_op_list
-{
-    nfnn_op *First;
-    nfnn_op *Last;
-};
+// NOTE(luatil): Forward and backward kernels read everything they need from T->Op
+typedef void nfnn_op_kernel(nfnn_tensor *T);
 
 struct nfnn_tensor
 {
     nfnn_dim Dimensions;
     f32 *Data;
     f32 *Gradient;
-    bool RequiresGrad;
-    bool Visited;
+    bool RequiresGrad; // Set on leaves, any input requiring it propagates to the result
+    u32 TapeIndex; // Position on the tape of the arena it was computed in
     nfnn_op Op;
-    nfnn_tensor *Next;
-    nfnn_tensor *Prev;
-};
-
-typedef struct nfnn_tensor_list nfnn_tensor_list;
-struct nfnn_tensor_list
-{
-    nfnn_tensor *First;
-    nfnn_tensor *Last;
+    nfnn_memory_arena *Pending; // Lazy arena that still has to compute Data, see NfNN_Realize
+    u32 GradEpoch; // Backward that last overwrote the gradient
 };
 
 static u32 NfNN_Length(nfnn_tensor *T)
@@ -200,20 +202,176 @@ static u32 NfNN_Size(nfnn_tensor *X)
     return Result;
 }
 
+static u32 NfNN_Op_InputCount(nfnn_op_type Type)
+{
+    u32 Result = 0;
+    switch (Type)
+    {
+    case NFNN_OP_TYPE_ADD:
+    case NFNN_OP_TYPE_BROADCAST_ADD:
+    case NFNN_OP_TYPE_SUB:
+    case NFNN_OP_TYPE_MUL:
+    case NFNN_OP_TYPE_MATMUL:
+    case NFNN_OP_TYPE_NLL_LOSS:
+    case NFNN_OP_TYPE_EQUAL: {
+        Result = 2;
+    }
+    break;
+    case NFNN_OP_TYPE_COPY:
+    case NFNN_OP_TYPE_SIGMOID:
+    case NFNN_OP_TYPE_RELU:
+    case NFNN_OP_TYPE_SQUARE:
+    case NFNN_OP_TYPE_LOG_SOFTMAX:
+    case NFNN_OP_TYPE_TANH:
+    case NFNN_OP_TYPE_MUL_CONST:
+    case NFNN_OP_TYPE_RESHAPE:
+    case NFNN_OP_TYPE_ARGMAX: {
+        Result = 1;
+    }
+    break;
+    case NFNN_OP_TYPE_LEAF:
+    case NFNN_OP_TYPE_COUNT:
+    default: {
+        Result = 0;
+    }
+    break;
+    }
+    return Result;
+}
+
 static nfnn_tensor *NfNN_CreateTensor(nfnn_memory_arena *Mem, nfnn_dim Dim, bool RequiresGrad)
 {
     nfnn_tensor *Result = NfNN_PushStruct(Mem, nfnn_tensor);
+    memset(Result, 0, sizeof(nfnn_tensor));
 
     Result->Dimensions = Dim;
     Result->Data = NfNN_PushTensor(Mem, Dim);
-    Result->Gradient = NfNN_PushTensor(Mem, Dim);
+    Result->Gradient = RequiresGrad ? NfNN_PushTensor(Mem, Dim) : 0;
 
     Result->RequiresGrad = RequiresGrad;
-    Result->Visited = false;
+    Result->TapeIndex = 0;
+    Result->Pending = 0;
+    Result->GradEpoch = 0;
+
+    return Result;
+}
+
+#define NFNN_TAPE_REQUIRES_GRAD 0x1
+#define NFNN_TAPE_PENDING 0x2
+
+static bool NfNN_Tape_Contains(nfnn_memory_arena *Mem, nfnn_tensor *T);
+
+static u8 *NfNN_Tape_Flags(nfnn_memory_arena *Mem, u32 Index)
+{
+    return NfNN_MemoryArena_TapeBlock(Mem, Index)->Flags + Index % NFNN_TAPE_BLOCK;
+}
+
+// NOTE(luatil): Copies what graph walks need from T into the dense arrays of its entry
+static void NfNN_Tape_Update(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    nfnn_tape_block *Block = NfNN_MemoryArena_TapeBlock(Mem, T->TapeIndex);
+    u32 Lane = T->TapeIndex % NFNN_TAPE_BLOCK;
+    Block->Types[Lane] = (u8)T->Op.Type;
+    Block->Flags[Lane] = (T->RequiresGrad ? NFNN_TAPE_REQUIRES_GRAD : 0) | (T->Pending ? NFNN_TAPE_PENDING : 0);
+    for (u32 Input = 0; Input < NFNN_TAPE_MAX_INPUTS; Input++)
+    {
+        nfnn_tensor *In = Input < NfNN_Op_InputCount(T->Op.Type) ? T->Op.Inputs[Input] : 0;
+        Block->Inputs[Input][Lane] = In && NfNN_Tape_Contains(Mem, In) ? In->TapeIndex : NFNN_TAPE_NONE;
+    }
+}
+
+// NOTE(luatil): Results of operations are appended to the tape of the arena
+// they were computed in, which gives a topological order for free
+static nfnn_tensor *NfNN_Tape_Record(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    // NOTE(luatil): Under no-grad the result is off the tape, so backward treats it as a constant
+    if (Mem->NoGradDepth == 0)
+    {
+        T->TapeIndex = NfNN_MemoryArena_TapePush(Mem, T);
+        NfNN_Tape_Update(Mem, T);
+    }
+    return T;
+}
+
+static nfnn_tensor *NfNN_Tape_Get(nfnn_memory_arena *Mem, u32 Index)
+{
+    return (nfnn_tensor *)*NfNN_MemoryArena_TapeEntry(Mem, Index);
+}
+
+static bool NfNN_Tape_Contains(nfnn_memory_arena *Mem, nfnn_tensor *T)
+{
+    return T->TapeIndex < Mem->TapeCount && NfNN_Tape_Get(Mem, T->TapeIndex) == T;
+}
+
+// NOTE(luatil): Returns one byte per tape entry, set for every entry T depends on.
+// The tape is already in topological order so a single reverse sweep is enough.
+// With GradientOnly set only edges into tensors that require a gradient are followed.
+static u8 *NfNN_Tape_MarkLive(nfnn_memory_arena *Mem, nfnn_tensor *T, bool GradientOnly)
+{
+    NFNN_ASSERT(NfNN_Tape_Contains(Mem, T), "Tensor was not computed on this arena");
 
-    Result->Next = 0;
-    Result->Prev = 0;
+    u8 *Result = NfNN_PushArray(Mem, u8, T->TapeIndex + 1);
+    memset(Result, 0, T->TapeIndex + 1);
+    Result[T->TapeIndex] = 1;
 
+    for (u32 Index = T->TapeIndex + 1; Index-- > 0;)
+    {
+        if (Result[Index])
+        {
+            nfnn_tape_block *Block = NfNN_MemoryArena_TapeBlock(Mem, Index);
+            for (u32 Input = 0; Input < NFNN_TAPE_MAX_INPUTS; Input++)
+            {
+                u32 In = Block->Inputs[Input][Index % NFNN_TAPE_BLOCK];
+                if (In != NFNN_TAPE_NONE && (!GradientOnly || (*NfNN_Tape_Flags(Mem, In) & NFNN_TAPE_REQUIRES_GRAD)))
+                {
+                    Result[In] = 1;
+                }
+            }
+        }
+    }
+
+    return Result;
+}
+
+// NOTE(luatil): Freezes or unfreezes a leaf, a gradient buffer is allocated the first time it is needed
+static void NfNN_SetRequiresGrad(nfnn_memory_arena *Mem, nfnn_tensor *T, bool RequiresGrad)
+{
+    if (RequiresGrad && !T->Gradient)
+    {
+        T->Gradient = NfNN_PushTensor(Mem, T->Dimensions);
+    }
+    T->RequiresGrad = RequiresGrad;
+}
+
+// NOTE(luatil): Allocates the output of an operation, nothing requires a gradient under no-grad
+static nfnn_tensor *NfNN_OpResult(nfnn_memory_arena *Mem, nfnn_dim Dim, bool RequiresGrad)
+{
+    nfnn_tensor *Result = NfNN_CreateTensor(Mem, Dim, RequiresGrad && Mem->NoGradDepth == 0);
+    return Result;
+}
+
+// NOTE(luatil): Elementwise operations write each output after reading the same input index,
+// so an in-place no-grad scope lets them take over the buffer of X when X is an intermediate
+// produced inside the scope. Any other reference to X sees the new values.
+static nfnn_tensor *NfNN_OpResultInPlace(nfnn_memory_arena *Mem, nfnn_tensor *X, bool RequiresGrad)
+{
+    nfnn_tensor *Result = 0;
+    if (X->Op.Type != NFNN_OP_TYPE_LEAF && NfNN_MemoryArena_IsScratch(Mem, X->Data))
+    {
+        Result = NfNN_PushStruct(Mem, nfnn_tensor);
+        memset(Result, 0, sizeof(nfnn_tensor));
+        Result->Dimensions = X->Dimensions;
+        Result->Data = X->Data;
+        Result->Gradient = 0;
+        Result->RequiresGrad = false;
+        Result->TapeIndex = 0;
+        Result->Pending = 0;
+        Result->GradEpoch = 0;
+    }
+    else
+    {
+        Result = NfNN_OpResult(Mem, X->Dimensions, RequiresGrad);
+    }
     return Result;
 }
 
@@ -253,7 +411,9 @@ static void NfNN_PrintGrad_(nfnn_tensor *T)
     }
 }
 
+// NOTE(luatil): Printing demands the value, so it realizes a lazy tensor first
 #define NfNN_Print(_T)                                                                                                 \
+    NfNN_Realize(_T);                                                                                                  \
     printf("%s:\n", #_T);                                                                                              \
     NfNN_Print_(_T);                                                                                                   \
     printf("\n");
@@ -0,0 +1,380 @@
+#ifndef NFNN_THREAD_H
+#define NFNN_THREAD_H
+
+#if defined(_WIN32)
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <limits.h>
+#include <linux/futex.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+#include "nfnn_macro.h"
+#include "nfnn_memory_arena.h"
+#include "nfnn_types.h"
+
+#if defined(_WIN32)
+typedef HANDLE nfnn_thread;
+typedef SRWLOCK nfnn_mutex;
+typedef CONDITION_VARIABLE nfnn_condition;
+#define NFNN_THREAD_RESULT DWORD WINAPI
+#define NFNN_THREAD_YIELD() SwitchToThread()
+#define NFNN_ATOMIC_LOAD_U32(_Ptr) ((u32)InterlockedCompareExchange((volatile LONG *)(_Ptr), 0, 0))
+#define NFNN_ATOMIC_ADD_U32(_Ptr, _Value) ((u32)InterlockedAdd((volatile LONG *)(_Ptr), (LONG)(_Value)))
+#define NFNN_ATOMIC_SUB_U32(_Ptr, _Value) ((u32)InterlockedAdd((volatile LONG *)(_Ptr), -(LONG)(_Value)))
+#define NFNN_ATOMIC_TRY_LOCK(_Ptr) (InterlockedExchange((volatile LONG *)(_Ptr), 1) == 0)
+#define NFNN_ATOMIC_UNLOCK(_Ptr) InterlockedExchange((volatile LONG *)(_Ptr), 0)
+#define NFNN_ATOMIC_STORE_U32(_Ptr, _Value) InterlockedExchange((volatile LONG *)(_Ptr), (LONG)(_Value))
+#define NFNN_ATOMIC_ADD_U64(_Ptr, _Value) InterlockedAdd64((volatile LONG64 *)(_Ptr), (LONG64)(_Value))
+#define NFNN_ATOMIC_FENCE() MemoryBarrier()
+#else
+typedef pthread_t nfnn_thread;
+typedef pthread_mutex_t nfnn_mutex;
+typedef pthread_cond_t nfnn_condition;
+#define NFNN_THREAD_RESULT void *
+#define NFNN_THREAD_YIELD() sched_yield()
+#define NFNN_ATOMIC_LOAD_U32(_Ptr) __atomic_load_n((_Ptr), __ATOMIC_ACQUIRE)
+#define NFNN_ATOMIC_ADD_U32(_Ptr, _Value) __atomic_add_fetch((_Ptr), (_Value), __ATOMIC_ACQ_REL)
+#define NFNN_ATOMIC_SUB_U32(_Ptr, _Value) __atomic_sub_fetch((_Ptr), (_Value), __ATOMIC_ACQ_REL)
+#define NFNN_ATOMIC_TRY_LOCK(_Ptr) (__atomic_exchange_n((_Ptr), 1, __ATOMIC_ACQUIRE) == 0)
+#define NFNN_ATOMIC_UNLOCK(_Ptr) __atomic_store_n((_Ptr), 0, __ATOMIC_RELEASE)
+#define NFNN_ATOMIC_STORE_U32(_Ptr, _Value) __atomic_store_n((_Ptr), (_Value), __ATOMIC_RELEASE)
+#define NFNN_ATOMIC_ADD_U64(_Ptr, _Value) __atomic_add_fetch((_Ptr), (_Value), __ATOMIC_RELAXED)
+#define NFNN_ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+typedef NFNN_THREAD_RESULT nfnn_thread_function(void *Parameter);
+
+typedef struct nfnn_thread_pool nfnn_thread_pool;
+
+// NOTE(luatil): Items are indexes into whatever the caller passed as Context
+typedef void nfnn_job_function(nfnn_thread_pool *Pool, u32 Worker, void *Context, u32 Item);
+
+// NOTE(luatil): The owner pushes and pops at the bottom, idle workers steal from the top.
+// The queue is only held for a couple of instructions so a spin lock is enough.
+typedef struct nfnn_work_queue nfnn_work_queue;
+struct nfnn_work_queue
+{
+    u32 Lock;
+    u32 Top;
+    u32 Bottom;
+    u32 Capacity;
+    u32 *Items;
+};
+
+typedef struct nfnn_thread_worker nfnn_thread_worker;
+struct nfnn_thread_worker
+{
+    nfnn_thread_pool *Pool;
+    u32 Index;
+    nfnn_thread Thread;
+};
+
+struct nfnn_thread_pool
+{
+    u32 ThreadCount; // Including the thread calling Run
+    nfnn_work_queue *Queues;
+    nfnn_thread_worker *Workers;
+
+    u32 Busy;    // Held for the duration of a Run
+    u32 Pending; // Items pushed and not yet finished
+    nfnn_job_function *Function;
+    void *Context;
+
+    nfnn_mutex Mutex;
+    nfnn_condition Start;
+    u32 Generation;
+    bool Quit;
+};
+
+static void NfNN_Mutex_Init(nfnn_mutex *Mutex)
+{
+#if defined(_WIN32)
+    InitializeSRWLock(Mutex);
+#else
+    pthread_mutex_init(Mutex, 0);
+#endif
+}
+
+static void NfNN_Mutex_Lock(nfnn_mutex *Mutex)
+{
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(Mutex);
+#else
+    pthread_mutex_lock(Mutex);
+#endif
+}
+
+static void NfNN_Mutex_Unlock(nfnn_mutex *Mutex)
+{
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(Mutex);
+#else
+    pthread_mutex_unlock(Mutex);
+#endif
+}
+
+static void NfNN_Condition_Init(nfnn_condition *Condition)
+{
+#if defined(_WIN32)
+    InitializeConditionVariable(Condition);
+#else
+    pthread_cond_init(Condition, 0);
+#endif
+}
+
+static void NfNN_Condition_Wait(nfnn_condition *Condition, nfnn_mutex *Mutex)
+{
+#if defined(_WIN32)
+    SleepConditionVariableSRW(Condition, Mutex, INFINITE, 0);
+#else
+    pthread_cond_wait(Condition, Mutex);
+#endif
+}
+
+static void NfNN_Condition_Broadcast(nfnn_condition *Condition)
+{
+#if defined(_WIN32)
+    WakeAllConditionVariable(Condition);
+#else
+    pthread_cond_broadcast(Condition);
+#endif
+}
+
+static nfnn_thread NfNN_Thread_Create(nfnn_thread_function *Function, void *Parameter)
+{
+    nfnn_thread Result;
+#if defined(_WIN32)
+    Result = CreateThread(0, 0, Function, Parameter, 0, 0);
+    NFNN_ASSERT(Result != 0, "NfNN_Thread_Create: Could not create thread");
+#else
+    int Error = pthread_create(&Result, 0, Function, Parameter);
+    NFNN_ASSERT(Error == 0, "NfNN_Thread_Create: Could not create thread");
+#endif
+    return Result;
+}
+
+static void NfNN_Thread_Join(nfnn_thread Thread)
+{
+#if defined(_WIN32)
+    WaitForSingleObject(Thread, INFINITE);
+    CloseHandle(Thread);
+#else
+    pthread_join(Thread, 0);
+#endif
+}
+
+// NOTE(luatil): Sleeps while *Address still holds Expected, at most Milliseconds and maybe less.
+// On Linux this also works between processes sharing the memory, platforms without futexes only
+// yield.
+static void NfNN_Futex_Wait(u32 *Address, u32 Expected, u32 Milliseconds)
+{
+#if defined(_WIN32)
+    WaitOnAddress((volatile VOID *)Address, &Expected, sizeof(u32), Milliseconds);
+#elif defined(__linux__)
+    struct timespec Timeout = {Milliseconds / 1000, (Milliseconds % 1000) * 1000000L};
+    syscall(SYS_futex, Address, FUTEX_WAIT, Expected, &Timeout, 0, 0);
+#else
+    NFNN_THREAD_YIELD();
+#endif
+}
+
+static void NfNN_Futex_WakeAll(u32 *Address)
+{
+#if defined(_WIN32)
+    WakeByAddressAll((PVOID)Address);
+#elif defined(__linux__)
+    syscall(SYS_futex, Address, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#endif
+}
+
+static void NfNN_WorkQueue_Push(nfnn_work_queue *Queue, u32 Item)
+{
+    while (!NFNN_ATOMIC_TRY_LOCK(&Queue->Lock))
+    {
+    }
+    NFNN_ASSERT(Queue->Bottom - Queue->Top < Queue->Capacity, "NfNN_WorkQueue_Push: Queue is full");
+    Queue->Items[Queue->Bottom % Queue->Capacity] = Item;
+    Queue->Bottom++;
+    NFNN_ATOMIC_UNLOCK(&Queue->Lock);
+}
+
+static bool NfNN_WorkQueue_Pop(nfnn_work_queue *Queue, u32 *Item)
+{
+    bool Result = false;
+    while (!NFNN_ATOMIC_TRY_LOCK(&Queue->Lock))
+    {
+    }
+    if (Queue->Bottom != Queue->Top)
+    {
+        Queue->Bottom--;
+        *Item = Queue->Items[Queue->Bottom % Queue->Capacity];
+        Result = true;
+    }
+    NFNN_ATOMIC_UNLOCK(&Queue->Lock);
+    return Result;
+}
+
+static bool NfNN_WorkQueue_Steal(nfnn_work_queue *Queue, u32 *Item)
+{
+    bool Result = false;
+    if (NFNN_ATOMIC_TRY_LOCK(&Queue->Lock))
+    {
+        if (Queue->Bottom != Queue->Top)
+        {
+            *Item = Queue->Items[Queue->Top % Queue->Capacity];
+            Queue->Top++;
+            Result = true;
+        }
+        NFNN_ATOMIC_UNLOCK(&Queue->Lock);
+    }
+    return Result;
+}
+
+// NOTE(luatil): Only valid from inside a job or before NfNN_ThreadPool_Run
+static void NfNN_ThreadPool_Push(nfnn_thread_pool *Pool, u32 Worker, u32 Item)
+{
+    NFNN_ATOMIC_ADD_U32(&Pool->Pending, 1);
+    NfNN_WorkQueue_Push(&Pool->Queues[Worker], Item);
+}
+
+static void NfNN_ThreadPool_Work(nfnn_thread_pool *Pool, u32 Worker)
+{
+    while (NFNN_ATOMIC_LOAD_U32(&Pool->Pending) > 0)
+    {
+        u32 Item = 0;
+        bool Found = NfNN_WorkQueue_Pop(&Pool->Queues[Worker], &Item);
+        for (u32 Offset = 1; !Found && Offset < Pool->ThreadCount; Offset++)
+        {
+            Found = NfNN_WorkQueue_Steal(&Pool->Queues[(Worker + Offset) % Pool->ThreadCount], &Item);
+        }
+
+        if (Found)
+        {
+            Pool->Function(Pool, Worker, Pool->Context, Item);
+            NFNN_ATOMIC_SUB_U32(&Pool->Pending, 1);
+        }
+        else
+        {
+            NFNN_THREAD_YIELD();
+        }
+    }
+}
+
+static NFNN_THREAD_RESULT NfNN_ThreadPool_WorkerMain(void *Parameter)
+{
+    nfnn_thread_worker *Worker = (nfnn_thread_worker *)Parameter;
+    nfnn_thread_pool *Pool = Worker->Pool;
+    u32 Seen = 0;
+    for (;;)
+    {
+        NfNN_Mutex_Lock(&Pool->Mutex);
+        while (Pool->Generation == Seen && !Pool->Quit)
+        {
+            NfNN_Condition_Wait(&Pool->Start, &Pool->Mutex);
+        }
+        bool Quit = Pool->Quit;
+        Seen = Pool->Generation;
+        NfNN_Mutex_Unlock(&Pool->Mutex);
+
+        if (Quit)
+        {
+            break;
+        }
+        NfNN_ThreadPool_Work(Pool, Worker->Index);
+    }
+    return 0;
+}
+
+// NOTE(luatil): Capacity bounds how many items a single worker can have queued at once
+static nfnn_thread_pool *NfNN_ThreadPool_Create(nfnn_memory_arena *Mem, u32 ThreadCount, u32 Capacity)
+{
+    NFNN_ASSERT(ThreadCount > 0, "NfNN_ThreadPool_Create: Needs at least one thread");
+
+    nfnn_thread_pool *Result = NfNN_PushStruct(Mem, nfnn_thread_pool);
+    memset(Result, 0, sizeof(nfnn_thread_pool));
+    Result->ThreadCount = ThreadCount;
+    Result->Queues = NfNN_PushArray(Mem, nfnn_work_queue, ThreadCount);
+    Result->Workers = NfNN_PushArray(Mem, nfnn_thread_worker, ThreadCount);
+    NfNN_Mutex_Init(&Result->Mutex);
+    NfNN_Condition_Init(&Result->Start);
+
+    for (u32 Index = 0; Index < ThreadCount; Index++)
+    {
+        nfnn_work_queue *Queue = &Result->Queues[Index];
+        memset(Queue, 0, sizeof(nfnn_work_queue));
+        Queue->Capacity = Capacity;
+        Queue->Items = NfNN_PushArray(Mem, u32, Capacity);
+
+        nfnn_thread_worker *Worker = &Result->Workers[Index];
+        Worker->Pool = Result;
+        Worker->Index = Index;
+    }
+
+    // NOTE(luatil): Worker 0 is whoever calls NfNN_ThreadPool_Run
+    for (u32 Index = 1; Index < ThreadCount; Index++)
+    {
+        nfnn_thread_worker *Worker = &Result->Workers[Index];
+        Worker->Thread = NfNN_Thread_Create(NfNN_ThreadPool_WorkerMain, Worker);
+    }
+
+    return Result;
+}
+
+// NOTE(luatil): Pushes the initial items to the calling thread and works until every item,
+// including the ones pushed by jobs, has finished. Returns false without running anything
+// while another Run is in progress, which includes being called from a job of this pool.
+static bool NfNN_ThreadPool_TryRun(nfnn_thread_pool *Pool, nfnn_job_function *Function, void *Context, u32 *Items,
+                                   u32 ItemCount)
+{
+    if (!NFNN_ATOMIC_TRY_LOCK(&Pool->Busy))
+    {
+        return false;
+    }
+
+    Pool->Function = Function;
+    Pool->Context = Context;
+    for (u32 Index = 0; Index < ItemCount; Index++)
+    {
+        NfNN_ThreadPool_Push(Pool, 0, Items[Index]);
+    }
+
+    NfNN_Mutex_Lock(&Pool->Mutex);
+    Pool->Generation++;
+    NfNN_Condition_Broadcast(&Pool->Start);
+    NfNN_Mutex_Unlock(&Pool->Mutex);
+
+    NfNN_ThreadPool_Work(Pool, 0);
+
+    NFNN_ATOMIC_UNLOCK(&Pool->Busy);
+    return true;
+}
+
+static void NfNN_ThreadPool_Run(nfnn_thread_pool *Pool, nfnn_job_function *Function, void *Context, u32 *Items,
+                                u32 ItemCount)
+{
+    bool Ran = NfNN_ThreadPool_TryRun(Pool, Function, Context, Items, ItemCount);
+    NFNN_ASSERT(Ran, "NfNN_ThreadPool_Run: Pool is already running");
+}
+
+static void NfNN_ThreadPool_Destroy(nfnn_thread_pool *Pool)
+{
+    NfNN_Mutex_Lock(&Pool->Mutex);
+    Pool->Quit = true;
+    NfNN_Condition_Broadcast(&Pool->Start);
+    NfNN_Mutex_Unlock(&Pool->Mutex);
+
+    for (u32 Index = 1; Index < Pool->ThreadCount; Index++)
+    {
+        NfNN_Thread_Join(Pool->Workers[Index].Thread);
+    }
+}
+
+#endif // NFNN_THREAD_H
@@ -0,0 +1,443 @@
+#ifndef NFNN_TRANSPORT_H
+#define NFNN_TRANSPORT_H
+
+#include "nfnn_macro.h"
+#include "nfnn_memory_arena.h"
+#include "nfnn_platform.h"
+#include "nfnn_thread.h"
+#include "nfnn_types.h"
+
+#if defined(__linux__)
+#include <stdio.h>
+#include <sys/mman.h>
+#endif
+
+// NOTE(luatil): Byte channels between the parameter server and its workers. TCP is one socket
+// per worker. The ring transports give every worker a pair of single producer, single consumer
+// rings in one segment, a file in /dev/shm for processes on the same host or plain memory for
+// threads of one process. A side that has to wait sleeps on a futex of the ring, and every change
+// a worker makes also rings the doorbell of the segment, so the server sleeps on one word for all
+// of its workers.
+
+static u64 GlobalRead = 0;
+static u64 GlobalWrite = 0;
+static u64 GlobalCalls = 0; // Transfers tried on a channel, on TCP each one is a system call
+
+typedef enum nfnn_transport
+{
+    NFNN_TRANSPORT_TCP,
+    NFNN_TRANSPORT_SHARED_MEMORY, // Processes on one host, Linux only
+    NFNN_TRANSPORT_IN_PROCESS,    // Threads of one process
+    NFNN_TRANSPORT_COUNT
+} nfnn_transport;
+
+#define NFNN_RING_SIZE KB(128)     // Bytes per direction and worker, power of two
+#define NFNN_RING_CHANNELS 64      // Workers per segment
+#define NFNN_RING_MAGIC 0x474E4952 // "RING"
+#define NFNN_RING_WAIT_MS 100      // A closing peer does not touch the word a side sleeps on
+
+#define NFNN_CHANNEL_AGAIN -1 // Nothing moved, the channel would have to wait
+#define NFNN_CHANNEL_CLOSED -2
+
+typedef struct nfnn_ring nfnn_ring;
+struct nfnn_ring
+{
+    u32 Head;        // Bytes written, stored by the producer
+    u32 HeadWaiting; // The consumer sleeps on Head
+    u8 HeadPad[56];
+    u32 Tail;        // Bytes read, stored by the consumer
+    u32 TailWaiting; // The producer sleeps on Tail
+    u8 TailPad[56];
+    u8 Data[NFNN_RING_SIZE];
+};
+
+typedef struct nfnn_ring_pair nfnn_ring_pair;
+struct nfnn_ring_pair
+{
+    nfnn_ring ToWorker;
+    nfnn_ring ToServer;
+    u32 ServerClosed;
+    u32 WorkerClosed;
+    u8 Pad[56];
+};
+
+// NOTE(luatil): Pages of unused pairs are never touched, they cost address space only
+typedef struct nfnn_ring_segment nfnn_ring_segment;
+struct nfnn_ring_segment
+{
+    u32 Magic;
+    u32 Attached;      // Pairs handed out to workers
+    u32 Doorbell;      // One more after every change a worker makes
+    u32 ServerWaiting; // The server sleeps on Doorbell
+    u8 Pad[48];
+    nfnn_ring_pair Pairs[NFNN_RING_CHANNELS];
+};
+
+typedef struct nfnn_channel nfnn_channel;
+struct nfnn_channel
+{
+    nfnn_transport Transport;
+    nfnn_platform_socket Handle; // TCP
+
+    nfnn_ring_segment *Segment; // Ring transports
+    nfnn_ring *Send;
+    nfnn_ring *Recv;
+    u32 *Closed; // Of this end
+    u32 *PeerClosed;
+    bool Worker; // Rings the doorbell on every change
+};
+
+// NOTE(luatil): In-process segments by port, only the thread creating servers changes the table
+typedef struct nfnn_segment_entry nfnn_segment_entry;
+struct nfnn_segment_entry
+{
+    u32 Port;
+    nfnn_ring_segment *Segment;
+};
+
+static nfnn_segment_entry NfNN_Segments[16];
+static u32 NfNN_Segments_Ephemeral = 0;
+
+// NOTE(luatil): Unique among the processes of the host, ring transports have no port to bind
+static u32 NfNN_Segment_EphemeralPort(void)
+{
+#if defined(_WIN32)
+    u32 Process = (u32)GetCurrentProcessId();
+#else
+    u32 Process = (u32)getpid();
+#endif
+    return 0x10000 + (Process << 8) + (NfNN_Segments_Ephemeral++ & 0xFF);
+}
+
+#if defined(__linux__)
+static void NfNN_Segment_Path(char *Path, u32 Size, u32 Port, char *Suffix)
+{
+    snprintf(Path, Size, "/dev/shm/nfnn_%u%s", Port, Suffix);
+}
+#endif
+
+static nfnn_ring_segment *NfNN_Segment_Create(nfnn_transport Transport, u32 Port)
+{
+    nfnn_ring_segment *Result = 0;
+    switch (Transport)
+    {
+    case NFNN_TRANSPORT_SHARED_MEMORY: {
+#if defined(__linux__)
+        // NOTE(luatil): Built under a temporary name, a worker never opens a half made segment
+        char Path[64];
+        char Temporary[64];
+        NfNN_Segment_Path(Path, sizeof(Path), Port, "");
+        NfNN_Segment_Path(Temporary, sizeof(Temporary), Port, ".new");
+        int File = open(Temporary, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        NFNN_ASSERT(File >= 0, "NfNN_Segment_Create: Could not create the shared memory file");
+        NFNN_ASSERT(ftruncate(File, sizeof(nfnn_ring_segment)) == 0, "NfNN_Segment_Create: ftruncate failed");
+        void *Memory = mmap(0, sizeof(nfnn_ring_segment), PROT_READ | PROT_WRITE, MAP_SHARED, File, 0);
+        close(File);
+        NFNN_ASSERT(Memory != MAP_FAILED, "NfNN_Segment_Create: mmap failed");
+        Result = (nfnn_ring_segment *)Memory;
+        Result->Magic = NFNN_RING_MAGIC;
+        NFNN_ASSERT(rename(Temporary, Path) == 0, "NfNN_Segment_Create: rename failed");
+#else
+        NFNN_ASSERT(0, "NfNN_Segment_Create: Shared memory transport needs Linux");
+#endif
+    }
+    break;
+    case NFNN_TRANSPORT_IN_PROCESS: {
+        u32 Index = 0;
+        while (Index < NFNN_ARRAY_COUNT(NfNN_Segments) && NfNN_Segments[Index].Segment)
+        {
+            Index++;
+        }
+        NFNN_ASSERT(Index < NFNN_ARRAY_COUNT(NfNN_Segments), "NfNN_Segment_Create: Too many in-process servers");
+        Result = (nfnn_ring_segment *)calloc(1, sizeof(nfnn_ring_segment));
+        NFNN_ASSERT(Result, "NfNN_Segment_Create: Out of memory");
+        Result->Magic = NFNN_RING_MAGIC;
+        NfNN_Segments[Index].Port = Port;
+        NfNN_Segments[Index].Segment = Result;
+    }
+    break;
+    case NFNN_TRANSPORT_TCP:
+    case NFNN_TRANSPORT_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+    return Result;
+}
+
+static nfnn_ring_segment *NfNN_Segment_Open(nfnn_transport Transport, u32 Port)
+{
+    nfnn_ring_segment *Result = 0;
+    switch (Transport)
+    {
+    case NFNN_TRANSPORT_SHARED_MEMORY: {
+#if defined(__linux__)
+        char Path[64];
+        NfNN_Segment_Path(Path, sizeof(Path), Port, "");
+        int File = open(Path, O_RDWR);
+        NFNN_ASSERT(File >= 0, "NfNN_Segment_Open: No server on this port");
+        void *Memory = mmap(0, sizeof(nfnn_ring_segment), PROT_READ | PROT_WRITE, MAP_SHARED, File, 0);
+        close(File);
+        NFNN_ASSERT(Memory != MAP_FAILED, "NfNN_Segment_Open: mmap failed");
+        Result = (nfnn_ring_segment *)Memory;
+#else
+        NFNN_ASSERT(0, "NfNN_Segment_Open: Shared memory transport needs Linux");
+#endif
+    }
+    break;
+    case NFNN_TRANSPORT_IN_PROCESS: {
+        for (u32 Index = 0; Index < NFNN_ARRAY_COUNT(NfNN_Segments) && !Result; Index++)
+        {
+            if (NfNN_Segments[Index].Segment && NfNN_Segments[Index].Port == Port)
+            {
+                Result = NfNN_Segments[Index].Segment;
+            }
+        }
+        NFNN_ASSERT(Result, "NfNN_Segment_Open: No server on this port");
+    }
+    break;
+    case NFNN_TRANSPORT_TCP:
+    case NFNN_TRANSPORT_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+    NFNN_ASSERT(Result->Magic == NFNN_RING_MAGIC, "NfNN_Segment_Open: Not a ring segment");
+    return Result;
+}
+
+// NOTE(luatil): The server also removes the segment. Shared memory mappings of workers stay
+// valid until they disconnect.
+static void NfNN_Segment_Close(nfnn_transport Transport, nfnn_ring_segment *Segment, u32 Port, bool Server)
+{
+    switch (Transport)
+    {
+    case NFNN_TRANSPORT_SHARED_MEMORY: {
+#if defined(__linux__)
+        if (Server)
+        {
+            char Path[64];
+            NfNN_Segment_Path(Path, sizeof(Path), Port, "");
+            unlink(Path);
+        }
+        munmap(Segment, sizeof(nfnn_ring_segment));
+#endif
+    }
+    break;
+    case NFNN_TRANSPORT_IN_PROCESS: {
+        // NOTE(luatil): Worker threads have to be disconnected before the server closes
+        for (u32 Index = 0; Index < NFNN_ARRAY_COUNT(NfNN_Segments) && Server; Index++)
+        {
+            if (NfNN_Segments[Index].Segment == Segment)
+            {
+                NfNN_Segments[Index].Segment = 0;
+                free(Segment);
+            }
+        }
+    }
+    break;
+    case NFNN_TRANSPORT_TCP:
+    case NFNN_TRANSPORT_COUNT:
+    default: {
+    }
+    break;
+    }
+}
+
+static void NfNN_Segment_Ring(nfnn_ring_segment *Segment)
+{
+    NFNN_ATOMIC_ADD_U32(&Segment->Doorbell, 1);
+    NFNN_ATOMIC_FENCE();
+    if (NFNN_ATOMIC_LOAD_U32(&Segment->ServerWaiting))
+    {
+        NfNN_Futex_WakeAll(&Segment->Doorbell);
+    }
+}
+
+// NOTE(luatil): Seen is the doorbell from before the server last looked at its rings
+static void NfNN_Segment_Wait(nfnn_ring_segment *Segment, u32 Seen)
+{
+    NFNN_ATOMIC_STORE_U32(&Segment->ServerWaiting, 1);
+    NFNN_ATOMIC_FENCE();
+    if (NFNN_ATOMIC_LOAD_U32(&Segment->Doorbell) == Seen)
+    {
+        NfNN_Futex_Wait(&Segment->Doorbell, Seen, NFNN_RING_WAIT_MS);
+    }
+    NFNN_ATOMIC_STORE_U32(&Segment->ServerWaiting, 0);
+}
+
+static u32 NfNN_Ring_Available(nfnn_ring *Ring, bool Write)
+{
+    u32 Used = NFNN_ATOMIC_LOAD_U32(&Ring->Head) - NFNN_ATOMIC_LOAD_U32(&Ring->Tail);
+    return Write ? NFNN_RING_SIZE - Used : Used;
+}
+
+static void NfNN_Ring_Copy(nfnn_ring *Ring, u32 Position, u8 *Memory, u32 Size, bool Write)
+{
+    u32 Offset = Position & (NFNN_RING_SIZE - 1);
+    u32 First = NFNN_MIN(Size, NFNN_RING_SIZE - Offset);
+    if (Write)
+    {
+        memcpy(Ring->Data + Offset, Memory, First);
+        memcpy(Ring->Data, Memory + First, Size - First);
+    }
+    else
+    {
+        memcpy(Memory, Ring->Data + Offset, First);
+        memcpy(Memory + First, Ring->Data, Size - First);
+    }
+}
+
+// NOTE(luatil): Moves as much of the vectors as the ring takes or has, returns the bytes moved
+static u32 NfNN_Ring_Transfer(nfnn_ring *Ring, nfnn_iovec *Vectors, u32 Count, bool Write)
+{
+    u32 *Counter = Write ? &Ring->Head : &Ring->Tail;
+    u32 *Waiting = Write ? &Ring->HeadWaiting : &Ring->TailWaiting;
+    u32 Position = *Counter;
+    u32 Available = NfNN_Ring_Available(Ring, Write);
+
+    u32 Result = 0;
+    for (u32 Index = 0; Index < Count && Result < Available; Index++)
+    {
+        u32 Size = NFNN_MIN(NFNN_IOVEC_LENGTH(Vectors[Index]), Available - Result);
+        NfNN_Ring_Copy(Ring, Position + Result, NFNN_IOVEC_BASE(Vectors[Index]), Size, Write);
+        Result += Size;
+    }
+
+    if (Result > 0)
+    {
+        NFNN_ATOMIC_STORE_U32(Counter, Position + Result);
+        NFNN_ATOMIC_FENCE();
+        if (NFNN_ATOMIC_LOAD_U32(Waiting))
+        {
+            NfNN_Futex_WakeAll(Counter);
+        }
+    }
+    return Result;
+}
+
+// NOTE(luatil): Sleeps until the other end moved, for room when writing and for data otherwise
+static void NfNN_Ring_Wait(nfnn_ring *Ring, bool Write, u32 *PeerClosed)
+{
+    u32 *Counter = Write ? &Ring->Tail : &Ring->Head;
+    u32 *Waiting = Write ? &Ring->TailWaiting : &Ring->HeadWaiting;
+    u32 Seen = NFNN_ATOMIC_LOAD_U32(Counter);
+    NFNN_ATOMIC_STORE_U32(Waiting, 1);
+    NFNN_ATOMIC_FENCE();
+    if (NfNN_Ring_Available(Ring, Write) == 0 && !NFNN_ATOMIC_LOAD_U32(PeerClosed))
+    {
+        NfNN_Futex_Wait(Counter, Seen, NFNN_RING_WAIT_MS);
+    }
+    NFNN_ATOMIC_STORE_U32(Waiting, 0);
+}
+
+static nfnn_channel NfNN_Channel_Socket(nfnn_platform_socket Handle)
+{
+    nfnn_channel Result = {0};
+    Result.Transport = NFNN_TRANSPORT_TCP;
+    Result.Handle = Handle;
+    return Result;
+}
+
+static nfnn_channel NfNN_Channel_Rings(nfnn_transport Transport, nfnn_ring_segment *Segment, u32 Pair, bool Worker)
+{
+    nfnn_ring_pair *Rings = Segment->Pairs + Pair;
+    nfnn_channel Result = {0};
+    Result.Transport = Transport;
+    Result.Segment = Segment;
+    Result.Send = Worker ? &Rings->ToServer : &Rings->ToWorker;
+    Result.Recv = Worker ? &Rings->ToWorker : &Rings->ToServer;
+    Result.Closed = Worker ? &Rings->WorkerClosed : &Rings->ServerClosed;
+    Result.PeerClosed = Worker ? &Rings->ServerClosed : &Rings->WorkerClosed;
+    Result.Worker = Worker;
+    return Result;
+}
+
+// NOTE(luatil): Returns the bytes moved, NFNN_CHANNEL_AGAIN when a non-blocking channel could
+// not move any or NFNN_CHANNEL_CLOSED. Reading from a closed ring still gets what is left in it.
+static int NfNN_Channel_Transfer(nfnn_channel *Channel, nfnn_iovec *Vectors, u32 Count, bool Write)
+{
+    int Result = NFNN_CHANNEL_CLOSED;
+    NFNN_ATOMIC_ADD_U64(&GlobalCalls, 1);
+    switch (Channel->Transport)
+    {
+    case NFNN_TRANSPORT_TCP: {
+        int Bytes = Write ? NfNN_Platform_WriteV(Channel->Handle, Vectors, Count)
+                          : NfNN_Platform_ReadV(Channel->Handle, Vectors, Count);
+        if (Bytes > 0)
+        {
+            Result = Bytes;
+        }
+        else if (Bytes < 0 && NFNN_WOULDBLOCK())
+        {
+            Result = NFNN_CHANNEL_AGAIN;
+        }
+    }
+    break;
+    case NFNN_TRANSPORT_SHARED_MEMORY:
+    case NFNN_TRANSPORT_IN_PROCESS: {
+        bool PeerClosed = NFNN_ATOMIC_LOAD_U32(Channel->PeerClosed) != 0;
+        u32 Bytes = (Write && PeerClosed) ? 0 : NfNN_Ring_Transfer(Write ? Channel->Send : Channel->Recv, Vectors,
+                                                                   Count, Write);
+        if (Bytes > 0)
+        {
+            Result = (int)Bytes;
+            if (Channel->Worker)
+            {
+                NfNN_Segment_Ring(Channel->Segment);
+            }
+        }
+        else if (!PeerClosed)
+        {
+            Result = NFNN_CHANNEL_AGAIN;
+        }
+    }
+    break;
+    case NFNN_TRANSPORT_COUNT:
+    default: {
+        NFNN_ERROR();
+    }
+    break;
+    }
+
+    if (Result > 0)
+    {
+        NFNN_ATOMIC_ADD_U64(Write ? &GlobalWrite : &GlobalRead, Result);
+    }
+    return Result;
+}
+
+// NOTE(luatil): For blocking ends after NFNN_CHANNEL_AGAIN, blocking sockets never need it
+static void NfNN_Channel_Wait(nfnn_channel *Channel, bool Write)
+{
+    if (Channel->Transport != NFNN_TRANSPORT_TCP)
+    {
+        NfNN_Ring_Wait(Write ? Channel->Send : Channel->Recv, Write, Channel->PeerClosed);
+    }
+}
+
+// NOTE(luatil): Whether a transfer would move bytes or report the close, for ring channels
+static bool NfNN_Channel_Ready(nfnn_channel *Channel, bool Write)
+{
+    return NFNN_ATOMIC_LOAD_U32(Channel->PeerClosed) ||
+           NfNN_Ring_Available(Write ? Channel->Send : Channel->Recv, Write) > 0;
+}
+
+static void NfNN_Channel_Close(nfnn_channel *Channel)
+{
+    if (Channel->Transport == NFNN_TRANSPORT_TCP)
+    {
+        NFNN_CLOSESOCKET(Channel->Handle);
+        return;
+    }
+
+    NFNN_ATOMIC_STORE_U32(Channel->Closed, 1);
+    if (Channel->Worker)
+    {
+        NfNN_Segment_Ring(Channel->Segment);
+    }
+}
+
+#endif // NFNN_TRANSPORT_H
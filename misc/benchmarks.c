@@ -0,0 +1,455 @@
+/**
+ * Micro benchmarks for the library kernels
+ *
+ * Usage:
+ *
+ * ./benchmarks
+ */
+#include "../lib/nfnn.h"
+
+static f64 Benchmark_Microseconds(nfnn_time Start, nfnn_time End)
+{
+    nfnn_time_diff Diff = NfNN_Time_Diff(Start, End);
+    return (f64)Diff.Seconds * 1000000.0 + (f64)Diff.Microseconds;
+}
+
+#define BENCHMARK_BEST_OF(_Best, _Repeats, _Iterations, _Body)                                                         \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        _Best = 1e30;                                                                                                  \
+        for (u32 Repeat = 0; Repeat < (_Repeats); Repeat++)                                                            \
+        {                                                                                                              \
+            nfnn_time Start = NfNN_Time_CurrentTime();                                                                 \
+            for (u32 Iteration = 0; Iteration < (_Iterations); Iteration++)                                            \
+            {                                                                                                          \
+                _Body;                                                                                                 \
+            }                                                                                                          \
+            f64 Elapsed = Benchmark_Microseconds(Start, NfNN_Time_CurrentTime()) / (_Iterations);                      \
+            _Best = Elapsed < _Best ? Elapsed : _Best;                                                                 \
+        }                                                                                                              \
+    } while (0)
+
+// NOTE(luatil): Generic against specialized kernels for every shape in NFNN_MATMUL_SHAPES
+static void Benchmark_MatMulShape(nfnn_memory_arena *Mem, u32 M, u32 K, u32 N)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    f32 *A = NfNN_PushArray(Mem, f32, M * K);
+    f32 *B = NfNN_PushArray(Mem, f32, K * N);
+    f32 *Out = NfNN_PushArray(Mem, f32, M * N);
+    f32 *DA = NfNN_PushArray(Mem, f32, M * K);
+    f32 *DB = NfNN_PushArray(Mem, f32, K * N);
+    for (u32 Index = 0; Index < M * K; Index++)
+    {
+        A[Index] = (f32)(Index % 13) * 0.01f;
+        DA[Index] = 0.0f;
+    }
+    for (u32 Index = 0; Index < K * N; Index++)
+    {
+        B[Index] = (f32)(Index % 7) * 0.02f;
+        DB[Index] = 0.0f;
+    }
+
+    u32 Iterations = NFNN_MAX(1, 20000000 / (M * K * N));
+    f64 Generic[3], Specialized[3];
+    BENCHMARK_BEST_OF(Generic[0], 5, Iterations, NfNN_Math_MatMulGeneric_f32(A, B, M, K, N, Out));
+    BENCHMARK_BEST_OF(Specialized[0], 5, Iterations, NfNN_Math_MatMul_f32(A, B, M, K, N, Out));
+    BENCHMARK_BEST_OF(Generic[1], 5, Iterations, NfNN_Math_MatmulAddTransposeRightGeneric_f32(Out, B, M, N, K, DA));
+    BENCHMARK_BEST_OF(Specialized[1], 5, Iterations, NfNN_Math_MatmulAddTransposeRight_f32(Out, B, M, N, K, DA));
+    BENCHMARK_BEST_OF(Generic[2], 5, Iterations, NfNN_Math_MatmulAddTransposeLeftGeneric_f32(A, Out, M, K, N, DB));
+    BENCHMARK_BEST_OF(Specialized[2], 5, Iterations, NfNN_Math_MatmulAddTransposeLeft_f32(A, Out, M, K, N, DB));
+
+    char *Names[3] = {"A @ B", "dA += G @ B^T", "dB += A^T @ G"};
+    for (u32 Kernel = 0; Kernel < 3; Kernel++)
+    {
+        printf("  (%4u, %4u, %4u) %-14s generic %9.2f us  specialized %9.2f us  speedup %5.2fx\n", M, K, N,
+               Names[Kernel], Generic[Kernel], Specialized[Kernel], Generic[Kernel] / Specialized[Kernel]);
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+// NOTE(luatil): Default dispatch against the configuration the autotuner picks for a shape
+static void Benchmark_Autotune(nfnn_memory_arena *Mem, nfnn_gemm_kernel Kernel, u32 D0, u32 D1, u32 D2)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    u32 Size = NFNN_MAX(D0, D1) * NFNN_MAX(D1, D2);
+    f32 *A = NfNN_PushArray(Mem, f32, Size);
+    f32 *B = NfNN_PushArray(Mem, f32, Size);
+    f32 *Out = NfNN_PushArray(Mem, f32, Size);
+    for (u32 Index = 0; Index < Size; Index++)
+    {
+        A[Index] = (f32)(Index % 13) * 0.01f;
+        B[Index] = (f32)(Index % 7) * 0.02f;
+        Out[Index] = 0.0f;
+    }
+
+    nfnn_gemm_config Default = {NFNN_GEMM_KIND_SPECIALIZED, 0, 0, 0, 1};
+    nfnn_gemm_entry *Entry = NfNN_Gemm_Add(Kernel, D0, D1, D2);
+    NfNN_Autotune_Entry(Entry);
+    nfnn_gemm_config Tuned = Entry->Config;
+
+    u32 Iterations = NFNN_MAX(1, 20000000 / (D0 * D1 * D2));
+    f64 DefaultTime, TunedTime;
+    BENCHMARK_BEST_OF(DefaultTime, 5, Iterations, NfNN_Math_GemmWithConfig_f32(Kernel, A, B, D0, D1, D2, Out, Default));
+    BENCHMARK_BEST_OF(TunedTime, 5, Iterations, NfNN_Math_GemmWithConfig_f32(Kernel, A, B, D0, D1, D2, Out, Tuned));
+
+    char *Kinds[NFNN_GEMM_KIND_COUNT] = {"specialized", "generic", "blocked"};
+    printf("  kernel %u (%4u, %4u, %4u) default %9.2f us  tuned %9.2f us  speedup %5.2fx  %s %u %u %u x%u\n", Kernel,
+           D0, D1, D2, DefaultTime, TunedTime, DefaultTime / TunedTime, Kinds[Tuned.Kind], Tuned.BlockRows,
+           Tuned.BlockInner, Tuned.BlockColumns, Tuned.Threads);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+// NOTE(luatil): Two heads written as separate calls on the same hidden layer, as a weight tied
+// model would, built eagerly with and without hash-consing
+static nfnn_tensor *Benchmark_InternStep(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *W, nfnn_tensor *Y)
+{
+    nfnn_tensor *First = NfNN_MSELoss(Mem, NfNN_Tanh(Mem, NfNN_MatMul(Mem, X, W)), Y);
+    nfnn_tensor *Second = NfNN_MSELoss(Mem, NfNN_Tanh(Mem, NfNN_MatMul(Mem, X, W)), NfNN_Square(Mem, Y));
+    return NfNN_Add(Mem, First, Second);
+}
+
+static void Benchmark_Intern(nfnn_memory_arena *Mem, bool Intern)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 7);
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, 64, 256);
+    nfnn_tensor *W = NfNN_Matrix(Mem, &Random, 256, 128);
+    nfnn_tensor *Y = NfNN_Matrix(Mem, &Random, 64, 128);
+    X->RequiresGrad = false;
+    Y->RequiresGrad = false;
+
+    NfNN_Constants_Attach(Mem, Intern ? Mem : 0);
+    NfNN_Ones(Mem, NfNN_Dim2(1, 64));
+    NfNN_Ones(Mem, NfNN_Dim2(128, 1));
+    NfNN_Const(Mem, NfNN_Dim2(1, 1), 0.5f / 64.0f);
+
+    u64 Bytes = 0;
+    u32 Nodes = 0;
+    f64 Best;
+    BENCHMARK_BEST_OF(Best, 5, 20, {
+        u64 Used = Mem->Used;
+        u32 TapeCount = Mem->TapeCount;
+        if (Intern)
+        {
+            NfNN_Intern_Begin(Mem);
+        }
+        nfnn_tensor *Loss = Benchmark_InternStep(Mem, X, W, Y);
+        NfNN_AutoGrad_Backward(Mem, Loss);
+        if (Intern)
+        {
+            NfNN_Intern_End(Mem);
+        }
+        Bytes = Mem->Used - Used;
+        Nodes = Mem->TapeCount - TapeCount;
+        memset(Mem->Base + Used, 0, Bytes);
+        Mem->Used = Used;
+        Mem->TapeCount = TapeCount;
+    });
+    NfNN_Constants_Attach(Mem, 0);
+
+    printf("  %-12s %3u nodes  %8llu bytes  %9.2f us per step\n", Intern ? "hash-consed" : "plain", Nodes,
+           (unsigned long long)Bytes, Best);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+// NOTE(luatil): Per-node cost of building, walking and replaying a long chain of tiny ops,
+// where bookkeeping rather than arithmetic dominates
+static nfnn_tensor *Benchmark_ChainStep(nfnn_memory_arena *Mem, nfnn_tensor *X, u32 NodeCount)
+{
+    nfnn_tensor *H = X;
+    for (u32 Index = 0; Index + 2 < NodeCount; Index += 2)
+    {
+        H = NfNN_Tanh(Mem, NfNN_Add(Mem, H, X));
+    }
+    return NfNN_SumAll(Mem, H);
+}
+
+static void Benchmark_NodeOverhead(nfnn_memory_arena *Mem, u32 NodeCount)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){0.1f, -0.2f, 0.3f, 0.4f}, NfNN_Dim2(1, 4));
+
+    f64 Build, Walk, Backward, Replay;
+    BENCHMARK_BEST_OF(Build, 5, 1, {
+        NfNN_MemoryArena_TempInit(Mem);
+        Benchmark_ChainStep(Mem, X, NodeCount);
+        NfNN_MemoryArena_TempClear(Mem);
+    });
+
+    nfnn_tensor *Loss = Benchmark_ChainStep(Mem, X, NodeCount);
+    u32 Nodes = Loss->TapeIndex + 1;
+    BENCHMARK_BEST_OF(Walk, 5, 10, {
+        u64 Used = Mem->Used;
+        NfNN_Tape_MarkLive(Mem, Loss, true);
+        memset(Mem->Base + Used, 0, Mem->Used - Used);
+        Mem->Used = Used;
+    });
+    BENCHMARK_BEST_OF(Backward, 5, 10, {
+        u64 Used = Mem->Used;
+        NfNN_AutoGrad_Backward(Mem, Loss);
+        memset(Mem->Base + Used, 0, Mem->Used - Used);
+        Mem->Used = Used;
+    });
+
+    nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+    NfNN_Graph_EndCapture(Graph, Benchmark_ChainStep(Mem, X, NodeCount), 0);
+    BENCHMARK_BEST_OF(Replay, 5, 10, NfNN_Graph_Replay(Graph));
+
+    printf("  %6u nodes  build %6.1f ns  walk %6.2f ns  backward %6.1f ns  replay %6.1f ns  per node\n", Nodes,
+           Build * 1000.0 / Nodes, Walk * 1000.0 / Nodes, Backward * 1000.0 / Nodes, Replay * 1000.0 / Nodes);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+// NOTE(luatil): One optimizer step over an MNIST sized and a larger model
+static void Benchmark_Optimizer(nfnn_memory_arena *Mem, u32 Width, u32 Layers, nfnn_optimizer_type Type, bool Quantized)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 3);
+    nfnn_optimizer *Optimizers[] = {NfNN_Optimizer_SGD(Mem, 0.01f, 1, 0.9f, 0.0f, 0.0001f, false),
+                                    NfNN_Optimizer_Adam(Mem, 0.001f, 1, 0, 0),
+                                    NfNN_Optimizer_LARS(Mem, 0.1f, 1, 0.9f, 0.0001f, 0),
+                                    NfNN_Optimizer_LAMB(Mem, 0.001f, 1, 0, 0, 0.01f)};
+    char *Names[] = {"SGD", "Adam", "LARS", "LAMB"};
+    nfnn_optimizer *Optimizer = Optimizers[Type];
+    if (Quantized)
+    {
+        NfNN_Optimizer_QuantizeState(Optimizer);
+    }
+    u32 Parameters = 0;
+    for (u32 Layer = 0; Layer < Layers; Layer++)
+    {
+        u32 Inputs = Layer == 0 ? 784 : Width;
+        nfnn_tensor *W = NfNN_Matrix(Mem, &Random, Inputs, Width);
+        nfnn_tensor *B = NfNN_Matrix(Mem, &Random, 1, Width);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, W);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, B);
+        NfNN_Random_UniformArrayInRange_f32(&Random, W->Gradient, NfNN_Length(W), -0.01f, 0.01f);
+        Parameters += NfNN_Length(W) + NfNN_Length(B);
+    }
+
+    u32 Iterations = NFNN_MAX(1, 50000000 / Parameters);
+    f64 Best;
+    BENCHMARK_BEST_OF(Best, 5, Iterations, NfNN_Optimizer_Step(Optimizer));
+
+    printf("  %-4s %-5s %8u parameters  %9.2f us per step  %6.3f ns per parameter\n", Names[Type],
+           Quantized ? "8-bit" : "f32", Parameters, Best, Best * 1000.0 / Parameters);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+// NOTE(luatil): Backward and step of a two layer MLP, with the step after backward or inside it.
+// Small batches make the step a large part of the time.
+static void Benchmark_GradReady(nfnn_memory_arena *Mem, u32 Batch, u32 Hidden, bool Overlap)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 3);
+    nfnn_optimizer *Optimizer = NfNN_Optimizer_SGD(Mem, 0.001f, 1, 0.9f, 0.0f, 0.0001f, false);
+    nfnn_tensor *Params[4] = {NfNN_Matrix(Mem, &Random, 784, Hidden), NfNN_Matrix(Mem, &Random, 1, Hidden),
+                              NfNN_Matrix(Mem, &Random, Hidden, Hidden), NfNN_Matrix(Mem, &Random, 1, Hidden)};
+    for (u32 Index = 0; Index < 4; Index++)
+    {
+        NfNN_Optimizer_AddParam(Mem, Optimizer, Params[Index]);
+    }
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, Batch, 784);
+    NfNN_SetRequiresGrad(Mem, X, false);
+
+    nfnn_tensor *H = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, Params[0]), Params[1]));
+    nfnn_tensor *L = NfNN_SumAll(Mem, NfNN_Square(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, H, Params[2]), Params[3])));
+    if (Overlap)
+    {
+        NfNN_Optimizer_OverlapBackward(Mem, Optimizer);
+    }
+
+    f64 Best;
+    u64 Used = Mem->Used;
+    BENCHMARK_BEST_OF(Best, 5, 20, {
+        NfNN_AutoGrad_Backward(Mem, L);
+        NfNN_Optimizer_Step(Optimizer);
+        memset(Mem->Base + Used, 0, Mem->Used - Used);
+        Mem->Used = Used;
+    });
+    NfNN_AutoGrad_SetGradReady(Mem, 0, 0);
+
+    printf("  %-22s batch %3u hidden %4u  %9.2f us per backward and step\n",
+           Overlap ? "step inside backward" : "step after backward", Batch, Hidden, Best);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void Benchmark_FirstWrite(nfnn_memory_arena *Mem, u32 Batch, u32 Hidden, bool ZeroGrad)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 4);
+    nfnn_tensor *W1 = NfNN_Matrix(Mem, &Random, 784, Hidden);
+    nfnn_tensor *B1 = NfNN_Matrix(Mem, &Random, 1, Hidden);
+    nfnn_tensor *W2 = NfNN_Matrix(Mem, &Random, Hidden, 10);
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, Batch, 784);
+    NfNN_SetRequiresGrad(Mem, X, false);
+
+    nfnn_tensor *H = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W1), B1));
+    nfnn_tensor *L = NfNN_SumAll(Mem, NfNN_Square(Mem, NfNN_MatMul(Mem, H, W2)));
+
+    f64 Best;
+    u64 Used = Mem->Used;
+    BENCHMARK_BEST_OF(Best, 5, 20, {
+        if (ZeroGrad)
+        {
+            NfNN_AutoGrad_ZeroGrad(Mem, L);
+        }
+        NfNN_AutoGrad_Backward(Mem, L);
+        memset(Mem->Base + Used, 0, Mem->Used - Used);
+        Mem->Used = Used;
+    });
+
+    printf("  %-22s batch %3u hidden %4u  %9.2f us per backward\n",
+           ZeroGrad ? "zero grad first" : "first write assigns", Batch, Hidden, Best);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void Benchmark_ParameterServer(nfnn_memory_arena *Mem, nfnn_transport Transport, u32 Workers, u32 Length)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    // NOTE(luatil): Workers live on this thread, one step is every worker sending the gradients of
+    // a small MLP with a first layer of Length floats, the server gathering them and broadcasting
+    // the weights back
+    nfnn_parameter_server *Server = NfNN_ParameterServer_Create(Mem, Transport, "127.0.0.1", 0);
+    Server->Quiet = true;
+    nfnn_channel **Channels = NfNN_PushArray(Mem, nfnn_channel *, Workers);
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        Channels[Worker] = NfNN_Network_Connect(Mem, Transport, "127.0.0.1", Server->Port);
+    }
+    NfNN_ParameterServer_AcceptWorkers(Server, Workers);
+
+    u32 Lengths[] = {Length, 32, 320, 10};
+    nfnn_tensor *Parameters[NFNN_ARRAY_COUNT(Lengths)];
+    nfnn_tensor *Local[NFNN_ARRAY_COUNT(Lengths)];
+    for (u32 Index = 0; Index < NFNN_ARRAY_COUNT(Lengths); Index++)
+    {
+        Parameters[Index] = NfNN_CreateTensor(Mem, NfNN_Dim2(1, Lengths[Index]), true);
+        Local[Index] = NfNN_CreateTensor(Mem, NfNN_Dim2(1, Lengths[Index]), true);
+    }
+
+    f64 Best;
+    f64 Gather = 1e30;
+    u64 Used = Mem->Used;
+    u64 Calls = GlobalCalls;
+    u64 WorkerCalls = 0;
+    BENCHMARK_BEST_OF(Best, 5, 20, {
+        u64 Before = GlobalCalls;
+        for (u32 Worker = 0; Worker < Workers; Worker++)
+        {
+            NfNN_Network_SendGradients(Mem, Channels[Worker], Server->Step, Local, NFNN_ARRAY_COUNT(Local));
+        }
+        WorkerCalls += GlobalCalls - Before;
+        nfnn_time GatherStart = NfNN_Time_CurrentTime();
+        NfNN_ParameterServer_AwaitGradients(Mem, Server, Parameters, NFNN_ARRAY_COUNT(Parameters));
+        Gather = NFNN_MIN(Gather, Benchmark_Microseconds(GatherStart, NfNN_Time_CurrentTime()));
+        NfNN_ParameterServer_BroadcastWeights(Mem, Server, Parameters, NFNN_ARRAY_COUNT(Parameters));
+        Before = GlobalCalls;
+        for (u32 Worker = 0; Worker < Workers; Worker++)
+        {
+            NfNN_Network_RecvWeights(Mem, Channels[Worker], Local, NFNN_ARRAY_COUNT(Local));
+        }
+        WorkerCalls += GlobalCalls - Before;
+    });
+    u64 Grown = (Mem->Used - Used) / (5 * 20);
+    f64 ServerCalls = (f64)(GlobalCalls - Calls - WorkerCalls) / (5 * 20 * Workers);
+
+    char *TransportNames[] = {"tcp", "shm", "inproc"};
+    printf("  %-6s workers %4u floats %5u  %9.2f us per step  %9.2f us gather  %6.2f us gather per worker  %8lu "
+           "arena bytes per step  %5.2f worker and %5.2f server calls per worker step\n",
+           TransportNames[Transport], Workers, Length, Best, Gather, Gather / Workers, (unsigned long)Grown,
+           (f64)WorkerCalls / (5 * 20 * Workers), ServerCalls);
+
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        NfNN_Network_Disconnect(Channels[Worker]);
+    }
+    NfNN_ParameterServer_Destroy(Server);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+#define BENCHMARK_MATMUL_SHAPE(_M, _K, _N) Benchmark_MatMulShape(&Mem, _M, _K, _N);
+
+int main()
+{
+    nfnn_memory_arena Mem = {0};
+    NfNN_MemoryArena_Init(&Mem, MB(64));
+
+    printf("MatMul shapes from NFNN_MATMUL_SHAPES (best of 5):\n");
+    NFNN_MATMUL_SHAPES(BENCHMARK_MATMUL_SHAPE)
+
+    printf("GEMM autotuner against the default dispatch (best of 5):\n");
+    Benchmark_Autotune(&Mem, NFNN_GEMM_MATMUL, 64, 784, 32);
+    Benchmark_Autotune(&Mem, NFNN_GEMM_MATMUL, 256, 512, 256);
+    Benchmark_Autotune(&Mem, NFNN_GEMM_ADD_TRANSPOSE_RIGHT, 256, 256, 512);
+    Benchmark_Autotune(&Mem, NFNN_GEMM_ADD_TRANSPOSE_LEFT, 256, 512, 256);
+
+    printf("Graph construction, two heads on one hidden layer (best of 5):\n");
+    Benchmark_Intern(&Mem, false);
+    Benchmark_Intern(&Mem, true);
+
+    printf("Per-node overhead of tiny ops (best of 5):\n");
+    Benchmark_NodeOverhead(&Mem, 10000);
+    Benchmark_NodeOverhead(&Mem, 40000);
+
+    printf("Optimizer step (best of 5):\n");
+    for (u32 Type = NFNN_OPTIMIZER_SGD; Type <= NFNN_OPTIMIZER_LAMB; Type++)
+    {
+        Benchmark_Optimizer(&Mem, 32, 2, (nfnn_optimizer_type)Type, false);
+    }
+    for (u32 Type = NFNN_OPTIMIZER_SGD; Type <= NFNN_OPTIMIZER_LAMB; Type++)
+    {
+        Benchmark_Optimizer(&Mem, 512, 4, (nfnn_optimizer_type)Type, false);
+        Benchmark_Optimizer(&Mem, 512, 4, (nfnn_optimizer_type)Type, true);
+    }
+
+    printf("Optimizer step overlapped with backward (best of 5):\n");
+    Benchmark_GradReady(&Mem, 1, 512, false);
+    Benchmark_GradReady(&Mem, 1, 512, true);
+    Benchmark_GradReady(&Mem, 1, 128, false);
+    Benchmark_GradReady(&Mem, 1, 128, true);
+
+    printf("Backward with and without a ZeroGrad pass (best of 5):\n");
+    Benchmark_FirstWrite(&Mem, 32, 512, true);
+    Benchmark_FirstWrite(&Mem, 32, 512, false);
+    Benchmark_FirstWrite(&Mem, 1, 128, true);
+    Benchmark_FirstWrite(&Mem, 1, 128, false);
+
+    printf("Parameter server step over loopback (best of 5):\n");
+    Benchmark_ParameterServer(&Mem, NFNN_TRANSPORT_TCP, 8, 1024);
+    Benchmark_ParameterServer(&Mem, NFNN_TRANSPORT_TCP, 64, 1024);
+    Benchmark_ParameterServer(&Mem, NFNN_TRANSPORT_TCP, 512, 1024);
+    Benchmark_ParameterServer(&Mem, NFNN_TRANSPORT_TCP, 8, 16384);
+    Benchmark_ParameterServer(&Mem, NFNN_TRANSPORT_TCP, 32, 16384);
+
+    printf("Parameter server step by transport on one host (best of 5):\n");
+    for (u32 Transport = NFNN_TRANSPORT_TCP; Transport < NFNN_TRANSPORT_COUNT; Transport++)
+    {
+        Benchmark_ParameterServer(&Mem, (nfnn_transport)Transport, 4, 1024);
+        Benchmark_ParameterServer(&Mem, (nfnn_transport)Transport, 8, 1024);
+        Benchmark_ParameterServer(&Mem, (nfnn_transport)Transport, 4, 16384);
+        Benchmark_ParameterServer(&Mem, (nfnn_transport)Transport, 8, 16384);
+    }
+
+    return 0;
+}
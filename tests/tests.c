@@ -1,4 +1,8 @@
 #include "../lib/nfnn.h"
+#if !defined(_WIN32)
+#include "../lib/nfnn_export.h"
+#include "../lib/nfnn_jit.h"
+#endif
 
 static void NfNN_Test_Addition(nfnn_memory_arena *Mem)
 {
@@ -35,7 +39,7 @@ static void NfNN_Test_BroadcastBackward(nfnn_memory_arena *Mem)
         // # a.grad:tensor([1., 1., 1.])
         // # b.grad:tensor([3.])
         nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){2.0f, 3.0f, 4.0f}, NfNN_Dim2(1, 3));
-        nfnn_tensor *B = NfNN_Ones(Mem, NfNN_Dim2(1, 1));
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){1.0f}, NfNN_Dim2(1, 1));
         nfnn_tensor *C = NfNN_Add(Mem, A, B);
         nfnn_tensor *S = NfNN_SumAll(Mem, C);
 
@@ -434,8 +438,8 @@ static void NfNN_Test_Backward(nfnn_memory_arena *Mem)
     }
 
     {
-        nfnn_tensor *A = NfNN_Ones(Mem, NfNN_Dim2(1, 1));
-        nfnn_tensor *B = NfNN_Ones(Mem, NfNN_Dim2(1, 1));
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){1.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){1.0f}, NfNN_Dim2(1, 1));
         nfnn_tensor *L = NfNN_Add(Mem, A, B);
         NfNN_AutoGrad_Backward(Mem, L);
         NFNN_TEST(NfNN_Math_CompareMemory_f32(A->Gradient, B->Data, NfNN_Length(A), 0.0001f), "Backward");
@@ -443,8 +447,8 @@ static void NfNN_Test_Backward(nfnn_memory_arena *Mem)
     }
 
     {
-        nfnn_tensor *A = NfNN_Const(Mem, NfNN_Dim2(1, 1), 2.0f);
-        nfnn_tensor *B = NfNN_Const(Mem, NfNN_Dim2(1, 1), 3.0f);
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){2.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){3.0f}, NfNN_Dim2(1, 1));
         nfnn_tensor *L = NfNN_Mul(Mem, A, B);
         NfNN_AutoGrad_Backward(Mem, L);
         NFNN_TEST(NfNN_Math_CompareMemory_f32(A->Gradient, B->Data, NfNN_Length(A), 0.0001f), "Backward");
@@ -460,8 +464,8 @@ static void NfNN_Test_Backward(nfnn_memory_arena *Mem)
          * dL/dB = A
          */
 
-        nfnn_tensor *A = NfNN_Const(Mem, NfNN_Dim2(1, 1), 2.0f);
-        nfnn_tensor *B = NfNN_Const(Mem, NfNN_Dim2(1, 1), 3.0f);
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){2.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){3.0f}, NfNN_Dim2(1, 1));
         nfnn_tensor *L = NfNN_MatMul(Mem, A, B);
         NfNN_AutoGrad_Backward(Mem, L);
         NFNN_TEST(NfNN_Math_CompareMemory_f32(A->Gradient, B->Data, NfNN_Length(A), 0.0001f), "Backward");
@@ -476,8 +480,8 @@ static void NfNN_Test_Backward(nfnn_memory_arena *Mem)
          * dC/dA = B
          * dC/dB = A
          */
-        nfnn_tensor *A = NfNN_Const(Mem, NfNN_Dim2(1, 1), 2.0f);
-        nfnn_tensor *B = NfNN_Const(Mem, NfNN_Dim2(1, 1), 3.0f);
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){2.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){3.0f}, NfNN_Dim2(1, 1));
         nfnn_tensor *C = NfNN_Mul(Mem, A, B);
         NfNN_AutoGrad_Backward(Mem, C);
         NFNN_TEST(NfNN_Math_CompareMemory_f32(A->Gradient, B->Data, NfNN_Length(A), 0.0001f), "Backward");
@@ -487,6 +491,1569 @@ static void NfNN_Test_Backward(nfnn_memory_arena *Mem)
     NfNN_MemoryArena_TempClear(Mem);
 }
 
+static void NfNN_Test_SavedState(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    {
+        // NOTE(luatil): More than 32 elements so the mask spans several words
+        f32 RawT[40];
+        f32 ExpectedT[40];
+        for (u32 I = 0; I < 40; I++)
+        {
+            RawT[I] = ((I * 7) % 40) - 19.5f;
+            ExpectedT[I] = RawT[I] > 0.0f ? 1.0f : 0.0f;
+        }
+        nfnn_tensor *T = NfNN_From_f32(Mem, RawT, NfNN_Dim2(5, 8));
+        nfnn_tensor *R = NfNN_ReLU(Mem, T);
+        nfnn_tensor *L = NfNN_SumAll(Mem, R);
+        NfNN_AutoGrad_Backward(Mem, L);
+
+        NFNN_TEST(R->Op.Saved.Mask != 0, "ReLU: Saves a bit mask");
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(T->Gradient, ExpectedT, NfNN_Length(T), 0.0001f), "ReLU: Backward");
+    }
+
+    {
+        /**
+         * A is a constant so only B is kept for backward and dL/dA is never computed
+         * A = [[1., 2.]], B = [[3.], [4.]]
+         * dL/dB = A^T = [[1.], [2.]]
+         */
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){1.0f, 2.0f}, NfNN_Dim2(1, 2));
+        A->RequiresGrad = false;
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){3.0f, 4.0f}, NfNN_Dim2(2, 1));
+        nfnn_tensor *L = NfNN_MatMul(Mem, A, B);
+        NfNN_AutoGrad_Backward(Mem, L);
+
+        f32 ExpectedA[] = {0.0f, 0.0f};
+        f32 ExpectedB[] = {1.0f, 2.0f};
+        NFNN_TEST(L->Op.Saved.Left == A->Data && L->Op.Saved.Right == 0, "MatMul: Saves only what backward reads");
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(A->Gradient, ExpectedA, NfNN_Length(A), 0.0001f), "MatMul: dL/dA");
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(B->Gradient, ExpectedB, NfNN_Length(B), 0.0001f), "MatMul: dL/dB");
+    }
+
+    {
+        /**
+         * Pytorch:
+         * t = torch.tensor([[0.5, -1.]], requires_grad=True)
+         * l = t.tanh().sum()
+         * l.backward()
+         * print(f"t.grad:{t.grad}")
+         * tensor([[0.7864, 0.4200]])
+         */
+        nfnn_tensor *T = NfNN_From_f32(Mem, (f32[]){0.5f, -1.0f}, NfNN_Dim2(1, 2));
+        nfnn_tensor *L = NfNN_SumAll(Mem, NfNN_Tanh(Mem, T));
+        NfNN_AutoGrad_Backward(Mem, L);
+
+        f32 ExpectedT[] = {0.7864f, 0.4200f};
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(T->Gradient, ExpectedT, NfNN_Length(T), 0.0001f), "Tanh: Backward");
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_Tape(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    {
+        // NOTE(luatil): Deep enough that a recursive graph walk would be a problem
+        nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){0.5f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *Y = X;
+        for (u32 I = 0; I < 1000; I++)
+        {
+            Y = NfNN_Add(Mem, Y, B);
+        }
+        NfNN_AutoGrad_Backward(Mem, Y);
+
+        NFNN_TEST(Y->Data[0] == 501.0f, "Tape: Forward");
+        NFNN_TEST(X->Gradient[0] == 1.0f, "Tape: dY/dX");
+        NFNN_TEST(B->Gradient[0] == 1000.0f, "Tape: dY/dB");
+    }
+
+    {
+        // NOTE(luatil): Backward only replays what the root depends on
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){2.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){3.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *LA = NfNN_Square(Mem, A);
+        nfnn_tensor *LB = NfNN_Square(Mem, B);
+        NfNN_AutoGrad_Backward(Mem, LB);
+
+        NFNN_TEST(A->Gradient[0] == 0.0f && LA->Gradient[0] == 0.0f, "Tape: Unrelated graph untouched");
+        NFNN_TEST(B->Gradient[0] == 6.0f, "Tape: dLB/dB");
+
+        NfNN_AutoGrad_ZeroGrad(Mem, LB);
+        NFNN_TEST(B->Gradient[0] == 0.0f && LB->Gradient[0] == 0.0f, "Tape: ZeroGrad");
+    }
+
+    {
+        // NOTE(luatil): The dense entry arrays mirror the tensors
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){2.0f}, NfNN_Dim2(1, 1));
+        nfnn_tensor *S = NfNN_Square(Mem, A);
+        nfnn_tensor *R = NfNN_Reshape(Mem, S, NfNN_Dim2(1, 1));
+        nfnn_tensor *M = NfNN_Mul(Mem, S, R);
+
+        nfnn_tape_block *Block = NfNN_MemoryArena_TapeBlock(Mem, M->TapeIndex);
+        u32 Lane = M->TapeIndex % NFNN_TAPE_BLOCK;
+        NFNN_TEST(Block->Inputs[0][Lane] == S->TapeIndex && Block->Inputs[1][Lane] == R->TapeIndex &&
+                      Block->Types[Lane] == NFNN_OP_TYPE_MUL && (Block->Flags[Lane] & NFNN_TAPE_REQUIRES_GRAD),
+                  "Tape: Entry of a binary op");
+        Block = NfNN_MemoryArena_TapeBlock(Mem, S->TapeIndex);
+        Lane = S->TapeIndex % NFNN_TAPE_BLOCK;
+        NFNN_TEST(Block->Inputs[0][Lane] == NFNN_TAPE_NONE && Block->Inputs[1][Lane] == NFNN_TAPE_NONE,
+                  "Tape: Leaves are not on the tape");
+        NFNN_TEST((*NfNN_Tape_Flags(Mem, R->TapeIndex) & NFNN_TAPE_REQUIRES_GRAD) &&
+                      NfNN_MemoryArena_TapeBlock(Mem, R->TapeIndex)->Types[R->TapeIndex % NFNN_TAPE_BLOCK] ==
+                          NFNN_OP_TYPE_RESHAPE,
+                  "Tape: Entry follows a reshape");
+    }
+
+    {
+        // NOTE(luatil): Tensors allocated where a cleared tape used to be start out empty
+        nfnn_memory_arena Small = {0};
+        NfNN_MemoryArena_Init(&Small, KB(64));
+        NfNN_MemoryArena_TempInit(&Small);
+        nfnn_tensor *A = NfNN_From_f32(&Small, (f32[]){-1.0f}, NfNN_Dim2(1, 1));
+        for (u32 I = 0; I < 250; I++)
+        {
+            A = NfNN_Add(&Small, A, A);
+        }
+        NfNN_MemoryArena_TempClear(&Small);
+
+        u32 Dirty = 0;
+        u32 Created = 0;
+        nfnn_op_saved Empty;
+        memset(&Empty, 0, sizeof(Empty));
+        NfNN_MemoryArena_NoGradBegin(&Small, false);
+        nfnn_tensor *X = NfNN_CreateTensor(&Small, NfNN_Dim2(1, 1), false);
+        X->Data[0] = -1.0f;
+        while (Small.Used + 2 * (sizeof(nfnn_tensor) + 8) <= Small.Size)
+        {
+            nfnn_tensor *Y = NfNN_ReLU(&Small, X);
+            Dirty += memcmp(&Y->Op.Saved, &Empty, sizeof(Empty)) != 0 || Y->Op.FirstWrite != 0 || Y->Data[0] != 0.0f;
+            Created++;
+        }
+        NfNN_MemoryArena_NoGradEnd(&Small);
+
+        NFNN_TEST(Created > 400 && Dirty == 0, "Tape: Cleared tape leaves no state in new tensors");
+        free(Small.Base);
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_BackwardParallel(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 7);
+
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, 4, 3);
+    nfnn_tensor *W = NfNN_Matrix(Mem, &Random, 3, 5);
+    nfnn_tensor *B = NfNN_Matrix(Mem, &Random, 1, 5);
+    nfnn_tensor *V = NfNN_Matrix(Mem, &Random, 5, 1);
+    nfnn_tensor *Params[] = {X, W, B, V};
+
+    // NOTE(luatil): Two towers sharing the input and both weights, one of them squaring X
+    nfnn_tensor *HA = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W), B));
+    nfnn_tensor *HB = NfNN_Tanh(Mem, NfNN_MatMul(Mem, NfNN_Mul(Mem, X, X), W));
+    nfnn_tensor *S = NfNN_Add(Mem, NfNN_MatMul(Mem, HA, V), NfNN_MatMul(Mem, HB, V));
+    nfnn_tensor *L = NfNN_SumAll(Mem, NfNN_Square(Mem, S));
+
+    f32 *Expected[NFNN_ARRAY_COUNT(Params)];
+    NfNN_AutoGrad_Backward(Mem, L);
+    for (u32 I = 0; I < NFNN_ARRAY_COUNT(Params); I++)
+    {
+        Expected[I] = NfNN_PushTensor(Mem, Params[I]->Dimensions);
+        NfNN_MemoryCopy(Expected[I], Params[I]->Gradient, NfNN_Size(Params[I]));
+    }
+
+    nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 4, 64);
+
+    NfNN_AutoGrad_ZeroGrad(Mem, L);
+    NfNN_AutoGrad_BackwardParallel(Mem, L, Pool);
+    bool Close = true;
+    for (u32 I = 0; I < NFNN_ARRAY_COUNT(Params); I++)
+    {
+        Close = Close && NfNN_Math_CompareMemory_f32(Params[I]->Gradient, Expected[I], NfNN_Length(Params[I]), 0.0001f);
+        NfNN_MemoryCopy(Expected[I], Params[I]->Gradient, NfNN_Size(Params[I]));
+    }
+    NFNN_TEST(Close, "BackwardParallel: Same gradients as sequential");
+
+    bool Deterministic = true;
+    for (u32 Run = 0; Run < 20; Run++)
+    {
+        NfNN_AutoGrad_ZeroGrad(Mem, L);
+        NfNN_AutoGrad_BackwardParallel(Mem, L, Pool);
+        for (u32 I = 0; I < NFNN_ARRAY_COUNT(Params); I++)
+        {
+            Deterministic = Deterministic && memcmp(Params[I]->Gradient, Expected[I], NfNN_Size(Params[I])) == 0;
+        }
+    }
+    NFNN_TEST(Deterministic, "BackwardParallel: Shared gradients are reduced in a fixed order");
+
+    NfNN_ThreadPool_Destroy(Pool);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_RequiresGrad(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    {
+        // NOTE(luatil): Inputs and labels never reach a trainable leaf
+        nfnn_tensor *X = NfNN_CreateTensor(Mem, NfNN_Dim2(2, 3), false);
+        nfnn_tensor *Labels = NfNN_From_f32(Mem, (f32[]){0.0f, 1.0f}, NfNN_Dim2(2, 1));
+        NfNN_SetRequiresGrad(Mem, Labels, false);
+        nfnn_tensor *W = NfNN_From_f32(Mem, (f32[]){0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f}, NfNN_Dim2(3, 2));
+        nfnn_tensor *Scaled = NfNN_MultiplyByConstant(Mem, X, 2.0f);
+        nfnn_tensor *H = NfNN_MatMul(Mem, Scaled, W);
+        nfnn_tensor *L = NfNN_NLLLoss(Mem, NfNN_LogSoftmax(Mem, H, 1), Labels);
+        NfNN_AutoGrad_Backward(Mem, L);
+
+        NFNN_TEST(X->Gradient == 0 && Scaled->Gradient == 0, "RequiresGrad: No buffer without a trainable leaf");
+        NFNN_TEST(!Scaled->RequiresGrad && H->RequiresGrad && L->RequiresGrad, "RequiresGrad: Propagation");
+        NFNN_TEST(H->Op.Saved.Right == 0, "RequiresGrad: dL/dX is never computed");
+    }
+
+    {
+        // NOTE(luatil): Freezing the first layer of a two layer network
+        nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f, 2.0f}, NfNN_Dim2(1, 2));
+        nfnn_tensor *W1 = NfNN_From_f32(Mem, (f32[]){0.5f, -1.0f, 1.0f, 0.25f}, NfNN_Dim2(2, 2));
+        nfnn_tensor *W2 = NfNN_From_f32(Mem, (f32[]){3.0f, 4.0f}, NfNN_Dim2(2, 1));
+        X->RequiresGrad = false;
+        NfNN_SetRequiresGrad(Mem, W1, false);
+
+        nfnn_optimizer *Optimizer = NfNN_Optimizer_SGD(Mem, 0.1f, 1, 0.0f, 0.0f, 0.0f, false);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, W1);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, W2);
+
+        nfnn_tensor *H = NfNN_MatMul(Mem, X, W1);
+        nfnn_tensor *L = NfNN_MatMul(Mem, H, W2);
+        NfNN_AutoGrad_Backward(Mem, L);
+        NfNN_Optimizer_Step(Optimizer);
+
+        // H = [2.5, -0.5], dL/dW2 = H^T
+        NFNN_TEST(H->Gradient == 0 && L->Op.Saved.Right == 0, "RequiresGrad: Frozen layer has no backward");
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(W2->Gradient, (f32[]){2.5f, -0.5f}, 2, 0.0001f), "RequiresGrad: dL/dW2");
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(W1->Data, (f32[]){0.5f, -1.0f, 1.0f, 0.25f}, 4, 0.0f),
+                  "RequiresGrad: Frozen layer is not updated");
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_Optimizer(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 11);
+
+    {
+        // NOTE(luatil): Parameters share one buffer, each on its own cache line
+        nfnn_optimizer *Optimizer = NfNN_Optimizer_SGD(Mem, 0.1f, 1, 0.0f, 0.0f, 0.0f, false);
+        nfnn_tensor *A = NfNN_Matrix(Mem, &Random, 3, 5);
+        nfnn_tensor *B = NfNN_Matrix(Mem, &Random, 1, 5);
+        f32 Expected[15];
+        memcpy(Expected, A->Data, sizeof(Expected));
+        NfNN_Optimizer_AddParam(Mem, Optimizer, A);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, B);
+
+        NFNN_TEST(((uintptr_t)A->Data & 63) == 0 && B->Data == A->Data + 16, "Optimizer: Contiguous parameters");
+        NFNN_TEST(B->Gradient == A->Gradient + 16, "Optimizer: Contiguous gradients");
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(A->Data, Expected, 15, 0.0f), "Optimizer: Values are kept");
+    }
+
+    {
+        // NOTE(luatil): Three steps against the per element formulas, the middle parameter is frozen
+        f32 Lr = 0.1f, WeightDecay = 0.01f, Momentum = 0.9f, Dampening = 0.1f, Beta1 = 0.8f, Beta2 = 0.95f;
+        for (u32 Adam = 0; Adam < 2; Adam++)
+        {
+            nfnn_optimizer *Optimizer = Adam ? NfNN_Optimizer_Adam(Mem, Lr, 1, Beta1, Beta2)
+                                             : NfNN_Optimizer_SGD(Mem, Lr, 1, Momentum, Dampening, WeightDecay, true);
+            nfnn_tensor *Params[3] = {NfNN_Matrix(Mem, &Random, 2, 3), NfNN_Matrix(Mem, &Random, 1, 3),
+                                      NfNN_Matrix(Mem, &Random, 5, 7)};
+            NfNN_SetRequiresGrad(Mem, Params[1], false);
+            f32 Theta[3][35], Buffer[3][35] = {0}, Second[3][35] = {0};
+            for (u32 Index = 0; Index < 3; Index++)
+            {
+                memcpy(Theta[Index], Params[Index]->Data, NfNN_Size(Params[Index]));
+                NfNN_Optimizer_AddParam(Mem, Optimizer, Params[Index]);
+            }
+
+            for (u32 Step = 1; Step <= 3; Step++)
+            {
+                for (u32 Index = 0; Index < 3; Index += 2)
+                {
+                    for (u32 I = 0; I < NfNN_Length(Params[Index]); I++)
+                    {
+                        f32 G = (f32)((I * 7 + Step * 3 + Index) % 11) * 0.1f - 0.5f;
+                        Params[Index]->Gradient[I] = G;
+                        if (Adam)
+                        {
+                            Buffer[Index][I] = Beta1 * Buffer[Index][I] + (1.0f - Beta1) * G;
+                            Second[Index][I] = Beta2 * Second[Index][I] + (1.0f - Beta2) * G * G;
+                            Theta[Index][I] -= Lr * Buffer[Index][I] / (sqrtf(Second[Index][I]) + 1e-8f);
+                        }
+                        else
+                        {
+                            // NOTE(luatil): The first two steps start the buffer from the gradient
+                            G += WeightDecay * Theta[Index][I];
+                            Buffer[Index][I] = Step > 2 ? Momentum * Buffer[Index][I] + (1.0f - Dampening) * G : G;
+                            Theta[Index][I] -= Lr * (G + Momentum * Buffer[Index][I]);
+                        }
+                    }
+                }
+                NfNN_Optimizer_Step(Optimizer);
+            }
+
+            for (u32 Index = 0; Index < 3; Index++)
+            {
+                NFNN_TEST(NfNN_Math_CompareMemory_f32(Params[Index]->Data, Theta[Index], NfNN_Length(Params[Index]),
+                                                      0.0001f),
+                          Adam ? "Optimizer: Adam" : "Optimizer: SGD");
+            }
+            NfNN_Optimizer_ZeroGrad(Optimizer);
+            NFNN_TEST(Params[2]->Gradient[0] == 0.0f && Params[2]->Gradient[34] == 0.0f, "Optimizer: ZeroGrad");
+        }
+    }
+
+    {
+        // NOTE(luatil): A step split over a pool matches the serial one
+        nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 2, 64);
+        nfnn_tensor *Serial = NfNN_Matrix(Mem, &Random, 1, NFNN_OPTIMIZER_CHUNK + 16);
+        nfnn_tensor *Split = NfNN_Matrix(Mem, &Random, 1, NFNN_OPTIMIZER_CHUNK + 16);
+        memcpy(Split->Data, Serial->Data, NfNN_Size(Serial));
+        nfnn_optimizer *Optimizers[2] = {NfNN_Optimizer_SGD(Mem, 0.01f, 1, 0.9f, 0.0f, 0.01f, false),
+                                         NfNN_Optimizer_SGD(Mem, 0.01f, 1, 0.9f, 0.0f, 0.01f, false)};
+        NfNN_Optimizer_AddParam(Mem, Optimizers[0], Serial);
+        NfNN_Optimizer_AddParam(Mem, Optimizers[1], Split);
+        NfNN_Optimizer_SetThreadPool(Optimizers[1], Pool);
+        for (u32 I = 0; I < NfNN_Length(Serial); I++)
+        {
+            Serial->Gradient[I] = Split->Gradient[I] = (f32)(I % 13) * 0.1f - 0.6f;
+        }
+        NfNN_Optimizer_Step(Optimizers[0]);
+        NfNN_Optimizer_Step(Optimizers[1]);
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Serial->Data, Split->Data, NfNN_Length(Serial), 0.0f),
+                  "Optimizer: Threaded step");
+        NfNN_ThreadPool_Destroy(Pool);
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_LayerWiseOptimizer(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 17);
+
+    {
+        // NOTE(luatil): Three steps with two of warmup against the per tensor formulas, the middle one is frozen
+        f32 Lr = 0.1f, WeightDecay = 0.01f, Momentum = 0.9f, Trust = 0.02f, Beta1 = 0.8f, Beta2 = 0.95f;
+        for (u32 Lamb = 0; Lamb < 2; Lamb++)
+        {
+            nfnn_optimizer *Optimizer = Lamb ? NfNN_Optimizer_LAMB(Mem, Lr, 1, Beta1, Beta2, WeightDecay)
+                                             : NfNN_Optimizer_LARS(Mem, Lr, 1, Momentum, WeightDecay, Trust);
+            NfNN_Optimizer_SetWarmup(Optimizer, 2);
+            nfnn_tensor *Params[3] = {NfNN_Matrix(Mem, &Random, 2, 3), NfNN_Matrix(Mem, &Random, 1, 3),
+                                      NfNN_Matrix(Mem, &Random, 5, 7)};
+            NfNN_SetRequiresGrad(Mem, Params[1], false);
+            f32 Theta[3][35], Buffer[3][35] = {0}, Second[3][35] = {0}, Update[35];
+            for (u32 Index = 0; Index < 3; Index++)
+            {
+                memcpy(Theta[Index], Params[Index]->Data, NfNN_Size(Params[Index]));
+                NfNN_Optimizer_AddParam(Mem, Optimizer, Params[Index]);
+            }
+
+            for (u32 Step = 1; Step <= 3; Step++)
+            {
+                f32 StepLr = Lr * (Step < 2 ? 0.5f : 1.0f);
+                for (u32 Index = 0; Index < 3; Index += 2)
+                {
+                    u32 Length = NfNN_Length(Params[Index]);
+                    f64 ThetaSquares = 0.0, UpdateSquares = 0.0;
+                    for (u32 I = 0; I < Length; I++)
+                    {
+                        f32 G = (f32)((I * 7 + Step * 3 + Index) % 11) * 0.1f - 0.5f;
+                        Params[Index]->Gradient[I] = G;
+                        if (Lamb)
+                        {
+                            Buffer[Index][I] = Beta1 * Buffer[Index][I] + (1.0f - Beta1) * G;
+                            Second[Index][I] = Beta2 * Second[Index][I] + (1.0f - Beta2) * G * G;
+                            f32 M = Buffer[Index][I] / (1.0f - powf(Beta1, (f32)Step));
+                            f32 V = Second[Index][I] / (1.0f - powf(Beta2, (f32)Step));
+                            Update[I] = M / (sqrtf(V) + 1e-6f) + WeightDecay * Theta[Index][I];
+                        }
+                        else
+                        {
+                            Update[I] = G;
+                        }
+                        ThetaSquares += Theta[Index][I] * Theta[Index][I];
+                        UpdateSquares += Update[I] * Update[I];
+                    }
+
+                    f32 Ratio = Lamb ? (f32)(sqrt(ThetaSquares) / sqrt(UpdateSquares))
+                                     : Trust * (f32)(sqrt(ThetaSquares) /
+                                                     (sqrt(UpdateSquares) + WeightDecay * sqrt(ThetaSquares)));
+                    for (u32 I = 0; I < Length; I++)
+                    {
+                        if (Lamb)
+                        {
+                            Theta[Index][I] -= StepLr * Ratio * Update[I];
+                        }
+                        else
+                        {
+                            f32 G = Update[I] + WeightDecay * Theta[Index][I];
+                            Buffer[Index][I] = Momentum * Buffer[Index][I] + StepLr * Ratio * G;
+                            Theta[Index][I] -= Buffer[Index][I];
+                        }
+                    }
+                }
+                NfNN_Optimizer_Step(Optimizer);
+            }
+
+            for (u32 Index = 0; Index < 3; Index++)
+            {
+                NFNN_TEST(NfNN_Math_CompareMemory_f32(Params[Index]->Data, Theta[Index], NfNN_Length(Params[Index]),
+                                                      0.0001f),
+                          Lamb ? "Optimizer: LAMB" : "Optimizer: LARS");
+            }
+        }
+    }
+
+    {
+        // NOTE(luatil): The sum of eight workers' gradients steps as far as one worker's
+        for (u32 Lamb = 0; Lamb < 2; Lamb++)
+        {
+            nfnn_tensor *Params[2] = {NfNN_Matrix(Mem, &Random, 4, 9), NfNN_Matrix(Mem, &Random, 4, 9)};
+            memcpy(Params[1]->Data, Params[0]->Data, NfNN_Size(Params[0]));
+            for (u32 Index = 0; Index < 2; Index++)
+            {
+                nfnn_optimizer *Optimizer = Lamb ? NfNN_Optimizer_LAMB(Mem, 0.01f, 1, 0.0f, 0.0f, 0.0f)
+                                                 : NfNN_Optimizer_LARS(Mem, 0.5f, 1, 0.9f, 0.0f, 0.01f);
+                NfNN_Optimizer_AddParam(Mem, Optimizer, Params[Index]);
+                for (u32 Step = 0; Step < 3; Step++)
+                {
+                    for (u32 I = 0; I < NfNN_Length(Params[Index]); I++)
+                    {
+                        Params[Index]->Gradient[I] = ((f32)((I * 5 + Step) % 7) * 0.1f - 0.3f) * (Index ? 8.0f : 1.0f);
+                    }
+                    NfNN_Optimizer_Step(Optimizer);
+                }
+            }
+            NFNN_TEST(NfNN_Math_CompareMemory_f32(Params[0]->Data, Params[1]->Data, NfNN_Length(Params[0]), 0.0001f),
+                      Lamb ? "Optimizer: LAMB step is independent of the gradient scale"
+                           : "Optimizer: LARS step is independent of the gradient scale");
+        }
+    }
+
+    {
+        // NOTE(luatil): Parameters spread over a pool match the serial step
+        nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 2, 64);
+        nfnn_optimizer *Optimizers[2] = {NfNN_Optimizer_LAMB(Mem, 0.01f, 1, 0.0f, 0.0f, 0.01f),
+                                         NfNN_Optimizer_LAMB(Mem, 0.01f, 1, 0.0f, 0.0f, 0.01f)};
+        NfNN_Optimizer_SetThreadPool(Optimizers[1], Pool);
+        nfnn_tensor *Params[2][3];
+        for (u32 Index = 0; Index < 3; Index++)
+        {
+            Params[0][Index] = NfNN_Matrix(Mem, &Random, 3 + Index, 20);
+            Params[1][Index] = NfNN_Matrix(Mem, &Random, 3 + Index, 20);
+            memcpy(Params[1][Index]->Data, Params[0][Index]->Data, NfNN_Size(Params[0][Index]));
+            for (u32 Which = 0; Which < 2; Which++)
+            {
+                NfNN_Optimizer_AddParam(Mem, Optimizers[Which], Params[Which][Index]);
+                for (u32 I = 0; I < NfNN_Length(Params[Which][Index]); I++)
+                {
+                    Params[Which][Index]->Gradient[I] = (f32)((I + Index) % 13) * 0.1f - 0.6f;
+                }
+            }
+        }
+        NfNN_Optimizer_Step(Optimizers[0]);
+        NfNN_Optimizer_Step(Optimizers[1]);
+        bool Same = true;
+        for (u32 Index = 0; Index < 3; Index++)
+        {
+            Same = Same && NfNN_Math_CompareMemory_f32(Params[0][Index]->Data, Params[1][Index]->Data,
+                                                       NfNN_Length(Params[0][Index]), 0.0f);
+        }
+        NFNN_TEST(Same, "Optimizer: Threaded layer-wise step");
+        NfNN_ThreadPool_Destroy(Pool);
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_QuantizedOptimizer(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 19);
+
+    {
+        f32 Values[NFNN_OPTIMIZER_BLOCK], Back[NFNN_OPTIMIZER_BLOCK];
+        s8 Signed[NFNN_OPTIMIZER_BLOCK];
+        u8 Unsigned[NFNN_OPTIMIZER_BLOCK];
+        NfNN_Random_UniformArrayInRange_f32(&Random, Values, NFNN_OPTIMIZER_BLOCK, -2.0f, 2.0f);
+        f32 Scale = NfNN_Math_Quantize_s8(Values, NFNN_OPTIMIZER_BLOCK, Signed);
+        NfNN_Math_Dequantize_s8(Signed, Scale, NFNN_OPTIMIZER_BLOCK, Back);
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Values, Back, NFNN_OPTIMIZER_BLOCK, Scale * 0.5f + 1e-6f),
+                  "QuantizedOptimizer: Signed codes round to nearest");
+
+        bool Up = true;
+        Values[3] = 0.0f;
+        NfNN_Math_Hadamard_f32(Values, Values, NFNN_OPTIMIZER_BLOCK, Values);
+        Scale = NfNN_Math_QuantizeUp_u8(Values, NFNN_OPTIMIZER_BLOCK, Unsigned);
+        NfNN_Math_Dequantize_u8(Unsigned, Scale, NFNN_OPTIMIZER_BLOCK, Back);
+        for (u32 I = 0; I < NFNN_OPTIMIZER_BLOCK; I++)
+        {
+            Up = Up && Back[I] >= Values[I] * 0.9999f && Back[I] <= Values[I] + Scale * 1.0001f;
+            Up = Up && (Back[I] == 0.0f) == (Values[I] == 0.0f);
+        }
+        NFNN_TEST(Up, "QuantizedOptimizer: Unsigned codes round up, only zero is zero");
+    }
+
+    {
+        // NOTE(luatil): A small regression trained with full and 8-bit Adam state ends at about the same loss
+        nfnn_tensor *X = NfNN_Matrix(Mem, &Random, 32, 4);
+        nfnn_tensor *Target = NfNN_Matrix(Mem, &Random, 4, 1);
+        NfNN_SetRequiresGrad(Mem, X, false);
+        NfNN_MemoryArena_NoGradBegin(Mem, false);
+        nfnn_tensor *Y = NfNN_Tanh(Mem, NfNN_MatMul(Mem, X, Target));
+        NfNN_MemoryArena_NoGradEnd(Mem);
+
+        f32 Losses[2][2];
+        u64 StateBytes[2], ParamBytes = 0;
+        for (u32 Quantized = 0; Quantized < 2; Quantized++)
+        {
+            nfnn_random_state ModelRandom = {0};
+            NfNN_Random_Init(&ModelRandom, 23);
+            nfnn_tensor *W1 = NfNN_Matrix(Mem, &ModelRandom, 4, 64);
+            nfnn_tensor *W2 = NfNN_Matrix(Mem, &ModelRandom, 64, 1);
+            nfnn_optimizer *Optimizer = NfNN_Optimizer_Adam(Mem, 0.01f, 1, 0, 0);
+            if (Quantized)
+            {
+                NfNN_Optimizer_QuantizeState(Optimizer);
+            }
+            NfNN_Optimizer_AddParam(Mem, Optimizer, W1);
+            NfNN_Optimizer_AddParam(Mem, Optimizer, W2);
+            ParamBytes = (NfNN_Length(W1) + NfNN_Length(W2)) * sizeof(f32);
+            u64 Blocks = Optimizer->Count / NFNN_OPTIMIZER_BLOCK;
+            StateBytes[Quantized] = Quantized ? 2 * (Optimizer->Count + Blocks * sizeof(f32))
+                                              : 2 * Optimizer->Count * sizeof(f32);
+
+            nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+            nfnn_tensor *Loss = NfNN_MSELoss(Mem, NfNN_MatMul(Mem, NfNN_Tanh(Mem, NfNN_MatMul(Mem, X, W1)), W2), Y);
+            Losses[Quantized][0] = NfNN_Item(Loss);
+            NfNN_AutoGrad_Backward(Mem, Loss);
+            NfNN_Optimizer_Step(Optimizer);
+            NfNN_Graph_EndCapture(Graph, Loss, Optimizer);
+            for (u32 Step = 0; Step < 300; Step++)
+            {
+                NfNN_Graph_Replay(Graph);
+            }
+            Losses[Quantized][1] = NfNN_Item(Graph->Loss);
+        }
+
+        NFNN_TEST(Losses[0][1] < 0.05f * Losses[0][0] && Losses[1][1] < 0.05f * Losses[1][0],
+                  "QuantizedOptimizer: Both converge");
+        NFNN_TEST(Losses[1][1] < 1.5f * Losses[0][1] + 0.0005f, "QuantizedOptimizer: 8-bit state keeps up");
+        NFNN_TEST(StateBytes[1] * 10 < StateBytes[0] * 3 && StateBytes[1] * 10 < ParamBytes * 6,
+                  "QuantizedOptimizer: Adam state is about half the parameters");
+    }
+
+    {
+        // NOTE(luatil): Jobs of a pool split on block boundaries, the result matches the serial step
+        nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 2, 64);
+        nfnn_tensor *Serial = NfNN_Matrix(Mem, &Random, 1, NFNN_OPTIMIZER_CHUNK + 16);
+        nfnn_tensor *Split = NfNN_Matrix(Mem, &Random, 1, NFNN_OPTIMIZER_CHUNK + 16);
+        memcpy(Split->Data, Serial->Data, NfNN_Size(Serial));
+        nfnn_optimizer *Optimizers[2] = {NfNN_Optimizer_SGD(Mem, 0.01f, 1, 0.9f, 0.0f, 0.01f, false),
+                                         NfNN_Optimizer_SGD(Mem, 0.01f, 1, 0.9f, 0.0f, 0.01f, false)};
+        NfNN_Optimizer_QuantizeState(Optimizers[0]);
+        NfNN_Optimizer_QuantizeState(Optimizers[1]);
+        NfNN_Optimizer_AddParam(Mem, Optimizers[0], Serial);
+        NfNN_Optimizer_AddParam(Mem, Optimizers[1], Split);
+        NfNN_Optimizer_SetThreadPool(Optimizers[1], Pool);
+        for (u32 Step = 0; Step < 3; Step++)
+        {
+            for (u32 I = 0; I < NfNN_Length(Serial); I++)
+            {
+                Serial->Gradient[I] = Split->Gradient[I] = (f32)((I + Step) % 13) * 0.1f - 0.6f;
+            }
+            NfNN_Optimizer_Step(Optimizers[0]);
+            NfNN_Optimizer_Step(Optimizers[1]);
+        }
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Serial->Data, Split->Data, NfNN_Length(Serial), 0.0f),
+                  "QuantizedOptimizer: Threaded step");
+        NfNN_ThreadPool_Destroy(Pool);
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+typedef struct nfnn_test_grad_ready nfnn_test_grad_ready;
+struct nfnn_test_grad_ready
+{
+    u32 Count;
+    nfnn_tensor *Leaves[4];
+    f32 Gradients[4][9]; // At the time of the call
+};
+
+static void NfNN_Test_GradReadyRecord(void *Context, nfnn_tensor *Leaf)
+{
+    nfnn_test_grad_ready *Record = (nfnn_test_grad_ready *)Context;
+    NFNN_ASSERT(Record->Count < 4 && NfNN_Length(Leaf) <= 9, "Test: Too many leaves");
+    Record->Leaves[Record->Count] = Leaf;
+    NfNN_MemoryCopy(Record->Gradients[Record->Count++], Leaf->Gradient, NfNN_Size(Leaf));
+}
+
+// NOTE(luatil): W is read by both layers, so it is only ready after the backward of the first
+static nfnn_tensor *NfNN_Test_GradReadyModel(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor **Params)
+{
+    nfnn_tensor *H = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, Params[0]), Params[1]));
+    nfnn_tensor *G = NfNN_Tanh(Mem, NfNN_MatMul(Mem, H, Params[0]));
+    return NfNN_SumAll(Mem, NfNN_Square(Mem, NfNN_MatMul(Mem, G, Params[2])));
+}
+
+static void NfNN_Test_GradReady(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 5);
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, 4, 3);
+    NfNN_SetRequiresGrad(Mem, X, false);
+
+    {
+        nfnn_tensor *Params[3] = {NfNN_Matrix(Mem, &Random, 3, 3), NfNN_Matrix(Mem, &Random, 1, 3),
+                                  NfNN_Matrix(Mem, &Random, 3, 1)};
+        nfnn_test_grad_ready Record = {0};
+        NfNN_AutoGrad_SetGradReady(Mem, NfNN_Test_GradReadyRecord, &Record);
+        NfNN_AutoGrad_Backward(Mem, NfNN_Test_GradReadyModel(Mem, X, Params));
+        NfNN_AutoGrad_SetGradReady(Mem, 0, 0);
+
+        NFNN_TEST(Record.Count == 3, "GradReady: Once per leaf");
+        NFNN_TEST(Record.Leaves[0] == Params[2] && Record.Leaves[1] == Params[1] && Record.Leaves[2] == Params[0],
+                  "GradReady: Last layer first, shared weight after its first reader");
+        bool Final = true;
+        for (u32 Index = 0; Index < Record.Count; Index++)
+        {
+            nfnn_tensor *Leaf = Record.Leaves[Index];
+            Final = Final && memcmp(Record.Gradients[Index], Leaf->Gradient, NfNN_Size(Leaf)) == 0;
+        }
+        NFNN_TEST(Final, "GradReady: Gradient is final when the hook runs");
+    }
+
+    {
+        // NOTE(luatil): Three steps updating inside backward, sequential and parallel, against plain steps
+        nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 4, 64);
+        f32 Expected[3][9];
+        for (u32 Mode = 0; Mode < 3; Mode++)
+        {
+            nfnn_random_state ModelRandom = {0};
+            NfNN_Random_Init(&ModelRandom, 9);
+            nfnn_tensor *Params[3] = {NfNN_Matrix(Mem, &ModelRandom, 3, 3), NfNN_Matrix(Mem, &ModelRandom, 1, 3),
+                                      NfNN_Matrix(Mem, &ModelRandom, 3, 1)};
+            nfnn_optimizer *Optimizer = NfNN_Optimizer_SGD(Mem, 0.1f, 1, 0.9f, 0.0f, 0.01f, false);
+            for (u32 Index = 0; Index < 3; Index++)
+            {
+                NfNN_Optimizer_AddParam(Mem, Optimizer, Params[Index]);
+            }
+            if (Mode > 0)
+            {
+                NfNN_Optimizer_OverlapBackward(Mem, Optimizer);
+            }
+
+            for (u32 Step = 0; Step < 3; Step++)
+            {
+                NfNN_Optimizer_ZeroGrad(Optimizer);
+                nfnn_tensor *L = NfNN_Test_GradReadyModel(Mem, X, Params);
+                if (Mode == 2)
+                {
+                    NfNN_AutoGrad_BackwardParallel(Mem, L, Pool);
+                }
+                else
+                {
+                    NfNN_AutoGrad_Backward(Mem, L);
+                }
+                NfNN_Optimizer_Step(Optimizer);
+            }
+            NfNN_AutoGrad_SetGradReady(Mem, 0, 0);
+
+            bool Same = true;
+            for (u32 Index = 0; Index < 3; Index++)
+            {
+                if (Mode == 0)
+                {
+                    NfNN_MemoryCopy(Expected[Index], Params[Index]->Data, NfNN_Size(Params[Index]));
+                }
+                Same = Same && NfNN_Math_CompareMemory_f32(Params[Index]->Data, Expected[Index],
+                                                           NfNN_Length(Params[Index]), Mode == 2 ? 0.0001f : 0.0f);
+            }
+            NFNN_TEST(Same, Mode == 2 ? "GradReady: Parallel overlapped step" : "GradReady: Overlapped step");
+        }
+        NfNN_ThreadPool_Destroy(Pool);
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_FirstWrite(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 13);
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, 4, 3);
+    nfnn_tensor *W = NfNN_Matrix(Mem, &Random, 3, 3);
+    nfnn_tensor *B = NfNN_Matrix(Mem, &Random, 1, 3);
+    nfnn_tensor *Unused = NfNN_Matrix(Mem, &Random, 2, 2);
+    nfnn_tensor *Params[] = {X, W, B};
+
+    // NOTE(luatil): X and W are read twice and H by three ops, so their gradients get added to
+    nfnn_tensor *H = NfNN_Add(Mem, NfNN_MatMul(Mem, NfNN_Mul(Mem, X, X), W), B);
+    nfnn_tensor *G = NfNN_Add(Mem, NfNN_Tanh(Mem, NfNN_MatMul(Mem, H, W)), NfNN_Mul(Mem, H, X));
+    nfnn_tensor *L = NfNN_SumAll(Mem, NfNN_Square(Mem, NfNN_Add(Mem, G, H)));
+
+    f32 *Expected[NFNN_ARRAY_COUNT(Params) + 1];
+    NfNN_AutoGrad_ZeroGrad(Mem, L);
+    NfNN_AutoGrad_Backward(Mem, L);
+    for (u32 I = 0; I < NFNN_ARRAY_COUNT(Params); I++)
+    {
+        Expected[I] = NfNN_PushTensor(Mem, Params[I]->Dimensions);
+        NfNN_MemoryCopy(Expected[I], Params[I]->Gradient, NfNN_Size(Params[I]));
+    }
+    Expected[NFNN_ARRAY_COUNT(Params)] = NfNN_PushTensor(Mem, H->Dimensions);
+    NfNN_MemoryCopy(Expected[NFNN_ARRAY_COUNT(Params)], H->Gradient, NfNN_Size(H));
+
+    u32 Writers = 0;
+    for (u32 Index = H->TapeIndex; Index < L->TapeIndex; Index++)
+    {
+        nfnn_tensor *It = NfNN_Tape_Get(Mem, Index);
+        for (u32 Input = 0; Input < NfNN_Op_InputCount(It->Op.Type); Input++)
+        {
+            Writers += It->Op.Inputs[Input] == H && NfNN_AutoGrad_FirstWrite(It, Input);
+        }
+    }
+    NFNN_TEST(Writers == 1, "FirstWrite: One first writer per gradient");
+
+    nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 4, 64);
+    for (u32 Parallel = 0; Parallel < 2; Parallel++)
+    {
+        // NOTE(luatil): Whatever the gradients held before is overwritten
+        for (u32 I = 0; I < NFNN_ARRAY_COUNT(Params); I++)
+        {
+            NfNN_Math_FillConstant_f32(Params[I]->Gradient, NfNN_Length(Params[I]), 123.0f);
+        }
+        NfNN_Math_FillConstant_f32(H->Gradient, NfNN_Length(H), -7.0f);
+        if (Parallel)
+        {
+            NfNN_AutoGrad_BackwardParallel(Mem, L, Pool);
+        }
+        else
+        {
+            NfNN_AutoGrad_Backward(Mem, L);
+        }
+
+        bool Same = memcmp(H->Gradient, Expected[NFNN_ARRAY_COUNT(Params)], NfNN_Size(H)) == 0;
+        for (u32 I = 0; I < NFNN_ARRAY_COUNT(Params); I++)
+        {
+            Same = Same && NfNN_Math_CompareMemory_f32(Params[I]->Gradient, Expected[I], NfNN_Length(Params[I]),
+                                                       Parallel ? 0.0001f : 0.0f);
+        }
+        NFNN_TEST(Same, Parallel ? "FirstWrite: Parallel backward without ZeroGrad"
+                                 : "FirstWrite: Backward without ZeroGrad");
+    }
+    NfNN_ThreadPool_Destroy(Pool);
+
+    {
+        // NOTE(luatil): A parameter backward did not reach steps with a zero gradient
+        nfnn_optimizer *Optimizer = NfNN_Optimizer_SGD(Mem, 0.1f, 1, 0.0f, 0.0f, 0.0f, false);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, W);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, Unused);
+        f32 Before[4];
+        NfNN_MemoryCopy(Before, Unused->Data, sizeof(Before));
+        NfNN_Math_FillConstant_f32(Unused->Gradient, 4, 5.0f);
+
+        nfnn_tensor *Loss = NfNN_SumAll(Mem, NfNN_Square(Mem, NfNN_MatMul(Mem, X, W)));
+        NfNN_AutoGrad_Backward(Mem, Loss);
+        NfNN_Optimizer_Step(Optimizer);
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Unused->Data, Before, 4, 0.0f) && Unused->Gradient[0] == 0.0f,
+                  "FirstWrite: Stale gradient is cleared before the step");
+    }
+
+    {
+        // NOTE(luatil): Two optimizers, the second backward only reaches the parameter of the first
+        nfnn_tensor *A = NfNN_From_f32(Mem, (f32[]){1.0f, 2.0f}, NfNN_Dim2(1, 2));
+        nfnn_tensor *P = NfNN_From_f32(Mem, (f32[]){0.5f, -0.5f}, NfNN_Dim2(2, 1));
+        nfnn_tensor *Q = NfNN_From_f32(Mem, (f32[]){0.25f, 0.75f}, NfNN_Dim2(2, 1));
+        A->RequiresGrad = false;
+        nfnn_optimizer *OptimizerP = NfNN_Optimizer_SGD(Mem, 0.1f, 1, 0.0f, 0.0f, 0.0f, false);
+        nfnn_optimizer *OptimizerQ = NfNN_Optimizer_SGD(Mem, 0.1f, 1, 0.0f, 0.0f, 0.0f, false);
+        NfNN_Optimizer_AddParam(Mem, OptimizerP, P);
+        NfNN_Optimizer_AddParam(Mem, OptimizerQ, Q);
+
+        nfnn_tensor *Both = NfNN_Add(Mem, NfNN_MatMul(Mem, A, P), NfNN_MatMul(Mem, A, Q));
+        NfNN_AutoGrad_Backward(Mem, NfNN_SumAll(Mem, Both));
+        NfNN_Optimizer_Step(OptimizerP);
+        NfNN_Optimizer_Step(OptimizerQ);
+        f32 Before[2];
+        NfNN_MemoryCopy(Before, Q->Data, sizeof(Before));
+
+        NfNN_AutoGrad_Backward(Mem, NfNN_SumAll(Mem, NfNN_MatMul(Mem, A, P)));
+        NfNN_Optimizer_Step(OptimizerP);
+        NfNN_Optimizer_Step(OptimizerQ);
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Q->Data, Before, 2, 0.0f) && Q->Gradient[0] == 0.0f &&
+                      Q->Gradient[1] == 0.0f,
+                  "FirstWrite: Step the backward did not reach applies no gradient");
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static nfnn_tensor *NfNN_Test_AccumulationLoss(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *Y,
+                                               nfnn_tensor *W, nfnn_tensor *B)
+{
+    nfnn_tensor *H = NfNN_Tanh(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W), B));
+    return NfNN_SumAll(Mem, NfNN_Square(Mem, NfNN_Sub(Mem, H, Y)));
+}
+
+static void NfNN_Test_GradAccumulation(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 21);
+    u32 MicroBatches = 4;
+    u32 Rows = 2;
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, MicroBatches * Rows, 3);
+    nfnn_tensor *Y = NfNN_Matrix(Mem, &Random, MicroBatches * Rows, 2);
+    nfnn_tensor *W = NfNN_Matrix(Mem, &Random, 3, 2);
+    nfnn_tensor *B = NfNN_Matrix(Mem, &Random, 1, 2);
+    X->RequiresGrad = false;
+    Y->RequiresGrad = false;
+
+    // NOTE(luatil): Mean over the micro-batches is the gradient of the whole batch divided by their count
+    f32 ExpectedW[6], ExpectedB[2];
+    {
+        nfnn_tensor *L = NfNN_Test_AccumulationLoss(Mem, X, Y, W, B);
+        NfNN_AutoGrad_Backward(Mem, NfNN_MultiplyByConstant(Mem, L, 1.0f / (f32)MicroBatches));
+        NfNN_MemoryCopy(ExpectedW, W->Gradient, sizeof(ExpectedW));
+        NfNN_MemoryCopy(ExpectedB, B->Gradient, sizeof(ExpectedB));
+    }
+
+    nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 4, 64);
+    for (u32 Parallel = 0; Parallel < 2; Parallel++)
+    {
+        NfNN_Math_FillConstant_f32(W->Gradient, 6, 99.0f);
+        NfNN_Math_FillConstant_f32(B->Gradient, 2, -99.0f);
+        // NOTE(luatil): Every micro-batch rewinds Mem, like TempInit/TempClear in the examples
+        u64 Start = Mem->Used;
+        u32 StartTape = Mem->TapeCount;
+
+        NfNN_AutoGrad_AccumulateBegin(Mem, MicroBatches);
+        for (u32 MicroBatch = 0; MicroBatch < MicroBatches; MicroBatch++)
+        {
+            nfnn_tensor *XM = NfNN_From_f32(Mem, X->Data + MicroBatch * Rows * 3, NfNN_Dim2(Rows, 3));
+            nfnn_tensor *YM = NfNN_From_f32(Mem, Y->Data + MicroBatch * Rows * 2, NfNN_Dim2(Rows, 2));
+            XM->RequiresGrad = false;
+            YM->RequiresGrad = false;
+            nfnn_tensor *L = NfNN_Test_AccumulationLoss(Mem, XM, YM, W, B);
+            if (Parallel)
+            {
+                NfNN_AutoGrad_BackwardParallel(Mem, L, Pool);
+            }
+            else
+            {
+                NfNN_AutoGrad_Backward(Mem, L);
+            }
+
+            memset(Mem->Base + Start, 0, Mem->Used - Start);
+            Mem->Used = Start;
+            Mem->TapeCount = StartTape;
+        }
+        NfNN_AutoGrad_AccumulateEnd(Mem);
+
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(W->Gradient, ExpectedW, 6, 0.0001f) &&
+                      NfNN_Math_CompareMemory_f32(B->Gradient, ExpectedB, 2, 0.0001f),
+                  Parallel ? "GradAccumulation: Parallel backward" : "GradAccumulation: Backward");
+    }
+    NfNN_ThreadPool_Destroy(Pool);
+
+    {
+        // NOTE(luatil): A backward after the end overwrites again
+        nfnn_tensor *L = NfNN_Test_AccumulationLoss(Mem, X, Y, W, B);
+        NfNN_AutoGrad_Backward(Mem, NfNN_MultiplyByConstant(Mem, L, 1.0f / (f32)MicroBatches));
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(W->Gradient, ExpectedW, 6, 0.0001f),
+                  "GradAccumulation: Backward after the end");
+    }
+
+    {
+        nfnn_tensor *XM = NfNN_From_f32(Mem, X->Data, NfNN_Dim2(Rows, 3));
+        nfnn_tensor *YM = NfNN_From_f32(Mem, Y->Data, NfNN_Dim2(Rows, 2));
+        XM->RequiresGrad = false;
+        YM->RequiresGrad = false;
+        nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+        nfnn_tensor *L = NfNN_Test_AccumulationLoss(Mem, XM, YM, W, B);
+        NfNN_AutoGrad_Backward(Mem, L);
+        NfNN_Graph_EndCapture(Graph, L, 0);
+
+        NfNN_AutoGrad_AccumulateBegin(Mem, MicroBatches);
+        for (u32 MicroBatch = 0; MicroBatch < MicroBatches; MicroBatch++)
+        {
+            NfNN_MemoryCopy(XM->Data, X->Data + MicroBatch * Rows * 3, NfNN_Size(XM));
+            NfNN_MemoryCopy(YM->Data, Y->Data + MicroBatch * Rows * 2, NfNN_Size(YM));
+            NfNN_Graph_Forward(Graph);
+            NfNN_Graph_Backward(Graph);
+        }
+        NfNN_AutoGrad_AccumulateEnd(Mem);
+
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(W->Gradient, ExpectedW, 6, 0.0001f) &&
+                      NfNN_Math_CompareMemory_f32(B->Gradient, ExpectedB, 2, 0.0001f),
+                  "GradAccumulation: Graph replay");
+
+        // NOTE(luatil): One step with the accumulated gradient
+        nfnn_optimizer *Optimizer = NfNN_Optimizer_SGD(Mem, 0.5f, 1, 0.0f, 0.0f, 0.0f, false);
+        NfNN_Optimizer_AddParam(Mem, Optimizer, W);
+        f32 Before = W->Data[0];
+        NfNN_Optimizer_Step(Optimizer);
+        NFNN_TEST(NfNN_Math_Single_Abs_f32(W->Data[0] - (Before - 0.5f * ExpectedW[0])) < 0.0001f,
+                  "GradAccumulation: Step uses the accumulated gradient");
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_ParameterServer(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    // NOTE(luatil): Everything runs on this thread, the server only polls what the workers already
+    // put on the loopback sockets
+    u32 Workers = 16;
+    nfnn_parameter_server *Server = NfNN_ParameterServer_Create(Mem, NFNN_TRANSPORT_TCP, "127.0.0.1", 0);
+    Server->Quiet = true;
+    nfnn_channel **Channels = NfNN_PushArray(Mem, nfnn_channel *, Workers);
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        Channels[Worker] = NfNN_Network_Connect(Mem, NFNN_TRANSPORT_TCP, "127.0.0.1", Server->Port);
+    }
+    NfNN_ParameterServer_AcceptWorkers(Server, Workers);
+    NFNN_TEST(Server->WorkerCount == Workers && Server->LiveCount == Workers, "ParameterServer: Accept workers");
+
+    nfnn_tensor *W = NfNN_CreateTensor(Mem, NfNN_Dim2(3, 5), true);
+    nfnn_tensor *B = NfNN_CreateTensor(Mem, NfNN_Dim2(1, 5), true);
+    nfnn_tensor *Sent = NfNN_CreateTensor(Mem, NfNN_Dim2(3, 5), true);
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        NfNN_Math_FillConstant_f32(Sent->Gradient, NfNN_Length(Sent), (f32)(Worker + 1));
+        NfNN_Network_SendGradients(Mem, Channels[Worker], Server->Step, &Sent, 1);
+    }
+    NfNN_ParameterServer_AwaitGradients(Mem, Server, &W, 1);
+    NFNN_TEST(W->Gradient[0] == (f32)(Workers * (Workers + 1) / 2) &&
+                  W->Gradient[NfNN_Length(W) - 1] == (f32)(Workers * (Workers + 1) / 2),
+              "ParameterServer: Gradient of every worker");
+    NFNN_TEST(Server->Step == 1, "ParameterServer: Next step after the barrier");
+
+    NfNN_Math_FillConstant_f32(W->Data, NfNN_Length(W), 0.5f);
+    u64 Calls = GlobalCalls;
+    NfNN_ParameterServer_BroadcastWeights(Mem, Server, &W, 1);
+    NFNN_TEST(GlobalCalls - Calls == Workers, "ParameterServer: One call per worker to send");
+    bool Same = true;
+    u32 Step = 0;
+    Calls = GlobalCalls;
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        Step = NfNN_Network_RecvWeights(Mem, Channels[Worker], &Sent, 1);
+        Same = Same && NfNN_Math_CompareMemory_f32(Sent->Data, W->Data, NfNN_Length(W), 0.0f);
+    }
+    NFNN_TEST(Same && Step == 1, "ParameterServer: Broadcast");
+    NFNN_TEST(GlobalCalls - Calls == Workers, "ParameterServer: One call per worker to receive");
+
+    {
+        // NOTE(luatil): Larger than a chunk, the pieces of every worker are added at their offset
+        nfnn_tensor *Large = NfNN_CreateTensor(Mem, NfNN_Dim2(1, 4500), true);
+        nfnn_tensor *LargeSent = NfNN_CreateTensor(Mem, NfNN_Dim2(1, 4500), true);
+        for (u32 Worker = 0; Worker < Workers; Worker++)
+        {
+            for (u32 Index = 0; Index < NfNN_Length(LargeSent); Index++)
+            {
+                LargeSent->Gradient[Index] = (f32)(Index + Worker);
+            }
+            NfNN_Network_SendGradients(Mem, Channels[Worker], Server->Step, &LargeSent, 1);
+        }
+        u64 Used = Mem->Used;
+        NfNN_ParameterServer_AwaitGradients(Mem, Server, &Large, 1);
+        bool Summed = true;
+        for (u32 Index = 0; Index < NfNN_Length(Large); Index++)
+        {
+            Summed = Summed && Large->Gradient[Index] == (f32)(Workers * Index + Workers * (Workers - 1) / 2);
+        }
+        NFNN_TEST(Summed, "ParameterServer: Gradient in chunks");
+        NFNN_TEST(Mem->Used == Used, "ParameterServer: Nothing allocated per step");
+
+        // NOTE(luatil): Same on the receiving end of a plain socket, after the header
+        NfNN_Math_FillConstant_f32(Large->Data, NfNN_Length(Large), 2.0f);
+        NfNN_ParameterServer_SendWeights(Mem, Server, 0, &Large, 1);
+        nfnn_message_header Header;
+        NfNN_Network_RecvSize(Channels[0]->Handle, sizeof(Header), (char *)&Header);
+        NfNN_Network_RecvAddGradient(Mem, Channels[0]->Handle, LargeSent);
+        NFNN_TEST(Header.Magic == NFNN_NETWORK_MAGIC && Header.BucketSize == 0 &&
+                      Header.PayloadSize == NfNN_Size(Large),
+                  "ParameterServer: Large tensors are not bucketed");
+        NFNN_TEST(Mem->Used == Used && LargeSent->Gradient[0] == (f32)(Workers - 1) + 2.0f &&
+                      LargeSent->Gradient[4499] == (f32)(4499 + Workers - 1) + 2.0f,
+                  "ParameterServer: Receive and add");
+    }
+
+    // NOTE(luatil): A worker that leaves no longer holds up the barrier
+    NfNN_Network_Disconnect(Channels[3]);
+    memset(W->Gradient, 0, NfNN_Size(W));
+    NfNN_Math_FillConstant_f32(Sent->Gradient, NfNN_Length(Sent), 1.0f);
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        if (Worker != 3)
+        {
+            NfNN_Network_SendGradients(Mem, Channels[Worker], Server->Step, &Sent, 1);
+        }
+    }
+    u32 Complete = NfNN_ParameterServer_AwaitGradients(Mem, Server, &W, 1);
+    NFNN_TEST(Server->LiveCount == Workers - 1 && W->Gradient[0] == (f32)(Workers - 1) &&
+                  Complete == Workers - 1 && Server->PartialCount == 0,
+              "ParameterServer: Worker disconnects");
+
+    // NOTE(luatil): Worker 7 sends the wrong tensor and worker 11 a step that did not happen, both
+    // are dropped before anything of theirs is added
+    memset(W->Gradient, 0, NfNN_Size(W));
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        if (Worker == 7)
+        {
+            NfNN_Network_SendGradients(Mem, Channels[Worker], Server->Step, &B, 1);
+        }
+        else if (Worker != 3)
+        {
+            u32 WorkerStep = Worker == 11 ? Server->Step + 1 : Server->Step;
+            NfNN_Network_SendGradients(Mem, Channels[Worker], WorkerStep, &Sent, 1);
+        }
+    }
+    NfNN_ParameterServer_AwaitGradients(Mem, Server, &W, 1);
+    NFNN_TEST(Server->LiveCount == Workers - 3 && Server->Workers[7].State == NFNN_CONNECTION_CLOSED &&
+                  Server->Workers[11].State == NFNN_CONNECTION_CLOSED && W->Gradient[0] == (f32)(Workers - 3),
+              "ParameterServer: Protocol error");
+
+    {
+        // NOTE(luatil): Worker 13 leaves halfway through its message, after more than the staging
+        // buffer of it was added. The step is reported short.
+        u32 Length = 2 * NFNN_NETWORK_STAGING / sizeof(f32) + 256;
+        nfnn_tensor *Large = NfNN_CreateTensor(Mem, NfNN_Dim2(1, Length), true);
+        nfnn_tensor *LargeSent = NfNN_CreateTensor(Mem, NfNN_Dim2(1, Length), true);
+        NfNN_Math_FillConstant_f32(LargeSent->Gradient, NfNN_Length(LargeSent), 1.0f);
+        for (u32 Worker = 0; Worker < Workers; Worker++)
+        {
+            if (Worker == 13)
+            {
+                nfnn_message_frame Frame;
+                nfnn_iovec Vectors[NFNN_NETWORK_MAX_TENSORS + 1];
+                NfNN_Message_Layout(&Frame.Header, NFNN_MESSAGE_GRADIENTS, Server->Step, &LargeSent, 1);
+                NfNN_Message_Bucket(&Frame, &LargeSent, true);
+                u32 VectorCount = NfNN_Message_Vectors(&Frame, &LargeSent, Vectors);
+                NFNN_IOVEC_SET(Vectors[VectorCount - 1], LargeSent->Gradient, NfNN_Size(LargeSent) / 2);
+                NfNN_Network_TransferVectors(Channels[Worker], Vectors, VectorCount, true);
+                NfNN_Network_Disconnect(Channels[Worker]);
+            }
+            else if (Worker != 3 && Worker != 7 && Worker != 11)
+            {
+                NfNN_Network_SendGradients(Mem, Channels[Worker], Server->Step, &LargeSent, 1);
+            }
+        }
+        Complete = NfNN_ParameterServer_AwaitGradients(Mem, Server, &Large, 1);
+        NFNN_TEST(Complete == Workers - 4 && Server->PartialCount == 1 && Server->LiveCount == Workers - 4,
+                  "ParameterServer: Partial gradient is reported");
+    }
+
+    {
+        // NOTE(luatil): Only workers 5 and 9 send, they are served in turn and get an answer. The
+        // others stay expected until they send, so this comes last.
+        nfnn_tensor *Parameters[] = {W, B};
+        nfnn_tensor *SentB = NfNN_CreateTensor(Mem, NfNN_Dim2(1, 5), true);
+        nfnn_tensor *SentParameters[] = {Sent, SentB};
+        NfNN_Math_FillConstant_f32(SentB->Gradient, NfNN_Length(SentB), 1.0f);
+        u32 Before = Server->Step;
+        NfNN_Network_SendGradients(Mem, Channels[5], Before, SentParameters, 2);
+        NfNN_Network_SendGradients(Mem, Channels[9], Before - 1, SentParameters, 2);
+
+        memset(B->Gradient, 0, NfNN_Size(B));
+        u32 First = NfNN_ParameterServer_AwaitAnyGradient(Mem, Server, Parameters, NFNN_ARRAY_COUNT(Parameters));
+        NfNN_Math_FillConstant_f32(B->Data, NfNN_Length(B), 3.0f);
+        NfNN_ParameterServer_SendWeights(Mem, Server, First, Parameters, NFNN_ARRAY_COUNT(Parameters));
+        u32 Second = NfNN_ParameterServer_AwaitAnyGradient(Mem, Server, Parameters, NFNN_ARRAY_COUNT(Parameters));
+        NFNN_TEST((First == 5 && Second == 9) || (First == 9 && Second == 5), "ParameterServer: Any worker");
+        NFNN_TEST(B->Gradient[0] == 2.0f, "ParameterServer: Gradients of a message");
+        NFNN_TEST(Server->Step == Before + 2 && Server->Workers[9].Step == Before - 1,
+                  "ParameterServer: Step of the gradients");
+
+        Step = NfNN_Network_RecvWeights(Mem, Channels[First], SentParameters, 2);
+        NFNN_TEST(Step == Before + 1 && NfNN_Math_CompareMemory_f32(SentB->Data, B->Data, NfNN_Length(B), 0.0f),
+                  "ParameterServer: Send to one worker");
+    }
+
+    for (u32 Worker = 0; Worker < Workers; Worker++)
+    {
+        if (Worker != 3)
+        {
+            NfNN_Network_Disconnect(Channels[Worker]);
+        }
+    }
+    NfNN_ParameterServer_Destroy(Server);
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+typedef struct nfnn_test_transport_worker nfnn_test_transport_worker;
+struct nfnn_test_transport_worker
+{
+    nfnn_channel **Channels;
+    u32 Count;
+    nfnn_tensor *Large;
+};
+
+static NFNN_THREAD_RESULT NfNN_Test_TransportWorker(void *Parameter)
+{
+    nfnn_test_transport_worker *Worker = (nfnn_test_transport_worker *)Parameter;
+    for (u32 Index = 0; Index < Worker->Count; Index++)
+    {
+        NfNN_Network_SendGradients(0, Worker->Channels[Index], 1, &Worker->Large, 1);
+    }
+    return 0;
+}
+
+static void NfNN_Test_Transports(nfnn_memory_arena *Mem)
+{
+    nfnn_transport Transports[] = {NFNN_TRANSPORT_SHARED_MEMORY, NFNN_TRANSPORT_IN_PROCESS};
+    for (u32 TransportIndex = 0; TransportIndex < NFNN_ARRAY_COUNT(Transports); TransportIndex++)
+    {
+        NfNN_MemoryArena_TempInit(Mem);
+
+        nfnn_transport Transport = Transports[TransportIndex];
+        u32 Workers = 4;
+        nfnn_parameter_server *Server = NfNN_ParameterServer_Create(Mem, Transport, "127.0.0.1", 0);
+        Server->Quiet = true;
+        nfnn_channel **Channels = NfNN_PushArray(Mem, nfnn_channel *, Workers);
+        for (u32 Worker = 0; Worker < Workers; Worker++)
+        {
+            Channels[Worker] = NfNN_Network_Connect(Mem, Transport, "127.0.0.1", Server->Port);
+        }
+        NfNN_ParameterServer_AcceptWorkers(Server, Workers);
+        NFNN_TEST(Server->LiveCount == Workers, "Transports: Accept workers");
+
+        nfnn_tensor *W = NfNN_CreateTensor(Mem, NfNN_Dim2(3, 5), true);
+        nfnn_tensor *B = NfNN_CreateTensor(Mem, NfNN_Dim2(1, 5), true);
+        nfnn_tensor *SentW = NfNN_CreateTensor(Mem, NfNN_Dim2(3, 5), true);
+        nfnn_tensor *SentB = NfNN_CreateTensor(Mem, NfNN_Dim2(1, 5), true);
+        nfnn_tensor *Parameters[] = {W, B};
+        nfnn_tensor *Sent[] = {SentW, SentB};
+        for (u32 Worker = 0; Worker < Workers; Worker++)
+        {
+            NfNN_Math_FillConstant_f32(SentW->Gradient, NfNN_Length(SentW), (f32)(Worker + 1));
+            NfNN_Math_FillConstant_f32(SentB->Gradient, NfNN_Length(SentB), 1.0f);
+            NfNN_Network_SendGradients(Mem, Channels[Worker], Server->Step, Sent, 2);
+        }
+        NfNN_ParameterServer_AwaitGradients(Mem, Server, Parameters, 2);
+        NFNN_TEST(W->Gradient[14] == (f32)(Workers * (Workers + 1) / 2) && B->Gradient[0] == (f32)Workers,
+                  "Transports: Gradient of every worker");
+
+        NfNN_Math_FillConstant_f32(W->Data, NfNN_Length(W), 0.5f);
+        NfNN_Math_FillConstant_f32(B->Data, NfNN_Length(B), 0.25f);
+        NfNN_ParameterServer_BroadcastWeights(Mem, Server, Parameters, 2);
+        bool Same = true;
+        for (u32 Worker = 0; Worker < Workers; Worker++)
+        {
+            u32 Step = NfNN_Network_RecvWeights(Mem, Channels[Worker], Sent, 2);
+            Same = Same && Step == 1 && NfNN_Math_CompareMemory_f32(SentW->Data, W->Data, NfNN_Length(W), 0.0f) &&
+                   NfNN_Math_CompareMemory_f32(SentB->Data, B->Data, NfNN_Length(B), 0.0f);
+        }
+        NFNN_TEST(Same, "Transports: Broadcast");
+
+        // NOTE(luatil): Worker 3 leaves, worker 2 sends only one of the tensors
+        NfNN_Network_Disconnect(Channels[3]);
+        memset(W->Gradient, 0, NfNN_Size(W));
+        NfNN_Math_FillConstant_f32(SentW->Gradient, NfNN_Length(SentW), 1.0f);
+        NfNN_Network_SendGradients(Mem, Channels[0], Server->Step, Sent, 2);
+        NfNN_Network_SendGradients(Mem, Channels[1], Server->Step, Sent, 2);
+        NfNN_Network_SendGradients(Mem, Channels[2], Server->Step, Sent, 1);
+        NfNN_ParameterServer_AwaitGradients(Mem, Server, Parameters, 2);
+        NFNN_TEST(Server->LiveCount == 2 && W->Gradient[0] == 2.0f, "Transports: Disconnect and protocol error");
+
+        {
+            // NOTE(luatil): More than a ring holds, the worker thread waits for the server to make
+            // room and the server waits for the worker to write
+            u32 Length = NFNN_RING_SIZE / sizeof(f32) + 256;
+            nfnn_tensor *Large = NfNN_CreateTensor(Mem, NfNN_Dim2(1, Length), true);
+            nfnn_tensor *LargeSent = NfNN_CreateTensor(Mem, NfNN_Dim2(1, Length), true);
+            for (u32 Index = 0; Index < Length; Index++)
+            {
+                LargeSent->Gradient[Index] = (f32)(Index % 1000);
+            }
+            nfnn_test_transport_worker Worker = {Channels, 2, LargeSent};
+            nfnn_thread Thread = NfNN_Thread_Create(NfNN_Test_TransportWorker, &Worker);
+            NfNN_ParameterServer_AwaitGradients(Mem, Server, &Large, 1);
+            NfNN_Thread_Join(Thread);
+            bool Summed = true;
+            for (u32 Index = 0; Index < Length; Index++)
+            {
+                Summed = Summed && Large->Gradient[Index] == 2.0f * (f32)(Index % 1000);
+            }
+            NFNN_TEST(Summed, "Transports: Larger than the ring");
+        }
+
+        for (u32 Worker = 0; Worker < 3; Worker++)
+        {
+            NfNN_Network_Disconnect(Channels[Worker]);
+        }
+        NfNN_ParameterServer_Destroy(Server);
+
+        NfNN_MemoryArena_TempClear(Mem);
+    }
+}
+
+static void NfNN_Test_NoGrad(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_random_state Random = {0};
+    NfNN_Random_Init(&Random, 42);
+
+    nfnn_tensor *X = NfNN_Matrix(Mem, &Random, 16, 64);
+    nfnn_tensor *W1 = NfNN_Matrix(Mem, &Random, 64, 64);
+    nfnn_tensor *B1 = NfNN_Matrix(Mem, &Random, 1, 64);
+    nfnn_tensor *W2 = NfNN_Matrix(Mem, &Random, 64, 10);
+    X->RequiresGrad = false;
+
+    u64 GradStart = Mem->Used;
+    nfnn_tensor *H = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W1), B1));
+    nfnn_tensor *Expected = NfNN_LogSoftmax(Mem, NfNN_MatMul(Mem, H, W2), 1);
+    u64 GradUsed = Mem->Used - GradStart;
+
+    u32 TapeCount = Mem->TapeCount;
+    u64 NoGradStart = Mem->Used;
+    NfNN_MemoryArena_NoGradBegin(Mem, true);
+    nfnn_tensor *L1 = NfNN_MatMul(Mem, X, W1);
+    nfnn_tensor *R1 = NfNN_ReLU(Mem, NfNN_Add(Mem, L1, B1));
+    nfnn_tensor *Outputs = NfNN_LogSoftmax(Mem, NfNN_MatMul(Mem, R1, W2), 1);
+    NfNN_MemoryArena_NoGradEnd(Mem);
+    u64 NoGradUsed = Mem->Used - NoGradStart;
+
+    NFNN_TEST(!Outputs->RequiresGrad && Outputs->Gradient == 0 && R1->Op.Saved.Mask == 0,
+              "NoGrad: Nothing saved for backward");
+    NFNN_TEST(Mem->TapeCount == TapeCount, "NoGrad: Nothing recorded");
+    NFNN_TEST(R1->Data == L1->Data, "NoGrad: Intermediates reused in place");
+    NFNN_TEST(NfNN_AllClose(Outputs, Expected, 0.0001f), "NoGrad: Same values as with gradients");
+    NFNN_TEST(2 * NoGradUsed < GradUsed, "NoGrad: Less than half the memory");
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_Lazy(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f, -2.0f, 0.5f, 3.0f, -1.0f, 1.0f}, NfNN_Dim2(3, 2));
+    nfnn_tensor *Y = NfNN_From_f32(Mem, (f32[]){0.0f, 1.0f, 1.0f}, NfNN_Dim2(3, 1));
+    nfnn_tensor *W = NfNN_From_f32(Mem, (f32[]){0.1f, -0.2f, 0.3f, 0.4f, 0.5f, -0.6f}, NfNN_Dim2(2, 3));
+    X->RequiresGrad = false;
+    Y->RequiresGrad = false;
+
+    nfnn_tensor *EagerOutputs = NfNN_LogSoftmax(Mem, NfNN_ReLU(Mem, NfNN_MatMul(Mem, X, W)), 1);
+    nfnn_tensor *EagerLoss = NfNN_NLLLoss(Mem, EagerOutputs, Y);
+    nfnn_tensor *EagerPredicted = NfNN_Argmax(Mem, EagerOutputs, 1);
+    NfNN_AutoGrad_Backward(Mem, EagerLoss);
+    f32 EagerGradient[6];
+    NfNN_MemoryCopy(EagerGradient, W->Gradient, sizeof(EagerGradient));
+    NfNN_AutoGrad_ZeroGrad(Mem, EagerLoss);
+
+    NfNN_MemoryArena_SetLazy(Mem, true);
+    nfnn_tensor *Outputs = NfNN_LogSoftmax(Mem, NfNN_ReLU(Mem, NfNN_MatMul(Mem, X, W)), 1);
+    nfnn_tensor *Loss = NfNN_NLLLoss(Mem, Outputs, Y);
+    nfnn_tensor *Predicted = NfNN_Argmax(Mem, Outputs, 1);
+    NFNN_TEST(Loss->Pending == Mem && Predicted->Pending == Mem && Loss->Data[0] == 0.0f,
+              "Lazy: Operations only build nodes");
+
+    NFNN_TEST(NfNN_Item(Loss) == NfNN_Item(EagerLoss) && Outputs->Pending == 0, "Lazy: Item runs what the loss needs");
+    NFNN_TEST(Predicted->Pending == Mem, "Lazy: Results nothing demanded are skipped");
+
+    NfNN_AutoGrad_Backward(Mem, Loss);
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(W->Gradient, EagerGradient, 6, 0.0f), "Lazy: Backward");
+
+    NfNN_MemoryArena_SetLazy(Mem, false);
+    nfnn_tensor *Correct = NfNN_Equal(Mem, Predicted, EagerPredicted);
+    NFNN_TEST(Predicted->Pending == 0 && NfNN_Math_CompareMemory_f32(Correct->Data, (f32[]){1.0f, 1.0f, 1.0f}, 3, 0.0f),
+              "Lazy: Eager operations realize their inputs");
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_Graph(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f, -2.0f, 0.5f, 3.0f, -1.0f, 1.0f}, NfNN_Dim2(3, 2));
+    nfnn_tensor *Y = NfNN_From_f32(Mem, (f32[]){0.0f, 1.0f, 1.0f}, NfNN_Dim2(3, 1));
+    nfnn_tensor *W1 = NfNN_From_f32(Mem, (f32[]){0.1f, -0.2f, 0.3f, 0.4f, 0.5f, -0.6f}, NfNN_Dim2(2, 3));
+    nfnn_tensor *B1 = NfNN_From_f32(Mem, (f32[]){0.1f, 0.0f, -0.1f}, NfNN_Dim2(1, 3));
+    nfnn_tensor *W2 = NfNN_From_f32(Mem, (f32[]){0.7f, -0.8f, 0.9f, 0.1f, -0.2f, 0.3f}, NfNN_Dim2(3, 2));
+    X->RequiresGrad = false;
+    Y->RequiresGrad = false;
+
+    nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+    {
+        nfnn_tensor *H = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W1), B1));
+        nfnn_tensor *O = NfNN_MultiplyByConstant(Mem, NfNN_MatMul(Mem, H, W2), 2.0f);
+        nfnn_tensor *Loss = NfNN_NLLLoss(Mem, NfNN_LogSoftmax(Mem, O, 1), Y);
+        NfNN_AutoGrad_Backward(Mem, Loss);
+        NfNN_Graph_EndCapture(Graph, Loss, 0);
+    }
+
+    NFNN_TEST(Graph->NodeCount == 7, "Graph: Captured nodes");
+
+    // NOTE(luatil): New batch through the captured graph
+    f32 NewX[] = {-0.5f, 1.0f, 2.0f, 2.0f, 0.25f, -3.0f};
+    NfNN_MemoryCopy(X->Data, NewX, sizeof(NewX));
+    NfNN_Graph_Replay(Graph);
+
+    f32 ReplayLoss = NfNN_Item(Graph->Loss);
+    f32 ReplayW1[6], ReplayB1[3];
+    NfNN_MemoryCopy(ReplayW1, W1->Gradient, sizeof(ReplayW1));
+    NfNN_MemoryCopy(ReplayB1, B1->Gradient, sizeof(ReplayB1));
+
+    // NOTE(luatil): Same batch eagerly
+    memset(W1->Gradient, 0, NfNN_Size(W1));
+    memset(B1->Gradient, 0, NfNN_Size(B1));
+    memset(W2->Gradient, 0, NfNN_Size(W2));
+    {
+        nfnn_tensor *H = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W1), B1));
+        nfnn_tensor *O = NfNN_MultiplyByConstant(Mem, NfNN_MatMul(Mem, H, W2), 2.0f);
+        nfnn_tensor *Loss = NfNN_NLLLoss(Mem, NfNN_LogSoftmax(Mem, O, 1), Y);
+        NfNN_AutoGrad_Backward(Mem, Loss);
+
+        NFNN_TEST(NfNN_Math_Single_Abs_f32(ReplayLoss - NfNN_Item(Loss)) < 0.0001f, "Graph: Replay loss");
+    }
+
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(ReplayW1, W1->Gradient, 6, 0.0001f), "Graph: Replay dW1");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(ReplayB1, B1->Gradient, 3, 0.0001f), "Graph: Replay dB1");
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static nfnn_tensor *NfNN_Test_FusionStep(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *W, nfnn_tensor *B,
+                                         nfnn_tensor *Z)
+{
+    // NOTE(luatil): Three fusable chains: Add(bias) -> Tanh, Mul -> Sub -> Square (Tanh is
+    // not recomputed so a chain ends there) and MultiplyByConstant -> Sigmoid after a MatMul
+    nfnn_tensor *H = NfNN_Tanh(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W), B));
+    H = NfNN_Square(Mem, NfNN_Sub(Mem, Z, NfNN_Mul(Mem, H, Z)));
+    nfnn_tensor *S = NfNN_MatMul(Mem, H, NfNN_Ones(Mem, NfNN_Dim2(3, 2)));
+    return NfNN_SumAll(Mem, NfNN_Sigmoid(Mem, NfNN_MultiplyByConstant(Mem, S, 3.0f)));
+}
+
+static void NfNN_Test_Fusion(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f, -2.0f, 0.5f, 3.0f, -1.0f, 1.0f}, NfNN_Dim2(3, 2));
+    nfnn_tensor *W = NfNN_From_f32(Mem, (f32[]){0.1f, -0.2f, 0.3f, 0.4f, 0.5f, -0.6f}, NfNN_Dim2(2, 3));
+    nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){0.1f, 0.0f, -0.1f}, NfNN_Dim2(1, 3));
+    nfnn_tensor *Z = NfNN_From_f32(Mem, (f32[]){0.3f, -0.1f, 0.2f, 0.9f, -0.5f, 0.4f, 0.1f, 0.2f, 0.3f},
+                                   NfNN_Dim2(3, 3));
+    X->RequiresGrad = false;
+
+    nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+    NfNN_Graph_EndCapture(Graph, NfNN_Test_FusionStep(Mem, X, W, B, Z), 0);
+    NfNN_Graph_Replay(Graph);
+
+    f32 Loss = NfNN_Item(Graph->Loss);
+    f32 DW[6], DB[3], DZ[9];
+    NfNN_MemoryCopy(DW, W->Gradient, sizeof(DW));
+    NfNN_MemoryCopy(DB, B->Gradient, sizeof(DB));
+    NfNN_MemoryCopy(DZ, Z->Gradient, sizeof(DZ));
+
+    nfnn_graph *Fused = NfNN_Graph_BeginCapture(Mem);
+    NfNN_Graph_EndCapture(Fused, NfNN_Test_FusionStep(Mem, X, W, B, Z), 0);
+    u32 NodeCount = Fused->NodeCount;
+    nfnn_graph_fusion_stats Stats = NfNN_Graph_Fuse(Fused);
+    NfNN_Graph_Replay(Fused);
+
+    NFNN_TEST(Stats.GroupCount == 3 && Stats.FusedOpCount == 7, "Fusion: Groups");
+    NFNN_TEST(Fused->NodeCount == NodeCount - 4, "Fusion: Nodes");
+    NFNN_TEST(Stats.BytesSaved == 6 * (3 * 9 * sizeof(f32) + 3 * 2 * sizeof(f32)), "Fusion: Bytes saved");
+    NFNN_TEST(NfNN_Math_Single_Abs_f32(Loss - NfNN_Item(Fused->Loss)) < 0.0001f, "Fusion: Loss");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(DW, W->Gradient, 6, 0.0001f), "Fusion: dW");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(DB, B->Gradient, 3, 0.0001f), "Fusion: dB (broadcast)");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(DZ, Z->Gradient, 9, 0.0001f), "Fusion: dZ (two uses)");
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static nfnn_tensor *NfNN_Test_InternStep(nfnn_memory_arena *Mem, nfnn_tensor *X, nfnn_tensor *W)
+{
+    // NOTE(luatil): Both heads compute Sigmoid(X @ W), the copy must stay a node of its own
+    nfnn_tensor *A = NfNN_Sigmoid(Mem, NfNN_MatMul(Mem, X, W));
+    nfnn_tensor *B = NfNN_Sigmoid(Mem, NfNN_MatMul(Mem, X, W));
+    nfnn_tensor *C = NfNN_MultiplyByConstant(Mem, A, 2.0f);
+    nfnn_tensor *D = NfNN_Add(Mem, NfNN_MultiplyByConstant(Mem, B, 3.0f), NfNN_Copy(Mem, A));
+    return NfNN_Add(Mem, NfNN_SumAll(Mem, C), NfNN_SumAll(Mem, D));
+}
+
+static void NfNN_Test_Intern(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f, -2.0f, 0.5f, 3.0f, -1.0f, 1.0f}, NfNN_Dim2(3, 2));
+    nfnn_tensor *W = NfNN_From_f32(Mem, (f32[]){0.1f, -0.2f, 0.3f, 0.4f, 0.5f, -0.6f}, NfNN_Dim2(2, 3));
+    X->RequiresGrad = false;
+
+    // NOTE(luatil): Shared constants
+    u64 Used = Mem->Used;
+    NfNN_MSELoss(Mem, X, X);
+    u64 PlainBytes = Mem->Used - Used;
+    NfNN_Constants_Attach(Mem, Mem);
+    nfnn_tensor *Ones = NfNN_Ones(Mem, NfNN_Dim2(3, 1));
+    NFNN_TEST(Ones == NfNN_Const(Mem, NfNN_Dim2(3, 1), 1.0f), "Intern: Same constant is shared");
+    NFNN_TEST(Ones != NfNN_Ones(Mem, NfNN_Dim2(1, 3)) && Ones != NfNN_Const(Mem, NfNN_Dim2(3, 1), 2.0f),
+              "Intern: Other shapes and values are not");
+    NfNN_MSELoss(Mem, X, X);
+    Used = Mem->Used;
+    NfNN_MSELoss(Mem, X, X);
+    NFNN_TEST(Mem->Used - Used < PlainBytes && Mem->Constants->Hits >= 4, "Intern: MSELoss builds no constants");
+    nfnn_memory_arena Other = {0};
+    NfNN_MemoryArena_Init(&Other, KB(16));
+    NFNN_TEST(NfNN_Ones(&Other, NfNN_Dim2(3, 1)) != Ones, "Intern: Constants are per arena");
+    free(Other.Base);
+    NfNN_Constants_Attach(Mem, 0);
+
+    // NOTE(luatil): Repeated ops inside a scope
+    NfNN_Intern_Begin(Mem);
+    nfnn_tensor *A = NfNN_Sigmoid(Mem, NfNN_MatMul(Mem, X, W));
+    Used = Mem->Used;
+    nfnn_tensor *B = NfNN_Sigmoid(Mem, NfNN_MatMul(Mem, X, W));
+    NFNN_TEST(A == B && Mem->Used == Used, "Intern: Repeated op is free");
+    NFNN_TEST(NfNN_MultiplyByConstant(Mem, A, 2.0f) != NfNN_MultiplyByConstant(Mem, A, 3.0f),
+              "Intern: Parameters are compared");
+    NFNN_TEST(NfNN_Copy(Mem, A) != NfNN_Copy(Mem, A), "Intern: Copies are not shared");
+    NfNN_Intern_End(Mem);
+    NFNN_TEST(NfNN_Sigmoid(Mem, NfNN_MatMul(Mem, X, W)) != A, "Intern: Only inside a scope");
+
+    // NOTE(luatil): A captured graph against the same step without interning
+    u32 TapeStart = Mem->TapeCount;
+    nfnn_tensor *Loss = NfNN_Test_InternStep(Mem, X, W);
+    u32 EagerNodes = Mem->TapeCount - TapeStart;
+    NfNN_AutoGrad_Backward(Mem, Loss);
+    f32 EagerLoss = NfNN_Item(Loss);
+    f32 DW[6];
+    NfNN_MemoryCopy(DW, W->Gradient, sizeof(DW));
+    memset(W->Gradient, 0, NfNN_Size(W));
+
+    nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+    NfNN_Graph_EndCapture(Graph, NfNN_Test_InternStep(Mem, X, W), 0);
+    NFNN_TEST(EagerNodes == 13 && Graph->NodeCount == EagerNodes - 2 && Graph->Intern->Hits == 2 &&
+                  Graph->Intern->BytesSaved > 0,
+              "Intern: Captured nodes");
+    NfNN_Graph_Replay(Graph);
+    NFNN_TEST(NfNN_Math_Single_Abs_f32(EagerLoss - NfNN_Item(Graph->Loss)) < 0.0001f, "Intern: Loss");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(DW, W->Gradient, 6, 0.0001f), "Intern: dW");
+
+    NfNN_Constants_Attach(Mem, Mem);
+    NfNN_MemoryArena_TempClear(Mem);
+    NFNN_TEST(Mem->Constants == 0, "Intern: Cache in released memory is dropped");
+}
+
+#if !defined(_WIN32)
+static void NfNN_Test_Jit(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f, -2.0f, 0.5f, 3.0f, -1.0f, 1.0f}, NfNN_Dim2(3, 2));
+    nfnn_tensor *W = NfNN_From_f32(Mem, (f32[]){0.1f, -0.2f, 0.3f, 0.4f, 0.5f, -0.6f}, NfNN_Dim2(2, 3));
+    nfnn_tensor *B = NfNN_From_f32(Mem, (f32[]){0.1f, 0.0f, -0.1f}, NfNN_Dim2(1, 3));
+    nfnn_tensor *Z = NfNN_From_f32(Mem, (f32[]){0.3f, -0.1f, 0.2f, 0.9f, -0.5f, 0.4f, 0.1f, 0.2f, 0.3f},
+                                   NfNN_Dim2(3, 3));
+    X->RequiresGrad = false;
+
+    nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+    NfNN_Graph_EndCapture(Graph, NfNN_Test_FusionStep(Mem, X, W, B, Z), 0);
+    NfNN_Graph_Fuse(Graph);
+    NfNN_Graph_Replay(Graph);
+
+    f32 Loss = NfNN_Item(Graph->Loss);
+    f32 DW[6], DB[3], DZ[9];
+    NfNN_MemoryCopy(DW, W->Gradient, sizeof(DW));
+    NfNN_MemoryCopy(DB, B->Gradient, sizeof(DB));
+    NfNN_MemoryCopy(DZ, Z->Gradient, sizeof(DZ));
+
+    nfnn_jit_stats Stats = NfNN_Jit_Compile(Graph, "nfnn_jit_cache");
+    Graph->Loss->Data[0] = 0.0f;
+    NfNN_Graph_Replay(Graph);
+
+    NFNN_TEST(Stats.Loaded && Stats.KernelCount > 0, "Jit: Loaded");
+    NFNN_TEST(NfNN_Math_Single_Abs_f32(Loss - NfNN_Item(Graph->Loss)) < 0.0001f, "Jit: Loss");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(DW, W->Gradient, 6, 0.0001f), "Jit: dW");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(DB, B->Gradient, 3, 0.0001f), "Jit: dB (broadcast)");
+    NFNN_TEST(NfNN_Math_CompareMemory_f32(DZ, Z->Gradient, 9, 0.0001f), "Jit: dZ (two uses)");
+
+    nfnn_jit_stats Again = NfNN_Jit_Compile(Graph, "nfnn_jit_cache");
+    NFNN_TEST(Again.Loaded && !Again.Compiled && Again.Hash == Stats.Hash, "Jit: Cache hit");
+
+    char SpacedObject[256];
+    snprintf(SpacedObject, sizeof(SpacedObject), "nfnn_jit_cache/with space/nfnn_jit_%016llx.so",
+             (unsigned long long)Stats.Hash);
+    remove(SpacedObject);
+    nfnn_jit_stats Spaced = NfNN_Jit_Compile(Graph, "nfnn_jit_cache/with space");
+    NFNN_TEST(Spaced.Loaded && Spaced.Compiled && Spaced.Hash == Stats.Hash, "Jit: Cache directory with a space");
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_Export(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    nfnn_tensor *X = NfNN_From_f32(Mem, (f32[]){1.0f, -2.0f, 0.5f, 3.0f, -1.0f, 1.0f, 0.0f, 2.0f}, NfNN_Dim2(2, 4));
+    nfnn_tensor *W1 =
+        NfNN_From_f32(Mem, (f32[]){0.1f, -0.2f, 0.3f, 0.4f, 0.5f, -0.6f, 0.7f, 0.8f, -0.9f, 0.2f, 0.1f, 0.3f},
+                      NfNN_Dim2(4, 3));
+    nfnn_tensor *B1 = NfNN_From_f32(Mem, (f32[]){0.1f, 0.0f, -0.1f}, NfNN_Dim2(1, 3));
+    nfnn_tensor *W2 = NfNN_From_f32(Mem, (f32[]){0.3f, -0.1f, 0.2f, 0.9f, -0.5f, 0.4f}, NfNN_Dim2(3, 2));
+    X->RequiresGrad = false;
+
+    nfnn_graph *Graph = NfNN_Graph_BeginCapture(Mem);
+    nfnn_tensor *H = NfNN_ReLU(Mem, NfNN_Add(Mem, NfNN_MatMul(Mem, X, W1), B1));
+    nfnn_tensor *O = NfNN_LogSoftmax(Mem, NfNN_MultiplyByConstant(Mem, NfNN_MatMul(Mem, H, W2), 2.0f), 1);
+    NfNN_Graph_EndCapture(Graph, O, 0);
+
+    mkdir("nfnn_jit_cache", 0755);
+    nfnn_export_stats Stats = NfNN_Export_C(Graph, X, "nfnn_test", "nfnn_jit_cache/nfnn_test_model.c");
+    NFNN_TEST(Stats.Written && Stats.NodeCount == 6 && Stats.WeightCount == 12 + 3 + 6, "Export: Written");
+    f32 Error = NfNN_Export_Validate(Graph, X, "nfnn_test", "nfnn_jit_cache/nfnn_test_model.c");
+    NFNN_TEST(Error >= 0.0f && Error < 0.00001f, "Export: Matches forward");
+
+    // NOTE(luatil): Only the input is read at prediction time
+    f32 NewX[] = {-0.5f, 1.0f, 2.0f, 2.0f, 0.25f, -3.0f, 1.5f, -1.0f};
+    NfNN_MemoryCopy(X->Data, NewX, sizeof(NewX));
+    Error = NfNN_Export_Validate(Graph, X, "nfnn_test", "nfnn_jit_cache/nfnn_test_model.c");
+    NFNN_TEST(Error >= 0.0f && Error < 0.00001f, "Export: Matches forward on a new input");
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+#endif
+
 static void NfNN_Test_Math()
 {
     {
@@ -573,6 +2140,163 @@ static void NfNN_Test_Math()
     }
 }
 
+static void NfNN_Test_MatMulShapes(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    // NOTE(luatil): Both default shapes of the MNIST model against the generic kernels
+    u32 Shapes[2][3] = {{32, 784, 32}, {32, 32, 10}};
+    for (u32 Shape = 0; Shape < 2; Shape++)
+    {
+        u32 M = Shapes[Shape][0], K = Shapes[Shape][1], N = Shapes[Shape][2];
+        f32 *A = NfNN_PushArray(Mem, f32, M * K);
+        f32 *B = NfNN_PushArray(Mem, f32, K * N);
+        f32 *G = NfNN_PushArray(Mem, f32, M * N);
+        f32 *Expected = NfNN_PushArray(Mem, f32, NFNN_MAX(M * N, NFNN_MAX(M * K, K * N)));
+        f32 *Actual = NfNN_PushArray(Mem, f32, NFNN_MAX(M * N, NFNN_MAX(M * K, K * N)));
+        for (u32 Index = 0; Index < M * K; Index++)
+        {
+            A[Index] = (f32)((Index * 7) % 11) * 0.1f - 0.5f;
+        }
+        for (u32 Index = 0; Index < K * N; Index++)
+        {
+            B[Index] = (f32)((Index * 5) % 13) * 0.1f - 0.6f;
+        }
+        for (u32 Index = 0; Index < M * N; Index++)
+        {
+            G[Index] = (f32)((Index * 3) % 7) * 0.1f - 0.3f;
+        }
+
+        NfNN_Math_MatMulGeneric_f32(A, B, M, K, N, Expected);
+        NfNN_Math_MatMul_f32(A, B, M, K, N, Actual);
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Expected, Actual, M * N, 0.001f), "MatMulShapes: A @ B");
+
+        memset(Expected, 0, M * K * sizeof(f32));
+        memset(Actual, 0, M * K * sizeof(f32));
+        NfNN_Math_MatmulAddTransposeRightGeneric_f32(G, B, M, N, K, Expected);
+        NfNN_Math_MatmulAddTransposeRight_f32(G, B, M, N, K, Actual);
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Expected, Actual, M * K, 0.001f), "MatMulShapes: G @ B^T");
+
+        memset(Expected, 0, K * N * sizeof(f32));
+        memset(Actual, 0, K * N * sizeof(f32));
+        NfNN_Math_MatmulAddTransposeLeftGeneric_f32(A, G, M, K, N, Expected);
+        NfNN_Math_MatmulAddTransposeLeft_f32(A, G, M, K, N, Actual);
+        NFNN_TEST(NfNN_Math_CompareMemory_f32(Expected, Actual, K * N, 0.001f), "MatMulShapes: A^T @ G");
+    }
+
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
+static void NfNN_Test_RecordJob(nfnn_thread_pool *Pool, u32 Worker, void *Context, u32 Item)
+{
+    NfNN_Gemm_Choose(NFNN_GEMM_MATMUL, 101 + Item % 4, 7, 3);
+}
+
+static void NfNN_Test_Autotune(nfnn_memory_arena *Mem)
+{
+    NfNN_MemoryArena_TempInit(Mem);
+
+    // NOTE(luatil): Blocked kernels on a shape that is not a multiple of any block
+    u32 D0 = 13, D1 = 37, D2 = 11;
+    f32 *A = NfNN_PushArray(Mem, f32, D0 * D1);
+    f32 *B = NfNN_PushArray(Mem, f32, D1 * NFNN_MAX(D0, D2));
+    f32 *Expected = NfNN_PushArray(Mem, f32, D1 * NFNN_MAX(D0, D2));
+    f32 *Actual = NfNN_PushArray(Mem, f32, D1 * NFNN_MAX(D0, D2));
+    for (u32 Index = 0; Index < D0 * D1; Index++)
+    {
+        A[Index] = (f32)((Index * 7) % 11) * 0.1f - 0.5f;
+    }
+    for (u32 Index = 0; Index < D1 * NFNN_MAX(D0, D2); Index++)
+    {
+        B[Index] = (f32)((Index * 5) % 13) * 0.1f - 0.6f;
+    }
+
+    nfnn_thread_pool *Pool = NfNN_ThreadPool_Create(Mem, 2, 64);
+    NfNN_Gemm_SetThreadPool(Pool);
+    nfnn_gemm_config Configs[2] = {{NFNN_GEMM_KIND_BLOCKED, 4, 8, 5, 1}, {NFNN_GEMM_KIND_BLOCKED, 3, 64, 4, 2}};
+    for (u32 Config = 0; Config < 2; Config++)
+    {
+        for (u32 Kernel = 0; Kernel < NFNN_GEMM_KERNEL_COUNT; Kernel++)
+        {
+            // NOTE(luatil): Output is (D0, D2), (D0, D2) and (D1, D2)
+            u32 OutLength = (Kernel == NFNN_GEMM_ADD_TRANSPOSE_LEFT ? D1 : D0) * D2;
+            u32 Inner = Kernel == NFNN_GEMM_ADD_TRANSPOSE_RIGHT ? D2 : D1;
+            u32 Outer = Kernel == NFNN_GEMM_ADD_TRANSPOSE_RIGHT ? D1 : D2;
+            memset(Expected, 0, OutLength * sizeof(f32));
+            memset(Actual, 0, OutLength * sizeof(f32));
+            NfNN_Math_GemmGeneric_f32((nfnn_gemm_kernel)Kernel, A, B, D0, Inner, Outer, Expected);
+            NfNN_Math_GemmWithConfig_f32((nfnn_gemm_kernel)Kernel, A, B, D0, Inner, Outer, Actual, Configs[Config]);
+            NFNN_TEST(NfNN_Math_CompareMemory_f32(Expected, Actual, OutLength, 0.0001f), "Autotune: Blocked kernel");
+        }
+    }
+
+    // NOTE(luatil): Every thread of the pool records the same four shapes
+    u32 Entries = NfNN_Gemm.EntryCount;
+    u32 Items[64];
+    for (u32 Item = 0; Item < NFNN_ARRAY_COUNT(Items); Item++)
+    {
+        Items[Item] = Item;
+    }
+    NfNN_Gemm.Recording = true;
+    NfNN_ThreadPool_Run(Pool, NfNN_Test_RecordJob, 0, Items, NFNN_ARRAY_COUNT(Items));
+    NfNN_Gemm.Recording = false;
+    bool Recorded = NfNN_Gemm.EntryCount == Entries + 4;
+    for (u32 Shape = 0; Shape < 4; Shape++)
+    {
+        Recorded = Recorded && NfNN_Gemm_Find(NFNN_GEMM_MATMUL, 101 + Shape, 7, 3) != 0;
+    }
+    NFNN_TEST(Recorded, "Autotune: Shapes recorded from several threads once");
+    NfNN_Gemm.EntryCount = Entries;
+
+    NfNN_Gemm_SetThreadPool(0);
+    NfNN_ThreadPool_Destroy(Pool);
+
+    // NOTE(luatil): A line of another machine survives the rewrite
+    char *Path = "nfnn_autotune_test.txt";
+    FILE *File = fopen(Path, "wb");
+    NFNN_TEST(File != 0, "Autotune: Cache file can be written");
+    if (!File)
+    {
+        NfNN_MemoryArena_TempClear(Mem);
+        return;
+    }
+    fprintf(File, "0 1 1 1 1 1 1 1 1 Some other machine| 64 cores\n");
+    fclose(File);
+
+    NFNN_TEST(NfNN_Autotune_Begin(Path) == 0, "Autotune: Nothing cached for this machine");
+    NfNN_Math_MatMul_f32(A, B, 5, 7, 3, Actual);
+    NfNN_Math_MatMul_f32(A, B, 5, 7, 3, Actual);
+    nfnn_autotune_stats Stats = NfNN_Autotune_End(Path);
+    nfnn_gemm_entry *Entry = NfNN_Gemm_Find(NFNN_GEMM_MATMUL, 5, 7, 3);
+    NFNN_TEST(Stats.Tuned == 1 && Stats.Candidates > 2 && Entry && Entry->Tuned, "Autotune: Records and tunes");
+
+    char Line[1024];
+    u32 Lines = 0;
+    bool Other = false;
+    File = fopen(Path, "rb");
+    NFNN_TEST(File != 0, "Autotune: Cache file can be read back");
+    if (File)
+    {
+        while (fgets(Line, sizeof(Line), File))
+        {
+            Other = Other || strstr(Line, "Some other machine") != 0;
+            Lines++;
+        }
+        fclose(File);
+        NFNN_TEST(Lines == 2 && Other, "Autotune: Cache keeps other machines");
+    }
+
+    memset(&NfNN_Gemm, 0, sizeof(NfNN_Gemm));
+    NFNN_TEST(NfNN_Autotune_Begin(Path) == 1, "Autotune: Loads this machine");
+    NfNN_Math_MatMul_f32(A, B, 5, 7, 3, Actual);
+    Stats = NfNN_Autotune_End(Path);
+    NFNN_TEST(Stats.Tuned == 0 && Stats.Candidates == 0, "Autotune: Starts tuned");
+
+    remove(Path);
+    memset(&NfNN_Gemm, 0, sizeof(NfNN_Gemm));
+    NfNN_MemoryArena_TempClear(Mem);
+}
+
 static void NfNN_Test_NLLLoss(nfnn_memory_arena *Mem)
 {
     NfNN_MemoryArena_TempInit(Mem);
@@ -673,10 +2397,33 @@ int main()
     NfNN_Test_MatMul(&Mem);
     NfNN_Test_Sum(&Mem);
     NfNN_Test_Math();
+    NfNN_Test_MatMulShapes(&Mem);
+    NfNN_Test_Autotune(&Mem);
     NfNN_Test_Backward(&Mem);
     NfNN_Test_Broadcast(&Mem);
     NfNN_Test_BroadcastBackward(&Mem);
     NfNN_Test_LogSoftMax(&Mem);
     NfNN_Test_NLLLoss(&Mem);
     NfNN_Test_Argmax(&Mem);
+    NfNN_Test_SavedState(&Mem);
+    NfNN_Test_Tape(&Mem);
+    NfNN_Test_BackwardParallel(&Mem);
+    NfNN_Test_RequiresGrad(&Mem);
+    NfNN_Test_Optimizer(&Mem);
+    NfNN_Test_LayerWiseOptimizer(&Mem);
+    NfNN_Test_QuantizedOptimizer(&Mem);
+    NfNN_Test_GradReady(&Mem);
+    NfNN_Test_FirstWrite(&Mem);
+    NfNN_Test_GradAccumulation(&Mem);
+    NfNN_Test_ParameterServer(&Mem);
+    NfNN_Test_Transports(&Mem);
+    NfNN_Test_NoGrad(&Mem);
+    NfNN_Test_Lazy(&Mem);
+    NfNN_Test_Graph(&Mem);
+    NfNN_Test_Fusion(&Mem);
+    NfNN_Test_Intern(&Mem);
+#if !defined(_WIN32)
+    NfNN_Test_Jit(&Mem);
+    NfNN_Test_Export(&Mem);
+#endif
 }